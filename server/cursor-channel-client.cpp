@@ -25,9 +25,10 @@
 #include "cursor-channel.h"
 #include "cursor-channel-client.h"
 
-#define CLIENT_CURSOR_CACHE_SIZE 256
+/* in bytes of shape data */
+#define CLIENT_CURSOR_CACHE_SIZE (4 * 1024 * 1024)
 
-#define CURSOR_CACHE_HASH_SHIFT 8
+#define CURSOR_CACHE_HASH_SHIFT 10
 #define CURSOR_CACHE_HASH_SIZE (1 << CURSOR_CACHE_HASH_SHIFT)
 #define CURSOR_CACHE_HASH_MASK (CURSOR_CACHE_HASH_SIZE - 1)
 #define CURSOR_CACHE_HASH_KEY(id) ((id) & CURSOR_CACHE_HASH_MASK)
@@ -23,16 +23,55 @@
 #include "common-graphics-channel.h"
 #include "cursor-channel.h"
 #include "cursor-channel-client.h"
+#include "red-client.h"
 #include "reds.h"
 
 struct RedCursorPipeItem: public RedPipeItemNum<RED_PIPE_ITEM_TYPE_CURSOR> {
     explicit RedCursorPipeItem(const red::shared_ptr<const RedCursorCmd>& cmd);
+    size_t get_size() const override
+    {
+        return red_cursor->type == QXL_CURSOR_SET ? red_cursor->u.set.shape.data_size : 0;
+    }
     red::shared_ptr<const RedCursorCmd> red_cursor;
+    /* id of the shape in the client caches, derived from its content */
+    uint64_t cache_id = 0;
 };
 
+/* FNV-1a */
+static uint64_t cursor_hash(uint64_t hash, const void *data, size_t size)
+{
+    auto p = static_cast<const uint8_t *>(data);
+
+    for (size_t i = 0; i < size; i++) {
+        hash ^= p[i];
+        hash *= UINT64_C(0x100000001b3);
+    }
+    return hash;
+}
+
+/* The guest unique ids are not used: the same shape is often set again
+ * with a new id and some guests (like the streaming agent) do not give
+ * any. The id is computed once for all the clients. */
+static uint64_t cursor_shape_cache_id(const SpiceCursor *shape)
+{
+    uint64_t hash = UINT64_C(0xcbf29ce484222325);
+
+    hash = cursor_hash(hash, &shape->header.type, sizeof(shape->header.type));
+    hash = cursor_hash(hash, &shape->header.width, sizeof(shape->header.width));
+    hash = cursor_hash(hash, &shape->header.height, sizeof(shape->header.height));
+    hash = cursor_hash(hash, &shape->header.hot_spot_x, sizeof(shape->header.hot_spot_x));
+    hash = cursor_hash(hash, &shape->header.hot_spot_y, sizeof(shape->header.hot_spot_y));
+    hash = cursor_hash(hash, shape->data, shape->data_size);
+    /* 0 means not cacheable */
+    return hash ? hash : 1;
+}
+
 RedCursorPipeItem::RedCursorPipeItem(const red::shared_ptr<const RedCursorCmd>& cmd):
     red_cursor(cmd)
 {
+    if (cmd->type == QXL_CURSOR_SET && !(cmd->u.set.shape.flags & SPICE_CURSOR_FLAGS_NONE)) {
+        cache_id = cursor_shape_cache_id(&cmd->u.set.shape);
+    }
 }
 
 static void cursor_fill(CursorChannelClient *ccc, RedCursorPipeItem *cursor,
@@ -46,12 +85,13 @@ static void cursor_fill(CursorChannelClient *ccc, RedCursorPipeItem *cursor,
     auto cursor_cmd = cursor->red_cursor.get();
     *red_cursor = cursor_cmd->u.set.shape;
 
+    red_cursor->header.unique = cursor->cache_id;
     if (red_cursor->header.unique) {
         if (ccc->cache_find(red_cursor->header.unique)) {
             red_cursor->flags |= SPICE_CURSOR_FLAGS_FROM_CACHE;
             return;
         }
-        if (ccc->cache_add(red_cursor->header.unique, 1)) {
+        if (ccc->cache_add(red_cursor->header.unique, MAX(red_cursor->data_size, 1u))) {
             red_cursor->flags |= SPICE_CURSOR_FLAGS_CACHE_ME;
         }
     }
@@ -175,6 +215,31 @@ cursor_channel_new(RedsState *server, int id,
     return red::make_shared<CursorChannel>(server, id, core, dispatcher);
 }
 
+/* Removes the cursor commands queued for a client which are made useless by
+ * a new command: a shape also sets the position and a position replaces the
+ * previous ones, so only the latest position is sent when the pipe is backed
+ * up. If @drop_shapes the shape replaces the previous shapes too */
+static void cursor_channel_client_drop_stale(RedChannelClient *rcc, uint8_t cmd_type,
+                                             bool drop_shapes)
+{
+    auto &pipe = rcc->get_pipe();
+
+    for (auto l = pipe.begin(); l != pipe.end(); ) {
+        RedPipeItem *item = l->get();
+
+        ++l;
+        if (item->type != RED_PIPE_ITEM_TYPE_CURSOR) {
+            continue;
+        }
+        auto queued_type = static_cast<RedCursorPipeItem*>(item)->red_cursor->type;
+        if (queued_type == QXL_CURSOR_MOVE ||
+            (drop_shapes && cmd_type == QXL_CURSOR_SET &&
+             (queued_type == QXL_CURSOR_SET || queued_type == QXL_CURSOR_HIDE))) {
+            rcc->pipe_remove_and_release(item);
+        }
+    }
+}
+
 void CursorChannel::process_cmd(red::shared_ptr<const RedCursorCmd> &&cursor_cmd)
 {
     bool cursor_show = false;
@@ -209,6 +274,13 @@ void CursorChannel::process_cmd(red::shared_ptr<const RedCursorCmd> &&cursor_cmd
         (mouse_mode == SPICE_MOUSE_MODE_SERVER
          || cursor_cmd->type != QXL_CURSOR_MOVE
          || cursor_show)) {
+        if (cursor_cmd->type == QXL_CURSOR_SET || cursor_cmd->type == QXL_CURSOR_MOVE) {
+            RedChannelClient *rcc;
+            FOREACH_CLIENT(this, rcc) {
+                cursor_channel_client_drop_stale(rcc, cursor_cmd->type,
+                                                 rcc->get_client()->is_over_memory_budget());
+            }
+        }
         pipes_add(cursor_pipe_item);
     }
 }
@@ -19,6 +19,9 @@
 #ifndef DCC_PRIVATE_H_
 #define DCC_PRIVATE_H_
 
+#include <atomic>
+#include <bitset>
+
 #include "cache-item.h"
 #include "dcc.h"
 #include "image-encoders.h"
@@ -27,6 +30,23 @@
 
 #include "push-visibility.h"
 
+/* number of image types accounted for the client statistics,
+ * the types after QUIC start at 100 */
+#define DCC_IMAGE_STATS_NUM \
+    (SPICE_IMAGE_TYPE_QUIC + 1 + SPICE_IMAGE_TYPE_LZ4 - SPICE_IMAGE_TYPE_LZ_PLT + 1)
+
+/* index of a SpiceImageType in DisplayChannelClientPrivate::images_sent, -1 if not accounted */
+static inline int dcc_image_stats_index(uint8_t type)
+{
+    if (type <= SPICE_IMAGE_TYPE_QUIC) {
+        return type;
+    }
+    if (type >= SPICE_IMAGE_TYPE_LZ_PLT && type <= SPICE_IMAGE_TYPE_LZ4) {
+        return SPICE_IMAGE_TYPE_QUIC + 1 + type - SPICE_IMAGE_TYPE_LZ_PLT;
+    }
+    return -1;
+}
+
 struct DisplayChannelClientPrivate
 {
     SPICE_CXX_GLIB_ALLOCATOR
@@ -67,6 +87,18 @@ struct DisplayChannelClientPrivate
     uint32_t streams_max_latency;
     uint64_t streams_max_bit_rate;
     bool gl_draw_ongoing;
+
+    /* statistics for spice_server_get_client_stats, read by the main thread */
+    std::array<std::atomic<uint64_t>, DCC_IMAGE_STATS_NUM> images_sent{};
+    std::atomic<uint32_t> stream_fps{0};
+    std::atomic<uint32_t> num_streams{0};
+    std::atomic<uint64_t> stream_stats_time{0};
+    /* frames sent since stream_window.start, published every second */
+    struct {
+        uint64_t start;
+        uint32_t frames;
+        std::bitset<NUM_STREAMS> ids;
+    } stream_window{};
 };
 
 #include "pop-visibility.h"
@@ -23,6 +23,7 @@
 #include "dcc-private.h"
 #include "display-channel-private.h"
 #include "red-qxl.h"
+#include "phase-profile.h"
 
 enum FillBitsType {
     FILL_BITS_TYPE_INVALID,
@@ -351,6 +352,18 @@ static void marshaller_unref_drawable(uint8_t *data, void *opaque)
     drawable_unref(drawable);
 }
 
+static void marshall_image(DisplayChannelClient *dcc, SpiceMarshaller *m, SpiceImage *image,
+                           SpiceMarshaller **bitmap_palette_out,
+                           SpiceMarshaller **lzplt_palette_out)
+{
+    int index = dcc_image_stats_index(image->descriptor.type);
+
+    if (index >= 0) {
+        dcc->priv->images_sent[index].fetch_add(1, std::memory_order_relaxed);
+    }
+    spice_marshall_Image(m, image, bitmap_palette_out, lzplt_palette_out);
+}
+
 /* if the number of times fill_bits can be called per one qxl_drawable increases -
    MAX_LZ_DRAWABLE_INSTANCES must be increased as well */
 /* NOTE: 'simage' should be owned by the drawable. The drawable will be kept
@@ -390,8 +403,8 @@ static FillBitsType fill_bits(DisplayChannelClient *dcc, SpiceMarshaller *m,
                     // will be retrieved as lossless by another display channel.
                     image.descriptor.type = SPICE_IMAGE_TYPE_FROM_CACHE_LOSSLESS;
                 }
-                spice_marshall_Image(m, &image,
-                                     &bitmap_palette_out, &lzplt_palette_out);
+                marshall_image(dcc, m, &image,
+                               &bitmap_palette_out, &lzplt_palette_out);
                 spice_assert(bitmap_palette_out == nullptr);
                 spice_assert(lzplt_palette_out == nullptr);
                 stat_inc_counter(display->priv->cache_hits_counter, 1);
@@ -421,8 +434,8 @@ static FillBitsType fill_bits(DisplayChannelClient *dcc, SpiceMarshaller *m,
         image.descriptor.height = surface->context.height;
 
         image.u.surface.surface_id = surface_id;
-        spice_marshall_Image(m, &image,
-                             &bitmap_palette_out, &lzplt_palette_out);
+        marshall_image(dcc, m, &image,
+                       &bitmap_palette_out, &lzplt_palette_out);
         spice_assert(bitmap_palette_out == nullptr);
         spice_assert(lzplt_palette_out == nullptr);
         pthread_mutex_unlock(&dcc->priv->pixmap_cache->lock);
@@ -448,8 +461,8 @@ static FillBitsType fill_bits(DisplayChannelClient *dcc, SpiceMarshaller *m,
 
             palette = bitmap->palette;
             dcc_palette_cache_palette(dcc, palette, &bitmap->flags);
-            spice_marshall_Image(m, &image,
-                                 &bitmap_palette_out, &lzplt_palette_out);
+            marshall_image(dcc, m, &image,
+                           &bitmap_palette_out, &lzplt_palette_out);
             spice_assert(lzplt_palette_out == nullptr);
 
             if (bitmap_palette_out && palette) {
@@ -469,7 +482,7 @@ static FillBitsType fill_bits(DisplayChannelClient *dcc, SpiceMarshaller *m,
         }
         red_display_add_image_to_pixmap_cache(dcc, simage, &image, comp_send_data.is_lossy);
 
-        spice_marshall_Image(m, &image, &bitmap_palette_out, &lzplt_palette_out);
+        marshall_image(dcc, m, &image, &bitmap_palette_out, &lzplt_palette_out);
         spice_assert(bitmap_palette_out == nullptr);
 
         marshaller_add_compressed(m, comp_send_data.comp_buf,
@@ -487,8 +500,8 @@ static FillBitsType fill_bits(DisplayChannelClient *dcc, SpiceMarshaller *m,
     case SPICE_IMAGE_TYPE_QUIC:
         red_display_add_image_to_pixmap_cache(dcc, simage, &image, FALSE);
         image.u.quic = simage->u.quic;
-        spice_marshall_Image(m, &image,
-                             &bitmap_palette_out, &lzplt_palette_out);
+        marshall_image(dcc, m, &image,
+                       &bitmap_palette_out, &lzplt_palette_out);
         spice_assert(bitmap_palette_out == nullptr);
         spice_assert(lzplt_palette_out == nullptr);
         /* 'drawable' owns this image data, so it must be kept
@@ -733,7 +746,7 @@ static void red_pipe_replace_rendered_drawables_with_images(DisplayChannelClient
         resent_areas[num_resent] = drawable->red_drawable->bbox;
         num_resent++;
 
-        l = pipe.erase(l);
+        l = dcc->pipe_erase(l);
     }
 }
 
@@ -1637,6 +1650,28 @@ static void red_release_video_encoder_buffer(uint8_t *data, void *opaque)
     buffer->free(buffer);
 }
 
+/* the stream statistics are computed on windows of about a second */
+static void stream_frame_sent(DisplayChannelClient *dcc, int stream_id)
+{
+    auto &window = dcc->priv->stream_window;
+    uint64_t now = spice_get_monotonic_time_ns();
+    uint64_t elapsed = now - window.start;
+
+    if (elapsed >= NSEC_PER_SEC) {
+        if (window.start) {
+            dcc->priv->stream_fps.store(window.frames * NSEC_PER_SEC / elapsed,
+                                        std::memory_order_relaxed);
+            dcc->priv->num_streams.store(window.ids.count(), std::memory_order_relaxed);
+            dcc->priv->stream_stats_time.store(now, std::memory_order_relaxed);
+        }
+        window.start = now;
+        window.frames = 0;
+        window.ids.reset();
+    }
+    window.frames++;
+    window.ids.set(stream_id);
+}
+
 static bool red_marshall_stream_data(DisplayChannelClient *dcc,
                                      SpiceMarshaller *base_marshaller,
                                      Drawable *drawable)
@@ -1671,6 +1706,7 @@ static bool red_marshall_stream_data(DisplayChannelClient *dcc,
     frame_mm_time =  drawable->red_drawable->mm_time ?
                         drawable->red_drawable->mm_time :
                         reds_get_mm_time();
+    ProfilePhase previous_phase = PhaseProfile::enter(PROFILE_PHASE_COMPRESS);
     ret = !agent->video_encoder ? VIDEO_ENCODER_FRAME_UNSUPPORTED :
           agent->video_encoder->encode_frame(agent->video_encoder,
                                              frame_mm_time,
@@ -1678,6 +1714,7 @@ static bool red_marshall_stream_data(DisplayChannelClient *dcc,
                                              &copy->src_area, stream->top_down,
                                              drawable->red_drawable.get(),
                                              &outbuf);
+    PhaseProfile::leave(previous_phase);
     switch (ret) {
     case VIDEO_ENCODER_FRAME_DROP:
 #ifdef STREAM_STATS
@@ -1693,6 +1730,11 @@ static bool red_marshall_stream_data(DisplayChannelClient *dcc,
         return FALSE;
     }
 
+    /* the encoder scaled the frame down, the client has to scale it back */
+    if (outbuf->width) {
+        is_sized = TRUE;
+    }
+
     if (!is_sized) {
         SpiceMsgDisplayStreamData stream_data;
 
@@ -1711,8 +1753,13 @@ static bool red_marshall_stream_data(DisplayChannelClient *dcc,
         stream_data.base.id = stream_id;
         stream_data.base.multi_media_time = frame_mm_time;
         stream_data.data_size = outbuf->size;
-        stream_data.width = copy->src_area.right - copy->src_area.left;
-        stream_data.height = copy->src_area.bottom - copy->src_area.top;
+        if (outbuf->width) {
+            stream_data.width = outbuf->width;
+            stream_data.height = outbuf->height;
+        } else {
+            stream_data.width = copy->src_area.right - copy->src_area.left;
+            stream_data.height = copy->src_area.bottom - copy->src_area.top;
+        }
         stream_data.dest = drawable->red_drawable->bbox;
 
         spice_debug("stream %d: sized frame: dest ==> ", stream_data.base.id);
@@ -1721,6 +1768,7 @@ static bool red_marshall_stream_data(DisplayChannelClient *dcc,
     }
     spice_marshaller_add_by_ref_full(base_marshaller, outbuf->data, outbuf->size,
                                      &red_release_video_encoder_buffer, outbuf);
+    stream_frame_sent(dcc, stream_id);
 #ifdef STREAM_STATS
     agent->stats.num_frames_sent++;
     agent->stats.size_sent += outbuf->size;
@@ -1940,8 +1988,8 @@ static void red_marshall_image(DisplayChannelClient *dcc,
 
     surface_lossy_region = &dcc->priv->surface_client_lossy_region[item->surface_id];
     if (comp_succeeded) {
-        spice_marshall_Image(src_bitmap_out, &red_image,
-                             &bitmap_palette_out, &lzplt_palette_out);
+        marshall_image(dcc, src_bitmap_out, &red_image,
+                       &bitmap_palette_out, &lzplt_palette_out);
 
         marshaller_add_compressed(src_bitmap_out,
                                   comp_send_data.comp_buf, comp_send_data.comp_buf_size);
@@ -1959,8 +2007,8 @@ static void red_marshall_image(DisplayChannelClient *dcc,
         red_image.descriptor.type = SPICE_IMAGE_TYPE_BITMAP;
         red_image.u.bitmap = bitmap;
 
-        spice_marshall_Image(src_bitmap_out, &red_image,
-                             &bitmap_palette_out, &lzplt_palette_out);
+        marshall_image(dcc, src_bitmap_out, &red_image,
+                       &bitmap_palette_out, &lzplt_palette_out);
         item->add_to_marshaller(src_bitmap_out, item->data,
                                 bitmap.y * bitmap.stride);
         region_remove(surface_lossy_region, &copy.base.box);
@@ -2326,6 +2374,7 @@ void DisplayChannelClient::send_item(RedPipeItem *pipe_item)
     SpiceMarshaller *m = get_marshaller();
 
     ::reset_send_data(dcc);
+    dcc_update_low_bandwidth(dcc);
     switch (pipe_item->type) {
     case RED_PIPE_ITEM_TYPE_DRAW: {
         auto dpi = static_cast<RedDrawablePipeItem*>(pipe_item);
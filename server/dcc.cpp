@@ -23,6 +23,7 @@
 #include "display-channel-private.h"
 #include "red-client.h"
 #include "main-channel-client.h"
+#include "phase-profile.h"
 #include <spice-server-enums.h>
 
 #define DISPLAY_CLIENT_SHORT_TIMEOUT 15000000000ULL //nano
@@ -126,7 +127,7 @@ bool dcc_clear_surface_drawables_from_pipe(DisplayChannelClient *dcc, RedSurface
         }
 
         if (drawable->surface == surface) {
-            l = pipe.erase(item_pos);
+            l = dcc->pipe_erase(item_pos);
             continue;
         }
 
@@ -283,6 +284,7 @@ RedDrawablePipeItem::RedDrawablePipeItem(DisplayChannelClient *init_dcc, Drawabl
     drawable(init_drawable),
     dcc(init_dcc)
 {
+    trace_id = drawable->red_drawable->trace_id;
     drawable->pipes = g_list_prepend(drawable->pipes, this);
     drawable->refs++;
 }
@@ -643,6 +645,7 @@ int dcc_compress_image(DisplayChannelClient *dcc,
     SpiceImageCompression image_compression;
     stat_start_time_t start_time;
     int success = FALSE;
+    PhaseScope phase(PROFILE_PHASE_COMPRESS);
 
     stat_start_time_init(&start_time, &display_channel->priv->encoder_shared_data.off_stat);
 
@@ -868,6 +871,8 @@ static bool dcc_handle_stream_report(DisplayChannelClient *dcc,
                                                report->end_frame_mm_time,
                                                report->last_frame_delay,
                                                report->audio_delay);
+    /* the visible area of the streams might have changed */
+    dcc_video_streams_schedule(dcc);
     return TRUE;
 }
 
@@ -1182,6 +1187,47 @@ void dcc_set_max_stream_bit_rate(DisplayChannelClient *dcc, uint64_t rate)
     dcc->priv->streams_max_bit_rate = rate;
 }
 
+static const struct {
+    SpiceImageType type;
+    uint64_t SpiceClientImageStats::*field;
+} image_stats_fields[] = {
+    { SPICE_IMAGE_TYPE_BITMAP, &SpiceClientImageStats::bitmap },
+    { SPICE_IMAGE_TYPE_QUIC, &SpiceClientImageStats::quic },
+    { SPICE_IMAGE_TYPE_LZ_PLT, &SpiceClientImageStats::lz_plt },
+    { SPICE_IMAGE_TYPE_LZ_RGB, &SpiceClientImageStats::lz_rgb },
+    { SPICE_IMAGE_TYPE_GLZ_RGB, &SpiceClientImageStats::glz_rgb },
+    { SPICE_IMAGE_TYPE_FROM_CACHE, &SpiceClientImageStats::from_cache },
+    { SPICE_IMAGE_TYPE_SURFACE, &SpiceClientImageStats::surface },
+    { SPICE_IMAGE_TYPE_JPEG, &SpiceClientImageStats::jpeg },
+    { SPICE_IMAGE_TYPE_FROM_CACHE_LOSSLESS, &SpiceClientImageStats::from_cache_lossless },
+    { SPICE_IMAGE_TYPE_ZLIB_GLZ_RGB, &SpiceClientImageStats::zlib_glz_rgb },
+    { SPICE_IMAGE_TYPE_JPEG_ALPHA, &SpiceClientImageStats::jpeg_alpha },
+    { SPICE_IMAGE_TYPE_LZ4, &SpiceClientImageStats::lz4 },
+};
+
+static_assert(G_N_ELEMENTS(image_stats_fields) == DCC_IMAGE_STATS_NUM,
+              "missing image types in the client statistics");
+
+void DisplayChannelClient::get_stats(SpiceClientChannelStats *stats,
+                                     SpiceClientStats *client_stats) const
+{
+    RedChannelClient::get_stats(stats, client_stats);
+
+    for (const auto &image_stats : image_stats_fields) {
+        int index = dcc_image_stats_index(image_stats.type);
+        client_stats->images.*image_stats.field +=
+            priv->images_sent[index].load(std::memory_order_relaxed);
+    }
+
+    // the stream statistics are published only while frames are sent
+    uint64_t stream_stats_time = priv->stream_stats_time.load(std::memory_order_relaxed);
+    if (stream_stats_time &&
+        spice_get_monotonic_time_ns() - stream_stats_time < 2 * NSEC_PER_SEC) {
+        client_stats->num_streams += priv->num_streams.load(std::memory_order_relaxed);
+        client_stats->stream_fps += priv->stream_fps.load(std::memory_order_relaxed);
+    }
+}
+
 bool DisplayChannelClient::config_socket()
 {
     RedClient *client = get_client();
@@ -1213,3 +1259,26 @@ gboolean dcc_is_low_bandwidth(DisplayChannelClient *dcc)
 {
     return dcc->is_low_bandwidth;
 }
+
+/* Follows the estimate of the link, the automatic compression settings are
+ * selected again when the client moves to a slower or faster network */
+void dcc_update_low_bandwidth(DisplayChannelClient *dcc)
+{
+    MainChannelClient *mcc = dcc->get_client()->get_main();
+
+    /* the main channel client can go away first on disconnection */
+    if (!mcc) {
+        return;
+    }
+    /* keep the setting received with the migration data till the link
+     * is measured */
+    if (!mcc->is_network_info_initialized()) {
+        return;
+    }
+    int is_low_bandwidth = mcc->is_low_bandwidth();
+    if (is_low_bandwidth == dcc->is_low_bandwidth) {
+        return;
+    }
+    dcc->is_low_bandwidth = is_low_bandwidth;
+    display_channel_update_compression(DCC_TO_DC(dcc), dcc);
+}
@@ -44,6 +44,8 @@ public:
                          spice_wan_compression_t jpeg_state,
                          spice_wan_compression_t zlib_glz_state);
     virtual void disconnect() override;
+    virtual void get_stats(SpiceClientChannelStats *stats,
+                           SpiceClientStats *client_stats) const override;
 
 protected:
     virtual bool handle_message(uint16_t type, uint32_t size, void *msg) override;
@@ -115,6 +117,7 @@ void                       dcc_video_stream_agent_clip               (DisplayCha
                                                                       VideoStreamAgent *agent);
 void                       dcc_create_stream                         (DisplayChannelClient *dcc,
                                                                       VideoStream *stream);
+void                       dcc_video_streams_schedule                (DisplayChannelClient *dcc);
 void                       dcc_palette_cache_reset                   (DisplayChannelClient *dcc);
 void                       dcc_palette_cache_palette                 (DisplayChannelClient *dcc,
                                                                       SpicePalette *palette,
@@ -154,6 +157,7 @@ void dcc_set_max_stream_latency(DisplayChannelClient *dcc, uint32_t latency);
 uint64_t dcc_get_max_stream_bit_rate(DisplayChannelClient *dcc);
 void dcc_set_max_stream_bit_rate(DisplayChannelClient *dcc, uint64_t rate);
 gboolean dcc_is_low_bandwidth(DisplayChannelClient *dcc);
+void dcc_update_low_bandwidth(DisplayChannelClient *dcc);
 GArray *dcc_get_preferred_video_codecs_for_encoding(DisplayChannelClient *dcc);
 void dcc_video_codecs_update(DisplayChannelClient *dcc);
 
@@ -113,6 +113,7 @@ struct DisplayChannelPrivate
     Ring streams;
     std::array<ItemTrace, NUM_TRACE_ITEMS> items_trace;
     uint32_t next_item_trace;
+    std::array<RegionActivity, NUM_ACTIVITY_REGIONS> activity_regions;
     uint64_t streams_size_total;
 
     std::array<RedSurface *, NUM_SURFACES> surfaces;
@@ -134,6 +135,11 @@ struct DisplayChannelPrivate
     RedStatCounter cache_hits_counter;
     RedStatCounter add_to_cache_counter;
     RedStatCounter non_cache_counter;
+    RedStatNode stream_activity_stat;
+    RedStatCounter stream_activity_promote_counter;
+    RedStatCounter stream_activity_demote_counter;
+    RedStatCounter stream_activity_start_counter;
+    std::array<RedStatCounter, VIDEO_STREAM_CONTENT_LAST> stream_activity_content_counters;
     ImageEncoderSharedData encoder_shared_data;
 };
 
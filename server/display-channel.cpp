@@ -20,6 +20,8 @@
 
 #include "display-channel-private.h"
 #include "red-qxl.h"
+#include "red-trace.h"
+#include "phase-profile.h"
 
 DisplayChannel::~DisplayChannel()
 {
@@ -306,6 +308,8 @@ static void pipes_add_drawable(DisplayChannel *display, Drawable *drawable)
     DisplayChannelClient *dcc;
 
     spice_warn_if_fail(drawable->pipes == nullptr);
+    red_trace_event(RED_TRACE_PIPES_ADD, drawable->red_drawable->trace_id,
+                    display->get_n_clients());
     FOREACH_DCC(display, dcc) {
         dcc_prepend_drawable(dcc, drawable);
     }
@@ -329,6 +333,8 @@ static void pipes_add_drawable_after(DisplayChannel *display,
         pipes_add_drawable(display, drawable);
         return;
     }
+    red_trace_event(RED_TRACE_PIPES_ADD, drawable->red_drawable->trace_id,
+                    display->get_n_clients());
     if (num_other_linked != display->get_n_clients()) {
         spice_debug("TODO: not O(n^2)");
         FOREACH_DCC(display, dcc) {
@@ -1351,8 +1357,10 @@ static void display_channel_add_drawable(DisplayChannel *display, Drawable *draw
         add_to_pipe = current_add_with_shadow(display, ring, drawable);
     } else {
         drawable->streamable = drawable_can_stream(display, drawable);
+        video_stream_activity_update(display, drawable);
         add_to_pipe = current_add(display, ring, drawable);
     }
+    red_trace_event(RED_TRACE_CURRENT_ADD, red_drawable->trace_id, add_to_pipe);
 
     if (add_to_pipe)
         pipes_add_drawable(display, drawable);
@@ -1645,6 +1653,7 @@ static void drawable_draw(DisplayChannel *display, Drawable *drawable)
     RedSurface *surface;
     SpiceCanvas *canvas;
     SpiceClip clip = drawable->red_drawable->clip;
+    PhaseScope phase(PROFILE_PHASE_RENDER);
 
     drawable_deps_draw(display, drawable);
 
@@ -2223,6 +2232,8 @@ DisplayChannel::DisplayChannel(RedsState *reds,
                       "add_to_cache", TRUE);
     stat_init_counter(&priv->non_cache_counter, reds, stat,
                       "non_cache", TRUE);
+    video_stream_activity_init_stat(this, reds, stat);
+    image_encoder_shared_stat_init(&priv->encoder_shared_data, reds, stat);
 
     set_cap(SPICE_DISPLAY_CAP_MONITORS_CONFIG);
     set_cap(SPICE_DISPLAY_CAP_PREF_COMPRESSION);
@@ -2288,7 +2299,7 @@ void display_channel_process_surface_cmd(DisplayChannel *display,
     };
 }
 
-static void display_channel_update_compression(DisplayChannel *display, DisplayChannelClient *dcc)
+void display_channel_update_compression(DisplayChannel *display, DisplayChannelClient *dcc)
 {
     if (dcc_get_jpeg_state(dcc) == SPICE_WAN_COMPRESSION_AUTO) {
         display->priv->enable_jpeg = dcc_is_low_bandwidth(dcc);
@@ -137,6 +137,7 @@ void display_channel_process_surface_cmd(DisplayChannel *display,
 void display_channel_update_monitors_config(DisplayChannel *display, const QXLMonitorsConfig *config,
                                             uint16_t count, uint16_t max_allowed);
 void display_channel_set_monitors_config_to_primary(DisplayChannel *display);
+void display_channel_update_compression(DisplayChannel *display, DisplayChannelClient *dcc);
 void display_channel_push_monitors_config(DisplayChannel *display);
 
 RedSurface *display_channel_validate_surface(DisplayChannel *display, uint32_t surface_id);
@@ -241,6 +241,11 @@ typedef struct SpiceGstEncoder {
     /* The last bit rate that let us recover from network congestion. */
     uint64_t min_bit_rate;
 
+    /* The limit set by the server to share the bandwidth between the
+     * streams, see spice_gst_encoder_set_max_bit_rate(). Zero if none.
+     */
+    uint64_t bit_rate_limit;
+
     /* Defines when the spread between max_bit_rate and min_bit_rate has been
      * narrowed down enough. Note that this value should be large enough for
      * min_bit_rate to allow recovery from network congestion in a reasonable
@@ -599,7 +604,12 @@ static void update_next_frame_mm_time(SpiceGstEncoder *encoder)
 static uint64_t get_bit_rate_cap(const SpiceGstEncoder *encoder)
 {
     uint32_t raw_frame_bits = encoder->width * encoder->height * encoder->format->bpp;
-    return raw_frame_bits * get_source_fps(encoder) / 10;
+    uint64_t cap = raw_frame_bits * get_source_fps(encoder) / 10;
+
+    if (encoder->bit_rate_limit) {
+        cap = MIN(cap, encoder->bit_rate_limit);
+    }
+    return cap;
 }
 
 static void set_bit_rate(SpiceGstEncoder *encoder, uint64_t bit_rate)
@@ -1690,6 +1700,22 @@ static uint64_t spice_gst_encoder_get_bit_rate(VideoEncoder *video_encoder)
     return get_effective_bit_rate(encoder);
 }
 
+static void spice_gst_encoder_set_max_bit_rate(VideoEncoder *video_encoder,
+                                               uint64_t max_bit_rate)
+{
+    SpiceGstEncoder *encoder = (SpiceGstEncoder*)video_encoder;
+
+    encoder->bit_rate_limit = max_bit_rate;
+    /* The bit rate is set when the first frame is encoded and will then
+     * take the limit into account through get_bit_rate_cap().
+     */
+    if (max_bit_rate && encoder->bit_rate > max_bit_rate) {
+        spice_debug("bit rate limited to %.3fMbps", get_mbps(max_bit_rate));
+        encoder->max_bit_rate = MIN(encoder->max_bit_rate, max_bit_rate);
+        set_bit_rate(encoder, max_bit_rate);
+    }
+}
+
 static void spice_gst_encoder_get_stats(VideoEncoder *video_encoder,
                                         VideoEncoderStats *stats)
 {
@@ -1761,6 +1787,7 @@ VideoEncoder *gstreamer_encoder_new(SpiceVideoCodecType codec_type,
     encoder->base.client_stream_report = spice_gst_encoder_client_stream_report;
     encoder->base.notify_server_frame_drop = spice_gst_encoder_notify_server_frame_drop;
     encoder->base.get_bit_rate = spice_gst_encoder_get_bit_rate;
+    encoder->base.set_max_bit_rate = spice_gst_encoder_set_max_bit_rate;
     encoder->base.get_stats = spice_gst_encoder_get_stats;
     encoder->base.codec_type = codec_type;
 #ifdef DO_ZERO_COPY
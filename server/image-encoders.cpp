@@ -839,6 +839,7 @@ bool image_encoders_compress_quic(ImageEncoders *enc, SpiceImage *dest,
     int size, stride;
     stat_start_time_t start_time;
     stat_start_time_init(&start_time, &enc->shared_data->quic_stat);
+    stat_time_t hist_start = stat_histogram_time();
 
     COMPRESS_DEBUG("QUIC compress");
 
@@ -898,6 +899,7 @@ bool image_encoders_compress_quic(ImageEncoders *enc, SpiceImage *dest,
 
     stat_compress_add(&enc->shared_data->quic_stat, start_time, src->stride * src->y,
                       o_comp_data->comp_buf_size);
+    stat_histogram_add_since(&enc->shared_data->quic_time_histogram, hist_start);
     return TRUE;
 }
 
@@ -926,6 +928,7 @@ bool image_encoders_compress_lz(ImageEncoders *enc,
 
     stat_start_time_t start_time;
     stat_start_time_init(&start_time, &enc->shared_data->lz_stat);
+    stat_time_t hist_start = stat_histogram_time();
 
     COMPRESS_DEBUG("LZ LOCAL compress");
 
@@ -975,6 +978,7 @@ bool image_encoders_compress_lz(ImageEncoders *enc,
 
     stat_compress_add(&enc->shared_data->lz_stat, start_time, src->stride * src->y,
                       o_comp_data->comp_buf_size);
+    stat_histogram_add_since(&enc->shared_data->lz_time_histogram, hist_start);
     return TRUE;
 }
 
@@ -995,6 +999,7 @@ bool image_encoders_compress_jpeg(ImageEncoders *enc, SpiceImage *dest,
     uint8_t *lz_out_start_byte;
     stat_start_time_t start_time;
     stat_start_time_init(&start_time, &enc->shared_data->jpeg_alpha_stat);
+    stat_time_t hist_start = stat_histogram_time();
 
     COMPRESS_DEBUG("JPEG compress");
 
@@ -1058,6 +1063,7 @@ bool image_encoders_compress_jpeg(ImageEncoders *enc, SpiceImage *dest,
 
         stat_compress_add(&enc->shared_data->jpeg_stat, start_time, src->stride * src->y,
                           o_comp_data->comp_buf_size);
+        stat_histogram_add_since(&enc->shared_data->jpeg_time_histogram, hist_start);
         return TRUE;
     }
 
@@ -1098,6 +1104,7 @@ bool image_encoders_compress_jpeg(ImageEncoders *enc, SpiceImage *dest,
     o_comp_data->is_lossy = TRUE;
     stat_compress_add(&enc->shared_data->jpeg_alpha_stat, start_time, src->stride * src->y,
                       o_comp_data->comp_buf_size);
+    stat_histogram_add_since(&enc->shared_data->jpeg_alpha_time_histogram, hist_start);
     return TRUE;
 }
 
@@ -1110,6 +1117,7 @@ bool image_encoders_compress_lz4(ImageEncoders *enc, SpiceImage *dest,
     int lz4_size = 0;
     stat_start_time_t start_time;
     stat_start_time_init(&start_time, &enc->shared_data->lz4_stat);
+    stat_time_t hist_start = stat_histogram_time();
 
     COMPRESS_DEBUG("LZ4 compress");
 
@@ -1146,6 +1154,7 @@ bool image_encoders_compress_lz4(ImageEncoders *enc, SpiceImage *dest,
 
     stat_compress_add(&enc->shared_data->lz4_stat, start_time, src->stride * src->y,
                       o_comp_data->comp_buf_size);
+    stat_histogram_add_since(&enc->shared_data->lz4_time_histogram, hist_start);
     return TRUE;
 }
 #endif
@@ -1212,6 +1221,7 @@ bool image_encoders_compress_glz(ImageEncoders *enc,
 {
     stat_start_time_t start_time;
     stat_start_time_init(&start_time, &enc->shared_data->zlib_glz_stat);
+    stat_time_t hist_start = stat_histogram_time();
     spice_assert(bitmap_fmt_is_rgb(src->format));
     GlzData *glz_data = &enc->glz_data;
     ZlibData *zlib_data;
@@ -1252,6 +1262,7 @@ bool image_encoders_compress_glz(ImageEncoders *enc,
                           &glz_drawable_instance->context);
 
     stat_compress_add(&enc->shared_data->glz_stat, start_time, src->stride * src->y, glz_size);
+    stat_histogram_add_since(&enc->shared_data->glz_time_histogram, hist_start);
 
     if (!enable_zlib_glz_wrap || (glz_size < MIN_GLZ_SIZE_FOR_ZLIB)) {
         goto glz;
@@ -1264,6 +1275,7 @@ bool image_encoders_compress_glz(ImageEncoders *enc,
         }
     }
     stat_start_time_init(&start_time, &enc->shared_data->zlib_glz_stat);
+    hist_start = stat_histogram_time();
     zlib_data = &enc->zlib_data;
 
     encoder_data_init(&zlib_data->data);
@@ -1291,6 +1303,7 @@ bool image_encoders_compress_glz(ImageEncoders *enc,
     o_comp_data->comp_buf_size = zlib_size;
 
     stat_compress_add(&enc->shared_data->zlib_glz_stat, start_time, glz_size, zlib_size);
+    stat_histogram_add_since(&enc->shared_data->zlib_glz_time_histogram, hist_start);
     pthread_rwlock_unlock(&enc->glz_dict->encode_lock);
     return TRUE;
 
@@ -1320,6 +1333,21 @@ void image_encoder_shared_init(ImageEncoderSharedData *shared_data)
     stat_compress_init(&shared_data->lz4_stat, "lz4", stat_clock);
 }
 
+void image_encoder_shared_stat_init(ImageEncoderSharedData *shared_data, SpiceServer *reds,
+                                    const RedStatNode *parent)
+{
+    RedStatNode *node = &shared_data->compress_time_stat;
+
+    stat_init_node(node, reds, parent, "compress_time", TRUE);
+    stat_init_histogram(&shared_data->lz_time_histogram, reds, node, "lz", TRUE);
+    stat_init_histogram(&shared_data->glz_time_histogram, reds, node, "glz", TRUE);
+    stat_init_histogram(&shared_data->quic_time_histogram, reds, node, "quic", TRUE);
+    stat_init_histogram(&shared_data->jpeg_time_histogram, reds, node, "jpeg", TRUE);
+    stat_init_histogram(&shared_data->zlib_glz_time_histogram, reds, node, "zlib_glz", TRUE);
+    stat_init_histogram(&shared_data->jpeg_alpha_time_histogram, reds, node, "jpeg_alpha", TRUE);
+    stat_init_histogram(&shared_data->lz4_time_histogram, reds, node, "lz4", TRUE);
+}
+
 void image_encoder_shared_stat_reset(ImageEncoderSharedData *shared_data)
 {
     stat_reset(&shared_data->off_stat);
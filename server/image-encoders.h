@@ -45,6 +45,8 @@ typedef struct GlzSharedDictionary GlzSharedDictionary;
 typedef struct GlzImageRetention GlzImageRetention;
 
 void image_encoder_shared_init(ImageEncoderSharedData *shared_data);
+void image_encoder_shared_stat_init(ImageEncoderSharedData *shared_data, SpiceServer *reds,
+                                    const RedStatNode *parent);
 void image_encoder_shared_stat_reset(ImageEncoderSharedData *shared_data);
 void image_encoder_shared_stat_print(const ImageEncoderSharedData *shared_data);
 
@@ -158,6 +160,16 @@ struct ImageEncoderSharedData {
     stat_info_t zlib_glz_stat;
     stat_info_t jpeg_alpha_stat;
     stat_info_t lz4_stat;
+
+    /* compression time in nanoseconds, exported in the statistics file */
+    RedStatNode compress_time_stat;
+    RedStatHistogram lz_time_histogram;
+    RedStatHistogram glz_time_histogram;
+    RedStatHistogram quic_time_histogram;
+    RedStatHistogram jpeg_time_histogram;
+    RedStatHistogram zlib_glz_time_histogram;
+    RedStatHistogram jpeg_alpha_time_histogram;
+    RedStatHistogram lz4_time_histogram;
 };
 
 struct ImageEncoders {
@@ -36,6 +36,7 @@ void InputsChannelClient::release_recv_buf(uint16_t type, uint32_t size, uint8_t
 
 void InputsChannelClient::on_disconnect()
 {
+    motion_pending = false;
     get_channel()->release_keys();
 }
 
@@ -36,6 +36,7 @@ private:
         return static_cast<InputsChannel*>(RedChannelClient::get_channel());
     }
     virtual bool handle_message(uint16_t type, uint32_t size, void *message) override;
+    virtual void on_messages_handled() override;
     virtual uint8_t *alloc_recv_buf(uint16_t type, uint32_t size) override;
     virtual void release_recv_buf(uint16_t type, uint32_t size, uint8_t *msg) override;
     virtual void on_disconnect() override;
@@ -45,6 +46,7 @@ private:
     virtual void handle_migrate_flush_mark() override;
     void send_migrate_data(SpiceMarshaller *m, RedPipeItem *item);
     void on_mouse_motion();
+    void flush_mouse_motion();
     void handle_migrate_data(uint16_t motion_count);
     void pipe_add_init();
 
@@ -57,6 +59,11 @@ private:
 
     uint8_t recv_buf[RECEIVE_BUF_SIZE];
     uint16_t motion_count;
+    /* relative motions received but not delivered to the mouse yet,
+     * consecutive motions with the same buttons state are merged */
+    bool motion_pending;
+    int motion_dx, motion_dy;
+    uint32_t motion_buttons;
 };
 
 InputsChannelClient* inputs_channel_client_create(RedChannel *channel,
@@ -132,27 +132,48 @@ void InputsChannel::activate_modifiers_watch()
     red_timer_start(key_modifiers_timer, KEY_MODIFIERS_TTL);
 }
 
-static void kbd_push_scan(SpiceKbdInstance *sin, uint8_t scan)
+/* track XT scan code set 1 key state */
+static void kbd_track_scan(SpiceKbdState *st, uint8_t scan)
+{
+    if (scan >= 0xe0 && scan <= 0xe2) {
+        st->push_ext_type = scan;
+    } else {
+        if (st->push_ext_type == 0 || st->push_ext_type == 0xe0) {
+            bool *state = st->push_ext_type ? st->key_ext : st->key;
+            state[scan & 0x7f] = !(scan & SCAN_CODE_RELEASE);
+        }
+        st->push_ext_type = 0;
+    }
+}
+
+/* pushes several scan code fragments with a single call if the keyboard
+ * interface allows it */
+static void kbd_push_scans(SpiceKbdInstance *sin, const uint8_t *scans, uint32_t num_scans)
 {
     SpiceKbdInterface *sif;
+    uint32_t i;
 
-    if (!sin) {
+    if (!sin || !num_scans) {
         return;
     }
     sif = SPICE_UPCAST(SpiceKbdInterface, sin->base.sif);
 
-    /* track XT scan code set 1 key state */
-    if (scan >= 0xe0 && scan <= 0xe2) {
-        sin->st->push_ext_type = scan;
-    } else {
-        if (sin->st->push_ext_type == 0 || sin->st->push_ext_type == 0xe0) {
-            bool *state = sin->st->push_ext_type ? sin->st->key_ext : sin->st->key;
-            state[scan & 0x7f] = !(scan & SCAN_CODE_RELEASE);
-        }
-        sin->st->push_ext_type = 0;
+    for (i = 0; i < num_scans; i++) {
+        kbd_track_scan(sin->st, scans[i]);
+    }
+
+    if (sif->base.minor_version >= 2 && sif->push_scan_frags) {
+        sif->push_scan_frags(sin, scans, num_scans);
+        return;
+    }
+    for (i = 0; i < num_scans; i++) {
+        sif->push_scan_freg(sin, scans[i]);
     }
+}
 
-    sif->push_scan_freg(sin, scan);
+static void kbd_push_scan(SpiceKbdInstance *sin, uint8_t scan)
+{
+    kbd_push_scans(sin, &scan, 1);
 }
 
 static uint8_t scancode_to_modifier_flag(uint8_t scancode)
@@ -244,6 +265,29 @@ bool InputsChannelClient::handle_message(uint16_t type, uint32_t size, void *mes
     uint32_t i;
     RedsState *reds = inputs_channel->get_server();
 
+    if (type == SPICE_MSGC_INPUTS_MOUSE_MOTION) {
+        auto mouse_motion = static_cast<SpiceMsgcMouseMotion *>(message);
+
+        on_mouse_motion();
+        if (!inputs_channel->mouse || reds_get_mouse_mode(reds) != SPICE_MOUSE_MODE_SERVER) {
+            return TRUE;
+        }
+        /* delivered in on_messages_handled() or before the next event */
+        if (motion_pending && motion_buttons != mouse_motion->buttons_state) {
+            flush_mouse_motion();
+        }
+        if (!motion_pending) {
+            motion_pending = true;
+            motion_dx = motion_dy = 0;
+            motion_buttons = mouse_motion->buttons_state;
+        }
+        motion_dx += mouse_motion->dx;
+        motion_dy += mouse_motion->dy;
+        return TRUE;
+    }
+    /* keep the events in order */
+    flush_mouse_motion();
+
     switch (type) {
     case SPICE_MSGC_INPUTS_KEY_DOWN: {
         auto key_down = static_cast<SpiceMsgcKeyDown *>(message);
@@ -252,36 +296,23 @@ bool InputsChannelClient::handle_message(uint16_t type, uint32_t size, void *mes
         /* fallthrough */
     case SPICE_MSGC_INPUTS_KEY_UP: {
         auto key_up = static_cast<SpiceMsgcKeyUp *>(message);
+        uint8_t codes[4];
         for (i = 0; i < 4; i++) {
-            uint8_t code = (key_up->code >> (i * 8)) & 0xff;
-            if (code == 0) {
+            codes[i] = (key_up->code >> (i * 8)) & 0xff;
+            if (codes[i] == 0) {
                 break;
             }
-            kbd_push_scan(inputs_channel->keyboard, code);
-            inputs_channel->sync_locks(code);
+            inputs_channel->sync_locks(codes[i]);
         }
+        kbd_push_scans(inputs_channel->keyboard, codes, i);
         break;
     }
     case SPICE_MSGC_INPUTS_KEY_SCANCODE: {
         auto code = static_cast<uint8_t *>(message);
         for (i = 0; i < size; i++) {
-            kbd_push_scan(inputs_channel->keyboard, code[i]);
             inputs_channel->sync_locks(code[i]);
         }
-        break;
-    }
-    case SPICE_MSGC_INPUTS_MOUSE_MOTION: {
-        SpiceMouseInstance *mouse = inputs_channel->mouse;
-        auto mouse_motion = static_cast<SpiceMsgcMouseMotion *>(message);
-
-        on_mouse_motion();
-        if (mouse && reds_get_mouse_mode(reds) == SPICE_MOUSE_MODE_SERVER) {
-            SpiceMouseInterface *sif;
-            sif = SPICE_UPCAST(SpiceMouseInterface, mouse->base.sif);
-            sif->motion(mouse,
-                        mouse_motion->dx, mouse_motion->dy, 0,
-                        RED_MOUSE_STATE_TO_LOCAL(mouse_motion->buttons_state));
-        }
+        kbd_push_scans(inputs_channel->keyboard, code, size);
         break;
     }
     case SPICE_MSGC_INPUTS_MOUSE_POSITION: {
@@ -400,6 +431,26 @@ bool InputsChannelClient::handle_message(uint16_t type, uint32_t size, void *mes
     return TRUE;
 }
 
+void InputsChannelClient::flush_mouse_motion()
+{
+    SpiceMouseInstance *mouse = get_channel()->mouse;
+
+    if (!motion_pending) {
+        return;
+    }
+    motion_pending = false;
+    if (mouse) {
+        SpiceMouseInterface *sif;
+        sif = SPICE_UPCAST(SpiceMouseInterface, mouse->base.sif);
+        sif->motion(mouse, motion_dx, motion_dy, 0, RED_MOUSE_STATE_TO_LOCAL(motion_buttons));
+    }
+}
+
+void InputsChannelClient::on_messages_handled()
+{
+    flush_mouse_motion();
+}
+
 void InputsChannel::release_keys()
 {
     int i;
@@ -410,22 +461,26 @@ void InputsChannel::release_keys()
     }
     st = keyboard->st;
 
+    /* all the key releases are pushed at once */
+    uint8_t scans[SPICE_N_ELEMENTS(st->key) + 2 * SPICE_N_ELEMENTS(st->key_ext)];
+    uint32_t num_scans = 0;
+
     for (i = 0; i < SPICE_N_ELEMENTS(st->key); i++) {
         if (!st->key[i])
             continue;
 
-        st->key[i] = FALSE;
-        kbd_push_scan(keyboard, i | SCAN_CODE_RELEASE);
+        scans[num_scans++] = i | SCAN_CODE_RELEASE;
     }
 
     for (i = 0; i < SPICE_N_ELEMENTS(st->key_ext); i++) {
         if (!st->key_ext[i])
             continue;
 
-        st->key_ext[i] = FALSE;
-        kbd_push_scan(keyboard, 0xe0);
-        kbd_push_scan(keyboard, i | SCAN_CODE_RELEASE);
+        scans[num_scans++] = 0xe0;
+        scans[num_scans++] = i | SCAN_CODE_RELEASE;
     }
+
+    kbd_push_scans(keyboard, scans, num_scans);
 }
 
 RedInputsInitPipeItem::RedInputsInitPipeItem(uint8_t init_modifiers):
@@ -37,6 +37,12 @@ enum NetTestStage {
 
 #define CLIENT_CONNECTIVITY_TIMEOUT (MSEC_PER_SEC * 30)
 
+/* how often the network estimate is updated */
+#define NET_ESTIMATE_INTERVAL_MS MSEC_PER_SEC
+/* below this bit rate the client is considered on a low bandwidth link,
+ * it must go 25% above to be considered on a fast link again */
+#define LOW_BANDWIDTH_BIT_RATE (10 * 1024 * 1024)
+
 // approximate max receive message size for main channel
 #define MAIN_CHANNEL_RECEIVE_BUF_SIZE \
     (4096 + (REDS_AGENT_WINDOW_SIZE + REDS_NUM_INTERNAL_AGENT_MESSAGES) * SPICE_AGENT_MAX_DATA_SIZE)
@@ -44,12 +50,16 @@ enum NetTestStage {
 struct MainChannelClientPrivate {
     SPICE_CXX_GLIB_ALLOCATOR
 
+    ~MainChannelClientPrivate();
+
     uint32_t connection_id;
     uint32_t ping_id = 0;
     uint32_t net_test_id = 0;
     NetTestStage net_test_stage = NET_TEST_STAGE_INVALID;
     uint64_t latency = 0;
-    uint64_t bitrate_per_sec = ~0;
+    /* can be read from the other channel threads */
+    std::atomic<bool> low_bandwidth{false};
+    SpiceTimer *net_estimate_timer = nullptr;
     int mig_wait_connect = 0;
     int mig_connect_ok = 0;
     int mig_wait_prev_complete = 0;
@@ -105,6 +115,11 @@ struct RedRegisteredChannelPipeItem:
     uint32_t channel_id;
 };
 
+MainChannelClientPrivate::~MainChannelClientPrivate()
+{
+    red_timer_remove(net_estimate_timer);
+}
+
 #define ZERO_BUF_SIZE 4096
 
 static const uint8_t zero_page[ZERO_BUF_SIZE] = {0};
@@ -138,6 +153,9 @@ void MainChannelClient::release_recv_buf(uint16_t type, uint32_t size, uint8_t *
 void MainChannelClient::on_disconnect()
 {
     RedsState *reds = get_channel()->get_server();
+
+    red_timer_remove(priv->net_estimate_timer);
+    priv->net_estimate_timer = nullptr;
     reds_get_main_dispatcher(reds)->client_disconnect(get_client());
 }
 
@@ -333,7 +351,7 @@ void MainChannelClient::handle_migrate_dst_do_seamless(uint32_t src_version)
 
 void MainChannelClient::handle_pong(SpiceMsgPing *ping, uint32_t size)
 {
-    uint64_t roundtrip;
+    uint64_t roundtrip, bitrate_per_sec;
 
     roundtrip = spice_get_monotonic_time_ns() / NSEC_PER_MICROSEC - ping->timestamp;
 
@@ -369,14 +387,19 @@ void MainChannelClient::handle_pong(SpiceMsgPing *ping, uint32_t size)
             start_connectivity_monitoring(CLIENT_CONNECTIVITY_TIMEOUT);
             break;
         }
-        priv->bitrate_per_sec =
+        bitrate_per_sec =
             uint64_t{NET_TEST_BYTES * 8} * 1000000 / (roundtrip - priv->latency);
         priv->net_test_stage = NET_TEST_STAGE_COMPLETE;
+        /* the test only gives the starting point of the estimate, see
+         * net_estimate_timer() */
+        get_client()->get_net_estimator().set_initial(bitrate_per_sec,
+                                                      MAX(priv->latency, 1) * NSEC_PER_MICROSEC);
+        priv->low_bandwidth = bitrate_per_sec < LOW_BANDWIDTH_BIT_RATE;
         red_channel_debug(get_channel(),
                           "net test: latency %f ms, bitrate %" G_GUINT64_FORMAT " bps (%f Mbps)%s",
                           (double)priv->latency / 1000,
-                          priv->bitrate_per_sec,
-                          (double)priv->bitrate_per_sec / 1024 / 1024,
+                          bitrate_per_sec,
+                          (double)bitrate_per_sec / 1024 / 1024,
                           this->is_low_bandwidth() ? " LOW BANDWIDTH" : "");
         start_connectivity_monitoring(CLIENT_CONNECTIVITY_TIMEOUT);
         break;
@@ -462,6 +485,45 @@ MainChannelClient::MainChannelClient(MainChannel *channel,
     RedChannelClient(channel, client, stream, caps)
 {
     priv->connection_id = connection_id;
+    priv->net_estimate_timer = reds_core_timer_add(channel->get_server(),
+                                                   MainChannelClient::net_estimate_timer,
+                                                   this);
+    red_timer_start(priv->net_estimate_timer, NET_ESTIMATE_INTERVAL_MS);
+}
+
+/*
+ * Updates the estimate of the link with what the channels measured during
+ * the last interval. The roundtrip of the main channel socket is a good
+ * sample as this channel sends few data, so its messages do not wait in
+ * the queues.
+ */
+void MainChannelClient::net_estimate_timer(MainChannelClient *mcc)
+{
+    NetEstimator &estimator = mcc->get_client()->get_net_estimator();
+    uint64_t roundtrip_ns;
+
+    if (red_stream_get_tcp_info(mcc->get_stream(), &roundtrip_ns, nullptr)) {
+        estimator.add_roundtrip(roundtrip_ns);
+    }
+    estimator.update(spice_get_monotonic_time_ns());
+
+    const uint64_t bit_rate = estimator.get_bit_rate();
+    if (bit_rate) {
+        bool low_bandwidth = mcc->priv->low_bandwidth;
+        if (low_bandwidth && bit_rate > LOW_BANDWIDTH_BIT_RATE / 4 * 5) {
+            low_bandwidth = false;
+        } else if (!low_bandwidth && bit_rate < LOW_BANDWIDTH_BIT_RATE) {
+            low_bandwidth = true;
+        }
+        if (low_bandwidth != mcc->priv->low_bandwidth) {
+            red_channel_debug(mcc->get_channel(),
+                              "bitrate %" G_GUINT64_FORMAT " bps (%f Mbps)%s",
+                              bit_rate, (double)bit_rate / 1024 / 1024,
+                              low_bandwidth ? " LOW BANDWIDTH" : "");
+            mcc->priv->low_bandwidth = low_bandwidth;
+        }
+    }
+    red_timer_start(mcc->priv->net_estimate_timer, NET_ESTIMATE_INTERVAL_MS);
 }
 
 MainChannelClient *main_channel_client_create(MainChannel *main_chan, RedClient *client,
@@ -478,23 +540,27 @@ MainChannelClient *main_channel_client_create(MainChannel *main_chan, RedClient
 
 bool MainChannelClient::is_network_info_initialized() const
 {
-    return priv->net_test_stage == NET_TEST_STAGE_COMPLETE;
+    NetEstimator &estimator = get_client()->get_net_estimator();
+
+    return estimator.get_bit_rate() && estimator.get_roundtrip_ns();
 }
 
 bool MainChannelClient::is_low_bandwidth() const
 {
     // TODO: configurable?
-    return priv->bitrate_per_sec < 10 * 1024 * 1024;
+    return priv->low_bandwidth;
 }
 
 uint64_t MainChannelClient::get_bitrate_per_sec() const
 {
-    return priv->bitrate_per_sec;
+    uint64_t bit_rate = get_client()->get_net_estimator().get_bit_rate();
+
+    return bit_rate ? bit_rate : ~uint64_t{0};
 }
 
 uint64_t MainChannelClient::get_roundtrip_ms() const
 {
-    return priv->latency / 1000;
+    return get_client()->get_net_estimator().get_roundtrip_ns() / NSEC_PER_MILLISEC;
 }
 
 void MainChannelClient::migrate()
@@ -55,7 +55,9 @@ public:
     gboolean migrate_src_complete(gboolean success);
 
     /*
-     * return TRUE if network test had been completed successfully.
+     * return TRUE if the bandwidth and roundtrip of the link are known, either
+     * from the network test or from the continuous estimate of the link.
+     * The values follow the changes of the link during the session.
      * If FALSE, bitrate_per_sec is set to MAX_UINT64 and the roundtrip is set to 0
      */
     bool is_network_info_initialized() const;
@@ -91,6 +93,9 @@ protected:
     virtual void migrate() override;
     virtual void handle_migrate_flush_mark() override;
 
+private:
+    static void net_estimate_timer(MainChannelClient *mcc);
+
 public:
     red::unique_link<MainChannelClientPrivate> priv;
 };
@@ -116,6 +121,10 @@ enum {
 };
 
 struct RedAgentDataPipeItem: public RedPipeItemNum<RED_PIPE_ITEM_TYPE_MAIN_AGENT_DATA> {
+    size_t get_size() const override
+    {
+        return len;
+    }
     int len = 0;
     uint8_t data[SPICE_AGENT_MAX_DATA_SIZE];
 };
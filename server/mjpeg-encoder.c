@@ -30,6 +30,7 @@
 #include "red-common.h"
 #include "video-encoder.h"
 #include "utils.h"
+#include "spice-bitmap-utils.h"
 
 #define MJPEG_MAX_FPS 25
 #define MJPEG_MIN_FPS 1
@@ -37,6 +38,18 @@
 #define MJPEG_QUALITY_SAMPLE_NUM 7
 static const int mjpeg_quality_samples[MJPEG_QUALITY_SAMPLE_NUM] = {20, 30, 40, 50, 60, 70, 80};
 
+/* Frame dimensions relative to the source area, in MJPEG_SCALE_DEN units.
+ * For a 1080p stream this gives 1080p, 720p and 540p */
+#define MJPEG_SCALE_DEN 6
+#define MJPEG_SCALE_SAMPLE_NUM 3
+static const int mjpeg_scale_samples[MJPEG_SCALE_SAMPLE_NUM] = {6, 4, 3};
+
+/* don't scale below this width, the picture becomes unusable */
+#define MJPEG_SCALE_MIN_WIDTH 320
+
+/* minimum time between two scale changes, to avoid oscillating */
+#define MJPEG_SCALE_CHANGE_TIMEOUT (NSEC_PER_SEC * 3)
+
 #define MJPEG_IMPROVE_QUALITY_FPS_STRICT_TH 10
 #define MJPEG_IMPROVE_QUALITY_FPS_PERMISSIVE_TH 5
 
@@ -152,6 +165,8 @@ typedef struct MJpegEncoderRateControl {
     MJpegEncoderServerState server_state;
 
     uint64_t byte_rate;
+    /* limit set by the server, see mjpeg_encoder_set_max_bit_rate(), 0 if none */
+    uint64_t max_byte_rate;
     int quality_id;
     uint32_t fps;
     double adjusted_fps;
@@ -167,6 +182,10 @@ typedef struct MJpegEncoderRateControl {
     uint32_t num_recent_enc_frames;
 
     uint64_t warmup_start_time;
+
+    /* index in mjpeg_scale_samples of the current frame dimensions */
+    int scale_id;
+    uint64_t scale_change_time;
 } MJpegEncoderRateControl;
 
 typedef struct MJpegVideoBuffer {
@@ -186,6 +205,12 @@ typedef struct MJpegEncoder {
     unsigned int bytes_per_pixel; /* bytes per pixel of the input buffer */
     void (*pixel_converter)(void *src, uint8_t *dest);
 
+    /* scaled down frame, see mjpeg_encoder_adjust_scale() */
+    bool downscale_enabled;
+    uint8_t *scaled_frame;
+    size_t scaled_frame_size;
+    BitmapScaler scaler;
+
     MJpegEncoderRateControl rate_control;
     VideoEncoderRateControlCbs cbs;
 
@@ -225,6 +250,8 @@ static void mjpeg_encoder_destroy(VideoEncoder *video_encoder)
     g_free(encoder->cinfo.dest);
     jpeg_destroy_compress(&encoder->cinfo);
     g_free(encoder->row);
+    g_free(encoder->scaled_frame);
+    bitmap_scaler_clear(&encoder->scaler);
     g_free(encoder);
 }
 
@@ -665,6 +692,74 @@ end:
     }
 }
 
+static inline uint32_t mjpeg_encoder_scale_size(int scale_id, uint32_t size)
+{
+    return MAX(1, size * mjpeg_scale_samples[scale_id] / MJPEG_SCALE_DEN);
+}
+
+/*
+ * When even the worst jpeg quality doesn't allow a reasonable frame rate,
+ * the frame dimensions are reduced and the client scales the frames back.
+ * When the bit rate allows the best qualities at the source frame rate,
+ * the frame dimensions are restored.
+ * Changing the dimensions changes the encoded frame size, so the quality
+ * and the frame rate are re-evaluated after each change.
+ */
+static void mjpeg_encoder_adjust_scale(MJpegEncoder *encoder, const SpiceRect *src,
+                                       uint64_t now)
+{
+    MJpegEncoderRateControl *rate_control = &encoder->rate_control;
+    uint32_t src_fps;
+    int scale_id = rate_control->scale_id;
+
+    if (!rate_control->scale_change_time) {
+        rate_control->scale_change_time = now;
+    }
+    if (rate_control->during_quality_eval) {
+        return;
+    }
+
+    src_fps = mjpeg_encoder_get_source_fps(encoder);
+    if (!encoder->downscale_enabled) {
+        scale_id = 0;
+    } else if (now - rate_control->scale_change_time < MJPEG_SCALE_CHANGE_TIMEOUT) {
+        return;
+    } else if (rate_control->quality_id == 0 &&
+               rate_control->fps < MIN(src_fps, MJPEG_IMPROVE_QUALITY_FPS_STRICT_TH) &&
+               scale_id + 1 < MJPEG_SCALE_SAMPLE_NUM &&
+               mjpeg_encoder_scale_size(scale_id + 1, src->right - src->left) >=
+                   MJPEG_SCALE_MIN_WIDTH) {
+        scale_id++;
+    } else if (scale_id > 0 &&
+               rate_control->quality_id >= MJPEG_QUALITY_SAMPLE_NUM - 2 &&
+               rate_control->fps >= MIN(src_fps, MJPEG_MAX_FPS)) {
+        scale_id--;
+    }
+    if (scale_id == rate_control->scale_id) {
+        return;
+    }
+
+    spice_debug("mjpeg %p: scale %d/%d -> %d/%d (quality %d fps %u)", encoder,
+                mjpeg_scale_samples[rate_control->scale_id], MJPEG_SCALE_DEN,
+                mjpeg_scale_samples[scale_id], MJPEG_SCALE_DEN,
+                mjpeg_quality_samples[rate_control->quality_id], rate_control->fps);
+    rate_control->last_enc_size = 0;
+    rate_control->sum_recent_enc_size = 0;
+    rate_control->num_recent_enc_frames = 0;
+    rate_control->scale_change_time = now;
+    if (scale_id > rate_control->scale_id) {
+        /* smaller frames: the quality and frame rate can only improve */
+        mjpeg_encoder_quality_eval_set_upgrade(encoder, MJPEG_QUALITY_EVAL_REASON_SIZE_CHANGE,
+                                               rate_control->quality_id,
+                                               rate_control->fps);
+    } else {
+        mjpeg_encoder_quality_eval_set_downgrade(encoder, MJPEG_QUALITY_EVAL_REASON_SIZE_CHANGE,
+                                                 rate_control->quality_id,
+                                                 rate_control->fps);
+    }
+    rate_control->scale_id = scale_id;
+}
+
 /*
  * The actual frames distribution does not necessarily fit the condition "at least
  * one frame every (1000/rate_contorl->fps) milliseconds".
@@ -748,6 +843,11 @@ mjpeg_encoder_start_frame(MJpegEncoder *encoder,
     }
 
     mjpeg_encoder_adjust_params_to_bit_rate(encoder);
+    mjpeg_encoder_adjust_scale(encoder, src, now);
+    if (rate_control->scale_id) {
+        /* the scaled frame is always converted to 32 bits */
+        format = SPICE_BITMAP_FMT_32BIT;
+    }
 
     if (!rate_control->during_quality_eval ||
         rate_control->quality_eval_data.reason == MJPEG_QUALITY_EVAL_REASON_SIZE_CHANGE) {
@@ -794,8 +894,10 @@ mjpeg_encoder_start_frame(MJpegEncoder *encoder,
         return VIDEO_ENCODER_FRAME_UNSUPPORTED;
     }
 
-    encoder->cinfo.image_width = src->right - src->left;
-    encoder->cinfo.image_height = src->bottom - src->top;
+    encoder->cinfo.image_width = mjpeg_encoder_scale_size(rate_control->scale_id,
+                                                          src->right - src->left);
+    encoder->cinfo.image_height = mjpeg_encoder_scale_size(rate_control->scale_id,
+                                                           src->bottom - src->top);
     if (encoder->pixel_converter != NULL) {
         JDIMENSION stride = encoder->cinfo.image_width * 3;
         /* check for integer overflow */
@@ -905,6 +1007,34 @@ static inline uint8_t *get_image_line(SpiceChunks *chunks, size_t *offset,
     return ret;
 }
 
+static bool encode_scaled_frame(MJpegEncoder *encoder, const SpiceRect *src,
+                                const SpiceBitmap *image, int top_down)
+{
+    const uint32_t width = encoder->cinfo.image_width;
+    const uint32_t height = encoder->cinfo.image_height;
+    const uint32_t stride = width * sizeof(rgb32_pixel_t);
+    uint32_t i;
+
+    if (encoder->scaled_frame_size < (size_t) stride * height) {
+        g_free(encoder->scaled_frame);
+        encoder->scaled_frame_size = (size_t) stride * height;
+        encoder->scaled_frame = (uint8_t*) g_malloc(encoder->scaled_frame_size);
+    }
+    if (!bitmap_scale_to_rgb32(&encoder->scaler, image, src, top_down,
+                               encoder->scaled_frame, stride, width, height)) {
+        jpeg_abort_compress(&encoder->cinfo);
+        return FALSE;
+    }
+
+    for (i = 0; i < height; i++) {
+        if (mjpeg_encoder_encode_scanline(encoder, encoder->scaled_frame + i * stride,
+                                          width) == 0) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
 static bool encode_frame(MJpegEncoder *encoder, const SpiceRect *src,
                          const SpiceBitmap *image, int top_down)
 {
@@ -959,8 +1089,15 @@ mjpeg_encoder_encode_frame(VideoEncoder *video_encoder,
     VideoEncodeResults ret = mjpeg_encoder_start_frame(encoder, (SpiceBitmapFmt) bitmap->format,
                                                        src, buffer, frame_mm_time);
     if (ret == VIDEO_ENCODER_FRAME_ENCODE_DONE) {
-        if (encode_frame(encoder, src, bitmap, top_down)) {
+        const bool scaled = encoder->rate_control.scale_id != 0;
+
+        if (scaled ? encode_scaled_frame(encoder, src, bitmap, top_down) :
+                     encode_frame(encoder, src, bitmap, top_down)) {
             buffer->base.size = mjpeg_encoder_end_frame(encoder);
+            if (scaled) {
+                buffer->base.width = encoder->cinfo.image_width;
+                buffer->base.height = encoder->cinfo.image_height;
+            }
             *outbuf = (VideoBuffer*)buffer;
         } else {
             ret = VIDEO_ENCODER_FRAME_UNSUPPORTED;
@@ -1127,6 +1264,11 @@ static void mjpeg_encoder_increase_bit_rate(MJpegEncoder *encoder)
     } else {
         rate_control->byte_rate = MIN(measured_byte_rate, rate_control->byte_rate) + increase_size;
     }
+    if (rate_control->max_byte_rate && rate_control->byte_rate > rate_control->max_byte_rate) {
+        spice_debug("bit rate limited by the server to %.2f (Mbps)",
+                    rate_control->max_byte_rate * 8 / 1024.0 / 1024.0);
+        rate_control->byte_rate = rate_control->max_byte_rate;
+    }
 
     bit_rate_info->change_start_time = 0;
     bit_rate_info->change_start_mm_time = 0;
@@ -1350,6 +1492,41 @@ static uint64_t mjpeg_encoder_get_bit_rate(VideoEncoder *video_encoder)
     return encoder->rate_control.byte_rate * 8;
 }
 
+static void mjpeg_encoder_set_max_bit_rate(VideoEncoder *video_encoder,
+                                           uint64_t max_bit_rate)
+{
+    MJpegEncoder *encoder = SPICE_CONTAINEROF(video_encoder, MJpegEncoder, base);
+    MJpegEncoderRateControl *rate_control = &encoder->rate_control;
+    MJpegEncoderBitRateInfo *bit_rate_info = &rate_control->bit_rate_info;
+
+    rate_control->max_byte_rate = max_bit_rate / 8;
+    if (!rate_control->max_byte_rate || rate_control->byte_rate <= rate_control->max_byte_rate) {
+        return;
+    }
+
+    mjpeg_encoder_quality_eval_stop(encoder);
+    rate_control->byte_rate = rate_control->max_byte_rate;
+    bit_rate_info->change_start_time = 0;
+    bit_rate_info->change_start_mm_time = 0;
+    bit_rate_info->last_frame_time = 0;
+    bit_rate_info->num_enc_frames = 0;
+    bit_rate_info->sum_enc_size = 0;
+    bit_rate_info->was_upgraded = FALSE;
+
+    spice_debug("bit rate limited to %.2f (Mbps)", rate_control->byte_rate * 8 / 1024.0/1024.0);
+    mjpeg_encoder_quality_eval_set_downgrade(encoder,
+                                             MJPEG_QUALITY_EVAL_REASON_RATE_CHANGE,
+                                             rate_control->quality_id,
+                                             rate_control->fps);
+}
+
+static void mjpeg_encoder_enable_downscale(VideoEncoder *video_encoder, bool enable)
+{
+    MJpegEncoder *encoder = SPICE_CONTAINEROF(video_encoder, MJpegEncoder, base);
+
+    encoder->downscale_enabled = enable;
+}
+
 static void mjpeg_encoder_get_stats(VideoEncoder *video_encoder,
                                     VideoEncoderStats *stats)
 {
@@ -1376,6 +1553,8 @@ VideoEncoder *mjpeg_encoder_new(SpiceVideoCodecType codec_type,
     encoder->base.client_stream_report = mjpeg_encoder_client_stream_report;
     encoder->base.notify_server_frame_drop = mjpeg_encoder_notify_server_frame_drop;
     encoder->base.get_bit_rate = mjpeg_encoder_get_bit_rate;
+    encoder->base.set_max_bit_rate = mjpeg_encoder_set_max_bit_rate;
+    encoder->base.enable_downscale = mjpeg_encoder_enable_downscale;
     encoder->base.get_stats = mjpeg_encoder_get_stats;
     encoder->base.codec_type = codec_type;
     encoder->first_frame = TRUE;
@@ -0,0 +1,133 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include <config.h>
+
+#include "net-estimator.h"
+#include "utils.h"
+
+/* periods shorter than this are merged with the next one */
+#define NET_ESTIMATOR_MIN_PERIOD_NS (NSEC_PER_SEC / 10)
+
+/* weight of a new sample in the estimates, 1/4: a change of network is
+ * followed in a few periods while a single odd sample has little effect */
+static uint64_t net_estimator_average(uint64_t estimate, uint64_t sample)
+{
+    if (!estimate) {
+        return sample;
+    }
+    return (estimate * 3 + sample) / 4;
+}
+
+void NetEstimator::set_initial(uint64_t init_bit_rate, uint64_t init_roundtrip_ns)
+{
+    bit_rate.store(init_bit_rate, std::memory_order_relaxed);
+    roundtrip.store(init_roundtrip_ns, std::memory_order_relaxed);
+}
+
+void NetEstimator::data_sent(size_t size, uint64_t now_ns)
+{
+    uint64_t first_send = 0;
+    period_first_send.compare_exchange_strong(first_send, now_ns, std::memory_order_relaxed);
+    period_bytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+void NetEstimator::send_blocked(uint64_t delivery_rate)
+{
+    period_blocked.store(true, std::memory_order_relaxed);
+
+    uint64_t old_rate = period_delivery_rate.load(std::memory_order_relaxed);
+    while (delivery_rate > old_rate &&
+           !period_delivery_rate.compare_exchange_weak(old_rate, delivery_rate,
+                                                       std::memory_order_relaxed)) {
+    }
+}
+
+void NetEstimator::send_unblocked(uint64_t now_ns)
+{
+    period_busy_bytes.store(period_bytes.load(std::memory_order_relaxed),
+                            std::memory_order_relaxed);
+    period_unblocked.store(now_ns, std::memory_order_relaxed);
+}
+
+void NetEstimator::add_roundtrip(uint64_t roundtrip_ns)
+{
+    if (!roundtrip_ns) {
+        return;
+    }
+
+    /* keep the smallest, the others include time spent in queues */
+    uint64_t old_roundtrip = period_roundtrip.load(std::memory_order_relaxed);
+    while (roundtrip_ns < old_roundtrip &&
+           !period_roundtrip.compare_exchange_weak(old_roundtrip, roundtrip_ns,
+                                                   std::memory_order_relaxed)) {
+    }
+}
+
+void NetEstimator::update(uint64_t now_ns)
+{
+    if (!period_start) {
+        period_start = now_ns;
+        return;
+    }
+
+    const uint64_t elapsed = now_ns - period_start;
+    if (elapsed < NET_ESTIMATOR_MIN_PERIOD_NS) {
+        return;
+    }
+    period_start = now_ns;
+
+    const uint64_t bytes = period_bytes.exchange(0, std::memory_order_relaxed);
+    const bool blocked = period_blocked.exchange(false, std::memory_order_relaxed);
+    const uint64_t delivery_rate = period_delivery_rate.exchange(0, std::memory_order_relaxed);
+    const uint64_t period_min_roundtrip =
+        period_roundtrip.exchange(UINT64_MAX, std::memory_order_relaxed);
+    const uint64_t first_send = period_first_send.exchange(0, std::memory_order_relaxed);
+    const uint64_t unblocked = period_unblocked.exchange(0, std::memory_order_relaxed);
+    const uint64_t busy_bytes = period_busy_bytes.exchange(0, std::memory_order_relaxed);
+
+    if (period_min_roundtrip != UINT64_MAX) {
+        roundtrip.store(net_estimator_average(get_roundtrip_ns(), period_min_roundtrip),
+                        std::memory_order_relaxed);
+    }
+
+    const uint64_t sent_rate = bytes * 8 * MSEC_PER_SEC / (elapsed / NSEC_PER_MILLISEC);
+    const uint64_t current = get_bit_rate();
+    uint64_t sample = 0;
+
+    if (delivery_rate) {
+        /* the kernel measured the link while the socket was full */
+        sample = delivery_rate;
+    } else if (blocked && first_send) {
+        /* the link was saturated from the first send, it carried what was
+         * sent till the socket accepted data again or till now if it is
+         * still full; the idle time of the period says nothing */
+        const bool still_blocked = unblocked <= first_send;
+        const uint64_t busy_end = still_blocked ? now_ns : unblocked;
+        const uint64_t busy_sent = still_blocked ? bytes : busy_bytes;
+        const uint64_t busy_us = (busy_end - first_send) / NSEC_PER_MICROSEC;
+        if (busy_us) {
+            sample = busy_sent * 8 * (NSEC_PER_SEC / NSEC_PER_MICROSEC) / busy_us;
+        }
+    } else if (current && sent_rate > current) {
+        /* not saturated, the link can carry at least what was sent */
+        sample = sent_rate;
+    }
+    if (sample) {
+        bit_rate.store(net_estimator_average(current, sample), std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,90 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef NET_ESTIMATOR_H_
+#define NET_ESTIMATOR_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "push-visibility.h"
+
+/**
+ * Continuous estimate of the bandwidth and roundtrip of the link to a client.
+ *
+ * The channels of the client report the data written to their sockets, when
+ * a socket is full or accepts data again and the roundtrips they measure;
+ * this can be done from any thread.
+ * update() is called periodically, always from the same thread, to fold the
+ * samples of the elapsed period into the estimates, which can be read from
+ * any thread.
+ */
+class NetEstimator
+{
+public:
+    /**
+     * Starts from the values measured by the network test at connection.
+     */
+    void set_initial(uint64_t bit_rate, uint64_t roundtrip_ns);
+
+    /* @size bytes were written to a socket to the client at @now_ns */
+    void data_sent(size_t size, uint64_t now_ns);
+    /**
+     * A socket to the client was full.
+     * @delivery_rate is the rate the kernel measured for it in bits per
+     * second, 0 if unknown.
+     */
+    void send_blocked(uint64_t delivery_rate);
+    /* a full socket accepted data again at @now_ns */
+    void send_unblocked(uint64_t now_ns);
+    void add_roundtrip(uint64_t roundtrip_ns);
+
+    void update(uint64_t now_ns);
+
+    /* 0 if not known yet */
+    uint64_t get_bit_rate() const
+    {
+        return bit_rate.load(std::memory_order_relaxed);
+    }
+    uint64_t get_roundtrip_ns() const
+    {
+        return roundtrip.load(std::memory_order_relaxed);
+    }
+
+private:
+    /* samples of the current period */
+    std::atomic<uint64_t> period_bytes{0};
+    std::atomic<bool> period_blocked{false};
+    std::atomic<uint64_t> period_delivery_rate{0};
+    std::atomic<uint64_t> period_roundtrip{UINT64_MAX};
+    uint64_t period_start = 0;
+    /* the link is busy from the first send of the period till the last
+     * time a full socket accepted data again, with the bytes sent before */
+    std::atomic<uint64_t> period_first_send{0};
+    std::atomic<uint64_t> period_unblocked{0};
+    std::atomic<uint64_t> period_busy_bytes{0};
+
+    /* estimates */
+    std::atomic<uint64_t> bit_rate{0};
+    std::atomic<uint64_t> roundtrip{0};
+};
+
+#include "pop-visibility.h"
+
+#endif /* NET_ESTIMATOR_H_ */
@@ -20,6 +20,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <string.h>
 #include <sys/types.h>
 #ifndef _WIN32
@@ -181,6 +182,43 @@ int red_socket_get_no_delay(int fd)
     return delay_val;
 }
 
+/**
+ * red_socket_get_tcp_info:
+ * @fd: a socket file descriptor
+ * @rtt_ns: location for the smoothed roundtrip in nanoseconds
+ * @delivery_rate: location for the last delivery rate measured by the
+ *                 kernel in bits per second, 0 if not available or if the
+ *                 application did not send enough data to fill the link,
+ *                 can be %NULL
+ *
+ * Returns: #true if @fd is a TCP socket and the values were retrieved
+ */
+bool red_socket_get_tcp_info(int fd, uint64_t *rtt_ns, uint64_t *delivery_rate)
+{
+#if defined(TCP_INFO) && defined(__linux__)
+    struct tcp_info info;
+    socklen_t info_size = sizeof(info);
+
+    if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &info_size) != 0 ||
+        info_size < offsetof(struct tcp_info, tcpi_rttvar)) {
+        return false;
+    }
+    *rtt_ns = (uint64_t) info.tcpi_rtt * 1000;
+    if (delivery_rate) {
+        *delivery_rate = 0;
+#ifdef HAVE_TCP_INFO_DELIVERY_RATE
+        if (info_size >= offsetof(struct tcp_info, tcpi_delivery_rate) + sizeof(info.tcpi_delivery_rate) &&
+            !info.tcpi_delivery_rate_app_limited) {
+            *delivery_rate = info.tcpi_delivery_rate * 8;
+        }
+#endif
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
 /**
  * red_socket_set_nosigpipe
  * @fd: a socket file descriptor
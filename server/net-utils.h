@@ -19,6 +19,7 @@
 #define RED_NET_UTILS_H_
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <spice/macros.h>
 
 SPICE_BEGIN_DECLS
@@ -26,6 +27,7 @@ SPICE_BEGIN_DECLS
 bool red_socket_set_keepalive(int fd, bool enable, int timeout);
 bool red_socket_set_no_delay(int fd, bool no_delay);
 int red_socket_get_no_delay(int fd);
+bool red_socket_get_tcp_info(int fd, uint64_t *rtt_ns, uint64_t *delivery_rate);
 bool red_socket_set_non_blocking(int fd, bool non_blocking);
 void red_socket_set_nosigpipe(int fd, bool enable);
 
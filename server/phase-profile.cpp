@@ -0,0 +1,92 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include <config.h>
+
+#include "phase-profile.h"
+
+#define PHASE_PROFILE_WINDOW_MS 1000
+
+static const char *const phase_names[] = {
+    nullptr,
+    "fetch_us",
+    "process_us",
+    "render_us",
+    "compress_us",
+    "marshall_us",
+    "socket_us",
+};
+
+static_assert(G_N_ELEMENTS(phase_names) == PROFILE_PHASE_NUM, "missing phase names");
+
+thread_local PhaseProfile *PhaseProfile::thread_profile;
+
+void PhaseProfile::init(RedsState *reds, const RedStatNode *parent,
+                        SpiceCoreInterfaceInternal *init_core)
+{
+    core = init_core;
+    stat_init_node(&stat, reds, parent, "phases", TRUE);
+    stat_init_counter(&window_counter, reds, &stat, "window_us", TRUE);
+    stat_init_counter(&cpu_counter, reds, &stat, "cpu_us", TRUE);
+    for (int i = PROFILE_PHASE_NONE + 1; i < PROFILE_PHASE_NUM; i++) {
+        stat_init_counter(&phase_counters[i], reds, &stat, phase_names[i], TRUE);
+    }
+}
+
+void PhaseProfile::start()
+{
+#ifdef RED_STATISTICS
+    phase = PROFILE_PHASE_NONE;
+    phase_start = window_start = stat_now(CLOCK_MONOTONIC);
+    window_cpu_start = stat_now(CLOCK_THREAD_CPUTIME_ID);
+    thread_profile = this;
+
+    timer = core->timer_new(publish_timer, this);
+    red_timer_start(timer, PHASE_PROFILE_WINDOW_MS);
+#endif
+}
+
+void PhaseProfile::destroy()
+{
+    red_timer_remove(timer);
+    timer = nullptr;
+}
+
+void PhaseProfile::publish_timer(PhaseProfile *profile)
+{
+    profile->publish();
+    red_timer_start(profile->timer, PHASE_PROFILE_WINDOW_MS);
+}
+
+void PhaseProfile::publish()
+{
+    stat_time_t now = stat_now(CLOCK_MONOTONIC);
+    stat_time_t cpu = stat_now(CLOCK_THREAD_CPUTIME_ID);
+
+    // close the running phase, it goes on in the next window
+    switch_to(phase, now);
+
+    stat_set_counter(window_counter, (now - window_start) / 1000);
+    stat_set_counter(cpu_counter, (cpu - window_cpu_start) / 1000);
+    for (int i = PROFILE_PHASE_NONE + 1; i < PROFILE_PHASE_NUM; i++) {
+        stat_set_counter(phase_counters[i], phase_times[i] / 1000);
+    }
+
+    memset(phase_times, 0, sizeof(phase_times));
+    window_start = now;
+    window_cpu_start = cpu;
+}
@@ -0,0 +1,138 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PHASE_PROFILE_H_
+#define PHASE_PROFILE_H_
+
+#include "red-common.h"
+#include "stat.h"
+
+#include "push-visibility.h"
+
+/* What a worker thread is doing. A phase entered while another one is
+ * running interrupts it, so nested phases are not counted twice */
+enum ProfilePhase {
+    PROFILE_PHASE_NONE,     /* not accounted, the event loop and everything else */
+    PROFILE_PHASE_FETCH,    /* getting the commands from the QXL rings */
+    PROFILE_PHASE_PROCESS,  /* parsing the commands and updating the drawables tree */
+    PROFILE_PHASE_RENDER,   /* drawing on the surfaces */
+    PROFILE_PHASE_COMPRESS, /* compressing the images and encoding the video frames */
+    PROFILE_PHASE_MARSHALL, /* building the messages */
+    PROFILE_PHASE_SOCKET,   /* writing to the sockets */
+
+    PROFILE_PHASE_NUM
+};
+
+/**
+ * Time spent by a thread in each phase.
+ *
+ * Every second the times of the elapsed window are published in the
+ * statistics file together with the length of the window and the CPU time
+ * used by the thread, so the load of a busy thread can be split between
+ * encoding and network.
+ * The phases are marked with PhaseScope or enter()/leave(), which only
+ * account the time if the calling thread started a profile.
+ * Without statistics support nothing is done.
+ */
+class PhaseProfile
+{
+public:
+    void init(RedsState *reds, const RedStatNode *parent, SpiceCoreInterfaceInternal *core);
+    /* must be called by the profiled thread */
+    void start();
+    /* can be called from another thread once the profiled thread exited */
+    void destroy();
+
+    /* returns the current phase, to be passed to leave() */
+    static inline ProfilePhase enter(ProfilePhase phase);
+    static inline void leave(ProfilePhase previous);
+
+private:
+    inline void switch_to(ProfilePhase new_phase, stat_time_t now);
+    void publish();
+    static void publish_timer(PhaseProfile *profile);
+
+    RedStatNode stat;
+    RedStatCounter window_counter;
+    RedStatCounter cpu_counter;
+    RedStatCounter phase_counters[PROFILE_PHASE_NUM];
+
+    SpiceCoreInterfaceInternal *core;
+    SpiceTimer *timer;
+
+    ProfilePhase phase;
+    stat_time_t phase_start;
+    stat_time_t phase_times[PROFILE_PHASE_NUM];
+    stat_time_t window_start;
+    stat_time_t window_cpu_start;
+
+    static thread_local PhaseProfile *thread_profile;
+};
+
+inline void PhaseProfile::switch_to(ProfilePhase new_phase, stat_time_t now)
+{
+    phase_times[phase] += now - phase_start;
+    phase_start = now;
+    phase = new_phase;
+}
+
+inline ProfilePhase PhaseProfile::enter(ProfilePhase phase)
+{
+#ifdef RED_STATISTICS
+    PhaseProfile *profile = thread_profile;
+    if (profile) {
+        ProfilePhase previous = profile->phase;
+        profile->switch_to(phase, stat_now(CLOCK_MONOTONIC));
+        return previous;
+    }
+#endif
+    return PROFILE_PHASE_NONE;
+}
+
+inline void PhaseProfile::leave(ProfilePhase previous)
+{
+#ifdef RED_STATISTICS
+    PhaseProfile *profile = thread_profile;
+    if (profile) {
+        profile->switch_to(previous, stat_now(CLOCK_MONOTONIC));
+    }
+#endif
+}
+
+/* accounts the rest of the scope to a phase */
+class PhaseScope
+{
+public:
+    explicit PhaseScope(ProfilePhase phase):
+        previous(PhaseProfile::enter(phase))
+    {
+    }
+    ~PhaseScope()
+    {
+        PhaseProfile::leave(previous);
+    }
+    PhaseScope(const PhaseScope&) = delete;
+    PhaseScope& operator=(const PhaseScope&) = delete;
+
+private:
+    const ProfilePhase previous;
+};
+
+#include "pop-visibility.h"
+
+#endif /* PHASE_PROFILE_H_ */
@@ -0,0 +1,116 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include <config.h>
+
+#include "red-common.h"
+#include "playback-encoder.h"
+
+PlaybackEncoder::~PlaybackEncoder()
+{
+    clear();
+}
+
+void PlaybackEncoder::clear()
+{
+    snd_codec_destroy(&codec);
+#ifdef HAVE_OPUS
+    g_clear_pointer(&opus_encoder, opus_encoder_destroy);
+#endif
+    mode = SPICE_AUDIO_DATA_MODE_RAW;
+}
+
+bool PlaybackEncoder::init(SpiceAudioDataMode new_mode, int frequency)
+{
+    clear();
+    if (new_mode == SPICE_AUDIO_DATA_MODE_RAW) {
+        return true;
+    }
+    if (!snd_codec_is_capable(new_mode, frequency)) {
+        return false;
+    }
+#ifdef HAVE_OPUS
+    if (new_mode == SPICE_AUDIO_DATA_MODE_OPUS) {
+        int err;
+
+        opus_encoder = opus_encoder_create(frequency, SND_CODEC_PLAYBACK_CHAN,
+                                           OPUS_APPLICATION_AUDIO, &err);
+        if (!opus_encoder) {
+            spice_warning("create opus encoder failed: %d", err);
+            return false;
+        }
+        mode = new_mode;
+        return true;
+    }
+#endif
+    if (snd_codec_create(&codec, new_mode, frequency, SND_CODEC_ENCODE) != SND_CODEC_OK) {
+        return false;
+    }
+    mode = new_mode;
+    return true;
+}
+
+int PlaybackEncoder::frame_size() const
+{
+#ifdef HAVE_OPUS
+    if (opus_encoder) {
+        return SND_CODEC_OPUS_FRAME_SIZE;
+    }
+#endif
+    return snd_codec_frame_size(codec);
+}
+
+bool PlaybackEncoder::set_bit_rate(int bit_rate)
+{
+#ifdef HAVE_OPUS
+    if (opus_encoder) {
+        return opus_encoder_ctl(opus_encoder, OPUS_SET_BITRATE(bit_rate)) == OPUS_OK;
+    }
+#endif
+    return false;
+}
+
+bool PlaybackEncoder::set_complexity(int complexity)
+{
+#ifdef HAVE_OPUS
+    if (opus_encoder) {
+        return opus_encoder_ctl(opus_encoder, OPUS_SET_COMPLEXITY(complexity)) == OPUS_OK;
+    }
+#endif
+    return false;
+}
+
+int PlaybackEncoder::encode(const uint32_t *samples, uint8_t *out, int *out_size)
+{
+#ifdef HAVE_OPUS
+    if (opus_encoder) {
+        int n = opus_encode(opus_encoder, reinterpret_cast<const opus_int16 *>(samples),
+                            SND_CODEC_OPUS_FRAME_SIZE, out, *out_size);
+        if (n < 0) {
+            return SND_CODEC_ENCODE_FAILED;
+        }
+        *out_size = n;
+        return SND_CODEC_OK;
+    }
+#endif
+    if (!codec) {
+        return SND_CODEC_ENCODE_FAILED;
+    }
+    return snd_codec_encode(codec, reinterpret_cast<uint8_t *>(const_cast<uint32_t *>(samples)),
+                            frame_size() * SND_CODEC_PLAYBACK_CHAN * sizeof(int16_t),
+                            out, out_size);
+}
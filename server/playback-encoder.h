@@ -0,0 +1,75 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PLAYBACK_ENCODER_H_
+#define PLAYBACK_ENCODER_H_
+
+#include <common/snd_codec.h>
+#ifdef HAVE_OPUS
+#include <opus.h>
+#endif
+
+#include "push-visibility.h"
+
+/**
+ * Encoder of the audio frames sent to a playback client.
+ *
+ * This is the SndCodec encoder with settings that can be changed while
+ * streaming. SndCodec creates its Opus encoder with fixed settings and
+ * gives no access to it, so in Opus mode libopus is driven directly, with
+ * the parameters used by SndCodec, and the client decodes the frames with
+ * SndCodec as before. The other modes are left to SndCodec.
+ */
+class PlaybackEncoder
+{
+public:
+    PlaybackEncoder() = default;
+    ~PlaybackEncoder();
+    PlaybackEncoder(const PlaybackEncoder&) = delete;
+    PlaybackEncoder& operator=(const PlaybackEncoder&) = delete;
+
+    /* creates the encoder for @mode, releasing the previous one */
+    bool init(SpiceAudioDataMode mode, int frequency);
+    SpiceAudioDataMode get_mode() const
+    {
+        return mode;
+    }
+    /* number of samples per channel in a frame */
+    int frame_size() const;
+
+    /* return false if the mode does not support the setting */
+    bool set_bit_rate(int bit_rate);
+    bool set_complexity(int complexity);
+
+    /* encodes a frame of frame_size() samples, returns SND_CODEC_OK or
+     * SND_CODEC_ENCODE_FAILED */
+    int encode(const uint32_t *samples, uint8_t *out, int *out_size);
+
+private:
+    void clear();
+
+    SpiceAudioDataMode mode = SPICE_AUDIO_DATA_MODE_RAW;
+    SndCodec codec = nullptr;
+#ifdef HAVE_OPUS
+    OpusEncoder *opus_encoder = nullptr;
+#endif
+};
+
+#include "pop-visibility.h"
+
+#endif /* PLAYBACK_ENCODER_H_ */
@@ -36,6 +36,8 @@
 
 #include "red-channel-client.h"
 #include "red-client.h"
+#include "red-trace.h"
+#include "phase-profile.h"
 
 #define CLIENT_ACK_WINDOW 20
 
@@ -104,6 +106,7 @@ struct RedChannelClientConnectivityMonitor {
 struct OutgoingMessageBuffer {
     int pos;
     int size;
+    stat_time_t start_time;
 };
 
 struct IncomingMessageBuffer {
@@ -144,6 +147,7 @@ struct RedChannelClientPrivate
         uint32_t size;
         bool blocked;
         uint64_t last_sent_serial;
+        uint64_t trace_id;
 
         struct {
             SpiceMarshaller *marshaller;
@@ -173,14 +177,30 @@ struct RedChannelClientPrivate
 
     RedStatCounter out_messages;
     RedStatCounter out_bytes;
+    RedStatHistogram pipe_time_histogram;
+    RedStatHistogram write_time_histogram;
+
+    /* for spice_server_get_client_stats, read by the main thread */
+    std::atomic<uint32_t> stats_pipe_size{0};
+    std::atomic<uint64_t> stats_sent_messages{0};
+    std::atomic<uint64_t> stats_sent_bytes{0};
+
+    /* bytes written to the socket already reported to the NetEstimator */
+    uint64_t estimator_sent_bytes = 0;
+    /* the socket was full at the last write */
+    bool socket_full = false;
 
     inline RedPipeItemPtr pipe_item_get();
     inline void pipe_remove(RedPipeItem *item);
+    inline void pipe_item_queued(RedPipeItem *item);
+    inline void pipe_item_dequeued(const RedPipeItem *item);
     void handle_pong(SpiceMsgPing *ping);
     inline void set_message_serial(uint64_t serial);
     void pipe_clear();
     void data_sent(int n);
+    void socket_data_sent();
     void data_read(int n);
+    void send_blocked();
     inline int get_out_msg_size();
     inline int prepare_out_msg(struct iovec *vec, int vec_size, int pos);
     inline void set_blocked();
@@ -313,6 +333,7 @@ RedChannelClientPrivate::RedChannelClientPrivate(RedChannel *init_channel,
 
     outgoing.pos = 0;
     outgoing.size = 0;
+    outgoing.start_time = 0;
 
     if (test_capability(remote_caps.common_caps, remote_caps.num_common_caps,
                         SPICE_COMMON_CAP_MINI_HEADER)) {
@@ -330,6 +351,8 @@ RedChannelClientPrivate::RedChannelClientPrivate(RedChannel *init_channel,
     const RedStatNode *node = channel->get_stat_node();
     stat_init_counter(&out_messages, reds, node, "out_messages", TRUE);
     stat_init_counter(&out_bytes, reds, node, "out_bytes", TRUE);
+    stat_init_histogram(&pipe_time_histogram, reds, node, "pipe_time", TRUE);
+    stat_init_histogram(&write_time_histogram, reds, node, "write_time", TRUE);
 }
 
 RedChannelClientPrivate::~RedChannelClientPrivate()
@@ -378,6 +401,39 @@ void RedChannelClientPrivate::data_sent(int n)
         connectivity_monitor.sent_bytes = true;
     }
     stat_inc_counter(out_bytes, n);
+    stats_sent_bytes.fetch_add(n, std::memory_order_relaxed);
+    socket_data_sent();
+}
+
+/* the stream can buffer the data (websocket frames are merged), the link
+ * is measured with the data which actually left through the socket */
+void RedChannelClientPrivate::socket_data_sent()
+{
+    const uint64_t sent_bytes = red_stream_get_sent_bytes(stream);
+    NetEstimator &estimator = client->get_net_estimator();
+
+    if (sent_bytes == estimator_sent_bytes) {
+        return;
+    }
+    const uint64_t now = spice_get_monotonic_time_ns();
+    if (socket_full) {
+        socket_full = false;
+        estimator.send_unblocked(now);
+    }
+    estimator.data_sent(sent_bytes - estimator_sent_bytes, now);
+    estimator_sent_bytes = sent_bytes;
+}
+
+/* the socket is full, the link to the client is saturated */
+void RedChannelClientPrivate::send_blocked()
+{
+    uint64_t roundtrip_ns, delivery_rate = 0;
+
+    if (!red_stream_get_tcp_info(stream, &roundtrip_ns, &delivery_rate)) {
+        delivery_rate = 0;
+    }
+    socket_full = true;
+    client->get_net_estimator().send_blocked(delivery_rate);
 }
 
 void RedChannelClientPrivate::data_read(int n)
@@ -491,8 +547,12 @@ void RedChannelClient::send_empty_msg(RedPipeItem *base)
 
 void RedChannelClient::send_any_item(RedPipeItem *item)
 {
+    PhaseScope phase(PROFILE_PHASE_MARSHALL);
+
     spice_assert(no_item_being_sent());
     priv->reset_send_data();
+    priv->send_data.trace_id = item->trace_id ? item->trace_id : red_trace_new_id();
+    red_trace_event(RED_TRACE_SEND_ITEM, priv->send_data.trace_id, item->type);
     switch (item->type) {
         case RED_PIPE_ITEM_TYPE_SET_ACK:
             send_set_ack();
@@ -539,6 +599,8 @@ void RedChannelClient::msg_sent()
     }
 #endif
 
+    red_trace_event(RED_TRACE_MSG_SENT, priv->send_data.trace_id,
+                    priv->send_data.header.get_msg_type(&priv->send_data.header));
     priv->clear_sent_item();
 
     if (priv->urgent_marshaller_is_active()) {
@@ -576,6 +638,7 @@ void RedChannelClientPrivate::pipe_remove(RedPipeItem *item)
 {
     auto i = find_pipe_item(pipe, item);
     if (i != pipe.end()) {
+        pipe_item_dequeued(item);
         pipe.erase(i);
     }
 }
@@ -945,17 +1008,21 @@ void RedChannelClient::handle_outgoing()
         if (!buffer->size) {  // nothing to be sent
             return;
         }
+        buffer->start_time = stat_histogram_time();
     }
 
     for (;;) {
         struct iovec vec[IOV_MAX];
         int vec_size =
             priv->prepare_out_msg(vec, G_N_ELEMENTS(vec), buffer->pos);
+        ProfilePhase previous_phase = PhaseProfile::enter(PROFILE_PHASE_SOCKET);
         n = red_stream_writev(stream, vec, vec_size);
+        PhaseProfile::leave(previous_phase);
         if (n == -1) {
             switch (errno) {
             case EAGAIN:
                 priv->set_blocked();
+                priv->send_blocked();
                 break;
             case EINTR:
                 continue;
@@ -977,6 +1044,7 @@ void RedChannelClient::handle_outgoing()
              * switching from the urgent marshaller to the main one */
             buffer->pos = 0;
             buffer->size = 0;
+            stat_histogram_add_since(&priv->write_time_histogram, buffer->start_time);
             msg_sent();
             return;
         }
@@ -1122,6 +1190,7 @@ void RedChannelClient::receive()
 {
     red::shared_ptr<RedChannelClient> hold_rcc(this);
     handle_incoming();
+    on_messages_handled();
 }
 
 void RedChannelClient::send()
@@ -1130,6 +1199,29 @@ void RedChannelClient::send()
     handle_outgoing();
 }
 
+/* account the item data in the client memory budget */
+inline void RedChannelClientPrivate::pipe_item_queued(RedPipeItem *item)
+{
+    // items can be queued to multiple clients, keep the first time
+    if (!item->queue_time) {
+        item->queue_time = stat_histogram_time();
+    }
+    stats_pipe_size.fetch_add(1, std::memory_order_relaxed);
+    size_t size = item->get_size();
+    if (size) {
+        client->queued_memory_add(size);
+    }
+}
+
+inline void RedChannelClientPrivate::pipe_item_dequeued(const RedPipeItem *item)
+{
+    stats_pipe_size.fetch_sub(1, std::memory_order_relaxed);
+    size_t size = item->get_size();
+    if (size) {
+        client->queued_memory_remove(size);
+    }
+}
+
 inline RedPipeItemPtr RedChannelClientPrivate::pipe_item_get()
 {
     RedPipeItemPtr ret;
@@ -1139,6 +1231,8 @@ inline RedPipeItemPtr RedChannelClientPrivate::pipe_item_get()
     }
     ret = std::move(pipe.back());
     pipe.pop_back();
+    pipe_item_dequeued(ret.get());
+    stat_histogram_add_since(&pipe_time_histogram, ret->queue_time);
     return ret;
 }
 
@@ -1181,7 +1275,13 @@ void RedChannelClient::push()
          * that for a long train of small messages the message that would
          * cause the client to send the ack is still in the queue
          */
-        red_stream_flush(priv->stream);
+        bool flushed = red_stream_flush(priv->stream);
+        priv->socket_data_sent();
+        if (!flushed) {
+            /* try again when we can write */
+            priv->watch_update_mask(SPICE_WATCH_EVENT_READ | SPICE_WATCH_EVENT_WRITE);
+            priv->send_blocked();
+        }
     }
     priv->during_send = FALSE;
 }
@@ -1234,6 +1334,7 @@ void RedChannelClientPrivate::handle_pong(SpiceMsgPing *ping)
      *  threads or processes that are utilizing the network. We update the roundtrip
      *  measurement with the minimal value we encountered till now.
      */
+    client->get_net_estimator().add_roundtrip(now - ping->timestamp);
     if (latency_monitor.roundtrip < 0 ||
         now - ping->timestamp < latency_monitor.roundtrip) {
         latency_monitor.roundtrip = now - ping->timestamp;
@@ -1334,6 +1435,7 @@ void RedChannelClient::begin_send_message()
     }
 
     stat_inc_counter(priv->out_messages, 1);
+    priv->stats_sent_messages.fetch_add(1, std::memory_order_relaxed);
 
     /* canceling the latency test timer till the nework is idle */
     priv->cancel_ping_timer();
@@ -1389,6 +1491,7 @@ void RedChannelClient::pipe_add(RedPipeItemPtr&& item)
     if (!prepare_pipe_add(item.get())) {
         return;
     }
+    priv->pipe_item_queued(item.get());
     priv->pipe.push_front(std::move(item));
 }
 
@@ -1407,6 +1510,7 @@ void RedChannelClient::pipe_add_after_pos(RedPipeItemPtr&& item,
     }
 
     ++pipe_item_pos;
+    priv->pipe_item_queued(item.get());
     priv->pipe.insert(pipe_item_pos, std::move(item));
 }
 
@@ -1418,6 +1522,7 @@ RedChannelClient::pipe_add_before_pos(RedPipeItemPtr&& item, Pipe::iterator pipe
         return;
     }
 
+    priv->pipe_item_queued(item.get());
     priv->pipe.insert(pipe_item_pos, std::move(item));
 }
 
@@ -1440,6 +1545,7 @@ void RedChannelClient::pipe_add_tail(RedPipeItemPtr&& item)
     if (!prepare_pipe_add(item.get())) {
         return;
     }
+    priv->pipe_item_queued(item.get());
     priv->pipe.push_back(std::move(item));
 }
 
@@ -1473,6 +1579,15 @@ uint32_t RedChannelClient::get_pipe_size() const
     return priv->pipe.size();
 }
 
+void RedChannelClient::get_stats(SpiceClientChannelStats *stats, SpiceClientStats *client_stats) const
+{
+    stats->type = priv->channel->type();
+    stats->id = priv->channel->id();
+    stats->pipe_size = priv->stats_pipe_size.load(std::memory_order_relaxed);
+    stats->sent_messages = priv->stats_sent_messages.load(std::memory_order_relaxed);
+    stats->sent_bytes = priv->stats_sent_bytes.load(std::memory_order_relaxed);
+}
+
 RedChannelClient::Pipe& RedChannelClient::get_pipe()
 {
     return priv->pipe;
@@ -1501,6 +1616,9 @@ void RedChannelClientPrivate::clear_sent_item()
 void RedChannelClientPrivate::pipe_clear()
 {
     clear_sent_item();
+    for (const auto &item : pipe) {
+        pipe_item_dequeued(item.get());
+    }
     pipe.clear();
 }
 
@@ -1565,7 +1683,7 @@ RedStream *RedChannelClient::get_stream()
     return priv->stream;
 }
 
-RedClient *RedChannelClient::get_client()
+RedClient *RedChannelClient::get_client() const
 {
     return priv->client;
 }
@@ -1650,6 +1768,12 @@ void RedChannelClient::pipe_remove_and_release(RedPipeItem *item)
     priv->pipe_remove(item);
 }
 
+RedChannelClient::Pipe::iterator RedChannelClient::pipe_erase(Pipe::iterator pos)
+{
+    priv->pipe_item_dequeued(pos->get());
+    return priv->pipe.erase(pos);
+}
+
 /* client mutex should be locked before this call */
 bool RedChannelClient::set_migration_seamless()
 {
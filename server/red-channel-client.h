@@ -92,6 +92,8 @@ public:
                             RedChannelClient::Pipe::iterator pos);
     bool pipe_item_is_linked(RedPipeItem *item) const;
     void pipe_remove_and_release(RedPipeItem *item);
+    /* removes the item at pos from the pipe, returns the following position */
+    Pipe::iterator pipe_erase(Pipe::iterator pos);
     void pipe_add_tail(RedPipeItemPtr&& item);
     /* for types that use this routine -> the pipe item should be freed */
     void pipe_add_type(int pipe_item_type);
@@ -99,6 +101,10 @@ public:
     void pipe_add_empty_msg(int msg_type);
     bool pipe_is_empty() const;
     uint32_t get_pipe_size() const;
+    /* fills the statistics of spice_server_get_client_stats, can be called from any thread */
+    virtual void get_stats(SpiceClientChannelStats *stats, SpiceClientStats *client_stats) const;
+    /* items must be removed with pipe_remove_and_release or pipe_erase
+     * to keep the client budget and statistics right */
     Pipe& get_pipe();
     bool is_mini_header() const;
 
@@ -120,7 +126,7 @@ public:
     /* Note: the valid times to call red_channel_get_marshaller are just during send_item callback. */
     SpiceMarshaller *get_marshaller();
     RedStream *get_stream();
-    RedClient *get_client();
+    RedClient *get_client() const;
 
     /* Note that the header is valid only between reset_send_data and
      * begin_send_message.*/
@@ -156,6 +162,9 @@ protected:
 
     /* handles general channel msgs from the client */
     virtual bool handle_message(uint16_t type, uint32_t size, void *message);
+    /* called once all the messages available on the stream were handled,
+     * allows to deliver the events of several messages at once */
+    virtual void on_messages_handled() {};
 
     /* configure socket connected to the client */
     virtual bool config_socket() { return true; }
@@ -17,10 +17,19 @@
 */
 #include <config.h>
 
+#include <cstddef>
+#include <cstdlib>
+
 #include "red-channel.h"
 #include "red-client.h"
 #include "reds.h"
 
+/* memory the items queued for a client can use before the channels start
+ * shedding, the display channel has its own limit (MAX_PIPE_SIZE) */
+#define CLIENT_MEMORY_BUDGET (128 * 1024 * 1024)
+/* environment variable to change the budget, in MB */
+#define CLIENT_MEMORY_BUDGET_ENV "SPICE_CLIENT_MEMORY_BUDGET"
+
 RedClient::~RedClient()
 {
     spice_debug("release client=%p", this);
@@ -33,6 +42,22 @@ RedClient::RedClient(RedsState *init_reds, bool migrated):
 {
     pthread_mutex_init(&lock, nullptr);
     thread_id = pthread_self();
+
+    memory_budget = CLIENT_MEMORY_BUDGET;
+    const char *budget = getenv(CLIENT_MEMORY_BUDGET_ENV);
+    if (budget && atoi(budget) > 0) {
+        memory_budget = uint64_t{1024} * 1024 * atoi(budget);
+    }
+}
+
+void RedClient::queued_memory_add(size_t size)
+{
+    queued_memory.fetch_add(size, std::memory_order_relaxed);
+}
+
+void RedClient::queued_memory_remove(size_t size)
+{
+    queued_memory.fetch_sub(size, std::memory_order_relaxed);
 }
 
 RedClient *red_client_new(RedsState *reds, int migrated)
@@ -258,6 +283,49 @@ void RedClient::set_disconnecting()
     pthread_mutex_unlock(&lock);
 }
 
+/* end of the fields of the first version of the statistics structures,
+ * the following versions only append fields */
+#define CLIENT_STATS_MIN_SIZE \
+    (offsetof(SpiceClientStats, images.lz4) + sizeof(SpiceClientImageStats::lz4))
+#define CLIENT_CHANNEL_STATS_MIN_SIZE \
+    (offsetof(SpiceClientChannelStats, sent_bytes) + sizeof(SpiceClientChannelStats::sent_bytes))
+
+bool RedClient::get_stats(SpiceClientStats *out)
+{
+    SpiceClientStats stats = {};
+    const uint32_t channel_size = out->channel_size;
+
+    if (out->size < CLIENT_STATS_MIN_SIZE || channel_size < CLIENT_CHANNEL_STATS_MIN_SIZE) {
+        return false;
+    }
+
+    // fill the structures of this version then copy what the caller knows
+    stats.size = out->size;
+    stats.channel_size = channel_size;
+    stats.bit_rate = net_estimator.get_bit_rate();
+    stats.roundtrip_ns = net_estimator.get_roundtrip_ns();
+    stats.queued_memory = queued_memory.load(std::memory_order_relaxed);
+
+    pthread_mutex_lock(&lock);
+    if (mcc) {
+        stats.connection_id = mcc->get_connection_id();
+    }
+    auto channels_data = static_cast<uint8_t *>(g_malloc0(size_t{channel_size} * channels.size()));
+    for (const auto &rcc : channels) {
+        SpiceClientChannelStats channel_stats = {};
+
+        rcc->get_stats(&channel_stats, &stats);
+        channel_stats.size = channel_size;
+        memcpy(channels_data + size_t{channel_size} * stats.num_channels++, &channel_stats,
+               MIN(channel_size, sizeof(channel_stats)));
+    }
+    pthread_mutex_unlock(&lock);
+
+    stats.channels = reinterpret_cast<SpiceClientChannelStats *>(channels_data);
+    memcpy(out, &stats, MIN(out->size, sizeof(stats)));
+    return true;
+}
+
 RedsState *RedClient::get_server()
 {
     return reds;
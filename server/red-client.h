@@ -19,7 +19,10 @@
 #ifndef RED_CLIENT_H_
 #define RED_CLIENT_H_
 
+#include <atomic>
+
 #include "main-channel-client.h"
+#include "net-estimator.h"
 #include "safe-list.hpp"
 
 #include "push-visibility.h"
@@ -66,6 +69,30 @@ public:
     void set_disconnecting();
     RedsState* get_server();
 
+    /*
+     * Memory used by the items queued to be sent to the client.
+     * When a slow client goes over budget channels stop producing
+     * data or drop what became useless.
+     * Can be called from any thread.
+     */
+    void queued_memory_add(size_t size);
+    void queued_memory_remove(size_t size);
+    bool is_over_memory_budget() const
+    {
+        return queued_memory.load(std::memory_order_relaxed) > memory_budget;
+    }
+
+    /* bandwidth and roundtrip of the link, fed by all the channels */
+    NetEstimator &get_net_estimator()
+    {
+        return net_estimator;
+    }
+
+    /* fills @stats for spice_server_get_client_stats, the channels array
+     * is allocated. Returns false if the size fields of @stats are too
+     * small. Can be called from any thread */
+    bool get_stats(SpiceClientStats *stats);
+
 private:
     RedChannelClient *get_channel(int type, int id);
 
@@ -88,6 +115,11 @@ private:
     int seamless_migrate;
     int num_migrated_channels; /* for seamless - number of channels that wait for migrate data*/
 
+    std::atomic<uint64_t> queued_memory{0};
+    uint64_t memory_budget;
+
+    NetEstimator net_estimator;
+
     gint _ref = 1;
 };
 
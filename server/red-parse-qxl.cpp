@@ -27,6 +27,7 @@
 #include "red-qxl.h"
 #include "memslot.h"
 #include "red-parse-qxl.h"
+#include "red-trace.h"
 
 /* Max size in bytes for any data field used in a QXL command.
  * This will for example be useful to prevent the guest from saturating the
@@ -1264,7 +1265,9 @@ red_drawable_new(QXLInstance *qxl, RedMemSlotInfo *slots,
 
     if (!red_get_drawable(qxl, slots, group_id, red.get(), addr, flags)) {
         red.reset();
+        return red;
     }
+    red->trace_id = red_trace_new_id();
 
     return red;
 }
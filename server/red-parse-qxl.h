@@ -49,6 +49,8 @@ struct RedDrawable final: public RedQXLResource<RedDrawable> {
     uint32_t mm_time;
     int32_t surface_deps[3];
     SpiceRect surfaces_rects[3];
+    /* id of the drawable in the traces, see red-trace.h */
+    uint64_t trace_id;
     union {
         SpiceFill fill;
         SpiceOpaque opaque;
@@ -60,8 +60,23 @@ struct RedPipeItem: public red::shared_ptr_counted
 
     RedPipeItem(int type);
     const int type;
+    /* time the item was first queued, used for statistics */
+    uint64_t queue_time = 0;
+    /* id linking the events of the item in the traces, see red-trace.h,
+     * a new id is given to the item when sent if not set */
+    uint64_t trace_id = 0;
 
     void add_to_marshaller(SpiceMarshaller *m, uint8_t *data, size_t size);
+
+    /**
+     * Size of the data hold by the item, accounted in the memory budget
+     * of the clients the item is queued for, see RedClient.
+     * Items whose number is already bounded by their channel can return 0.
+     */
+    virtual size_t get_size() const
+    {
+        return 0;
+    }
 };
 
 typedef red::shared_ptr<RedPipeItem> RedPipeItemPtr;
@@ -19,19 +19,66 @@
 
 #include <inttypes.h>
 #include <pthread.h>
+#include <signal.h>
 #include <glib.h>
 
 #include "red-common.h"
 #include "memslot.h"
 #include "red-parse-qxl.h"
-#include "zlib-encoder.h"
 #include "red-record-qxl.h"
 
+#ifdef USE_LZ4
+#include <lz4.h>
+#endif
+
+// compatibility for FreeBSD
+#ifdef HAVE_PTHREAD_NP_H
+#include <pthread_np.h>
+#define pthread_setname_np pthread_set_name_np
+#endif
+
+/* default size of the events waiting to be written, in MB */
+#define RECORD_QUEUE_SIZE 64
+/* payloads kept to be reused for the next events */
+#define RECORD_FREE_PAYLOADS 8
+#define RECORD_FREE_PAYLOAD_MAX_SIZE (1024 * 1024)
+
+struct RecordEvent {
+    uint32_t counter;
+    uint32_t what;
+    uint32_t type;
+    uint64_t timestamp;
+    GByteArray *payload;
+};
+
 struct RedRecord {
     FILE *fd;
     pthread_mutex_t lock;
     unsigned int counter;
     gint refs;
+    int compression;
+
+    /* event being recorded, queued once complete */
+    RecordEvent *event;
+
+    /* events waiting for the writer thread */
+    GQueue queue;
+    size_t queued_size;
+    size_t max_queued_size;
+    bool drop_when_full;
+    unsigned int dropped; // commands dropped since the last queued event
+    uint64_t total_dropped;
+    GQueue free_payloads;
+    bool stopping;
+    pthread_cond_t queue_cond;
+    pthread_cond_t space_cond;
+    pthread_t writer;
+
+    /* used by the writer thread */
+    uint8_t *compress_buf;
+    size_t compress_buf_size;
+    uint64_t offset;
+    GArray *index; // RecordIndexEntry
 };
 
 #if 0
@@ -57,83 +104,67 @@ static void hexdump_qxl(RedMemSlotInfo *slots, int group_id,
 }
 #endif
 
-#define WITH_ZLIB 0
-
-/* TODO: make this thread safe (required for two qxl devices) */
+/* payloads smaller than this are not worth compressing */
+#define RECORD_COMPRESS_MIN_SIZE 256
 
-#if WITH_ZLIB
-struct RecordEncoderData {
-    ZlibEncoderUsrContext base;
-    uint8_t *buf;
-    int size;
-};
-
-static int record_zlib_more_space(ZlibEncoderUsrContext *usr, uint8_t **io_ptr)
+static void record_put_uint32(GByteArray *out, uint32_t value)
 {
-    return 0;
+    value = GUINT32_TO_LE(value);
+    g_byte_array_append(out, reinterpret_cast<guint8 *>(&value), sizeof(value));
 }
 
-static int record_zlib_more_input(ZlibEncoderUsrContext *usr, uint8_t **input)
+static void record_put_uint64(GByteArray *out, uint64_t value)
 {
-    RecordEncoderData *data = SPICE_UPCAST(RecordEncoderData, usr);
-
-    if (data->buf == NULL) {
-        fprintf(stderr, "%s: error: no more data\n", __FUNCTION__);
-        exit(1);
-    }
-    *input = data->buf;
-    data->buf = 0;
-    return data->size;
+    value = GUINT64_TO_LE(value);
+    g_byte_array_append(out, reinterpret_cast<guint8 *>(&value), sizeof(value));
 }
 
-RecordEncoderData record_encoder_data = {
-    .base = {
-        record_zlib_more_space,
-        record_zlib_more_input,
-    },
-    .buf = NULL,
-    .size = 0,
-};
-#define RECORD_ZLIB_DEFAULT_COMPRESSION_LEVEL 3
-#endif
-
-#if WITH_ZLIB
-static uint8_t output[1024*1024*4]; // static buffer for encoding, 4MB
-#endif
-
-static void write_binary(FILE *fd, const char *prefix, size_t size, const uint8_t *buf)
+/* Stores the fields of a printf like format, see RECORD_FORMAT_VERSION.
+ * The format names the fields and matches the one the replay reads them
+ * back with, its text and the strings are not written. */
+static void G_GNUC_PRINTF(2, 3) record_printf(GByteArray *out, const char *fmt, ...)
 {
-    int n;
+    va_list ap;
 
-#if WITH_ZLIB
-    ZlibEncoder *enc;
-    int zlib_size;
+    va_start(ap, fmt);
+    while ((fmt = strchr(fmt, '%')) != NULL) {
+        int longs = 0;
 
-    record_encoder_data.buf = buf;
-    record_encoder_data.size = size;
-    enc = zlib_encoder_create(&record_encoder_data.base,
-            RECORD_ZLIB_DEFAULT_COMPRESSION_LEVEL);
-    if (!enc) {
-        fprintf(stderr, "%s: zlib encoder creation failed\n", __FUNCTION__);
-        exit(1);
+        fmt++;
+        while (*fmt == 'l' || *fmt == 'h') {
+            longs += *fmt == 'l';
+            fmt++;
+        }
+        switch (*fmt++) {
+        case '%':
+            break;
+        case 's':
+            (void) va_arg(ap, const char *);
+            break;
+        case 'd':
+        case 'i':
+        case 'u':
+            if (longs == 0) {
+                record_put_uint32(out, va_arg(ap, unsigned int));
+            } else if (longs == 1) {
+                record_put_uint64(out, va_arg(ap, unsigned long));
+            } else {
+                record_put_uint64(out, va_arg(ap, unsigned long long));
+            }
+            break;
+        default:
+            spice_error("unsupported conversion in record format");
+        }
     }
-#endif
-
-    fprintf(fd, "binary %d %s %" PRIuPTR ":", WITH_ZLIB, prefix, size);
-#if WITH_ZLIB
-    zlib_size = zlib_encode(enc, RECORD_ZLIB_DEFAULT_COMPRESSION_LEVEL, size,
-        output, sizeof(output));
-    fprintf(fd, "%d:", zlib_size);
-    n = fwrite(output, zlib_size, 1, fd);
-    zlib_encoder_destroy(enc);
-#else
-    n = fwrite(buf, size, 1, fd);
-#endif
-    (void)n;
-    fprintf(fd, "\n");
+    va_end(ap);
 }
 
-static size_t red_record_data_chunks_ptr(FILE *fd, const char *prefix,
+static void write_binary(GByteArray *out, const char *prefix, size_t size, const uint8_t *buf)
+{
+    record_put_uint64(out, size);
+    g_byte_array_append(out, buf, size);
+}
+static size_t red_record_data_chunks_ptr(GByteArray *out, const char *prefix,
                                          RedMemSlotInfo *slots, int group_id,
                                          int memslot_id, QXLDataChunk *qxl)
 {
@@ -147,22 +178,22 @@ static size_t red_record_data_chunks_ptr(FILE *fd, const char *prefix,
         data_size += cur->data_size;
         count_chunks++;
     }
-    fprintf(fd, "data_chunks %d %" PRIuPTR "\n", count_chunks, data_size);
+    record_printf(out, "data_chunks %d %" PRIu64 "\n", count_chunks, (uint64_t) data_size);
     memslot_validate_virt(slots, (intptr_t)qxl->data, memslot_id, qxl->data_size, group_id);
-    write_binary(fd, prefix, qxl->data_size, qxl->data);
+    write_binary(out, prefix, qxl->data_size, qxl->data);
 
     while (qxl->next_chunk) {
         memslot_id = memslot_get_id(slots, qxl->next_chunk);
         qxl = (QXLDataChunk*)memslot_get_virt(slots, qxl->next_chunk, sizeof(*qxl), group_id);
 
         memslot_validate_virt(slots, (intptr_t)qxl->data, memslot_id, qxl->data_size, group_id);
-        write_binary(fd, prefix, qxl->data_size, qxl->data);
+        write_binary(out, prefix, qxl->data_size, qxl->data);
     }
 
     return data_size;
 }
 
-static size_t red_record_data_chunks(FILE *fd, const char *prefix,
+static size_t red_record_data_chunks(GByteArray *out, const char *prefix,
                                      RedMemSlotInfo *slots, int group_id,
                                      QXLPHYSICAL addr)
 {
@@ -170,129 +201,129 @@ static size_t red_record_data_chunks(FILE *fd, const char *prefix,
     int memslot_id = memslot_get_id(slots, addr);
 
     qxl = (QXLDataChunk*)memslot_get_virt(slots, addr, sizeof(*qxl), group_id);
-    return red_record_data_chunks_ptr(fd, prefix, slots, group_id, memslot_id, qxl);
+    return red_record_data_chunks_ptr(out, prefix, slots, group_id, memslot_id, qxl);
 }
 
-static void red_record_point_ptr(FILE *fd, QXLPoint *qxl)
+static void red_record_point_ptr(GByteArray *out, QXLPoint *qxl)
 {
-    fprintf(fd, "point %d %d\n", qxl->x, qxl->y);
+    record_printf(out, "point %d %d\n", qxl->x, qxl->y);
 }
 
-static void red_record_point16_ptr(FILE *fd, QXLPoint16 *qxl)
+static void red_record_point16_ptr(GByteArray *out, QXLPoint16 *qxl)
 {
-    fprintf(fd, "point16 %d %d\n", qxl->x, qxl->y);
+    record_printf(out, "point16 %d %d\n", qxl->x, qxl->y);
 }
 
-static void red_record_rect_ptr(FILE *fd, const char *prefix, QXLRect *qxl)
+static void red_record_rect_ptr(GByteArray *out, const char *prefix, QXLRect *qxl)
 {
-    fprintf(fd, "rect %s %d %d %d %d\n", prefix,
+    record_printf(out, "rect %s %d %d %d %d\n", prefix,
         qxl->top, qxl->left, qxl->bottom, qxl->right);
 }
 
-static void red_record_path(FILE *fd, RedMemSlotInfo *slots, int group_id,
+static void red_record_path(GByteArray *out, RedMemSlotInfo *slots, int group_id,
                             QXLPHYSICAL addr)
 {
     QXLPath *qxl;
 
     qxl = (QXLPath *)memslot_get_virt(slots, addr, sizeof(*qxl), group_id);
-    red_record_data_chunks_ptr(fd, "path", slots, group_id,
+    red_record_data_chunks_ptr(out, "path", slots, group_id,
                                    memslot_get_id(slots, addr),
                                    &qxl->chunk);
 }
 
-static void red_record_clip_rects(FILE *fd, RedMemSlotInfo *slots, int group_id,
+static void red_record_clip_rects(GByteArray *out, RedMemSlotInfo *slots, int group_id,
                                   QXLPHYSICAL addr)
 {
     QXLClipRects *qxl;
 
     qxl = (QXLClipRects *)memslot_get_virt(slots, addr, sizeof(*qxl), group_id);
-    fprintf(fd, "num_rects %d\n", qxl->num_rects);
-    red_record_data_chunks_ptr(fd, "clip_rects", slots, group_id,
+    record_printf(out, "num_rects %d\n", qxl->num_rects);
+    red_record_data_chunks_ptr(out, "clip_rects", slots, group_id,
                                    memslot_get_id(slots, addr),
                                    &qxl->chunk);
 }
 
-static void red_record_virt_data_flat(FILE *fd, const char *prefix,
+static void red_record_virt_data_flat(GByteArray *out, const char *prefix,
                                       RedMemSlotInfo *slots, int group_id,
                                       QXLPHYSICAL addr, size_t size)
 {
-    write_binary(fd, prefix,
+    write_binary(out, prefix,
                  size, (uint8_t*)memslot_get_virt(slots, addr, size, group_id));
 }
 
-static void red_record_image_data_flat(FILE *fd, RedMemSlotInfo *slots, int group_id,
+static void red_record_image_data_flat(GByteArray *out, RedMemSlotInfo *slots, int group_id,
                                        QXLPHYSICAL addr, size_t size)
 {
-    red_record_virt_data_flat(fd, "image_data_flat", slots, group_id, addr, size);
+    red_record_virt_data_flat(out, "image_data_flat", slots, group_id, addr, size);
 }
 
-static void red_record_transform(FILE *fd, RedMemSlotInfo *slots, int group_id,
+static void red_record_transform(GByteArray *out, RedMemSlotInfo *slots, int group_id,
                                  QXLPHYSICAL addr)
 {
-    red_record_virt_data_flat(fd, "transform", slots, group_id,
+    red_record_virt_data_flat(out, "transform", slots, group_id,
                               addr, sizeof(SpiceTransform));
 }
 
-static void red_record_image(FILE *fd, RedMemSlotInfo *slots, int group_id,
+static void red_record_image(GByteArray *out, RedMemSlotInfo *slots, int group_id,
                                  QXLPHYSICAL addr, uint32_t flags)
 {
     QXLImage *qxl;
     size_t bitmap_size, size;
     uint8_t qxl_flags;
 
-    fprintf(fd, "image %d\n", addr ? 1 : 0);
+    record_printf(out, "image %d\n", addr ? 1 : 0);
     if (addr == 0) {
         return;
     }
 
     qxl = (QXLImage *)memslot_get_virt(slots, addr, sizeof(*qxl), group_id);
-    fprintf(fd, "descriptor.id %" PRIu64 "\n", qxl->descriptor.id);
-    fprintf(fd, "descriptor.type %d\n", qxl->descriptor.type);
-    fprintf(fd, "descriptor.flags %d\n", qxl->descriptor.flags);
-    fprintf(fd, "descriptor.width %d\n", qxl->descriptor.width);
-    fprintf(fd, "descriptor.height %d\n", qxl->descriptor.height);
+    record_printf(out, "descriptor.id %" PRIu64 "\n", qxl->descriptor.id);
+    record_printf(out, "descriptor.type %d\n", qxl->descriptor.type);
+    record_printf(out, "descriptor.flags %d\n", qxl->descriptor.flags);
+    record_printf(out, "descriptor.width %d\n", qxl->descriptor.width);
+    record_printf(out, "descriptor.height %d\n", qxl->descriptor.height);
 
     switch (qxl->descriptor.type) {
     case SPICE_IMAGE_TYPE_BITMAP:
-        fprintf(fd, "bitmap.format %d\n", qxl->bitmap.format);
-        fprintf(fd, "bitmap.flags %d\n", qxl->bitmap.flags);
-        fprintf(fd, "bitmap.x %d\n", qxl->bitmap.x);
-        fprintf(fd, "bitmap.y %d\n", qxl->bitmap.y);
-        fprintf(fd, "bitmap.stride %d\n", qxl->bitmap.stride);
+        record_printf(out, "bitmap.format %d\n", qxl->bitmap.format);
+        record_printf(out, "bitmap.flags %d\n", qxl->bitmap.flags);
+        record_printf(out, "bitmap.x %d\n", qxl->bitmap.x);
+        record_printf(out, "bitmap.y %d\n", qxl->bitmap.y);
+        record_printf(out, "bitmap.stride %d\n", qxl->bitmap.stride);
         qxl_flags = qxl->bitmap.flags;
-        fprintf(fd, "has_palette %d\n", qxl->bitmap.palette ? 1 : 0);
+        record_printf(out, "has_palette %d\n", qxl->bitmap.palette ? 1 : 0);
         if (qxl->bitmap.palette) {
             QXLPalette *qp;
             int i, num_ents;
             qp = (QXLPalette *)memslot_get_virt(slots, qxl->bitmap.palette,
                                                 sizeof(*qp), group_id);
             num_ents = qp->num_ents;
-            fprintf(fd, "qp.num_ents %d\n", qp->num_ents);
+            record_printf(out, "qp.num_ents %d\n", qp->num_ents);
             memslot_validate_virt(slots, (intptr_t)qp->ents,
                           memslot_get_id(slots, qxl->bitmap.palette),
                           num_ents * sizeof(qp->ents[0]), group_id);
-            fprintf(fd, "unique %" PRIu64 "\n", qp->unique);
+            record_printf(out, "unique %" PRIu64 "\n", qp->unique);
             for (i = 0; i < num_ents; i++) {
-                fprintf(fd, "ents %d\n", qp->ents[i]);
+                record_printf(out, "ents %d\n", qp->ents[i]);
             }
         }
         bitmap_size = qxl->bitmap.y * qxl->bitmap.stride;
         if (qxl_flags & QXL_BITMAP_DIRECT) {
-            red_record_image_data_flat(fd, slots, group_id,
+            red_record_image_data_flat(out, slots, group_id,
                                                          qxl->bitmap.data,
                                                          bitmap_size);
         } else {
-            size = red_record_data_chunks(fd, "bitmap.data", slots, group_id,
+            size = red_record_data_chunks(out, "bitmap.data", slots, group_id,
                                           qxl->bitmap.data);
             spice_assert(size == bitmap_size);
         }
         break;
     case SPICE_IMAGE_TYPE_SURFACE:
-        fprintf(fd, "surface_image.surface_id %d\n", qxl->surface_image.surface_id);
+        record_printf(out, "surface_image.surface_id %d\n", qxl->surface_image.surface_id);
         break;
     case SPICE_IMAGE_TYPE_QUIC:
-        fprintf(fd, "quic.data_size %d\n", qxl->quic.data_size);
-        size = red_record_data_chunks_ptr(fd, "quic.data", slots, group_id,
+        record_printf(out, "quic.data_size %d\n", qxl->quic.data_size);
+        size = red_record_data_chunks_ptr(out, "quic.data", slots, group_id,
                                        memslot_get_id(slots, addr),
                                        (QXLDataChunk *)qxl->quic.data);
         spice_assert(size == qxl->quic.data_size);
@@ -302,205 +333,205 @@ static void red_record_image(FILE *fd, RedMemSlotInfo *slots, int group_id,
     }
 }
 
-static void red_record_brush_ptr(FILE *fd, RedMemSlotInfo *slots, int group_id,
+static void red_record_brush_ptr(GByteArray *out, RedMemSlotInfo *slots, int group_id,
                                  QXLBrush *qxl, uint32_t flags)
 {
-    fprintf(fd, "type %d\n", qxl->type);
+    record_printf(out, "type %d\n", qxl->type);
     switch (qxl->type) {
     case SPICE_BRUSH_TYPE_SOLID:
-        fprintf(fd, "u.color %d\n", qxl->u.color);
+        record_printf(out, "u.color %d\n", qxl->u.color);
         break;
     case SPICE_BRUSH_TYPE_PATTERN:
-        red_record_image(fd, slots, group_id, qxl->u.pattern.pat, flags);
-        red_record_point_ptr(fd, &qxl->u.pattern.pos);
+        red_record_image(out, slots, group_id, qxl->u.pattern.pat, flags);
+        red_record_point_ptr(out, &qxl->u.pattern.pos);
         break;
     }
 }
 
-static void red_record_qmask_ptr(FILE *fd, RedMemSlotInfo *slots, int group_id,
+static void red_record_qmask_ptr(GByteArray *out, RedMemSlotInfo *slots, int group_id,
                                  QXLQMask *qxl, uint32_t flags)
 {
-    fprintf(fd, "flags %d\n", qxl->flags);
-    red_record_point_ptr(fd, &qxl->pos);
-    red_record_image(fd, slots, group_id, qxl->bitmap, flags);
+    record_printf(out, "flags %d\n", qxl->flags);
+    red_record_point_ptr(out, &qxl->pos);
+    red_record_image(out, slots, group_id, qxl->bitmap, flags);
 }
 
-static void red_record_fill_ptr(FILE *fd, RedMemSlotInfo *slots, int group_id,
+static void red_record_fill_ptr(GByteArray *out, RedMemSlotInfo *slots, int group_id,
                                 QXLFill *qxl, uint32_t flags)
 {
-    red_record_brush_ptr(fd, slots, group_id, &qxl->brush, flags);
-    fprintf(fd, "rop_descriptor %d\n", qxl->rop_descriptor);
-    red_record_qmask_ptr(fd, slots, group_id, &qxl->mask, flags);
+    red_record_brush_ptr(out, slots, group_id, &qxl->brush, flags);
+    record_printf(out, "rop_descriptor %d\n", qxl->rop_descriptor);
+    red_record_qmask_ptr(out, slots, group_id, &qxl->mask, flags);
 }
 
-static void red_record_opaque_ptr(FILE *fd, RedMemSlotInfo *slots, int group_id,
+static void red_record_opaque_ptr(GByteArray *out, RedMemSlotInfo *slots, int group_id,
                                   QXLOpaque *qxl, uint32_t flags)
 {
-   red_record_image(fd, slots, group_id, qxl->src_bitmap, flags);
-   red_record_rect_ptr(fd, "src_area", &qxl->src_area);
-   red_record_brush_ptr(fd, slots, group_id, &qxl->brush, flags);
-   fprintf(fd, "rop_descriptor %d\n", qxl->rop_descriptor);
-   fprintf(fd, "scale_mode %d\n", qxl->scale_mode);
-   red_record_qmask_ptr(fd, slots, group_id, &qxl->mask, flags);
+   red_record_image(out, slots, group_id, qxl->src_bitmap, flags);
+   red_record_rect_ptr(out, "src_area", &qxl->src_area);
+   red_record_brush_ptr(out, slots, group_id, &qxl->brush, flags);
+   record_printf(out, "rop_descriptor %d\n", qxl->rop_descriptor);
+   record_printf(out, "scale_mode %d\n", qxl->scale_mode);
+   red_record_qmask_ptr(out, slots, group_id, &qxl->mask, flags);
 }
 
-static void red_record_copy_ptr(FILE *fd, RedMemSlotInfo *slots, int group_id,
+static void red_record_copy_ptr(GByteArray *out, RedMemSlotInfo *slots, int group_id,
                                 QXLCopy *qxl, uint32_t flags)
 {
-   red_record_image(fd, slots, group_id, qxl->src_bitmap, flags);
-   red_record_rect_ptr(fd, "src_area", &qxl->src_area);
-   fprintf(fd, "rop_descriptor %d\n", qxl->rop_descriptor);
-   fprintf(fd, "scale_mode %d\n", qxl->scale_mode);
-   red_record_qmask_ptr(fd, slots, group_id, &qxl->mask, flags);
+   red_record_image(out, slots, group_id, qxl->src_bitmap, flags);
+   red_record_rect_ptr(out, "src_area", &qxl->src_area);
+   record_printf(out, "rop_descriptor %d\n", qxl->rop_descriptor);
+   record_printf(out, "scale_mode %d\n", qxl->scale_mode);
+   red_record_qmask_ptr(out, slots, group_id, &qxl->mask, flags);
 }
 
-static void red_record_blend_ptr(FILE *fd, RedMemSlotInfo *slots, int group_id,
+static void red_record_blend_ptr(GByteArray *out, RedMemSlotInfo *slots, int group_id,
                              QXLBlend *qxl, uint32_t flags)
 {
-   red_record_image(fd, slots, group_id, qxl->src_bitmap, flags);
-   red_record_rect_ptr(fd, "src_area", &qxl->src_area);
-   fprintf(fd, "rop_descriptor %d\n", qxl->rop_descriptor);
-   fprintf(fd, "scale_mode %d\n", qxl->scale_mode);
-   red_record_qmask_ptr(fd, slots, group_id, &qxl->mask, flags);
+   red_record_image(out, slots, group_id, qxl->src_bitmap, flags);
+   red_record_rect_ptr(out, "src_area", &qxl->src_area);
+   record_printf(out, "rop_descriptor %d\n", qxl->rop_descriptor);
+   record_printf(out, "scale_mode %d\n", qxl->scale_mode);
+   red_record_qmask_ptr(out, slots, group_id, &qxl->mask, flags);
 }
 
-static void red_record_transparent_ptr(FILE *fd, RedMemSlotInfo *slots, int group_id,
+static void red_record_transparent_ptr(GByteArray *out, RedMemSlotInfo *slots, int group_id,
                                     QXLTransparent *qxl,
                                     uint32_t flags)
 {
-   red_record_image(fd, slots, group_id, qxl->src_bitmap, flags);
-   red_record_rect_ptr(fd, "src_area", &qxl->src_area);
-   fprintf(fd, "src_color %d\n", qxl->src_color);
-   fprintf(fd, "true_color %d\n", qxl->true_color);
+   red_record_image(out, slots, group_id, qxl->src_bitmap, flags);
+   red_record_rect_ptr(out, "src_area", &qxl->src_area);
+   record_printf(out, "src_color %d\n", qxl->src_color);
+   record_printf(out, "true_color %d\n", qxl->true_color);
 }
 
-static void red_record_alpha_blend_ptr(FILE *fd, RedMemSlotInfo *slots, int group_id,
+static void red_record_alpha_blend_ptr(GByteArray *out, RedMemSlotInfo *slots, int group_id,
                                     QXLAlphaBlend *qxl,
                                     uint32_t flags)
 {
-    fprintf(fd, "alpha_flags %d\n", qxl->alpha_flags);
-    fprintf(fd, "alpha %d\n", qxl->alpha);
-    red_record_image(fd, slots, group_id, qxl->src_bitmap, flags);
-    red_record_rect_ptr(fd, "src_area", &qxl->src_area);
+    record_printf(out, "alpha_flags %d\n", qxl->alpha_flags);
+    record_printf(out, "alpha %d\n", qxl->alpha);
+    red_record_image(out, slots, group_id, qxl->src_bitmap, flags);
+    red_record_rect_ptr(out, "src_area", &qxl->src_area);
 }
 
-static void red_record_alpha_blend_ptr_compat(FILE *fd, RedMemSlotInfo *slots, int group_id,
+static void red_record_alpha_blend_ptr_compat(GByteArray *out, RedMemSlotInfo *slots, int group_id,
                                            QXLCompatAlphaBlend *qxl,
                                            uint32_t flags)
 {
-    fprintf(fd, "alpha %d\n", qxl->alpha);
-    red_record_image(fd, slots, group_id, qxl->src_bitmap, flags);
-    red_record_rect_ptr(fd, "src_area", &qxl->src_area);
+    record_printf(out, "alpha %d\n", qxl->alpha);
+    red_record_image(out, slots, group_id, qxl->src_bitmap, flags);
+    red_record_rect_ptr(out, "src_area", &qxl->src_area);
 }
 
-static void red_record_rop3_ptr(FILE *fd, RedMemSlotInfo *slots, int group_id,
+static void red_record_rop3_ptr(GByteArray *out, RedMemSlotInfo *slots, int group_id,
                                 QXLRop3 *qxl, uint32_t flags)
 {
-    red_record_image(fd, slots, group_id, qxl->src_bitmap, flags);
-    red_record_rect_ptr(fd, "src_area", &qxl->src_area);
-    red_record_brush_ptr(fd, slots, group_id, &qxl->brush, flags);
-    fprintf(fd, "rop3 %d\n", qxl->rop3);
-    fprintf(fd, "scale_mode %d\n", qxl->scale_mode);
-    red_record_qmask_ptr(fd, slots, group_id, &qxl->mask, flags);
+    red_record_image(out, slots, group_id, qxl->src_bitmap, flags);
+    red_record_rect_ptr(out, "src_area", &qxl->src_area);
+    red_record_brush_ptr(out, slots, group_id, &qxl->brush, flags);
+    record_printf(out, "rop3 %d\n", qxl->rop3);
+    record_printf(out, "scale_mode %d\n", qxl->scale_mode);
+    red_record_qmask_ptr(out, slots, group_id, &qxl->mask, flags);
 }
 
-static void red_record_stroke_ptr(FILE *fd, RedMemSlotInfo *slots, int group_id,
+static void red_record_stroke_ptr(GByteArray *out, RedMemSlotInfo *slots, int group_id,
                                   QXLStroke *qxl, uint32_t flags)
 {
-    red_record_path(fd, slots, group_id, qxl->path);
-    fprintf(fd, "attr.flags %d\n", qxl->attr.flags);
+    red_record_path(out, slots, group_id, qxl->path);
+    record_printf(out, "attr.flags %d\n", qxl->attr.flags);
     if (qxl->attr.flags & SPICE_LINE_FLAGS_STYLED) {
         int style_nseg = qxl->attr.style_nseg;
         uint8_t *buf;
 
-        fprintf(fd, "attr.style_nseg %d\n", qxl->attr.style_nseg);
+        record_printf(out, "attr.style_nseg %d\n", qxl->attr.style_nseg);
         spice_assert(qxl->attr.style);
         buf = (uint8_t *)memslot_get_virt(slots, qxl->attr.style,
                                           style_nseg * sizeof(QXLFIXED), group_id);
-        write_binary(fd, "style", style_nseg * sizeof(QXLFIXED), buf);
+        write_binary(out, "style", style_nseg * sizeof(QXLFIXED), buf);
     }
-    red_record_brush_ptr(fd, slots, group_id, &qxl->brush, flags);
-    fprintf(fd, "fore_mode %d\n", qxl->fore_mode);
-    fprintf(fd, "back_mode %d\n", qxl->back_mode);
+    red_record_brush_ptr(out, slots, group_id, &qxl->brush, flags);
+    record_printf(out, "fore_mode %d\n", qxl->fore_mode);
+    record_printf(out, "back_mode %d\n", qxl->back_mode);
 }
 
-static void red_record_string(FILE *fd, RedMemSlotInfo *slots, int group_id,
+static void red_record_string(GByteArray *out, RedMemSlotInfo *slots, int group_id,
                               QXLPHYSICAL addr)
 {
     QXLString *qxl;
     size_t chunk_size;
 
     qxl = (QXLString *)memslot_get_virt(slots, addr, sizeof(*qxl), group_id);
-    fprintf(fd, "data_size %d\n", qxl->data_size);
-    fprintf(fd, "length %d\n", qxl->length);
-    fprintf(fd, "flags %d\n", qxl->flags);
-    chunk_size = red_record_data_chunks_ptr(fd, "string", slots, group_id,
+    record_printf(out, "data_size %d\n", qxl->data_size);
+    record_printf(out, "length %d\n", qxl->length);
+    record_printf(out, "flags %d\n", qxl->flags);
+    chunk_size = red_record_data_chunks_ptr(out, "string", slots, group_id,
                                             memslot_get_id(slots, addr),
                                             &qxl->chunk);
     spice_assert(chunk_size == qxl->data_size);
 }
 
-static void red_record_text_ptr(FILE *fd, RedMemSlotInfo *slots, int group_id,
+static void red_record_text_ptr(GByteArray *out, RedMemSlotInfo *slots, int group_id,
                                 QXLText *qxl, uint32_t flags)
 {
-   red_record_string(fd, slots, group_id, qxl->str);
-   red_record_rect_ptr(fd, "back_area", &qxl->back_area);
-   red_record_brush_ptr(fd, slots, group_id, &qxl->fore_brush, flags);
-   red_record_brush_ptr(fd, slots, group_id, &qxl->back_brush, flags);
-   fprintf(fd, "fore_mode %d\n", qxl->fore_mode);
-   fprintf(fd, "back_mode %d\n", qxl->back_mode);
+   red_record_string(out, slots, group_id, qxl->str);
+   red_record_rect_ptr(out, "back_area", &qxl->back_area);
+   red_record_brush_ptr(out, slots, group_id, &qxl->fore_brush, flags);
+   red_record_brush_ptr(out, slots, group_id, &qxl->back_brush, flags);
+   record_printf(out, "fore_mode %d\n", qxl->fore_mode);
+   record_printf(out, "back_mode %d\n", qxl->back_mode);
 }
 
-static void red_record_whiteness_ptr(FILE *fd, RedMemSlotInfo *slots, int group_id,
+static void red_record_whiteness_ptr(GByteArray *out, RedMemSlotInfo *slots, int group_id,
                                      QXLWhiteness *qxl, uint32_t flags)
 {
-    red_record_qmask_ptr(fd, slots, group_id, &qxl->mask, flags);
+    red_record_qmask_ptr(out, slots, group_id, &qxl->mask, flags);
 }
 
-static void red_record_blackness_ptr(FILE *fd, RedMemSlotInfo *slots, int group_id,
+static void red_record_blackness_ptr(GByteArray *out, RedMemSlotInfo *slots, int group_id,
                                      QXLBlackness *qxl, uint32_t flags)
 {
-    red_record_qmask_ptr(fd, slots, group_id, &qxl->mask, flags);
+    red_record_qmask_ptr(out, slots, group_id, &qxl->mask, flags);
 }
 
-static void red_record_invers_ptr(FILE *fd, RedMemSlotInfo *slots, int group_id,
+static void red_record_invers_ptr(GByteArray *out, RedMemSlotInfo *slots, int group_id,
                                   QXLInvers *qxl, uint32_t flags)
 {
-    red_record_qmask_ptr(fd, slots, group_id, &qxl->mask, flags);
+    red_record_qmask_ptr(out, slots, group_id, &qxl->mask, flags);
 }
 
-static void red_record_clip_ptr(FILE *fd, RedMemSlotInfo *slots, int group_id,
+static void red_record_clip_ptr(GByteArray *out, RedMemSlotInfo *slots, int group_id,
                                 QXLClip *qxl)
 {
-    fprintf(fd, "type %d\n", qxl->type);
+    record_printf(out, "type %d\n", qxl->type);
     switch (qxl->type) {
     case SPICE_CLIP_TYPE_RECTS:
-        red_record_clip_rects(fd, slots, group_id, qxl->data);
+        red_record_clip_rects(out, slots, group_id, qxl->data);
         break;
     }
 }
 
-static void red_record_composite_ptr(FILE *fd, RedMemSlotInfo *slots, int group_id,
+static void red_record_composite_ptr(GByteArray *out, RedMemSlotInfo *slots, int group_id,
                                      QXLComposite *qxl, uint32_t flags)
 {
-    fprintf(fd, "flags %d\n", qxl->flags);
+    record_printf(out, "flags %d\n", qxl->flags);
 
-    red_record_image(fd, slots, group_id, qxl->src, flags);
-    fprintf(fd, "src_transform %d\n", !!qxl->src_transform);
+    red_record_image(out, slots, group_id, qxl->src, flags);
+    record_printf(out, "src_transform %d\n", !!qxl->src_transform);
     if (qxl->src_transform)
-        red_record_transform(fd, slots, group_id, qxl->src_transform);
-    fprintf(fd, "mask %d\n", !!qxl->mask);
+        red_record_transform(out, slots, group_id, qxl->src_transform);
+    record_printf(out, "mask %d\n", !!qxl->mask);
     if (qxl->mask)
-        red_record_image(fd, slots, group_id, qxl->mask, flags);
-    fprintf(fd, "mask_transform %d\n", !!qxl->mask_transform);
+        red_record_image(out, slots, group_id, qxl->mask, flags);
+    record_printf(out, "mask_transform %d\n", !!qxl->mask_transform);
     if (qxl->mask_transform)
-        red_record_transform(fd, slots, group_id, qxl->mask_transform);
+        red_record_transform(out, slots, group_id, qxl->mask_transform);
 
-    fprintf(fd, "src_origin %d %d\n", qxl->src_origin.x, qxl->src_origin.y);
-    fprintf(fd, "mask_origin %d %d\n", qxl->mask_origin.x, qxl->mask_origin.y);
+    record_printf(out, "src_origin %d %d\n", qxl->src_origin.x, qxl->src_origin.y);
+    record_printf(out, "mask_origin %d %d\n", qxl->mask_origin.x, qxl->mask_origin.y);
 }
 
-static void red_record_native_drawable(FILE *fd, RedMemSlotInfo *slots, int group_id,
+static void red_record_native_drawable(GByteArray *out, RedMemSlotInfo *slots, int group_id,
                                        QXLPHYSICAL addr, uint32_t flags)
 {
     QXLDrawable *qxl;
@@ -508,66 +539,66 @@ static void red_record_native_drawable(FILE *fd, RedMemSlotInfo *slots, int grou
 
     qxl = (QXLDrawable *)memslot_get_virt(slots, addr, sizeof(*qxl), group_id);
 
-    red_record_rect_ptr(fd, "bbox", &qxl->bbox);
-    red_record_clip_ptr(fd, slots, group_id, &qxl->clip);
-    fprintf(fd, "effect %d\n", qxl->effect);
-    fprintf(fd, "mm_time %d\n", qxl->mm_time);
-    fprintf(fd, "self_bitmap %d\n", qxl->self_bitmap);
-    red_record_rect_ptr(fd, "self_bitmap_area", &qxl->self_bitmap_area);
-    fprintf(fd, "surface_id %d\n", qxl->surface_id);
+    red_record_rect_ptr(out, "bbox", &qxl->bbox);
+    red_record_clip_ptr(out, slots, group_id, &qxl->clip);
+    record_printf(out, "effect %d\n", qxl->effect);
+    record_printf(out, "mm_time %d\n", qxl->mm_time);
+    record_printf(out, "self_bitmap %d\n", qxl->self_bitmap);
+    red_record_rect_ptr(out, "self_bitmap_area", &qxl->self_bitmap_area);
+    record_printf(out, "surface_id %d\n", qxl->surface_id);
 
     for (i = 0; i < 3; i++) {
-        fprintf(fd, "surfaces_dest %d\n", qxl->surfaces_dest[i]);
-        red_record_rect_ptr(fd, "surfaces_rects", &qxl->surfaces_rects[i]);
+        record_printf(out, "surfaces_dest %d\n", qxl->surfaces_dest[i]);
+        red_record_rect_ptr(out, "surfaces_rects", &qxl->surfaces_rects[i]);
     }
 
-    fprintf(fd, "type %d\n", qxl->type);
+    record_printf(out, "type %d\n", qxl->type);
     switch (qxl->type) {
     case QXL_DRAW_ALPHA_BLEND:
-        red_record_alpha_blend_ptr(fd, slots, group_id,
+        red_record_alpha_blend_ptr(out, slots, group_id,
                                    &qxl->u.alpha_blend, flags);
         break;
     case QXL_DRAW_BLACKNESS:
-        red_record_blackness_ptr(fd, slots, group_id,
+        red_record_blackness_ptr(out, slots, group_id,
                                  &qxl->u.blackness, flags);
         break;
     case QXL_DRAW_BLEND:
-        red_record_blend_ptr(fd, slots, group_id, &qxl->u.blend, flags);
+        red_record_blend_ptr(out, slots, group_id, &qxl->u.blend, flags);
         break;
     case QXL_DRAW_COPY:
-        red_record_copy_ptr(fd, slots, group_id, &qxl->u.copy, flags);
+        red_record_copy_ptr(out, slots, group_id, &qxl->u.copy, flags);
         break;
     case QXL_COPY_BITS:
-        red_record_point_ptr(fd, &qxl->u.copy_bits.src_pos);
+        red_record_point_ptr(out, &qxl->u.copy_bits.src_pos);
         break;
     case QXL_DRAW_FILL:
-        red_record_fill_ptr(fd, slots, group_id, &qxl->u.fill, flags);
+        red_record_fill_ptr(out, slots, group_id, &qxl->u.fill, flags);
         break;
     case QXL_DRAW_OPAQUE:
-        red_record_opaque_ptr(fd, slots, group_id, &qxl->u.opaque, flags);
+        red_record_opaque_ptr(out, slots, group_id, &qxl->u.opaque, flags);
         break;
     case QXL_DRAW_INVERS:
-        red_record_invers_ptr(fd, slots, group_id, &qxl->u.invers, flags);
+        red_record_invers_ptr(out, slots, group_id, &qxl->u.invers, flags);
         break;
     case QXL_DRAW_NOP:
         break;
     case QXL_DRAW_ROP3:
-        red_record_rop3_ptr(fd, slots, group_id, &qxl->u.rop3, flags);
+        red_record_rop3_ptr(out, slots, group_id, &qxl->u.rop3, flags);
         break;
     case QXL_DRAW_STROKE:
-        red_record_stroke_ptr(fd, slots, group_id, &qxl->u.stroke, flags);
+        red_record_stroke_ptr(out, slots, group_id, &qxl->u.stroke, flags);
         break;
     case QXL_DRAW_TEXT:
-        red_record_text_ptr(fd, slots, group_id, &qxl->u.text, flags);
+        red_record_text_ptr(out, slots, group_id, &qxl->u.text, flags);
         break;
     case QXL_DRAW_TRANSPARENT:
-        red_record_transparent_ptr(fd, slots, group_id, &qxl->u.transparent, flags);
+        red_record_transparent_ptr(out, slots, group_id, &qxl->u.transparent, flags);
         break;
     case QXL_DRAW_WHITENESS:
-        red_record_whiteness_ptr(fd, slots, group_id, &qxl->u.whiteness, flags);
+        red_record_whiteness_ptr(out, slots, group_id, &qxl->u.whiteness, flags);
         break;
     case QXL_DRAW_COMPOSITE:
-        red_record_composite_ptr(fd, slots, group_id, &qxl->u.composite, flags);
+        red_record_composite_ptr(out, slots, group_id, &qxl->u.composite, flags);
         break;
     default:
         spice_error("unknown type %d", qxl->type);
@@ -575,65 +606,65 @@ static void red_record_native_drawable(FILE *fd, RedMemSlotInfo *slots, int grou
     };
 }
 
-static void red_record_compat_drawable(FILE *fd, RedMemSlotInfo *slots, int group_id,
+static void red_record_compat_drawable(GByteArray *out, RedMemSlotInfo *slots, int group_id,
                                        QXLPHYSICAL addr, uint32_t flags)
 {
     QXLCompatDrawable *qxl;
 
     qxl = (QXLCompatDrawable *)memslot_get_virt(slots, addr, sizeof(*qxl), group_id);
 
-    red_record_rect_ptr(fd, "bbox", &qxl->bbox);
-    red_record_clip_ptr(fd, slots, group_id, &qxl->clip);
-    fprintf(fd, "effect %d\n", qxl->effect);
-    fprintf(fd, "mm_time %d\n", qxl->mm_time);
+    red_record_rect_ptr(out, "bbox", &qxl->bbox);
+    red_record_clip_ptr(out, slots, group_id, &qxl->clip);
+    record_printf(out, "effect %d\n", qxl->effect);
+    record_printf(out, "mm_time %d\n", qxl->mm_time);
 
-    fprintf(fd, "bitmap_offset %d\n", qxl->bitmap_offset);
-    red_record_rect_ptr(fd, "bitmap_area", &qxl->bitmap_area);
+    record_printf(out, "bitmap_offset %d\n", qxl->bitmap_offset);
+    red_record_rect_ptr(out, "bitmap_area", &qxl->bitmap_area);
 
-    fprintf(fd, "type %d\n", qxl->type);
+    record_printf(out, "type %d\n", qxl->type);
     switch (qxl->type) {
     case QXL_DRAW_ALPHA_BLEND:
-        red_record_alpha_blend_ptr_compat(fd, slots, group_id,
+        red_record_alpha_blend_ptr_compat(out, slots, group_id,
                                        &qxl->u.alpha_blend, flags);
         break;
     case QXL_DRAW_BLACKNESS:
-        red_record_blackness_ptr(fd, slots, group_id,
+        red_record_blackness_ptr(out, slots, group_id,
                               &qxl->u.blackness, flags);
         break;
     case QXL_DRAW_BLEND:
-        red_record_blend_ptr(fd, slots, group_id, &qxl->u.blend, flags);
+        red_record_blend_ptr(out, slots, group_id, &qxl->u.blend, flags);
         break;
     case QXL_DRAW_COPY:
-        red_record_copy_ptr(fd, slots, group_id, &qxl->u.copy, flags);
+        red_record_copy_ptr(out, slots, group_id, &qxl->u.copy, flags);
         break;
     case QXL_COPY_BITS:
-        red_record_point_ptr(fd, &qxl->u.copy_bits.src_pos);
+        red_record_point_ptr(out, &qxl->u.copy_bits.src_pos);
         break;
     case QXL_DRAW_FILL:
-        red_record_fill_ptr(fd, slots, group_id, &qxl->u.fill, flags);
+        red_record_fill_ptr(out, slots, group_id, &qxl->u.fill, flags);
         break;
     case QXL_DRAW_OPAQUE:
-        red_record_opaque_ptr(fd, slots, group_id, &qxl->u.opaque, flags);
+        red_record_opaque_ptr(out, slots, group_id, &qxl->u.opaque, flags);
         break;
     case QXL_DRAW_INVERS:
-        red_record_invers_ptr(fd, slots, group_id, &qxl->u.invers, flags);
+        red_record_invers_ptr(out, slots, group_id, &qxl->u.invers, flags);
         break;
     case QXL_DRAW_NOP:
         break;
     case QXL_DRAW_ROP3:
-        red_record_rop3_ptr(fd, slots, group_id, &qxl->u.rop3, flags);
+        red_record_rop3_ptr(out, slots, group_id, &qxl->u.rop3, flags);
         break;
     case QXL_DRAW_STROKE:
-        red_record_stroke_ptr(fd, slots, group_id, &qxl->u.stroke, flags);
+        red_record_stroke_ptr(out, slots, group_id, &qxl->u.stroke, flags);
         break;
     case QXL_DRAW_TEXT:
-        red_record_text_ptr(fd, slots, group_id, &qxl->u.text, flags);
+        red_record_text_ptr(out, slots, group_id, &qxl->u.text, flags);
         break;
     case QXL_DRAW_TRANSPARENT:
-        red_record_transparent_ptr(fd, slots, group_id, &qxl->u.transparent, flags);
+        red_record_transparent_ptr(out, slots, group_id, &qxl->u.transparent, flags);
         break;
     case QXL_DRAW_WHITENESS:
-        red_record_whiteness_ptr(fd, slots, group_id, &qxl->u.whiteness, flags);
+        red_record_whiteness_ptr(out, slots, group_id, &qxl->u.whiteness, flags);
         break;
     default:
         spice_error("unknown type %d", qxl->type);
@@ -641,31 +672,31 @@ static void red_record_compat_drawable(FILE *fd, RedMemSlotInfo *slots, int grou
     };
 }
 
-static void red_record_drawable(FILE *fd, RedMemSlotInfo *slots, int group_id,
+static void red_record_drawable(GByteArray *out, RedMemSlotInfo *slots, int group_id,
                                 QXLPHYSICAL addr, uint32_t flags)
 {
-    fprintf(fd, "drawable\n");
+    record_printf(out, "drawable\n");
     if (flags & QXL_COMMAND_FLAG_COMPAT) {
-        red_record_compat_drawable(fd, slots, group_id, addr, flags);
+        red_record_compat_drawable(out, slots, group_id, addr, flags);
     } else {
-        red_record_native_drawable(fd, slots, group_id, addr, flags);
+        red_record_native_drawable(out, slots, group_id, addr, flags);
     }
 }
 
-static void red_record_update_cmd(FILE *fd, RedMemSlotInfo *slots, int group_id,
+static void red_record_update_cmd(GByteArray *out, RedMemSlotInfo *slots, int group_id,
                                   QXLPHYSICAL addr)
 {
     QXLUpdateCmd *qxl;
 
     qxl = (QXLUpdateCmd *)memslot_get_virt(slots, addr, sizeof(*qxl), group_id);
 
-    fprintf(fd, "update\n");
-    red_record_rect_ptr(fd, "area", &qxl->area);
-    fprintf(fd, "update_id %d\n", qxl->update_id);
-    fprintf(fd, "surface_id %d\n", qxl->surface_id);
+    record_printf(out, "update\n");
+    red_record_rect_ptr(out, "area", &qxl->area);
+    record_printf(out, "update_id %d\n", qxl->update_id);
+    record_printf(out, "surface_id %d\n", qxl->surface_id);
 }
 
-static void red_record_message(FILE *fd, RedMemSlotInfo *slots, int group_id,
+static void red_record_message(GByteArray *out, RedMemSlotInfo *slots, int group_id,
                                QXLPHYSICAL addr)
 {
     QXLMessage *qxl;
@@ -677,10 +708,10 @@ static void red_record_message(FILE *fd, RedMemSlotInfo *slots, int group_id,
      *   so we can just ignore it by default.
      */
     qxl = (QXLMessage *)memslot_get_virt(slots, addr, sizeof(*qxl), group_id);
-    write_binary(fd, "message", strlen((char*)qxl->data), (uint8_t*)qxl->data);
+    write_binary(out, "message", strlen((char*)qxl->data), (uint8_t*)qxl->data);
 }
 
-static void red_record_surface_cmd(FILE *fd, RedMemSlotInfo *slots, int group_id,
+static void red_record_surface_cmd(GByteArray *out, RedMemSlotInfo *slots, int group_id,
                             QXLPHYSICAL addr)
 {
     QXLSurfaceCmd *qxl;
@@ -688,131 +719,306 @@ static void red_record_surface_cmd(FILE *fd, RedMemSlotInfo *slots, int group_id
 
     qxl = (QXLSurfaceCmd *)memslot_get_virt(slots, addr, sizeof(*qxl), group_id);
 
-    fprintf(fd, "surface_cmd\n");
-    fprintf(fd, "surface_id %d\n", qxl->surface_id);
-    fprintf(fd, "type %d\n", qxl->type);
-    fprintf(fd, "flags %d\n", qxl->flags);
+    record_printf(out, "surface_cmd\n");
+    record_printf(out, "surface_id %d\n", qxl->surface_id);
+    record_printf(out, "type %d\n", qxl->type);
+    record_printf(out, "flags %d\n", qxl->flags);
 
     switch (qxl->type) {
     case QXL_SURFACE_CMD_CREATE:
-        fprintf(fd, "u.surface_create.format %d\n", qxl->u.surface_create.format);
-        fprintf(fd, "u.surface_create.width %d\n", qxl->u.surface_create.width);
-        fprintf(fd, "u.surface_create.height %d\n", qxl->u.surface_create.height);
-        fprintf(fd, "u.surface_create.stride %d\n", qxl->u.surface_create.stride);
+        record_printf(out, "u.surface_create.format %d\n", qxl->u.surface_create.format);
+        record_printf(out, "u.surface_create.width %d\n", qxl->u.surface_create.width);
+        record_printf(out, "u.surface_create.height %d\n", qxl->u.surface_create.height);
+        record_printf(out, "u.surface_create.stride %d\n", qxl->u.surface_create.stride);
         size = qxl->u.surface_create.height * abs(qxl->u.surface_create.stride);
         if ((qxl->flags & QXL_SURF_FLAG_KEEP_DATA) != 0) {
-            write_binary(fd, "data", size,
+            write_binary(out, "data", size,
                 (uint8_t*)memslot_get_virt(slots, qxl->u.surface_create.data, size, group_id));
         }
         break;
     }
 }
 
-static void red_record_cursor(FILE *fd, RedMemSlotInfo *slots, int group_id,
+static void red_record_cursor(GByteArray *out, RedMemSlotInfo *slots, int group_id,
                               QXLPHYSICAL addr)
 {
     QXLCursor *qxl;
 
     qxl = (QXLCursor *)memslot_get_virt(slots, addr, sizeof(*qxl), group_id);
 
-    fprintf(fd, "header.unique %" PRIu64 "\n", qxl->header.unique);
-    fprintf(fd, "header.type %d\n", qxl->header.type);
-    fprintf(fd, "header.width %d\n", qxl->header.width);
-    fprintf(fd, "header.height %d\n", qxl->header.height);
-    fprintf(fd, "header.hot_spot_x %d\n", qxl->header.hot_spot_x);
-    fprintf(fd, "header.hot_spot_y %d\n", qxl->header.hot_spot_y);
+    record_printf(out, "header.unique %" PRIu64 "\n", qxl->header.unique);
+    record_printf(out, "header.type %d\n", qxl->header.type);
+    record_printf(out, "header.width %d\n", qxl->header.width);
+    record_printf(out, "header.height %d\n", qxl->header.height);
+    record_printf(out, "header.hot_spot_x %d\n", qxl->header.hot_spot_x);
+    record_printf(out, "header.hot_spot_y %d\n", qxl->header.hot_spot_y);
 
-    fprintf(fd, "data_size %d\n", qxl->data_size);
-    red_record_data_chunks_ptr(fd, "cursor", slots, group_id,
+    record_printf(out, "data_size %d\n", qxl->data_size);
+    red_record_data_chunks_ptr(out, "cursor", slots, group_id,
                                    memslot_get_id(slots, addr),
                                    &qxl->chunk);
 }
 
-static void red_record_cursor_cmd(FILE *fd, RedMemSlotInfo *slots, int group_id,
+static void red_record_cursor_cmd(GByteArray *out, RedMemSlotInfo *slots, int group_id,
                                   QXLPHYSICAL addr)
 {
     QXLCursorCmd *qxl;
 
     qxl = (QXLCursorCmd *)memslot_get_virt(slots, addr, sizeof(*qxl), group_id);
 
-    fprintf(fd, "cursor_cmd\n");
-    fprintf(fd, "type %d\n", qxl->type);
+    record_printf(out, "cursor_cmd\n");
+    record_printf(out, "type %d\n", qxl->type);
     switch (qxl->type) {
     case QXL_CURSOR_SET:
-        red_record_point16_ptr(fd, &qxl->u.set.position);
-        fprintf(fd, "u.set.visible %d\n", qxl->u.set.visible);
-        red_record_cursor(fd, slots, group_id, qxl->u.set.shape);
+        red_record_point16_ptr(out, &qxl->u.set.position);
+        record_printf(out, "u.set.visible %d\n", qxl->u.set.visible);
+        red_record_cursor(out, slots, group_id, qxl->u.set.shape);
         break;
     case QXL_CURSOR_MOVE:
-        red_record_point16_ptr(fd, &qxl->u.position);
+        red_record_point16_ptr(out, &qxl->u.position);
         break;
     case QXL_CURSOR_TRAIL:
-        fprintf(fd, "u.trail.length %d\n", qxl->u.trail.length);
-        fprintf(fd, "u.trail.frequency %d\n", qxl->u.trail.frequency);
+        record_printf(out, "u.trail.length %d\n", qxl->u.trail.length);
+        record_printf(out, "u.trail.frequency %d\n", qxl->u.trail.frequency);
         break;
     }
 }
 
+static void red_record_write(RedRecord *record, const void *data, size_t size)
+{
+    if (size > 0) {
+        size_t n = fwrite(data, size, 1, record->fd);
+        (void)n;
+    }
+    record->offset += size;
+}
+
+/* Writes the block of an event, from the writer thread */
+static void red_record_write_event(RedRecord *record, const RecordEvent *event)
+{
+    RecordBlockHeader header;
+    RecordIndexEntry entry;
+    const uint8_t *payload = event->payload->data;
+    uint32_t size = event->payload->len;
+
+    header.compression = RECORD_COMPRESSION_NONE;
+#ifdef USE_LZ4
+    if (record->compression == RECORD_COMPRESSION_LZ4 && size >= RECORD_COMPRESS_MIN_SIZE) {
+        int bound = LZ4_compressBound(size);
+        int compressed = 0;
+
+        if (bound > 0 && record->compress_buf_size < (size_t) bound) {
+            g_free(record->compress_buf);
+            record->compress_buf = (uint8_t *) g_malloc(bound);
+            record->compress_buf_size = bound;
+        }
+        if (bound > 0) {
+            compressed = LZ4_compress_default((const char *) payload,
+                                              (char *) record->compress_buf, size, bound);
+        }
+        if (compressed > 0 && (uint32_t) compressed < size) {
+            header.compression = RECORD_COMPRESSION_LZ4;
+            payload = record->compress_buf;
+            size = compressed;
+        }
+    }
+#endif
+
+    entry.offset = GUINT64_TO_LE(record->offset);
+    entry.what = GUINT32_TO_LE(event->what);
+    entry.type = GUINT32_TO_LE(event->type);
+    g_array_append_val(record->index, entry);
+
+    header.magic = GUINT32_TO_LE(RECORD_BLOCK_MAGIC);
+    header.counter = GUINT32_TO_LE(event->counter);
+    header.what = GUINT32_TO_LE(event->what);
+    header.type = GUINT32_TO_LE(event->type);
+    header.timestamp = GUINT64_TO_LE(event->timestamp);
+    header.compression = GUINT32_TO_LE(header.compression);
+    header.size = GUINT32_TO_LE(size);
+    header.raw_size = GUINT32_TO_LE(event->payload->len);
+    header.padding = 0;
+    red_record_write(record, &header, sizeof(header));
+    red_record_write(record, payload, size);
+}
+
+static void *red_record_writer_main(void *opaque)
+{
+    RedRecord *record = (RedRecord *) opaque;
+    RecordEvent *event;
+
+    pthread_mutex_lock(&record->lock);
+    for (;;) {
+        while (g_queue_is_empty(&record->queue) && !record->stopping) {
+            pthread_cond_wait(&record->queue_cond, &record->lock);
+        }
+        event = (RecordEvent *) g_queue_pop_head(&record->queue);
+        if (!event) {
+            break;
+        }
+        pthread_mutex_unlock(&record->lock);
+
+        red_record_write_event(record, event);
+
+        pthread_mutex_lock(&record->lock);
+        record->queued_size -= event->payload->len;
+        if (event->payload->len <= RECORD_FREE_PAYLOAD_MAX_SIZE &&
+            g_queue_get_length(&record->free_payloads) < RECORD_FREE_PAYLOADS) {
+            g_byte_array_set_size(event->payload, 0);
+            g_queue_push_tail(&record->free_payloads, event->payload);
+        } else {
+            g_byte_array_free(event->payload, TRUE);
+        }
+        g_free(event);
+        pthread_cond_broadcast(&record->space_cond);
+    }
+    pthread_mutex_unlock(&record->lock);
+    fflush(record->fd);
+    return NULL;
+}
+
+/* Hands the event being recorded to the writer thread */
+static void red_record_queue_event(RedRecord *record)
+{
+    RecordEvent *event = record->event;
+
+    if (!event) {
+        return;
+    }
+    record->event = NULL;
+    record->queued_size += event->payload->len;
+    g_queue_push_tail(&record->queue, event);
+    pthread_cond_signal(&record->queue_cond);
+}
+
+static void red_record_new_event(RedRecord *record, int what, uint32_t type)
+{
+    RecordEvent *event = g_new(RecordEvent, 1);
+
+    event->counter = record->counter++;
+    event->what = what;
+    event->type = type;
+    event->timestamp = spice_get_monotonic_time_ns();
+    event->payload = (GByteArray *) g_queue_pop_head(&record->free_payloads);
+    if (!event->payload) {
+        event->payload = g_byte_array_new();
+    }
+    record->event = event;
+}
+
+/* Records the number of commands dropped before the next event */
+static void red_record_queue_dropped(RedRecord *record)
+{
+    if (record->dropped == 0) {
+        return;
+    }
+    red_record_new_event(record, 2, record->dropped);
+    red_record_queue_event(record);
+    record->dropped = 0;
+}
+
+/* Waits for the writer thread if too much data is queued, returns false if
+ * the event should be dropped instead */
+static bool red_record_wait_queue(RedRecord *record, bool droppable)
+{
+    while (record->queued_size >= record->max_queued_size) {
+        if (droppable && record->drop_when_full) {
+            return false;
+        }
+        pthread_cond_wait(&record->space_cond, &record->lock);
+    }
+    return true;
+}
+
 void red_record_primary_surface_create(RedRecord *record,
                                        QXLDevSurfaceCreate* surface,
                                        uint8_t *line_0)
 {
-    FILE *fd = record->fd;
+    GByteArray *out;
 
     pthread_mutex_lock(&record->lock);
-    fprintf(fd, "%d %d %d %d\n", surface->width, surface->height,
+    if (!record->event) {
+        pthread_mutex_unlock(&record->lock);
+        return;
+    }
+    out = record->event->payload;
+    record_printf(out, "%d %d %d %d\n", surface->width, surface->height,
         surface->stride, surface->format);
-    fprintf(fd, "%d %d %d %d\n", surface->position, surface->mouse_mode,
+    record_printf(out, "%d %d %d %d\n", surface->position, surface->mouse_mode,
         surface->flags, surface->type);
-    write_binary(fd, "data", line_0 ? abs(surface->stride)*surface->height : 0,
+    write_binary(out, "data", line_0 ? abs(surface->stride)*surface->height : 0,
         line_0);
     pthread_mutex_unlock(&record->lock);
 }
 
+/* The event is queued when the next one starts, as device messages can
+ * be followed by some data, see red_record_primary_surface_create() */
 static void red_record_event_unlocked(RedRecord *record, int what, uint32_t type)
 {
-    red_time_t ts = spice_get_monotonic_time_ns();
-    // TODO: record the size of the packet in the header. This would make
-    // navigating it much faster (well, I can add an index while I'm at it..)
-    // and make it trivial to get a histogram from a file.
-    // But to implement that I would need some temporary buffer for each event.
-    // (that can be up to VGA_FRAMEBUFFER large)
-    fprintf(record->fd, "event %u %d %u %" PRIu64 "\n", record->counter++, what, type, ts);
+    red_record_queue_event(record);
+    red_record_queue_dropped(record);
+    red_record_new_event(record, what, type);
 }
 
 void red_record_event(RedRecord *record, int what, uint32_t type)
 {
     pthread_mutex_lock(&record->lock);
+    red_record_wait_queue(record, false);
     red_record_event_unlocked(record, what, type);
     pthread_mutex_unlock(&record->lock);
 }
 
-void red_record_qxl_command(RedRecord *record, RedMemSlotInfo *slots,
+bool red_record_qxl_command(RedRecord *record, RedMemSlotInfo *slots,
                             QXLCommandExt ext_cmd)
 {
-    FILE *fd = record->fd;
+    GByteArray *out;
 
     pthread_mutex_lock(&record->lock);
+    /* surface commands are never dropped, the following ones depend on them */
+    if (!red_record_wait_queue(record, ext_cmd.cmd.type != QXL_CMD_SURFACE)) {
+        record->dropped++;
+        record->total_dropped++;
+        pthread_mutex_unlock(&record->lock);
+        return false;
+    }
     red_record_event_unlocked(record, 0, ext_cmd.cmd.type);
+    out = record->event->payload;
 
     switch (ext_cmd.cmd.type) {
     case QXL_CMD_DRAW:
-        red_record_drawable(fd, slots, ext_cmd.group_id, ext_cmd.cmd.data, ext_cmd.flags);
+        red_record_drawable(out, slots, ext_cmd.group_id, ext_cmd.cmd.data, ext_cmd.flags);
         break;
     case QXL_CMD_UPDATE:
-        red_record_update_cmd(fd, slots, ext_cmd.group_id, ext_cmd.cmd.data);
+        red_record_update_cmd(out, slots, ext_cmd.group_id, ext_cmd.cmd.data);
         break;
     case QXL_CMD_MESSAGE:
-        red_record_message(fd, slots, ext_cmd.group_id, ext_cmd.cmd.data);
+        red_record_message(out, slots, ext_cmd.group_id, ext_cmd.cmd.data);
         break;
     case QXL_CMD_SURFACE:
-        red_record_surface_cmd(fd, slots, ext_cmd.group_id, ext_cmd.cmd.data);
+        red_record_surface_cmd(out, slots, ext_cmd.group_id, ext_cmd.cmd.data);
         break;
     case QXL_CMD_CURSOR:
-        red_record_cursor_cmd(fd, slots, ext_cmd.group_id, ext_cmd.cmd.data);
+        red_record_cursor_cmd(out, slots, ext_cmd.group_id, ext_cmd.cmd.data);
         break;
     }
+    red_record_queue_event(record);
     pthread_mutex_unlock(&record->lock);
+    return true;
+}
+
+static int red_record_get_compression(void)
+{
+    const char *name = getenv("SPICE_WORKER_RECORD_COMPRESSION");
+
+#ifdef USE_LZ4
+    if (name == NULL || strcmp(name, "lz4") == 0) {
+        return RECORD_COMPRESSION_LZ4;
+    }
+#endif
+    if (name != NULL && strcmp(name, "none") != 0) {
+        spice_warning("unsupported recording compression %s", name);
+    }
+    return RECORD_COMPRESSION_NONE;
 }
 
 #ifndef _WIN32
@@ -832,11 +1038,16 @@ static void child_output_setup(gpointer user_data)
 
 RedRecord *red_record_new(const char *filename)
 {
-    static const char header[] = "SPICE_REPLAY 1\n";
+    static const char header[] = "SPICE_REPLAY " G_STRINGIFY(RECORD_FORMAT_VERSION) "\n";
 
-    const char *filter;
+    const char *filter, *queue_size, *policy;
     FILE *f;
     RedRecord *record;
+#ifndef _WIN32
+    sigset_t thread_sig_mask;
+    sigset_t curr_sig_mask;
+#endif
+    int r;
 
     f = fopen(filename, "wb+");
     if (!f) {
@@ -881,14 +1092,58 @@ RedRecord *red_record_new(const char *filename)
         spice_error("failed to write replay header");
     }
 
-    record = g_new(RedRecord, 1);
+    record = g_new0(RedRecord, 1);
     record->refs = 1;
     record->fd = f;
     record->counter = 0;
+    record->compression = red_record_get_compression();
+    record->max_queued_size = RECORD_QUEUE_SIZE * 1024 * 1024;
+    queue_size = getenv("SPICE_WORKER_RECORD_QUEUE_SIZE");
+    if (queue_size && atoi(queue_size) > 0) {
+        record->max_queued_size = size_t{1024} * 1024 * atoi(queue_size);
+    }
+    policy = getenv("SPICE_WORKER_RECORD_POLICY");
+    record->drop_when_full = policy && strcmp(policy, "drop") == 0;
+    g_queue_init(&record->queue);
+    g_queue_init(&record->free_payloads);
+    record->offset = sizeof(header)-1;
+    record->index = g_array_new(FALSE, FALSE, sizeof(RecordIndexEntry));
     pthread_mutex_init(&record->lock, NULL);
+    pthread_cond_init(&record->queue_cond, NULL);
+    pthread_cond_init(&record->space_cond, NULL);
+
+#ifndef _WIN32
+    sigfillset(&thread_sig_mask);
+    sigdelset(&thread_sig_mask, SIGILL);
+    sigdelset(&thread_sig_mask, SIGFPE);
+    sigdelset(&thread_sig_mask, SIGSEGV);
+    pthread_sigmask(SIG_SETMASK, &thread_sig_mask, &curr_sig_mask);
+#endif
+    r = pthread_create(&record->writer, NULL, red_record_writer_main, record);
+#ifndef _WIN32
+    pthread_sigmask(SIG_SETMASK, &curr_sig_mask, NULL);
+#endif
+    if (r) {
+        spice_error("create recording thread failed %d", r);
+    }
+#if !defined(__APPLE__)
+    pthread_setname_np(record->writer, "SPICE Recorder");
+#endif
     return record;
 }
 
+static void red_record_write_index(RedRecord *record)
+{
+    RecordIndexFooter footer;
+
+    footer.index_offset = GUINT64_TO_LE(record->offset);
+    footer.num_entries = GUINT32_TO_LE(record->index->len);
+    footer.magic = GUINT32_TO_LE(RECORD_INDEX_MAGIC);
+    red_record_write(record, record->index->data,
+                     record->index->len * sizeof(RecordIndexEntry));
+    red_record_write(record, &footer, sizeof(footer));
+}
+
 RedRecord *red_record_ref(RedRecord *record)
 {
     g_atomic_int_inc(&record->refs);
@@ -897,10 +1152,32 @@ RedRecord *red_record_ref(RedRecord *record)
 
 void red_record_unref(RedRecord *record)
 {
+    GByteArray *payload;
+
     if (!record || !g_atomic_int_dec_and_test(&record->refs)) {
         return;
     }
+    pthread_mutex_lock(&record->lock);
+    red_record_queue_event(record);
+    red_record_queue_dropped(record);
+    record->stopping = true;
+    pthread_cond_signal(&record->queue_cond);
+    pthread_mutex_unlock(&record->lock);
+    pthread_join(record->writer, NULL);
+
+    if (record->total_dropped > 0) {
+        spice_warning("%" PRIu64 " commands were dropped from the recording",
+                      record->total_dropped);
+    }
+    red_record_write_index(record);
     fclose(record->fd);
     pthread_mutex_destroy(&record->lock);
+    pthread_cond_destroy(&record->queue_cond);
+    pthread_cond_destroy(&record->space_cond);
+    while ((payload = (GByteArray *) g_queue_pop_head(&record->free_payloads)) != NULL) {
+        g_byte_array_free(payload, TRUE);
+    }
+    g_free(record->compress_buf);
+    g_array_free(record->index, TRUE);
     g_free(record);
 }
@@ -27,6 +27,55 @@
 
 SPICE_BEGIN_DECLS
 
+/*
+ * Recording file format, version 2.
+ *
+ * The file starts with a "SPICE_REPLAY 2\n" line followed by a block for
+ * each recorded event, then by an index of all the blocks and a footer:
+ *
+ *   header line | block | block | ... | RecordIndexEntry[] | RecordIndexFooter
+ *
+ * Each block is a RecordBlockHeader followed by the payload of the event,
+ * possibly compressed. The payload is a sequence of fields: integers are 4
+ * bytes long, or 8 bytes for 64 bit values, and binary data are stored as
+ * their 8 bytes size followed by the data.
+ * The index is missing if the recording was interrupted, in that case the
+ * blocks must be walked from the start of the file.
+ * All integers are stored in little endian.
+ */
+#define RECORD_FORMAT_VERSION 2
+#define RECORD_BLOCK_MAGIC 0x4b4c4252 /* "RBLK" */
+#define RECORD_INDEX_MAGIC 0x58444952 /* "RIDX" */
+
+enum {
+    RECORD_COMPRESSION_NONE,
+    RECORD_COMPRESSION_LZ4,
+};
+
+typedef struct RecordBlockHeader {
+    uint32_t magic;
+    uint32_t counter;
+    uint32_t what; /* 0 for a QXL command, 1 for a device message, 2 for dropped commands */
+    uint32_t type; /* command or message type, number of commands dropped */
+    uint64_t timestamp;
+    uint32_t compression;
+    uint32_t size; /* size of the payload in the file */
+    uint32_t raw_size; /* size of the payload once decompressed */
+    uint32_t padding;
+} RecordBlockHeader;
+
+typedef struct RecordIndexEntry {
+    uint64_t offset; /* offset of the block from the start of the file */
+    uint32_t what;
+    uint32_t type;
+} RecordIndexEntry;
+
+typedef struct RecordIndexFooter {
+    uint64_t index_offset;
+    uint32_t num_entries;
+    uint32_t magic;
+} RecordIndexFooter;
+
 typedef struct RedRecord RedRecord;
 
 /**
@@ -44,7 +93,14 @@ void red_record_primary_surface_create(RedRecord *record,
 
 void red_record_event(RedRecord *record, int what, uint32_t type);
 
-void red_record_qxl_command(RedRecord *record, RedMemSlotInfo *slots,
+/**
+ * Records a command, the data it references are copied and written later
+ * by a separate thread.
+ * Returns false if the command was dropped as too much data is waiting to
+ * be written and SPICE_WORKER_RECORD_POLICY is "drop", otherwise the call
+ * waits for the data to be written.
+ */
+bool red_record_qxl_command(RedRecord *record, RedMemSlotInfo *slots,
                             QXLCommandExt ext_cmd);
 
 SPICE_END_DECLS
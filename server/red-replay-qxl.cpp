@@ -21,6 +21,13 @@
 #include <zlib.h>
 #include <pthread.h>
 #include <glib.h>
+#ifndef _WIN32
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+#ifdef USE_LZ4
+#include <lz4.h>
+#endif
 
 #include "reds.h"
 #include "red-qxl.h"
@@ -28,6 +35,7 @@
 #include "red-common.h"
 #include "memslot.h"
 #include "red-parse-qxl.h"
+#include "red-record-qxl.h"
 
 static inline QXLPHYSICAL QXLPHYSICAL_FROM_PTR(const void *ptr)
 {
@@ -47,6 +55,7 @@ enum replay_t {
 
 struct SpiceReplay {
     FILE *fd;
+    unsigned int version;
     gboolean error;
     int counter;
     bool created_primary;
@@ -62,10 +71,32 @@ struct SpiceReplay {
 
     pthread_mutex_t mutex;
     pthread_cond_t cond;
+
+    /* binary recordings, see RECORD_FORMAT_VERSION */
+    uint8_t *data;
+    size_t data_size;
+    bool data_mapped;
+    GArray *events; // RecordIndexEntry
+    GArray *commands; // position of the commands in events
+    unsigned int next_event;
+    int seek_primary_event; // primary surface to create after a seek, or -1
+    const uint8_t *pos;
+    const uint8_t *end;
+    uint8_t *block_buf;
+    size_t block_buf_size;
 };
 
 static ssize_t replay_fread(SpiceReplay *replay, uint8_t *buf, size_t size)
 {
+    if (replay->version >= RECORD_FORMAT_VERSION) {
+        if (replay->error || size > (size_t) (replay->end - replay->pos)) {
+            replay->error = TRUE;
+            return 0;
+        }
+        memcpy(buf, replay->pos, size);
+        replay->pos += size;
+        return size;
+    }
     if (replay->error || feof(replay->fd) ||
         fread(buf, 1, size, replay->fd) != size) {
         replay->error = TRUE;
@@ -74,6 +105,64 @@ static ssize_t replay_fread(SpiceReplay *replay, uint8_t *buf, size_t size)
     return size;
 }
 
+static uint64_t replay_read_uint(SpiceReplay *replay, size_t size)
+{
+    uint32_t value32;
+    uint64_t value64;
+
+    if (size == sizeof(value32)) {
+        replay_fread(replay, reinterpret_cast<uint8_t *>(&value32), sizeof(value32));
+        return replay->error ? 0 : GUINT32_FROM_LE(value32);
+    }
+    replay_fread(replay, reinterpret_cast<uint8_t *>(&value64), sizeof(value64));
+    return replay->error ? 0 : GUINT64_FROM_LE(value64);
+}
+
+/* Reads the fields of a binary recording described by the same format as
+ * the text ones, see record_printf() for the encoding */
+static replay_t replay_read_fields(SpiceReplay *replay, const char *fmt, va_list ap)
+{
+    while ((fmt = strchr(fmt, '%')) != nullptr) {
+        int longs = 0, shorts = 0;
+        uint64_t value;
+
+        fmt++;
+        while (*fmt == 'l' || *fmt == 'h') {
+            longs += *fmt == 'l';
+            shorts += *fmt == 'h';
+            fmt++;
+        }
+        switch (*fmt++) {
+        case '%':
+            break;
+        case 'n':
+            *va_arg(ap, int *) = 0;
+            break;
+        case 'd':
+        case 'i':
+        case 'u':
+            value = replay_read_uint(replay, longs ? sizeof(uint64_t) : sizeof(uint32_t));
+            if (longs > 1) {
+                *va_arg(ap, unsigned long long *) = value;
+            } else if (longs) {
+                *va_arg(ap, unsigned long *) = value;
+            } else if (shorts > 1) {
+                *va_arg(ap, unsigned char *) = value;
+            } else if (shorts) {
+                *va_arg(ap, unsigned short *) = value;
+            } else {
+                *va_arg(ap, unsigned int *) = value;
+            }
+            break;
+        default:
+            spice_warning("unsupported conversion in replay format");
+            replay->error = TRUE;
+            return REPLAY_ERROR;
+        }
+    }
+    return replay->error ? REPLAY_ERROR : REPLAY_OK;
+}
+
 #ifdef __USE_MINGW_ANSI_STDIO
 __attribute__((format(gnu_scanf, 2, 3)))
 #else
@@ -89,6 +178,12 @@ static replay_t replay_fscanf_check(SpiceReplay *replay, const char *fmt, ...)
     if (replay->error) {
         return REPLAY_ERROR;
     }
+    if (replay->version >= RECORD_FORMAT_VERSION) {
+        va_start(ap, fmt);
+        replay_read_fields(replay, fmt, ap);
+        va_end(ap);
+        return replay->error ? REPLAY_ERROR : REPLAY_OK;
+    }
     if (feof(replay->fd)) {
         replay->error = TRUE;
         return REPLAY_ERROR;
@@ -237,6 +332,19 @@ static replay_t read_binary(SpiceReplay *replay, const char *prefix, size_t *siz
     uint8_t *zlib_buffer;
     z_stream strm;
 
+    if (replay->version >= RECORD_FORMAT_VERSION) {
+        *size = replay_read_uint(replay, sizeof(uint64_t));
+        if (replay->error || *size > (size_t) (replay->end - replay->pos)) {
+            replay->error = TRUE;
+            return REPLAY_ERROR;
+        }
+        if (*buf == nullptr) {
+            *buf = static_cast<uint8_t *>(replay_malloc(replay, *size + base_size));
+        }
+        replay_fread(replay, *buf + base_size, *size);
+        return REPLAY_OK;
+    }
+
     snprintf(pattern, sizeof(pattern), "binary %%d %s %%" PRIdPTR ":%%n", prefix);
     replay_fscanf_check(replay, pattern, &with_zlib, size, &replay->end_pos);
     if (replay->error) {
@@ -302,12 +410,12 @@ static replay_t read_binary(SpiceReplay *replay, const char *prefix, size_t *siz
 static ssize_t red_replay_data_chunks(SpiceReplay *replay, const char *prefix,
                                       uint8_t **mem, size_t base_size)
 {
-    size_t data_size;
+    uint64_t data_size;
     unsigned int count_chunks;
     size_t next_data_size;
     QXLDataChunk *cur, *next;
 
-    replay_fscanf(replay, "data_chunks %u %" PRIuPTR "\n", &count_chunks, &data_size);
+    replay_fscanf(replay, "data_chunks %u %" SCNu64 "\n", &count_chunks, &data_size);
     if (replay->error) {
         return -1;
     }
@@ -1267,6 +1375,87 @@ static void red_replay_cursor_cmd_free(SpiceReplay *replay, QXLCursorCmd *qxl)
     g_free(qxl);
 }
 
+/* Gets the header of the block at offset, checking it fits in the recording */
+static bool replay_get_block_header(SpiceReplay *replay, uint64_t offset,
+                                    RecordBlockHeader *header)
+{
+    if (offset > replay->data_size || replay->data_size - offset < sizeof(*header)) {
+        return false;
+    }
+    memcpy(header, replay->data + offset, sizeof(*header));
+    header->magic = GUINT32_FROM_LE(header->magic);
+    header->counter = GUINT32_FROM_LE(header->counter);
+    header->what = GUINT32_FROM_LE(header->what);
+    header->type = GUINT32_FROM_LE(header->type);
+    header->timestamp = GUINT64_FROM_LE(header->timestamp);
+    header->compression = GUINT32_FROM_LE(header->compression);
+    header->size = GUINT32_FROM_LE(header->size);
+    header->raw_size = GUINT32_FROM_LE(header->raw_size);
+
+    return header->magic == RECORD_BLOCK_MAGIC &&
+           header->size <= replay->data_size - offset - sizeof(*header);
+}
+
+/* Reads the next event of a binary recording, its payload becomes the one
+ * the following fields are read from */
+static replay_t replay_read_block(SpiceReplay *replay, int *counter, int *what, int *type,
+                                  uint64_t *timestamp)
+{
+    RecordBlockHeader header;
+    const RecordIndexEntry *entry;
+    const uint8_t *payload;
+
+    if (replay->error || replay->next_event >= replay->events->len) {
+        replay->error = TRUE;
+        return REPLAY_ERROR;
+    }
+    entry = &g_array_index(replay->events, RecordIndexEntry, replay->next_event++);
+    if (!replay_get_block_header(replay, entry->offset, &header)) {
+        spice_warning("invalid block at offset %" G_GUINT64_FORMAT, entry->offset);
+        replay->error = TRUE;
+        return REPLAY_ERROR;
+    }
+    payload = replay->data + entry->offset + sizeof(header);
+
+    switch (header.compression) {
+    case RECORD_COMPRESSION_NONE:
+        if (header.size != header.raw_size) {
+            replay->error = TRUE;
+            return REPLAY_ERROR;
+        }
+        replay->pos = payload;
+        break;
+#ifdef USE_LZ4
+    case RECORD_COMPRESSION_LZ4:
+        if (replay->block_buf_size < header.raw_size) {
+            g_free(replay->block_buf);
+            replay->block_buf = static_cast<uint8_t *>(g_malloc(header.raw_size));
+            replay->block_buf_size = header.raw_size;
+        }
+        if (LZ4_decompress_safe(reinterpret_cast<const char *>(payload),
+                                reinterpret_cast<char *>(replay->block_buf),
+                                header.size, header.raw_size) != (int) header.raw_size) {
+            spice_warning("failed to decompress block %u", header.counter);
+            replay->error = TRUE;
+            return REPLAY_ERROR;
+        }
+        replay->pos = replay->block_buf;
+        break;
+#endif
+    default:
+        spice_warning("unsupported compression %u in recording", header.compression);
+        replay->error = TRUE;
+        return REPLAY_ERROR;
+    }
+    replay->end = replay->pos + header.raw_size;
+
+    *counter = header.counter;
+    *what = header.what;
+    *type = header.type;
+    *timestamp = header.timestamp;
+    return REPLAY_OK;
+}
+
 static void replay_handle_create_primary(QXLInstance *instance, SpiceReplay *replay)
 {
     QXLDevSurfaceCreate surface = { 0, };
@@ -1339,14 +1528,32 @@ SPICE_GNUC_VISIBLE QXLCommandExt* spice_replay_next_cmd(SpiceReplay *replay,
     int what = -1;
     int counter;
 
+    if (replay->seek_primary_event >= 0) {
+        unsigned int next_event = replay->next_event;
+
+        replay->next_event = replay->seek_primary_event;
+        replay->seek_primary_event = -1;
+        if (replay_read_block(replay, &counter, &what, &type, &timestamp) == REPLAY_OK) {
+            replay_handle_dev_input(instance, replay, type);
+        }
+        replay->next_event = next_event;
+        what = -1;
+    }
+
     while (what != 0) {
-        replay_fscanf(replay, "event %d %d %d %" SCNu64 "\n", &counter,
-                            &what, &type, &timestamp);
+        if (replay->version >= RECORD_FORMAT_VERSION) {
+            replay_read_block(replay, &counter, &what, &type, &timestamp);
+        } else {
+            replay_fscanf(replay, "event %d %d %d %" SCNu64 "\n", &counter,
+                          &what, &type, &timestamp);
+        }
         if (replay->error) {
             goto error;
         }
         if (what == 1) {
             replay_handle_dev_input(instance, replay, type);
+        } else if (what == 2) {
+            g_warning("%d: %d commands were dropped while recording", replay->counter, type);
         }
     }
     cmd = static_cast<QXLCommandExt *>(replay_malloc0(replay, sizeof(QXLCommandExt)));
@@ -1442,18 +1649,155 @@ SPICE_GNUC_VISIBLE void spice_replay_free_cmd(SpiceReplay *replay, QXLCommandExt
     g_free(cmd);
 }
 
+/* Maps the binary recording in memory, or reads it if the file cannot be
+ * mapped like a pipe, header being what was already read from it */
+static void replay_load_data(SpiceReplay *replay, const char *header)
+{
+    GByteArray *data;
+    uint8_t buf[64 * 1024];
+    size_t n;
+
+#ifndef _WIN32
+    struct stat st;
+    int fd = fileno(replay->fd);
+
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, st.st_size, MADV_SEQUENTIAL);
+            replay->data = static_cast<uint8_t *>(map);
+            replay->data_size = st.st_size;
+            replay->data_mapped = true;
+            return;
+        }
+    }
+#endif
+
+    data = g_byte_array_new();
+    g_byte_array_append(data, reinterpret_cast<const guint8 *>(header), strlen(header));
+    while ((n = fread(buf, 1, sizeof(buf), replay->fd)) > 0) {
+        g_byte_array_append(data, buf, n);
+    }
+    replay->data_size = data->len;
+    replay->data = g_byte_array_free(data, FALSE);
+    replay->data_mapped = false;
+}
+
+/* Loads the index of the events from the end of the recording, or builds it
+ * walking the blocks if the recording was interrupted */
+static void replay_load_index(SpiceReplay *replay, uint64_t offset)
+{
+    RecordIndexFooter footer;
+    RecordBlockHeader header;
+    bool indexed = false;
+    uint32_t i;
+
+    replay->events = g_array_new(FALSE, FALSE, sizeof(RecordIndexEntry));
+    replay->commands = g_array_new(FALSE, FALSE, sizeof(uint32_t));
+
+    if (replay->data_size >= offset + sizeof(footer)) {
+        uint64_t index_end = replay->data_size - sizeof(footer);
+        uint64_t index_offset;
+        uint32_t num_entries;
+
+        memcpy(&footer, replay->data + index_end, sizeof(footer));
+        index_offset = GUINT64_FROM_LE(footer.index_offset);
+        num_entries = GUINT32_FROM_LE(footer.num_entries);
+        if (GUINT32_FROM_LE(footer.magic) == RECORD_INDEX_MAGIC &&
+            index_offset >= offset && index_offset <= index_end &&
+            index_end - index_offset == (uint64_t) num_entries * sizeof(RecordIndexEntry)) {
+            g_array_set_size(replay->events, num_entries);
+            memcpy(replay->events->data, replay->data + index_offset,
+                   num_entries * sizeof(RecordIndexEntry));
+            indexed = true;
+        }
+    }
+
+    if (!indexed) {
+        while (replay_get_block_header(replay, offset, &header)) {
+            RecordIndexEntry entry = { offset, header.what, header.type };
+            g_array_append_val(replay->events, entry);
+            offset += sizeof(header) + header.size;
+        }
+        if (offset != replay->data_size) {
+            spice_warning("recording not terminated, %u events found", replay->events->len);
+        }
+    } else {
+        for (i = 0; i < replay->events->len; i++) {
+            auto entry = &g_array_index(replay->events, RecordIndexEntry, i);
+            entry->offset = GUINT64_FROM_LE(entry->offset);
+            entry->what = GUINT32_FROM_LE(entry->what);
+            entry->type = GUINT32_FROM_LE(entry->type);
+        }
+    }
+
+    for (i = 0; i < replay->events->len; i++) {
+        if (g_array_index(replay->events, RecordIndexEntry, i).what == 0) {
+            g_array_append_val(replay->commands, i);
+        }
+    }
+}
+
+SPICE_GNUC_VISIBLE int spice_replay_get_num_cmds(SpiceReplay *replay)
+{
+    spice_return_val_if_fail(replay != nullptr, -1);
+
+    if (replay->commands == nullptr) {
+        return -1;
+    }
+    return replay->commands->len;
+}
+
+/* The primary surface in use at the command is created again, the other
+ * surfaces created by the skipped commands are missing */
+SPICE_GNUC_VISIBLE int spice_replay_seek(SpiceReplay *replay, int cmd)
+{
+    unsigned int i;
+
+    spice_return_val_if_fail(replay != nullptr, -1);
+
+    if (replay->commands == nullptr || cmd < 0 || (unsigned) cmd >= replay->commands->len) {
+        return -1;
+    }
+    /* device messages recorded just before the command are replayed with it */
+    replay->next_event = cmd > 0 ? g_array_index(replay->commands, uint32_t, cmd - 1) + 1 : 0;
+
+    replay->seek_primary_event = -1;
+    for (i = replay->next_event; i-- > 0; ) {
+        auto entry = &g_array_index(replay->events, RecordIndexEntry, i);
+        if (entry->what != 1) {
+            continue;
+        }
+        if (entry->type == RED_WORKER_MESSAGE_CREATE_PRIMARY_SURFACE ||
+            entry->type == RED_WORKER_MESSAGE_CREATE_PRIMARY_SURFACE_ASYNC) {
+            replay->seek_primary_event = i;
+            break;
+        }
+        if (entry->type == RED_WORKER_MESSAGE_DESTROY_PRIMARY_SURFACE ||
+            entry->type == RED_WORKER_MESSAGE_DESTROY_SURFACES) {
+            break;
+        }
+    }
+    replay->counter = cmd;
+    replay->error = FALSE;
+    return 0;
+}
+
 /* caller is incharge of closing the replay when done and releasing the SpiceReplay
  * memory */
 SPICE_GNUC_VISIBLE
 SpiceReplay *spice_replay_new(FILE *file, int nsurfaces)
 {
+    char header[64];
     unsigned int version = 0;
     SpiceReplay *replay;
 
     spice_return_val_if_fail(file != nullptr, NULL);
 
-    if (fscanf(file, "SPICE_REPLAY %u\n", &version) == 1) {
-        if (version != 1) {
+    /* binary recordings follow the header, do not skip any byte after it */
+    if (fgets(header, sizeof(header), file) != nullptr &&
+        sscanf(header, "SPICE_REPLAY %u\n", &version) == 1) {
+        if (version != 1 && version != RECORD_FORMAT_VERSION) {
             spice_warning("Replay file version unsupported");
             return nullptr;
         }
@@ -1466,6 +1810,7 @@ SpiceReplay *spice_replay_new(FILE *file, int nsurfaces)
 
     replay->error = FALSE;
     replay->fd = file;
+    replay->version = version;
     replay->created_primary = FALSE;
     pthread_mutex_init(&replay->mutex, nullptr);
     pthread_cond_init(&replay->cond, nullptr);
@@ -1474,6 +1819,12 @@ SpiceReplay *spice_replay_new(FILE *file, int nsurfaces)
     replay->id_free = g_array_new(FALSE, FALSE, sizeof(uint32_t));
     replay->nsurfaces = nsurfaces;
     replay->allocated = nullptr;
+    replay->seek_primary_event = -1;
+
+    if (version >= RECORD_FORMAT_VERSION) {
+        replay_load_data(replay, header);
+        replay_load_index(replay, strlen(header));
+    }
 
     /* reserve id 0 */
     replay_id_new(replay, 0);
@@ -1492,6 +1843,18 @@ SPICE_GNUC_VISIBLE void spice_replay_free(SpiceReplay *replay)
     g_array_free(replay->id_map_inv, TRUE);
     g_array_free(replay->id_free, TRUE);
     g_free(replay->primary_mem);
+    if (replay->events) {
+        g_array_free(replay->events, TRUE);
+        g_array_free(replay->commands, TRUE);
+    }
+    g_free(replay->block_buf);
+#ifndef _WIN32
+    if (replay->data_mapped) {
+        munmap(replay->data, replay->data_size);
+        replay->data = nullptr;
+    }
+#endif
+    g_free(replay->data);
     fclose(replay->fd);
     g_free(replay);
 }
@@ -25,11 +25,16 @@
 #include "stream-channel.h"
 #include "cursor-channel.h"
 #include "reds.h"
+#include "utils.h"
 
 static void char_device_set_state(RedCharDevice *char_dev, int state);
 
 RECORDER(stream_device_data, 32, "Stream device data packet");
 
+/* how long to wait before reading again when a client is over its
+ * memory budget */
+#define MEMORY_BUDGET_RETRY_NS (20 * NSEC_PER_MILLISEC)
+
 void
 StreamDevice::close_timer_func(StreamDevice *dev)
 {
@@ -38,6 +43,12 @@ StreamDevice::close_timer_func(StreamDevice *dev)
     }
 }
 
+void
+StreamDevice::pace_timer_func(StreamDevice *dev)
+{
+    dev->wakeup();
+}
+
 static void
 fill_dev_hdr(StreamDevHeader *hdr, StreamMsgType msg_type, uint32_t msg_size)
 {
@@ -319,28 +330,26 @@ StreamDevice::handle_msg_data()
     spice_extra_assert(hdr_pos >= sizeof(StreamDevHeader));
     spice_extra_assert(hdr.type == STREAM_TYPE_DATA);
 
-    /* make sure we have a large enough buffer for the whole frame */
-    /* ---
-     * TODO: Now that we copy partial data into the buffer, for each frame
-     * the buffer is allocated and freed (look for g_realloc in
-     * partial_read).
-     * Probably better to just keep the larger buffer.
-     */
-    if (msg_pos == 0) {
+    /* the frame is read directly in the pipe item sent to the clients */
+    if (!data_item) {
+        if (!pace_frame()) {
+            return false;
+        }
         frame_mmtime = reds_get_mm_time();
         record(stream_device_data, "Stream data packet size %u mm_time %u",
                hdr.size, frame_mmtime);
-        if (msg_len < hdr.size) {
-            g_free(msg);
-            msg = static_cast<StreamDevice::AllMessages *>(g_malloc(hdr.size));
-            msg_len = hdr.size;
-        }
+        data_item = stream_channel->new_data_item(hdr.size, &data_buf);
     }
 
     /* read from device */
-    n = read(msg->buf + msg_pos, hdr.size - msg_pos);
+    n = read(data_buf + msg_pos, hdr.size - msg_pos);
     if (n <= 0) {
-        return msg_pos == hdr.size;
+        if (msg_pos != hdr.size) {
+            return false;
+        }
+        /* empty frame, nothing to send */
+        data_item.reset();
+        return true;
     }
 
     msg_pos += n;
@@ -349,8 +358,42 @@ StreamDevice::handle_msg_data()
     }
 
     /* The whole frame was read from the device, send it */
-    stream_channel->send_data(msg->buf, hdr.size, frame_mmtime);
+    stream_channel->send_data(std::move(data_item), frame_mmtime);
+    data_buf = nullptr;
+
+    return true;
+}
+
+/*
+ * Delays the next frame if the clients cannot receive frames at the rate
+ * the guest produces them or if a client queued more data than its memory
+ * budget allows. Not reading from the device blocks the guest agent, which
+ * is the only feedback the stream device protocol allows.
+ * Returns false if the frame has to wait.
+ */
+bool
+StreamDevice::pace_frame()
+{
+    const uint64_t now = spice_get_monotonic_time_ns();
+    uint64_t delay = 0;
+
+    if (stream_channel && stream_channel->is_over_memory_budget()) {
+        /* wait for the clients to drain their queues */
+        delay = MEMORY_BUDGET_RETRY_NS;
+    } else if (!frame_interval) {
+        return true;
+    } else if (now < next_frame_time) {
+        delay = next_frame_time - now;
+    }
 
+    if (delay) {
+        if (!pace_timer) {
+            pace_timer = reds_core_timer_add(get_server(), pace_timer_func, this);
+        }
+        red_timer_start(pace_timer, delay / NSEC_PER_MILLISEC + 1);
+        return false;
+    }
+    next_frame_time = now + frame_interval;
     return true;
 }
 
@@ -515,7 +558,7 @@ StreamDevice::stream_start(void *opaque, StreamMsgStartStop *start,
 }
 
 void
-StreamDevice::stream_queue_stat(void *opaque, const StreamQueueStat *stats G_GNUC_UNUSED,
+StreamDevice::stream_queue_stat(void *opaque, const StreamQueueStat *stats,
                                 StreamChannel *stream_channel G_GNUC_UNUSED)
 {
     auto dev = static_cast<StreamDevice *>(opaque);
@@ -524,6 +567,8 @@ StreamDevice::stream_queue_stat(void *opaque, const StreamQueueStat *stats G_GNU
         return;
     }
 
+    dev->frame_interval = stats->target_fps ? NSEC_PER_SEC / stats->target_fps : 0;
+
     // very easy control flow... if any data stop
     // this seems a very small queue but as we use tcp
     // there's already that queue
@@ -566,6 +611,7 @@ StreamDevice::StreamDevice(RedsState *reds, SpiceCharDeviceInstance *sin):
 StreamDevice::~StreamDevice()
 {
     red_timer_remove(close_timer);
+    red_timer_remove(pace_timer);
 
     if (stream_channel) {
         // close all current connections
@@ -655,6 +701,13 @@ StreamDevice::port_event(uint8_t event)
     }
     hdr_pos = 0;
     msg_pos = 0;
+    data_item.reset();
+    data_buf = nullptr;
+    frame_interval = 0;
+    next_frame_time = 0;
+    if (pace_timer) {
+        red_timer_cancel(pace_timer);
+    }
     has_error = false;
     flow_stopped = false;
     reset();
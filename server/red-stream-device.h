@@ -86,7 +86,15 @@ private:
     red::shared_ptr<StreamChannel> stream_channel;
     red::shared_ptr<CursorChannel> cursor_channel;
     SpiceTimer *close_timer;
+    /* paces the frames to the rate the clients can receive,
+     * see stream_queue_stat() */
+    SpiceTimer *pace_timer;
+    uint64_t frame_interval;
+    uint64_t next_frame_time;
     uint32_t frame_mmtime;
+    /* frame being read from the device, see handle_msg_data() */
+    RedPipeItemPtr data_item;
+    uint8_t *data_buf;
     StreamDeviceDisplayInfo device_display_info;
 
 private:
@@ -101,9 +109,11 @@ private:
     bool handle_msg_cursor_move() SPICE_GNUC_WARN_UNUSED_RESULT;
     bool handle_msg_cursor_set() SPICE_GNUC_WARN_UNUSED_RESULT;
     bool handle_msg_data() SPICE_GNUC_WARN_UNUSED_RESULT;
+    bool pace_frame();
     bool handle_msg_device_display_info() SPICE_GNUC_WARN_UNUSED_RESULT;
     void reset_channels();
     static void close_timer_func(StreamDevice *dev);
+    static void pace_timer_func(StreamDevice *dev);
     static void stream_start(void *opaque, StreamMsgStartStop *start,
                              StreamChannel *stream_channel);
     static void stream_queue_stat(void *opaque, const StreamQueueStat *stats,
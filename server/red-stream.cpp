@@ -97,6 +97,8 @@ struct RedStreamPrivate {
     SpiceChannelEventInfo* info;
     bool use_cork;
     bool corked;
+    /* bytes written to the socket, see red_stream_get_sent_bytes() */
+    uint64_t sent_bytes;
 
     ssize_t (*read)(RedStream *s, void *buf, size_t nbyte);
     ssize_t (*write)(RedStream *s, const void *buf, size_t nbyte);
@@ -123,9 +125,17 @@ static inline int socket_set_cork(int socket, int enabled)
 }
 #endif
 
+static inline ssize_t stream_account_sent(RedStream *s, ssize_t n)
+{
+    if (n > 0) {
+        s->priv->sent_bytes += n;
+    }
+    return n;
+}
+
 static ssize_t stream_write_cb(RedStream *s, const void *buf, size_t size)
 {
-    return socket_write(s->socket, buf, size);
+    return stream_account_sent(s, socket_write(s->socket, buf, size));
 }
 
 static ssize_t stream_writev_cb(RedStream *s, const struct iovec *iov, int iovcnt)
@@ -143,7 +153,7 @@ static ssize_t stream_writev_cb(RedStream *s, const struct iovec *iov, int iovcn
         for (i = 0; i < tosend; i++) {
             expected += iov[i].iov_len;
         }
-        n = socket_writev(s->socket, iov, tosend);
+        n = stream_account_sent(s, socket_writev(s->socket, iov, tosend));
         if (n <= expected) {
             if (n > 0)
                 ret += n;
@@ -195,7 +205,7 @@ static ssize_t stream_ssl_write_cb(RedStream *s, const void *buf, size_t size)
         return stream_ssl_error(s, return_code);
     }
 
-    return return_code;
+    return stream_account_sent(s, return_code);
 }
 
 static ssize_t stream_ssl_read_cb(RedStream *s, void *buf, size_t size)
@@ -259,10 +269,18 @@ bool red_stream_set_auto_flush(RedStream *s, bool auto_flush)
         return true;
     }
 
+    /* websocket frames are merged till the stream is flushed */
+    if (s->priv->ws) {
+        websocket_set_coalesce(s->priv->ws, !auto_flush);
+    }
+
     s->priv->use_cork = !auto_flush;
     if (s->priv->use_cork) {
         if (socket_set_cork(s->socket, 1)) {
             s->priv->use_cork = false;
+            if (s->priv->ws) {
+                websocket_set_coalesce(s->priv->ws, false);
+            }
             return false;
         }
         s->priv->corked = true;
@@ -273,12 +291,18 @@ bool red_stream_set_auto_flush(RedStream *s, bool auto_flush)
     return true;
 }
 
-void red_stream_flush(RedStream *s)
+bool red_stream_flush(RedStream *s)
 {
+    bool flushed = true;
+
+    if (s->priv->ws && websocket_flush(s->priv->ws) < 0 && errno == EAGAIN) {
+        flushed = false;
+    }
     if (s->priv->corked) {
         socket_set_cork(s->socket, 0);
         socket_set_cork(s->socket, 1);
     }
+    return flushed;
 }
 
 #if HAVE_SASL
@@ -347,6 +371,30 @@ int red_stream_get_no_delay(RedStream *stream)
     return red_socket_get_no_delay(stream->socket);
 }
 
+/**
+ * red_stream_get_tcp_info:
+ * @stream: a #RedStream
+ *
+ * See red_socket_get_tcp_info()
+ */
+bool red_stream_get_tcp_info(RedStream *stream, uint64_t *rtt_ns, uint64_t *delivery_rate)
+{
+    return red_socket_get_tcp_info(stream->socket, rtt_ns, delivery_rate);
+}
+
+/**
+ * red_stream_get_sent_bytes:
+ * @stream: a #RedStream
+ *
+ * Returns the number of bytes written to the socket. Unlike the values
+ * returned by red_stream_write(), data buffered by the stream, for
+ * instance by the websocket layer, is counted only once written.
+ */
+uint64_t red_stream_get_sent_bytes(const RedStream *stream)
+{
+    return stream->priv->sent_bytes;
+}
+
 #ifndef _WIN32
 int red_stream_send_msgfd(RedStream *stream, int fd)
 {
@@ -69,6 +69,8 @@ int red_stream_get_family(const RedStream *stream);
 bool red_stream_is_plain_unix(const RedStream *stream);
 bool red_stream_set_no_delay(RedStream *stream, bool no_delay);
 int red_stream_get_no_delay(RedStream *stream);
+bool red_stream_get_tcp_info(RedStream *stream, uint64_t *rtt_ns, uint64_t *delivery_rate);
+uint64_t red_stream_get_sent_bytes(const RedStream *stream);
 #ifndef _WIN32
 int red_stream_send_msgfd(RedStream *stream, int fd);
 #endif
@@ -90,8 +92,11 @@ bool red_stream_set_auto_flush(RedStream *stream, bool auto_flush);
  * Flush data to the underlying socket.
  * Calling this function on a stream with auto flush set has
  * no result.
+ *
+ * Returns false if some data is still pending as the socket would
+ * block, flush again when the socket is writable.
  */
-void red_stream_flush(RedStream *stream);
+bool red_stream_flush(RedStream *stream);
 
 bool red_stream_is_websocket(RedStream *stream, const void *buf, size_t len);
 
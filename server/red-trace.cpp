@@ -0,0 +1,308 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include <config.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include <common/log.h>
+
+#include "red-trace.h"
+#include "utils.h"
+
+struct RedTraceEvent {
+    uint64_t time;
+    uint64_t id;
+    uint32_t stage;
+    uint32_t arg;
+};
+
+struct RedTraceRing {
+    RedTraceRing *next;
+    uint32_t thread;
+    /* total number of events written, only the writer thread updates it */
+    std::atomic<uint64_t> head;
+    RedTraceEvent events[RED_TRACE_RING_SIZE];
+};
+
+static_assert((RED_TRACE_RING_SIZE & (RED_TRACE_RING_SIZE - 1)) == 0,
+              "RED_TRACE_RING_SIZE must be a power of 2");
+
+static const char *const stage_names[] = {
+    "process_cmd",
+    "current_add",
+    "pipes_add",
+    "send_item",
+    "msg_sent",
+};
+
+static_assert(G_N_ELEMENTS(stage_names) == RED_TRACE_NUM_STAGES,
+              "missing stage names");
+
+bool red_trace_enabled = false;
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool trace_initialized;
+static char *trace_filename;
+static RedTraceRing *trace_rings;
+static uint32_t trace_num_rings;
+static int trace_signal_pipe[2] = { -1, -1 };
+
+static thread_local RedTraceRing *thread_ring;
+static std::atomic<uint64_t> trace_next_id{1};
+
+#ifndef _WIN32
+static void trace_signal_handler(int)
+{
+    int saved_errno = errno;
+    char c = 0;
+
+    // only async-signal-safe calls here, the dump is done by the main loop
+    if (write(trace_signal_pipe[1], &c, 1) < 0) {
+        // pipe already full, a dump is pending
+    }
+    errno = saved_errno;
+}
+
+static void trace_signal_init(const char *signal_str)
+{
+    char *end;
+    long signum = strtol(signal_str, &end, 10);
+    struct sigaction sa;
+
+    if (*end != '\0' || signum <= 0 || signum >= NSIG) {
+        spice_warning("invalid SPICE_TRACE_SIGNAL value %s", signal_str);
+        return;
+    }
+    if (pipe(trace_signal_pipe) < 0) {
+        spice_warning("failed to create trace signal pipe: %s", strerror(errno));
+        return;
+    }
+    for (int fd : trace_signal_pipe) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = trace_signal_handler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(signum, &sa, nullptr) < 0) {
+        spice_warning("failed to install trace signal handler: %s", strerror(errno));
+    }
+}
+#endif
+
+bool red_trace_init(void)
+{
+    pthread_mutex_lock(&trace_lock);
+    if (!trace_initialized) {
+        trace_initialized = true;
+
+        const char *filename = getenv("SPICE_TRACE_FILENAME");
+        if (filename && *filename) {
+            trace_filename = g_strdup(filename);
+            red_trace_enabled = true;
+#ifndef _WIN32
+            const char *signal_str = getenv("SPICE_TRACE_SIGNAL");
+            if (signal_str) {
+                trace_signal_init(signal_str);
+            }
+#endif
+        }
+    }
+    pthread_mutex_unlock(&trace_lock);
+
+    return red_trace_enabled;
+}
+
+static RedTraceRing *red_trace_ring_new(void)
+{
+    auto ring = new RedTraceRing();
+
+    pthread_mutex_lock(&trace_lock);
+    ring->thread = ++trace_num_rings;
+    ring->next = trace_rings;
+    trace_rings = ring;
+    pthread_mutex_unlock(&trace_lock);
+
+    return ring;
+}
+
+void red_trace_event_internal(RedTraceStage stage, uint64_t id, uint32_t arg)
+{
+    RedTraceRing *ring = thread_ring;
+
+    // rings are never freed so events of exited threads can still be dumped
+    if (G_UNLIKELY(ring == nullptr)) {
+        ring = thread_ring = red_trace_ring_new();
+    }
+
+    uint64_t pos = ring->head.load(std::memory_order_relaxed);
+    RedTraceEvent *event = &ring->events[pos % RED_TRACE_RING_SIZE];
+    event->time = spice_get_monotonic_time_ns();
+    event->id = id;
+    event->stage = stage;
+    event->arg = arg;
+    ring->head.store(pos + 1, std::memory_order_release);
+}
+
+uint64_t red_trace_new_id_internal(void)
+{
+    return trace_next_id.fetch_add(1, std::memory_order_relaxed);
+}
+
+struct DumpEvent {
+    RedTraceEvent event;
+    uint32_t thread;
+};
+
+static void red_trace_collect(std::vector<DumpEvent> &events)
+{
+    pthread_mutex_lock(&trace_lock);
+    for (RedTraceRing *ring = trace_rings; ring; ring = ring->next) {
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t start = head > RED_TRACE_RING_SIZE ? head - RED_TRACE_RING_SIZE : 0;
+        size_t first = events.size();
+
+        for (uint64_t pos = start; pos < head; pos++) {
+            events.push_back({ring->events[pos % RED_TRACE_RING_SIZE], ring->thread});
+        }
+
+        // drop the events the writer overwrote while we were copying,
+        // the writer can also be writing position new_head which
+        // overwrites position new_head - RED_TRACE_RING_SIZE
+        uint64_t new_head = ring->head.load(std::memory_order_acquire);
+        if (new_head + 1 > start + RED_TRACE_RING_SIZE) {
+            uint64_t overwritten = std::min(new_head + 1 - RED_TRACE_RING_SIZE - start,
+                                            head - start);
+            events.erase(events.begin() + first, events.begin() + first + overwritten);
+        }
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
+
+static void append_event(GString *out, const char *name, const char *phase,
+                         const DumpEvent &ev, uint64_t base_time, int pid)
+{
+    uint64_t time = ev.event.time - base_time;
+
+    if (out->len && out->str[out->len - 1] == '}') {
+        g_string_append(out, ",\n");
+    }
+    g_string_append_printf(out,
+                           "{\"name\":\"%s\",\"cat\":\"spice\",\"ph\":\"%s\","
+                           "\"ts\":%" PRIu64 ".%03u,\"pid\":%d,\"tid\":%u",
+                           name, phase, time / 1000, (unsigned) (time % 1000),
+                           pid, ev.thread);
+    if (ev.event.id) {
+        g_string_append_printf(out, ",\"id\":\"0x%" PRIx64 "\"", ev.event.id);
+    }
+    if (phase[0] == 'i') {
+        g_string_append(out, ",\"s\":\"t\"");
+    }
+    if (phase[0] != 'b' && phase[0] != 'e') {
+        g_string_append_printf(out, ",\"args\":{\"arg\":%u}", ev.event.arg);
+    }
+    g_string_append_c(out, '}');
+}
+
+bool red_trace_dump(const char *filename)
+{
+    std::vector<DumpEvent> events;
+    GError *error = nullptr;
+    int pid = getpid();
+
+    red_trace_collect(events);
+
+    // group the events of the same item, each item becomes an async slice
+    // going from its first to its last event
+    std::stable_sort(events.begin(), events.end(),
+                     [](const DumpEvent &a, const DumpEvent &b) {
+                         if (a.event.id != b.event.id) {
+                             return a.event.id < b.event.id;
+                         }
+                         return a.event.time < b.event.time;
+                     });
+
+    uint64_t base_time = UINT64_MAX;
+    for (const auto &ev : events) {
+        base_time = std::min(base_time, ev.event.time);
+    }
+
+    GString *out = g_string_new("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    for (size_t i = 0; i < events.size(); i++) {
+        const DumpEvent &ev = events[i];
+        const char *name = ev.event.stage < RED_TRACE_NUM_STAGES ?
+                           stage_names[ev.event.stage] : "unknown";
+
+        if (ev.event.id == 0) {
+            append_event(out, name, "i", ev, base_time, pid);
+            continue;
+        }
+        bool first = i == 0 || events[i - 1].event.id != ev.event.id;
+        bool last = i + 1 == events.size() || events[i + 1].event.id != ev.event.id;
+        if (first) {
+            append_event(out, "item", "b", ev, base_time, pid);
+        }
+        append_event(out, name, "n", ev, base_time, pid);
+        if (last) {
+            append_event(out, "item", "e", ev, base_time, pid);
+        }
+    }
+    g_string_append(out, "\n]}\n");
+
+    bool ret = g_file_set_contents(filename, out->str, out->len, &error);
+    if (!ret) {
+        spice_warning("failed to write trace to %s: %s", filename, error->message);
+        g_clear_error(&error);
+    }
+    g_string_free(out, TRUE);
+    return ret;
+}
+
+void red_trace_dump_default(void)
+{
+    if (trace_filename) {
+        red_trace_dump(trace_filename);
+    }
+}
+
+int red_trace_get_signal_fd(void)
+{
+    return trace_signal_pipe[0];
+}
+
+void red_trace_handle_signal(void)
+{
+    char buf[16];
+
+    while (read(trace_signal_pipe[0], buf, sizeof(buf)) > 0) {
+        continue;
+    }
+    red_trace_dump_default();
+}
@@ -0,0 +1,102 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * Lifecycle tracing of the items going through the display pipeline.
+ *
+ * Each thread records events in its own ring buffer so recording does
+ * not take any lock, older events are overwritten when the ring is full.
+ * Events are linked by an id given by red_trace_new_id(), a drawable gets
+ * its id when its QXL command is parsed so it can be followed from the
+ * command to the message sent.
+ *
+ * Tracing is enabled by setting SPICE_TRACE_FILENAME. The rings are written
+ * to this file in Chrome trace format (which Perfetto can load too) when the
+ * server is destroyed and, if SPICE_TRACE_SIGNAL is set to a signal number,
+ * every time the process receives that signal.
+ */
+#ifndef RED_TRACE_H_
+#define RED_TRACE_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <glib.h>
+#include <spice/macros.h>
+
+SPICE_BEGIN_DECLS
+
+typedef enum {
+    RED_TRACE_PROCESS_CMD,
+    RED_TRACE_CURRENT_ADD,
+    RED_TRACE_PIPES_ADD,
+    RED_TRACE_SEND_ITEM,
+    RED_TRACE_MSG_SENT,
+
+    RED_TRACE_NUM_STAGES
+} RedTraceStage;
+
+/* number of events kept for each thread, must be a power of 2 */
+#define RED_TRACE_RING_SIZE 16384
+
+extern bool red_trace_enabled;
+
+/**
+ * Reads the configuration from the environment, can be called multiple times.
+ * Returns whether tracing is enabled.
+ */
+bool red_trace_init(void);
+
+void red_trace_event_internal(RedTraceStage stage, uint64_t id, uint32_t arg);
+
+static inline void red_trace_event(RedTraceStage stage, uint64_t id, uint32_t arg)
+{
+    if (G_UNLIKELY(red_trace_enabled)) {
+        red_trace_event_internal(stage, id, arg);
+    }
+}
+
+uint64_t red_trace_new_id_internal(void);
+
+/* Returns an id never returned before, 0 (no id) if tracing is disabled */
+static inline uint64_t red_trace_new_id(void)
+{
+    if (G_UNLIKELY(red_trace_enabled)) {
+        return red_trace_new_id_internal();
+    }
+    return 0;
+}
+
+/**
+ * Writes the events currently in the rings to the file.
+ * Events can be recorded by other threads while dumping.
+ */
+bool red_trace_dump(const char *filename);
+
+/* Writes the events to the file set in SPICE_TRACE_FILENAME, if any */
+void red_trace_dump_default(void);
+
+/**
+ * File descriptor readable when the dump signal was received,
+ * -1 if no signal was configured.
+ * red_trace_handle_signal() should be called when it becomes readable.
+ */
+int red_trace_get_signal_fd(void);
+void red_trace_handle_signal(void);
+
+SPICE_END_DECLS
+
+#endif /* RED_TRACE_H_ */
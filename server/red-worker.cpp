@@ -47,6 +47,8 @@
 #include "cursor-channel.h"
 #include "tree.h"
 #include "red-record-qxl.h"
+#include "red-trace.h"
+#include "phase-profile.h"
 
 // compatibility for FreeBSD
 #ifdef HAVE_PTHREAD_NP_H
@@ -82,6 +84,9 @@ struct RedWorker {
     RedStatCounter command_counter;
     RedStatCounter full_loop_counter;
     RedStatCounter total_loop_counter;
+    RedStatCounter record_dropped_counter;
+    RedStatHistogram command_time_histogram;
+    PhaseProfile profile;
 
     bool driver_cap_monitors_config;
 
@@ -114,7 +119,10 @@ static int red_process_cursor(RedWorker *worker, int *ring_is_empty)
 
     *ring_is_empty = FALSE;
     while (worker->cursor_channel->max_pipe_size() <= MAX_PIPE_SIZE) {
-        if (!red_qxl_get_cursor_command(worker->qxl, &ext_cmd)) {
+        ProfilePhase previous_phase = PhaseProfile::enter(PROFILE_PHASE_FETCH);
+        bool has_command = red_qxl_get_cursor_command(worker->qxl, &ext_cmd);
+        PhaseProfile::leave(previous_phase);
+        if (!has_command) {
             *ring_is_empty = TRUE;
             if (worker->cursor_poll_tries < CMD_RING_POLL_RETRIES) {
                 worker->event_timeout = MIN(worker->event_timeout, CMD_RING_POLL_TIMEOUT);
@@ -126,11 +134,13 @@ static int red_process_cursor(RedWorker *worker, int *ring_is_empty)
             return n;
         }
 
-        if (worker->record) {
-            red_record_qxl_command(worker->record, &worker->mem_slots, ext_cmd);
+        if (worker->record &&
+            !red_record_qxl_command(worker->record, &worker->mem_slots, ext_cmd)) {
+            stat_inc_counter(worker->record_dropped_counter, 1);
         }
 
         worker->cursor_poll_tries = 0;
+        previous_phase = PhaseProfile::enter(PROFILE_PHASE_PROCESS);
         switch (ext_cmd.cmd.type) {
         case QXL_CMD_CURSOR:
             red_process_cursor_cmd(worker, &ext_cmd);
@@ -138,6 +148,7 @@ static int red_process_cursor(RedWorker *worker, int *ring_is_empty)
         default:
             spice_warning("bad command type");
         }
+        PhaseProfile::leave(previous_phase);
         n++;
     }
     worker->was_blocked = TRUE;
@@ -172,7 +183,10 @@ static int red_process_display(RedWorker *worker, int *ring_is_empty)
     worker->process_display_generation++;
     *ring_is_empty = FALSE;
     while (worker->display_channel->max_pipe_size() <= MAX_PIPE_SIZE) {
-        if (!red_qxl_get_command(worker->qxl, &ext_cmd)) {
+        ProfilePhase previous_phase = PhaseProfile::enter(PROFILE_PHASE_FETCH);
+        bool has_command = red_qxl_get_command(worker->qxl, &ext_cmd);
+        PhaseProfile::leave(previous_phase);
+        if (!has_command) {
             *ring_is_empty = TRUE;
             if (worker->display_poll_tries < CMD_RING_POLL_RETRIES) {
                 worker->event_timeout = MIN(worker->event_timeout, CMD_RING_POLL_TIMEOUT);
@@ -184,12 +198,15 @@ static int red_process_display(RedWorker *worker, int *ring_is_empty)
             return n;
         }
 
-        if (worker->record) {
-            red_record_qxl_command(worker->record, &worker->mem_slots, ext_cmd);
+        if (worker->record &&
+            !red_record_qxl_command(worker->record, &worker->mem_slots, ext_cmd)) {
+            stat_inc_counter(worker->record_dropped_counter, 1);
         }
 
         stat_inc_counter(worker->command_counter, 1);
+        stat_time_t command_start = stat_histogram_time();
         worker->display_poll_tries = 0;
+        previous_phase = PhaseProfile::enter(PROFILE_PHASE_PROCESS);
         switch (ext_cmd.cmd.type) {
         case QXL_CMD_DRAW: {
             auto red_drawable = red_drawable_new(worker->qxl, &worker->mem_slots,
@@ -197,6 +214,8 @@ static int red_process_display(RedWorker *worker, int *ring_is_empty)
                                                  ext_cmd.flags); // returns with 1 ref
 
             if (red_drawable) {
+                red_trace_event(RED_TRACE_PROCESS_CMD, red_drawable->trace_id,
+                                ext_cmd.cmd.type);
                 display_channel_process_draw(worker->display_channel, std::move(red_drawable),
                                              worker->process_display_generation);
             }
@@ -234,6 +253,8 @@ static int red_process_display(RedWorker *worker, int *ring_is_empty)
         default:
             spice_error("bad command type");
         }
+        PhaseProfile::leave(previous_phase);
+        stat_histogram_add_since(&worker->command_time_histogram, command_start);
         n++;
         if (worker->display_channel->all_blocked()
             || spice_get_monotonic_time_ns() - start > NSEC_PER_SEC / 100) {
@@ -965,6 +986,9 @@ RedWorker* red_worker_new(QXLInstance *qxl)
     stat_init_counter(&worker->command_counter, reds, &worker->stat, "commands", TRUE);
     stat_init_counter(&worker->full_loop_counter, reds, &worker->stat, "full_loops", TRUE);
     stat_init_counter(&worker->total_loop_counter, reds, &worker->stat, "total_loops", TRUE);
+    stat_init_counter(&worker->record_dropped_counter, reds, &worker->stat, "record_dropped", TRUE);
+    stat_init_histogram(&worker->command_time_histogram, reds, &worker->stat, "command_time", TRUE);
+    worker->profile.init(reds, &worker->stat, &worker->core);
 
     worker->dispatch_watch = dispatcher->create_watch(&worker->core);
     spice_assert(worker->dispatch_watch != nullptr);
@@ -1015,6 +1039,7 @@ static void *red_worker_main(void *arg)
 
     worker->cursor_channel->reset_thread_id();
     worker->display_channel->reset_thread_id();
+    worker->profile.start();
 
     GMainLoop *loop = g_main_loop_new(worker->core.main_context, FALSE);
     worker->loop = loop;
@@ -1079,6 +1104,7 @@ void red_worker_free(RedWorker *worker)
     if (worker->dispatch_watch) {
         red_watch_remove(worker->dispatch_watch);
     }
+    worker->profile.destroy();
 
     g_main_context_unref(worker->core.main_context);
 
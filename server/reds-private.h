@@ -143,6 +143,7 @@ struct RedsState {
     red::safe_list<QXLInstance*> qxl_instances; // XXX owning
     red::shared_ptr<MainDispatcher> main_dispatcher;
     RedRecord *record;
+    SpiceWatch *trace_watch;
 };
 
 #endif /* REDS_PRIVATE_H_ */
@@ -81,9 +81,11 @@
 #include "main-channel-client.h"
 #include "red-client.h"
 #include "net-utils.h"
+#include "red-trace.h"
 #include "red-stream-device.h"
 
-#define REDS_MAX_STAT_NODES 100
+/* each histogram uses STAT_HISTOGRAM_NUM_BUCKETS + 3 nodes */
+#define REDS_MAX_STAT_NODES 4096
 
 static void reds_client_monitors_config(RedsState *reds, VDAgentMonitorsConfig *monitors_config);
 static gboolean reds_use_client_monitors_config(RedsState *reds);
@@ -95,6 +97,9 @@ static void reds_set_video_codecs(RedsState *reds, GArray *video_codecs);
 
 #define REDS_TOKENS_TO_SEND 5
 #define REDS_VDI_PORT_NUM_RECEIVE_BUFFS 5
+#define REDS_VDI_PORT_MAX_RECEIVE_BUFFS 128
+/* environment variable to force the number of agent read buffers */
+#define REDS_VDI_PORT_RECEIVE_BUFFS_ENV "SPICE_AGENT_READ_BUFFERS"
 
 /* TODO while we can technically create more than one server in a process,
  * the intended use is to support a single server per process */
@@ -184,6 +189,7 @@ struct RedCharDeviceVDIPortPrivate {
 
     /* read from agent */
     uint32_t num_read_buf;
+    uint32_t forced_max_read_buf; /* 0 to compute it from the link */
     VDIPortReadStates read_state;
     uint32_t message_receive_len;
     uint8_t *receive_pos;
@@ -313,6 +319,20 @@ void stat_remove_counter(SpiceServer *reds, RedStatCounter *counter)
     }
 }
 
+void stat_init_histogram(RedStatHistogram *histogram, SpiceServer *reds,
+                         const RedStatNode *parent, const char *name, int visible)
+{
+    StatNodeRef parent_ref = parent ? parent->ref : INVALID_STAT_REF;
+    histogram->ref = stat_file_add_histogram(reds->stat_file, parent_ref, name, visible,
+                                             &histogram->values);
+}
+
+void stat_remove_histogram(SpiceServer *reds, RedStatHistogram *histogram)
+{
+    stat_file_remove_histogram(reds->stat_file, histogram->ref, &histogram->values);
+    histogram->ref = INVALID_STAT_REF;
+}
+
 #endif
 
 void reds_register_channel(RedsState *reds, RedChannel *channel)
@@ -690,9 +710,32 @@ static red::shared_ptr<RedVDIReadBuf> vdi_read_buf_new(RedCharDeviceVDIPort *dev
     return buf;
 }
 
+/* Returns how many chunks read from the agent can be queued for the client.
+ * Each chunk waits for the client to receive it, so enough chunks are allowed
+ * to fill the link during a roundtrip, otherwise large transfers like
+ * clipboard or files are limited by the latency */
+static uint32_t vdi_port_get_max_read_buf(RedCharDeviceVDIPort *dev)
+{
+    RedsState *reds = dev->get_server();
+    uint64_t num = REDS_VDI_PORT_NUM_RECEIVE_BUFFS;
+
+    if (dev->priv->forced_max_read_buf) {
+        return dev->priv->forced_max_read_buf;
+    }
+    if (!reds->clients.empty()) {
+        MainChannelClient *mcc = reds->clients.front()->get_main();
+        if (mcc && mcc->is_network_info_initialized()) {
+            uint64_t link_bytes = mcc->get_bitrate_per_sec() / 8 *
+                                  mcc->get_roundtrip_ms() / MSEC_PER_SEC;
+            num = MAX(num, link_bytes / SPICE_AGENT_MAX_DATA_SIZE + 1);
+        }
+    }
+    return MIN(num, REDS_VDI_PORT_MAX_RECEIVE_BUFFS);
+}
+
 static red::shared_ptr<RedVDIReadBuf> vdi_port_get_read_buf(RedCharDeviceVDIPort *dev)
 {
-    if (dev->priv->num_read_buf >= REDS_VDI_PORT_NUM_RECEIVE_BUFFS) {
+    if (dev->priv->num_read_buf >= vdi_port_get_max_read_buf(dev)) {
         return red::shared_ptr<RedVDIReadBuf>();
     }
 
@@ -957,6 +1000,42 @@ SPICE_GNUC_VISIBLE int spice_server_get_num_clients(SpiceServer *reds)
     return reds ? reds->clients.size() : 0;
 }
 
+/* the elements have the size of the structure known by the caller */
+static SpiceClientStats *client_stats_nth(SpiceClientStats *stats, int n)
+{
+    return reinterpret_cast<SpiceClientStats *>(reinterpret_cast<uint8_t *>(stats) +
+                                                size_t{stats->size} * n);
+}
+
+SPICE_GNUC_VISIBLE int spice_server_get_client_stats(SpiceServer *reds,
+                                                     SpiceClientStats *stats,
+                                                     int max_clients)
+{
+    int i = 0;
+
+    spice_return_val_if_fail(reds != nullptr, -1);
+    spice_return_val_if_fail(stats != nullptr || max_clients <= 0, -1);
+
+    for (auto client: reds->clients) {
+        if (i < max_clients && !client->get_stats(client_stats_nth(stats, i))) {
+            spice_warning("invalid size of the client statistics structures");
+            spice_server_free_client_stats(reds, stats, i);
+            return -1;
+        }
+        i++;
+    }
+    return i;
+}
+
+SPICE_GNUC_VISIBLE void spice_server_free_client_stats(SpiceServer *reds,
+                                                       SpiceClientStats *stats,
+                                                       int num_clients)
+{
+    for (int i = 0; i < num_clients; i++) {
+        g_clear_pointer(&client_stats_nth(stats, i)->channels, g_free);
+    }
+}
+
 static bool channel_supports_multiple_clients(const RedChannel *channel)
 {
     switch (channel->type()) {
@@ -1026,7 +1105,7 @@ void reds_on_main_agent_start(RedsState *reds, MainChannelClient *mcc, uint32_t
         int client_added;
 
         client_added = dev_state->client_add(client_opaque, TRUE,
-                                             REDS_VDI_PORT_NUM_RECEIVE_BUFFS,
+                                             REDS_VDI_PORT_MAX_RECEIVE_BUFFS,
                                              REDS_AGENT_WINDOW_SIZE,
                                              num_tokens,
                                              mcc->is_waiting_for_migrate_data());
@@ -3199,7 +3278,7 @@ attach_to_red_agent(RedsState *reds, SpiceCharDeviceInstance *sin)
             int client_added;
 
             client_added = dev->client_add(client_opaque, TRUE,
-                                           REDS_VDI_PORT_NUM_RECEIVE_BUFFS,
+                                           REDS_VDI_PORT_MAX_RECEIVE_BUFFS,
                                            REDS_AGENT_WINDOW_SIZE, ~0, TRUE);
 
             if (!client_added) {
@@ -3508,6 +3587,11 @@ SPICE_GNUC_VISIBLE int spice_server_remove_interface(SpiceBaseInstance *sin)
     return 0;
 }
 
+static void reds_handle_trace_signal(int fd, int event, void *data)
+{
+    red_trace_handle_signal();
+}
+
 static int do_spice_init(RedsState *reds, SpiceCoreInterface *core_interface)
 {
     spice_debug("starting %s", VERSION);
@@ -3563,6 +3647,11 @@ static int do_spice_init(RedsState *reds, SpiceCoreInterface *core_interface)
     if (reds->allow_multiple_clients) {
         spice_warning("spice: allowing multiple client connections");
     }
+    if (red_trace_get_signal_fd() >= 0) {
+        reds->trace_watch = reds_core_watch_add(reds, red_trace_get_signal_fd(),
+                                                SPICE_WATCH_EVENT_READ,
+                                                reds_handle_trace_signal, reds);
+    }
     pthread_mutex_lock(&global_reds_lock);
     servers = g_list_prepend(servers, reds);
     pthread_mutex_unlock(&global_reds_lock);
@@ -3628,6 +3717,7 @@ SPICE_GNUC_VISIBLE SpiceServer *spice_server_new(void)
     if (record_filename) {
         reds->record = red_record_new(record_filename);
     }
+    red_trace_init();
     return reds;
 }
 
@@ -3900,6 +3990,8 @@ SPICE_GNUC_VISIBLE void spice_server_destroy(SpiceServer *reds)
 
     spice_buffer_free(&reds->client_monitors_config);
     red_record_unref(reds->record);
+    red_watch_remove(reds->trace_watch);
+    red_trace_dump_default();
     reds_cleanup(reds);
 #ifdef RED_STATISTICS
     stat_file_free(reds->stat_file);
@@ -4591,6 +4683,11 @@ RedCharDeviceVDIPort::RedCharDeviceVDIPort(RedsState *reds):
     priv->receive_pos = reinterpret_cast<uint8_t *>(&priv->vdi_chunk_header);
     priv->receive_len = sizeof(priv->vdi_chunk_header);
 
+    const char *read_buffers = getenv(REDS_VDI_PORT_RECEIVE_BUFFS_ENV);
+    if (read_buffers) {
+        priv->forced_max_read_buf = CLAMP(atoi(read_buffers), 1, REDS_VDI_PORT_MAX_RECEIVE_BUFFS);
+    }
+
     RedCharDeviceVDIPort *dev = this;
 
     agent_msg_filter_init(&dev->priv->write_filter, reds->config->agent_copypaste,
@@ -61,6 +61,14 @@ SmartCardChannelClient* smartcard_channel_client_create(RedChannel *channel,
     return rcc.get();
 }
 
+bool SmartCardChannelClient::config_socket()
+{
+    /* the messages queued together are sent in a single write, the stream
+     * is flushed as soon as the pipe is empty so this adds no latency */
+    red_stream_set_auto_flush(get_stream(), false);
+    return true;
+}
+
 uint8_t *
 SmartCardChannelClient::alloc_recv_buf(uint16_t type, uint32_t size)
 {
@@ -241,7 +249,10 @@ bool SmartCardChannelClient::handle_message(uint16_t type, uint32_t size, void *
         return FALSE;
     }
     spice_assert(priv->write_buf->buf_size >= size);
-    memcpy(priv->write_buf->buf, message, size);
+    /* nothing to copy if the message was parsed in place */
+    if (priv->write_buf->buf != message) {
+        memcpy(priv->write_buf->buf, message, size);
+    }
     smartcard_channel_client_write_to_reader(this);
 
     return TRUE;
@@ -37,6 +37,7 @@ public:
                            RedChannelCapabilities *caps);
 
 private:
+    virtual bool config_socket() override;
     virtual uint8_t *alloc_recv_buf(uint16_t type, uint32_t size) override;
     virtual void release_recv_buf(uint16_t type, uint32_t size, uint8_t *msg) override;
     virtual void on_disconnect() override;
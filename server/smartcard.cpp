@@ -104,6 +104,7 @@ RedCharDeviceSmartcard::read_one_msg_from_device()
     VSCMsgHeader *vheader = (VSCMsgHeader*)dev->priv->buf;
     int remaining;
     int actual_length;
+    bool msg_queued = false;
 
     while (true) {
         // it's possible we already got a full message from a previous partial
@@ -135,9 +136,15 @@ RedCharDeviceSmartcard::read_one_msg_from_device()
         dev->priv->buf_pos = dev->priv->buf + remaining;
         dev->priv->buf_used = remaining;
         if (msg_to_client && dev->priv->scc) {
-            dev->priv->scc->pipe_add_push(std::move(msg_to_client));
+            dev->priv->scc->pipe_add(std::move(msg_to_client));
+            msg_queued = true;
         }
     }
+    /* send all the responses read together, a multi-APDU operation then
+     * costs a single write to the client socket */
+    if (msg_queued && dev->priv->scc) {
+        dev->priv->scc->push();
+    }
     return RedPipeItemPtr();
 }
 
@@ -17,10 +17,13 @@
 */
 #include <config.h>
 
+#include <atomic>
 #include <cerrno>
 #include <climits>
 
 #include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
 #include <sys/types.h>
 #ifndef _WIN32
 #include <netinet/in.h>
@@ -41,10 +44,32 @@
 #include "red-client.h"
 #include "sound.h"
 #include "main-channel-client.h"
+#include "playback-encoder.h"
+#include "dispatcher.h"
+#include "utils.h"
+
+// compatibility for FreeBSD
+#ifdef HAVE_PTHREAD_NP_H
+#include <pthread_np.h>
+#define pthread_setname_np pthread_set_name_np
+#endif
 
 #define SND_RECEIVE_BUF_SIZE     (16 * 1024 * 2)
 #define RECORD_SAMPLES_SIZE (SND_RECEIVE_BUF_SIZE >> 2)
 
+/* Opus playback settings, from the best quality to the lowest bit rate.
+ * Lower bit rates use a higher complexity to keep the quality acceptable */
+static const int snd_opus_bit_rates[] = { 128000, 96000, 64000, 48000, 32000, 24000 };
+static const int snd_opus_complexities[] = { 6, 7, 8, 9, 10, 10 };
+#define SND_OPUS_NUM_LEVELS G_N_ELEMENTS(snd_opus_bit_rates)
+
+/* interval between two adaptations of the Opus settings */
+#define SND_OPUS_ADAPT_INTERVAL NSEC_PER_SEC
+/* intervals without drops before trying a better quality */
+#define SND_OPUS_UPGRADE_INTERVALS 5
+/* the audio should not use more than 1/SND_OPUS_LINK_SHARE of the link */
+#define SND_OPUS_LINK_SHARE 10
+
 enum SndCommand {
     SND_MIGRATE,
     SND_CTRL,
@@ -125,17 +150,29 @@ static void snd_playback_alloc_frames(PlaybackChannelClient *playback);
 struct AudioFrame {
     uint32_t time;
     uint32_t samples[SND_CODEC_MAX_FRAME_SIZE];
+    /* compressed samples, filled by the encoding thread, see
+     * snd_playback_encoder_main(). encoded_size is 0 if the frame was not
+     * encoded and -1 if the encoding failed */
+    uint8_t encoded[SND_CODEC_MAX_COMPRESSED_BYTES];
+    int encoded_size;
+    /* waiting for the encoding thread or being encoded */
+    bool encoding;
     PlaybackChannelClient *client;
     AudioFrame *next;
+    AudioFrame *encode_next;
     AudioFrameContainer *container;
     bool allocated;
 };
 
-#define NUM_AUDIO_FRAMES 3
+/* Enough frames for the queue allowed by snd_playback_max_pending() on
+ * links with a large roundtrip, plus the frame being sent and the one the
+ * guest is filling */
+#define NUM_AUDIO_FRAMES 8
 struct AudioFrameContainer
 {
     int refs;
-    AudioFrame items[NUM_AUDIO_FRAMES];
+    int num_items;
+    AudioFrame *items;
 };
 
 class PlaybackChannelClient final: public SndChannelClient
@@ -152,11 +189,42 @@ public:
     AudioFrameContainer *frames = nullptr;
     AudioFrame *free_frames = nullptr;
     AudioFrame *in_progress = nullptr;   /* Frame being sent to the client */
-    AudioFrame *pending_frame = nullptr; /* Next frame to send to the client */
+    /* Next frames to send to the client, oldest first */
+    AudioFrame *pending_frames = nullptr;
+    AudioFrame *pending_tail = nullptr;
+    uint32_t num_pending = 0;
     SpiceAudioDataMode mode = SPICE_AUDIO_DATA_MODE_RAW;
     uint32_t latency = 0;
-    SndCodec codec = nullptr;
-    uint8_t  encode_buf[SND_CODEC_MAX_COMPRESSED_BYTES];
+    PlaybackEncoder encoder;
+    /* frames dropped since the last adaptation of the codec settings */
+    uint32_t frames_dropped = 0;
+    /* Opus settings adapted to the link, see snd_playback_opus_adapt(),
+     * applied to the encoder by the encoding thread */
+    std::atomic<unsigned> opus_level{0};
+    unsigned opus_stable_intervals = 0;
+    uint64_t opus_adapt_time = 0;
+
+    RedStatNode stat;
+    RedStatCounter opus_bit_rate_counter;
+    RedStatCounter opus_complexity_counter;
+    RedStatCounter opus_rate_up_counter;
+    RedStatCounter opus_rate_down_counter;
+
+    /* The frames are encoded by a thread started with the first frame to
+     * encode, which wakes up the channel through encode_dispatcher once a
+     * frame is encoded. The encoding fields of the frames and the fields
+     * below encode_cond are protected by encode_lock. */
+    pthread_t encode_thread;
+    bool encode_thread_started = false;
+    red::shared_ptr<Dispatcher> encode_dispatcher;
+    SpiceWatch *encode_watch = nullptr;
+    pthread_mutex_t encode_lock;
+    pthread_cond_t encode_cond;
+    AudioFrame *encode_frames = nullptr;   /* Frames to encode, oldest first */
+    AudioFrame *encode_tail = nullptr;
+    AudioFrame *encode_current = nullptr;  /* Frame being encoded */
+    bool encode_notified = false;
+    bool encode_stopping = false;
 
     static void on_message_marshalled(uint8_t *data, void *opaque);
 protected:
@@ -190,6 +258,8 @@ struct PlaybackChannel final: public SndChannel
     explicit PlaybackChannel(RedsState *reds);
     void on_connect(RedClient *client, RedStream *stream,
                     int migration, RedChannelCapabilities *caps) override;
+
+    RedStatCounter frames_dropped_counter;
 };
 
 
@@ -227,6 +297,7 @@ protected:
 static GList *snd_channels;
 
 static void snd_send(SndChannelClient * client);
+static void snd_set_command(SndChannelClient *client, uint32_t command);
 
 /* sound channels only support a single client */
 static SndChannelClient *snd_channel_get_client(SndChannel *channel)
@@ -252,6 +323,382 @@ static void snd_playback_free_frame(PlaybackChannelClient *playback_client, Audi
     playback_client->free_frames = frame;
 }
 
+/* Removes the frame from the frames waiting for the encoding thread,
+ * encode_lock must be held */
+static void snd_playback_unqueue_encode(PlaybackChannelClient *playback_client, AudioFrame *frame)
+{
+    AudioFrame *prev = nullptr;
+    AudioFrame *item;
+
+    for (item = playback_client->encode_frames; item != frame; item = item->encode_next) {
+        spice_assert(item);
+        prev = item;
+    }
+    if (prev) {
+        prev->encode_next = frame->encode_next;
+    } else {
+        playback_client->encode_frames = frame->encode_next;
+    }
+    if (playback_client->encode_tail == frame) {
+        playback_client->encode_tail = prev;
+    }
+    frame->encode_next = nullptr;
+    frame->encoding = false;
+}
+
+/* Hands the frame to the encoding thread, encode_lock must be held */
+static void snd_playback_queue_encode(PlaybackChannelClient *playback_client, AudioFrame *frame)
+{
+    frame->encoding = true;
+    frame->encode_next = nullptr;
+    if (playback_client->encode_tail) {
+        playback_client->encode_tail->encode_next = frame;
+    } else {
+        playback_client->encode_frames = frame;
+    }
+    playback_client->encode_tail = frame;
+    pthread_cond_broadcast(&playback_client->encode_cond);
+}
+
+/* Called in the main thread once the encoding thread encoded a frame */
+static void snd_playback_frame_encoded(void *opaque, void *)
+{
+    auto playback_client = static_cast<PlaybackChannelClient *>(opaque);
+
+    /* the client is being destroyed */
+    if (!playback_client) {
+        return;
+    }
+    pthread_mutex_lock(&playback_client->encode_lock);
+    playback_client->encode_notified = false;
+    pthread_mutex_unlock(&playback_client->encode_lock);
+
+    if (!playback_client->in_progress && playback_client->pending_frames) {
+        snd_set_command(playback_client, SND_PLAYBACK_PCM_MASK);
+        snd_send(playback_client);
+    }
+}
+
+/* Encodes the queued frames with the settings chosen by snd_playback_opus_adapt() */
+static void *snd_playback_encoder_main(void *opaque)
+{
+    auto playback_client = static_cast<PlaybackChannelClient *>(opaque);
+    unsigned level = SND_OPUS_NUM_LEVELS;
+
+    pthread_mutex_lock(&playback_client->encode_lock);
+    while (!playback_client->encode_stopping) {
+        AudioFrame *frame = playback_client->encode_frames;
+
+        if (!frame) {
+            pthread_cond_wait(&playback_client->encode_cond, &playback_client->encode_lock);
+            continue;
+        }
+        playback_client->encode_frames = frame->encode_next;
+        if (!playback_client->encode_frames) {
+            playback_client->encode_tail = nullptr;
+        }
+        frame->encode_next = nullptr;
+        playback_client->encode_current = frame;
+        pthread_mutex_unlock(&playback_client->encode_lock);
+
+        if (level != playback_client->opus_level) {
+            level = playback_client->opus_level;
+            playback_client->encoder.set_bit_rate(snd_opus_bit_rates[level]);
+            playback_client->encoder.set_complexity(snd_opus_complexities[level]);
+        }
+        int n = sizeof(frame->encoded);
+        if (playback_client->encoder.encode(frame->samples, frame->encoded, &n) != SND_CODEC_OK) {
+            n = -1;
+        }
+
+        pthread_mutex_lock(&playback_client->encode_lock);
+        frame->encoded_size = n;
+        frame->encoding = false;
+        playback_client->encode_current = nullptr;
+        pthread_cond_broadcast(&playback_client->encode_cond);
+        /* a single wake up is enough for all the frames encoded meanwhile */
+        if (!playback_client->encode_notified) {
+            playback_client->encode_notified = true;
+            pthread_mutex_unlock(&playback_client->encode_lock);
+            playback_client->encode_dispatcher->send_message_custom(snd_playback_frame_encoded,
+                                                                    nullptr, 0, false);
+            pthread_mutex_lock(&playback_client->encode_lock);
+        }
+    }
+    pthread_mutex_unlock(&playback_client->encode_lock);
+    return nullptr;
+}
+
+static bool snd_playback_start_encoder(PlaybackChannelClient *playback_client)
+{
+#ifndef _WIN32
+    sigset_t thread_sig_mask;
+    sigset_t curr_sig_mask;
+#endif
+    int r;
+
+    if (playback_client->encode_thread_started) {
+        return true;
+    }
+    if (!playback_client->encode_dispatcher) {
+        playback_client->encode_dispatcher = red::make_shared<Dispatcher>(1);
+        playback_client->encode_dispatcher->set_opaque(playback_client);
+        playback_client->encode_watch = playback_client->encode_dispatcher->create_watch(
+            playback_client->get_channel()->get_core_interface());
+    }
+
+#ifndef _WIN32
+    sigfillset(&thread_sig_mask);
+    sigdelset(&thread_sig_mask, SIGILL);
+    sigdelset(&thread_sig_mask, SIGFPE);
+    sigdelset(&thread_sig_mask, SIGSEGV);
+    pthread_sigmask(SIG_SETMASK, &thread_sig_mask, &curr_sig_mask);
+#endif
+    r = pthread_create(&playback_client->encode_thread, nullptr,
+                       snd_playback_encoder_main, playback_client);
+#ifndef _WIN32
+    pthread_sigmask(SIG_SETMASK, &curr_sig_mask, nullptr);
+#endif
+    if (r) {
+        red_channel_warning(playback_client->get_channel(),
+                            "create encoding thread failed %d", r);
+        return false;
+    }
+#if !defined(__APPLE__)
+    pthread_setname_np(playback_client->encode_thread, "SPICE Audio Enc");
+#endif
+    playback_client->encode_thread_started = true;
+    return true;
+}
+
+/* Removes the frame from the pending frames, prev is the frame before it */
+static void snd_playback_unlink_frame(PlaybackChannelClient *playback_client,
+                                      AudioFrame *prev, AudioFrame *frame)
+{
+    if (prev) {
+        prev->next = frame->next;
+    } else {
+        playback_client->pending_frames = frame->next;
+    }
+    if (playback_client->pending_tail == frame) {
+        playback_client->pending_tail = prev;
+    }
+    playback_client->num_pending--;
+    frame->next = nullptr;
+}
+
+/*
+ * Returns the next frame to send, if it is ready. A frame queued before
+ * switching to a compressed mode is handed to the encoding thread first,
+ * the thread wakes up the channel once it is done.
+ */
+static AudioFrame *snd_playback_pop_frame(PlaybackChannelClient *playback_client)
+{
+    AudioFrame *frame = playback_client->pending_frames;
+
+    if (!frame) {
+        return nullptr;
+    }
+    if (playback_client->mode != SPICE_AUDIO_DATA_MODE_RAW &&
+        !snd_playback_start_encoder(playback_client)) {
+        return nullptr;
+    }
+    pthread_mutex_lock(&playback_client->encode_lock);
+    if (!frame->encoding && !frame->encoded_size &&
+        playback_client->mode != SPICE_AUDIO_DATA_MODE_RAW) {
+        snd_playback_queue_encode(playback_client, frame);
+    }
+    if (frame->encoding) {
+        frame = nullptr;
+    } else {
+        snd_playback_unlink_frame(playback_client, nullptr, frame);
+    }
+    pthread_mutex_unlock(&playback_client->encode_lock);
+    return frame;
+}
+
+static void snd_playback_free_pending_frames(PlaybackChannelClient *playback_client)
+{
+    AudioFrame *frame;
+
+    /* the frames can't be reused before the encoding thread is done with them */
+    pthread_mutex_lock(&playback_client->encode_lock);
+    playback_client->encode_frames = nullptr;
+    playback_client->encode_tail = nullptr;
+    while (playback_client->encode_current) {
+        pthread_cond_wait(&playback_client->encode_cond, &playback_client->encode_lock);
+    }
+    pthread_mutex_unlock(&playback_client->encode_lock);
+
+    while ((frame = playback_client->pending_frames) != nullptr) {
+        snd_playback_unlink_frame(playback_client, nullptr, frame);
+        frame->encoding = false;
+        frame->encode_next = nullptr;
+        snd_playback_free_frame(playback_client, frame);
+    }
+}
+
+/*
+ * Number of frames which can wait to be sent. Queuing frames absorbs the
+ * network jitter, assumed to be of the order of the roundtrip measured by
+ * the main channel, but adds latency, so only what covers the jitter is
+ * kept. Two frames are left for the one being sent and the one the guest
+ * is filling.
+ */
+static uint32_t snd_playback_max_pending(PlaybackChannelClient *playback_client)
+{
+    MainChannelClient *mcc = playback_client->get_client()->get_main();
+    uint32_t frame_ms = playback_client->encoder.frame_size() * MSEC_PER_SEC /
+                        playback_client->get_channel()->frequency;
+    uint32_t max_pending = 1;
+
+    if (mcc && mcc->is_network_info_initialized() && frame_ms) {
+        max_pending = mcc->get_roundtrip_ms() / frame_ms + 1;
+    }
+    return CLAMP(max_pending, 1u, (uint32_t) playback_client->frames->num_items - 2);
+}
+
+/*
+ * Drops the oldest pending frame which was not encoded yet. The Opus
+ * encoder state depends on all the frames it encoded, so dropping an
+ * encoded frame would make the client decode the next ones with a state
+ * which does not match. encode_lock must be held.
+ */
+static bool snd_playback_drop_frame(PlaybackChannelClient *playback_client)
+{
+    AudioFrame *prev = nullptr;
+    AudioFrame *frame;
+
+    for (frame = playback_client->pending_frames; frame; prev = frame, frame = frame->next) {
+        if (!frame->encoded_size && frame != playback_client->encode_current) {
+            break;
+        }
+    }
+    if (!frame) {
+        return false;
+    }
+    if (frame->encoding) {
+        snd_playback_unqueue_encode(playback_client, frame);
+    }
+    snd_playback_unlink_frame(playback_client, prev, frame);
+    snd_playback_free_frame(playback_client, frame);
+    return true;
+}
+
+/*
+ * Queues the frame, handing it to the encoding thread in compressed mode.
+ * If the queue is full the oldest frame not encoded yet is dropped, or
+ * this one if they are all encoded.
+ */
+static void snd_playback_queue_frame(PlaybackChannelClient *playback_client, AudioFrame *frame)
+{
+    auto channel = static_cast<PlaybackChannel *>(playback_client->get_channel());
+    const uint32_t max_pending = snd_playback_max_pending(playback_client);
+    bool queued = true;
+
+    frame->encoded_size = 0;
+    frame->next = nullptr;
+
+    pthread_mutex_lock(&playback_client->encode_lock);
+    while (playback_client->num_pending >= max_pending) {
+        playback_client->frames_dropped++;
+        stat_inc_counter(channel->frames_dropped_counter, 1);
+        if (!snd_playback_drop_frame(playback_client)) {
+            queued = false;
+            break;
+        }
+    }
+    if (queued) {
+        if (playback_client->pending_tail) {
+            playback_client->pending_tail->next = frame;
+        } else {
+            playback_client->pending_frames = frame;
+        }
+        playback_client->pending_tail = frame;
+        playback_client->num_pending++;
+        if (playback_client->mode != SPICE_AUDIO_DATA_MODE_RAW) {
+            snd_playback_queue_encode(playback_client, frame);
+        }
+    }
+    pthread_mutex_unlock(&playback_client->encode_lock);
+
+    if (!queued) {
+        snd_playback_free_frame(playback_client, frame);
+    }
+}
+
+static void snd_playback_opus_apply(PlaybackChannelClient *playback_client)
+{
+    const int bit_rate = snd_opus_bit_rates[playback_client->opus_level];
+    const int complexity = snd_opus_complexities[playback_client->opus_level];
+
+    stat_set_counter(playback_client->opus_bit_rate_counter, bit_rate);
+    stat_set_counter(playback_client->opus_complexity_counter, complexity);
+    spice_debug("playback client %p: opus bit rate %d complexity %d",
+                playback_client, bit_rate, complexity);
+}
+
+/* Returns the best level the link bandwidth allows */
+static unsigned snd_playback_opus_link_level(PlaybackChannelClient *playback_client)
+{
+    MainChannelClient *mcc = playback_client->get_client()->get_main();
+    unsigned level = 0;
+
+    if (!mcc || !mcc->is_network_info_initialized()) {
+        return 0;
+    }
+    const uint64_t max_bit_rate = mcc->get_bitrate_per_sec() / SND_OPUS_LINK_SHARE;
+    while (level + 1 < SND_OPUS_NUM_LEVELS &&
+           (uint64_t) snd_opus_bit_rates[level] > max_bit_rate) {
+        level++;
+    }
+    return level;
+}
+
+/*
+ * Adapts the Opus bit rate to the link: the bit rate is capped according to
+ * the bandwidth measured by the main channel, decreased when frames are
+ * dropped because they could not be sent in time (the queue length depends
+ * on the roundtrip, see snd_playback_max_pending()) and slowly increased
+ * again while no frame is dropped.
+ */
+static void snd_playback_opus_adapt(PlaybackChannelClient *playback_client)
+{
+    const uint64_t now = spice_get_monotonic_time_ns();
+    unsigned level = playback_client->opus_level;
+
+    if (!playback_client->opus_adapt_time) {
+        /* first frame, start from what the link allows */
+        playback_client->opus_adapt_time = now;
+        playback_client->opus_level = snd_playback_opus_link_level(playback_client);
+        snd_playback_opus_apply(playback_client);
+        return;
+    }
+    if (now - playback_client->opus_adapt_time < SND_OPUS_ADAPT_INTERVAL) {
+        return;
+    }
+    playback_client->opus_adapt_time = now;
+
+    if (playback_client->frames_dropped) {
+        level = MIN(level + 1, SND_OPUS_NUM_LEVELS - 1);
+        playback_client->opus_stable_intervals = 0;
+    } else if (++playback_client->opus_stable_intervals >= SND_OPUS_UPGRADE_INTERVALS) {
+        level = level ? level - 1 : 0;
+        playback_client->opus_stable_intervals = 0;
+    }
+    level = MAX(level, snd_playback_opus_link_level(playback_client));
+    playback_client->frames_dropped = 0;
+
+    if (level == playback_client->opus_level) {
+        return;
+    }
+    stat_inc_counter(level > playback_client->opus_level ?
+                     playback_client->opus_rate_down_counter :
+                     playback_client->opus_rate_up_counter, 1);
+    playback_client->opus_level = level;
+    snd_playback_opus_apply(playback_client);
+}
+
 void PlaybackChannelClient::on_message_marshalled(uint8_t *, void *opaque)
 {
     auto client = reinterpret_cast<PlaybackChannelClient*>(opaque);
@@ -259,7 +706,7 @@ void PlaybackChannelClient::on_message_marshalled(uint8_t *, void *opaque)
     if (client->in_progress) {
         snd_playback_free_frame(client, client->in_progress);
         client->in_progress = nullptr;
-        if (client->pending_frame) {
+        if (client->pending_frames) {
             client->command |= SND_PLAYBACK_PCM_MASK;
             snd_send(client);
         }
@@ -583,20 +1030,16 @@ static bool snd_playback_send_write(PlaybackChannelClient *playback_client)
     if (playback_client->mode == SPICE_AUDIO_DATA_MODE_RAW) {
         spice_marshaller_add_by_ref_full(
             m, reinterpret_cast<uint8_t *>(frame->samples),
-            snd_codec_frame_size(playback_client->codec) * sizeof(frame->samples[0]),
+            playback_client->encoder.frame_size() * sizeof(frame->samples[0]),
             PlaybackChannelClient::on_message_marshalled, playback_client);
     }
     else {
-        int n = sizeof(playback_client->encode_buf);
-        if (snd_codec_encode(playback_client->codec, reinterpret_cast<uint8_t *>(frame->samples),
-                             snd_codec_frame_size(playback_client->codec) *
-                                 sizeof(frame->samples[0]),
-                             playback_client->encode_buf, &n) != SND_CODEC_OK) {
+        if (frame->encoded_size < 0) {
             red_channel_warning(rcc->get_channel(), "encode failed");
             rcc->disconnect();
             return false;
         }
-        spice_marshaller_add_by_ref_full(m, playback_client->encode_buf, n,
+        spice_marshaller_add_by_ref_full(m, frame->encoded, frame->encoded_size,
                                          PlaybackChannelClient::on_message_marshalled,
                                          playback_client);
     }
@@ -651,15 +1094,18 @@ void PlaybackChannelClient::send_item(G_GNUC_UNUSED RedPipeItem *item)
             }
         }
         if (command & SND_PLAYBACK_PCM_MASK) {
-            spice_assert(!in_progress && pending_frame);
-            in_progress = pending_frame;
-            pending_frame = nullptr;
+            spice_assert(!in_progress);
             command &= ~SND_PLAYBACK_PCM_MASK;
-            if (snd_playback_send_write(this)) {
-                break;
+            /* if the frame is still encoding the encoding thread sets the
+             * command again once it is done */
+            in_progress = snd_playback_pop_frame(this);
+            if (in_progress) {
+                if (snd_playback_send_write(this)) {
+                    break;
+                }
+                red_channel_warning(get_channel(),
+                                    "snd_send_playback_write failed");
             }
-            red_channel_warning(get_channel(),
-                                "snd_send_playback_write failed");
         }
         if (command & SND_CTRL_MASK) {
             command &= ~SND_CTRL_MASK;
@@ -876,11 +1322,9 @@ SPICE_GNUC_VISIBLE void spice_server_playback_stop(SpicePlaybackInstance *sin)
         client->command &= ~SND_CTRL_MASK;
         client->command &= ~SND_PLAYBACK_PCM_MASK;
 
-        if (playback_client->pending_frame) {
+        if (playback_client->pending_frames) {
             spice_assert(!playback_client->in_progress);
-            snd_playback_free_frame(playback_client,
-                                    playback_client->pending_frame);
-            playback_client->pending_frame = nullptr;
+            snd_playback_free_pending_frames(playback_client);
         }
     }
 }
@@ -908,7 +1352,7 @@ SPICE_GNUC_VISIBLE void spice_server_playback_get_buffer(SpicePlaybackInstance *
 
     *samples = playback_client->free_frames->samples;
     playback_client->free_frames = playback_client->free_frames->next;
-    *num_samples = snd_codec_frame_size(playback_client->codec);
+    *num_samples = playback_client->encoder.frame_size();
 }
 
 SPICE_GNUC_VISIBLE void spice_server_playback_put_samples(SpicePlaybackInstance *sin, uint32_t *samples)
@@ -920,6 +1364,7 @@ SPICE_GNUC_VISIBLE void spice_server_playback_put_samples(SpicePlaybackInstance
     if (frame->allocated) {
         frame->allocated = false;
         if (--frame->container->refs == 0) {
+            g_free(frame->container->items);
             g_free(frame->container);
             return;
         }
@@ -932,13 +1377,23 @@ SPICE_GNUC_VISIBLE void spice_server_playback_put_samples(SpicePlaybackInstance
     }
     spice_assert(playback_client->active);
 
-    if (playback_client->pending_frame) {
-        snd_playback_free_frame(playback_client, playback_client->pending_frame);
-    }
     frame->time = reds_get_mm_time();
-    playback_client->pending_frame = frame;
-    snd_set_command(playback_client, SND_PLAYBACK_PCM_MASK);
-    snd_send(playback_client);
+    if (playback_client->mode != SPICE_AUDIO_DATA_MODE_RAW) {
+        if (!snd_playback_start_encoder(playback_client)) {
+            snd_playback_free_frame(playback_client, frame);
+            playback_client->disconnect();
+            return;
+        }
+        if (playback_client->encoder.get_mode() == SPICE_AUDIO_DATA_MODE_OPUS) {
+            snd_playback_opus_adapt(playback_client);
+        }
+    }
+    snd_playback_queue_frame(playback_client, frame);
+    /* compressed frames are sent once the encoding thread is done with them */
+    if (playback_client->mode == SPICE_AUDIO_DATA_MODE_RAW) {
+        snd_set_command(playback_client, SND_PLAYBACK_PCM_MASK);
+        snd_send(playback_client);
+    }
 }
 
 void snd_set_playback_latency(RedClient *client, uint32_t latency)
@@ -978,19 +1433,41 @@ snd_desired_audio_mode(bool playback_compression, int frequency, bool client_can
 
 PlaybackChannelClient::~PlaybackChannelClient()
 {
+    if (encode_thread_started) {
+        pthread_mutex_lock(&encode_lock);
+        encode_stopping = true;
+        pthread_cond_broadcast(&encode_cond);
+        pthread_mutex_unlock(&encode_lock);
+        pthread_join(encode_thread, nullptr);
+    }
+    if (encode_dispatcher) {
+        /* ignore the wake ups still queued */
+        encode_dispatcher->set_opaque(nullptr);
+        red_watch_remove(encode_watch);
+        encode_dispatcher.reset();
+    }
+    pthread_cond_destroy(&encode_cond);
+    pthread_mutex_destroy(&encode_lock);
+
     // free frames, unref them
-    for (auto& item : frames->items) {
-        item.client = nullptr;
+    for (int i = 0; i < frames->num_items; i++) {
+        frames->items[i].client = nullptr;
     }
     if (--frames->refs == 0) {
+        g_free(frames->items);
         g_free(frames);
     }
 
+    RedsState *reds = snd_channel_get_server(this);
     if (active) {
-        reds_enable_mm_time(snd_channel_get_server(this));
+        reds_enable_mm_time(reds);
     }
 
-    snd_codec_destroy(&codec);
+    stat_remove_counter(reds, &opus_bit_rate_counter);
+    stat_remove_counter(reds, &opus_complexity_counter);
+    stat_remove_counter(reds, &opus_rate_up_counter);
+    stat_remove_counter(reds, &opus_rate_down_counter);
+    stat_remove_node(reds, &stat);
 }
 
 
@@ -1000,6 +1477,8 @@ PlaybackChannelClient::PlaybackChannelClient(PlaybackChannel *channel,
                                              RedChannelCapabilities *caps):
     SndChannelClient(channel, client, stream, caps)
 {
+    pthread_mutex_init(&encode_lock, nullptr);
+    pthread_cond_init(&encode_cond, nullptr);
     snd_playback_alloc_frames(this);
 
     bool client_can_opus = test_remote_cap(SPICE_PLAYBACK_CAP_OPUS);
@@ -1008,8 +1487,7 @@ PlaybackChannelClient::PlaybackChannelClient(PlaybackChannel *channel,
     auto desired_mode =
         snd_desired_audio_mode(playback_compression, channel->frequency, client_can_opus);
     if (desired_mode != SPICE_AUDIO_DATA_MODE_RAW) {
-        if (snd_codec_create(&codec, static_cast<SpiceAudioDataMode>(desired_mode),
-                             channel->frequency, SND_CODEC_ENCODE) == SND_CODEC_OK) {
+        if (encoder.init(desired_mode, channel->frequency)) {
             mode = desired_mode;
         } else {
             red_channel_warning(channel, "create encoder failed");
@@ -1018,6 +1496,17 @@ PlaybackChannelClient::PlaybackChannelClient(PlaybackChannel *channel,
 
     spice_debug("playback client %p using mode %s", this,
                 spice_audio_data_mode_to_string(mode));
+
+    /* the settings of each client are reported separately */
+    RedsState *reds = channel->get_server();
+    MainChannelClient *mcc = client->get_main();
+    char name[32];
+    snprintf(name, sizeof(name), "client_%u", mcc ? mcc->get_connection_id() : 0);
+    stat_init_node(&stat, reds, channel->get_stat_node(), name, TRUE);
+    stat_init_counter(&opus_bit_rate_counter, reds, &stat, "opus_bit_rate", TRUE);
+    stat_init_counter(&opus_complexity_counter, reds, &stat, "opus_complexity", TRUE);
+    stat_init_counter(&opus_rate_up_counter, reds, &stat, "opus_rate_up", TRUE);
+    stat_init_counter(&opus_rate_down_counter, reds, &stat, "opus_rate_down", TRUE);
 }
 
 bool PlaybackChannelClient::init()
@@ -1234,6 +1723,10 @@ PlaybackChannel::PlaybackChannel(RedsState *reds):
 {
     set_cap(SPICE_PLAYBACK_CAP_VOLUME);
 
+    init_stat_node(nullptr, "playback");
+    const RedStatNode *stat = get_stat_node();
+    stat_init_counter(&frames_dropped_counter, reds, stat, "frames_dropped", TRUE);
+
     add_channel(this);
     reds_register_channel(reds, this);
 }
@@ -1301,9 +1794,12 @@ void snd_set_playback_compression(bool on)
 static void snd_playback_alloc_frames(PlaybackChannelClient *playback)
 {
     playback->frames = g_new0(AudioFrameContainer, 1);
+    playback->frames->items = g_new0(AudioFrame, NUM_AUDIO_FRAMES);
     playback->frames->refs = 1;
-    for (auto& item : playback->frames->items) {
-        item.container = playback->frames;
-        snd_playback_free_frame(playback, &item);
+    playback->frames->num_items = NUM_AUDIO_FRAMES;
+    for (int i = 0; i < NUM_AUDIO_FRAMES; i++) {
+        AudioFrame *item = &playback->frames->items[i];
+        item->container = playback->frames;
+        snd_playback_free_frame(playback, item);
     }
 }
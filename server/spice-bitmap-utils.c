@@ -17,6 +17,7 @@
 */
 #include <config.h>
 
+#include <string.h>
 #include <sys/stat.h>
 
 #include "spice-bitmap-utils.h"
@@ -137,6 +138,201 @@ int spice_bitmap_from_surface_type(uint32_t surface_format)
     return SPICE_BITMAP_FMT_INVALID;
 }
 
+/* Converts @width pixels of a RGB line to 32 bits pixels */
+static void bitmap_line_to_rgb32(uint8_t format, const uint8_t *src, rgb32_pixel_t *dest,
+                                 uint32_t width)
+{
+    uint32_t x;
+
+    switch (format) {
+    case SPICE_BITMAP_FMT_16BIT: {
+        const rgb16_pixel_t *pix = (const rgb16_pixel_t *) src;
+
+        for (x = 0; x < width; x++) {
+            uint8_t r = (pix[x] >> 10) & 0x1f;
+            uint8_t g = (pix[x] >> 5) & 0x1f;
+            uint8_t b = pix[x] & 0x1f;
+
+            dest[x].r = (r << 3) | (r >> 2);
+            dest[x].g = (g << 3) | (g >> 2);
+            dest[x].b = (b << 3) | (b >> 2);
+            dest[x].pad = 0;
+        }
+        break;
+    }
+    case SPICE_BITMAP_FMT_24BIT: {
+        const rgb24_pixel_t *pix = (const rgb24_pixel_t *) src;
+
+        for (x = 0; x < width; x++) {
+            dest[x].r = pix[x].r;
+            dest[x].g = pix[x].g;
+            dest[x].b = pix[x].b;
+            dest[x].pad = 0;
+        }
+        break;
+    }
+    default:
+        memcpy(dest, src, width * sizeof(rgb32_pixel_t));
+        break;
+    }
+}
+
+/* Computes the source positions of a scaled line. The position of the
+ * sample is in 16.16 fixed point, the weight of the next pixel uses 8 bits */
+static void bitmap_scale_positions(uint32_t src_size, uint32_t dest_size,
+                                   uint32_t *pos, uint16_t *weight)
+{
+    uint32_t i;
+    int64_t max_pos = (int64_t) (src_size - 1) << 16;
+
+    for (i = 0; i < dest_size; i++) {
+        /* sample the center of the destination pixel */
+        int64_t p = ((2 * (int64_t) i + 1) * src_size << 16) / (2 * dest_size) - (1 << 15);
+
+        p = CLAMP(p, 0, max_pos);
+        pos[i] = p >> 16;
+        weight[i] = (p >> 8) & 0xff;
+    }
+}
+
+static inline uint8_t bilinear(uint8_t p00, uint8_t p01, uint8_t p10, uint8_t p11,
+                               uint32_t wx, uint32_t wy)
+{
+    uint32_t top = p00 * (256 - wx) + p01 * wx;
+    uint32_t bottom = p10 * (256 - wx) + p11 * wx;
+
+    return (top * (256 - wy) + bottom * wy + (1 << 15)) >> 16;
+}
+
+/* Returns the converted source @line, keeping @keep_line in the cache */
+static const rgb32_pixel_t *bitmap_scale_get_row(uint8_t format, const uint8_t **lines,
+                                                 uint32_t width, rgb32_pixel_t *rows[2],
+                                                 int64_t rows_nr[2], uint32_t line,
+                                                 uint32_t keep_line)
+{
+    int slot;
+
+    if (rows_nr[0] == line) {
+        return rows[0];
+    }
+    if (rows_nr[1] == line) {
+        return rows[1];
+    }
+    slot = rows_nr[0] == keep_line ? 1 : 0;
+    bitmap_line_to_rgb32(format, lines[line], rows[slot], width);
+    rows_nr[slot] = line;
+    return rows[slot];
+}
+
+void bitmap_scaler_clear(BitmapScaler *scaler)
+{
+    g_free(scaler->rows[0]);
+    g_free(scaler->rows[1]);
+    g_free(scaler->yweight);
+    g_free(scaler->ypos);
+    g_free(scaler->xweight);
+    g_free(scaler->xpos);
+    g_free(scaler->lines);
+    memset(scaler, 0, sizeof(*scaler));
+}
+
+/* Allocates the buffers and computes the source positions, unless the
+ * previous frame had the same dimensions */
+static void bitmap_scaler_prepare(BitmapScaler *scaler,
+                                  uint32_t src_width, uint32_t src_height,
+                                  uint32_t dest_width, uint32_t dest_height)
+{
+    if (scaler->src_width == src_width && scaler->src_height == src_height &&
+        scaler->dest_width == dest_width && scaler->dest_height == dest_height) {
+        return;
+    }
+    bitmap_scaler_clear(scaler);
+    scaler->src_width = src_width;
+    scaler->src_height = src_height;
+    scaler->dest_width = dest_width;
+    scaler->dest_height = dest_height;
+    scaler->lines = g_new(const uint8_t *, src_height);
+    scaler->xpos = g_new(uint32_t, dest_width);
+    scaler->xweight = g_new(uint16_t, dest_width);
+    scaler->ypos = g_new(uint32_t, dest_height);
+    scaler->yweight = g_new(uint16_t, dest_height);
+    scaler->rows[0] = g_new(rgb32_pixel_t, src_width);
+    scaler->rows[1] = g_new(rgb32_pixel_t, src_width);
+    bitmap_scale_positions(src_width, dest_width, scaler->xpos, scaler->xweight);
+    bitmap_scale_positions(src_height, dest_height, scaler->ypos, scaler->yweight);
+}
+
+bool bitmap_scale_to_rgb32(BitmapScaler *scaler, const SpiceBitmap *bitmap,
+                           const SpiceRect *src, int top_down,
+                           uint8_t *dest, uint32_t dest_stride,
+                           uint32_t dest_width, uint32_t dest_height)
+{
+    const uint32_t src_width = src->right - src->left;
+    const uint32_t src_height = src->bottom - src->top;
+    const int bpp = bitmap_fmt_get_bytes_per_pixel(bitmap->format);
+    const SpiceChunks *chunks = bitmap->data;
+    uint32_t chunk_nr = 0;
+    size_t offset = 0;
+    uint32_t i, x, y;
+
+    if (!bitmap_fmt_has_graduality(bitmap->format) ||
+        src->right <= src->left || src->bottom <= src->top ||
+        dest_width == 0 || dest_height == 0 ||
+        src->left < 0 || src->top < 0 ||
+        (uint32_t) src->right > bitmap->x || (uint32_t) src->bottom > bitmap->y) {
+        return false;
+    }
+
+    bitmap_scaler_prepare(scaler, src_width, src_height, dest_width, dest_height);
+    const uint8_t **lines = scaler->lines;
+    const uint32_t *xpos = scaler->xpos;
+    const uint16_t *xweight = scaler->xweight;
+    const uint32_t *ypos = scaler->ypos;
+    const uint16_t *yweight = scaler->yweight;
+    int64_t rows_nr[2] = { -1, -1 };
+
+    /* lines are used in memory order, like the video encoders do */
+    const uint32_t skip_lines = top_down ? (uint32_t) src->top : bitmap->y - src->bottom;
+    for (i = 0; i < skip_lines + src_height; i++) {
+        while (chunk_nr < chunks->num_chunks && offset == chunks->chunk[chunk_nr].len) {
+            offset = 0;
+            chunk_nr++;
+        }
+        if (chunk_nr == chunks->num_chunks ||
+            chunks->chunk[chunk_nr].len - offset < bitmap->stride) {
+            spice_warning("bad chunk alignment");
+            return false;
+        }
+        if (i >= skip_lines) {
+            lines[i - skip_lines] = chunks->chunk[chunk_nr].data + offset + src->left * bpp;
+        }
+        offset += bitmap->stride;
+    }
+
+    for (y = 0; y < dest_height; y++) {
+        const uint32_t wy = yweight[y];
+        const uint32_t line0 = ypos[y];
+        const uint32_t line1 = MIN(line0 + 1, src_height - 1);
+        const rgb32_pixel_t *r0 = bitmap_scale_get_row(bitmap->format, lines, src_width,
+                                                       scaler->rows, rows_nr, line0, line1);
+        const rgb32_pixel_t *r1 = bitmap_scale_get_row(bitmap->format, lines, src_width,
+                                                       scaler->rows, rows_nr, line1, line0);
+        rgb32_pixel_t *out = (rgb32_pixel_t *) (dest + y * dest_stride);
+
+        for (x = 0; x < dest_width; x++) {
+            const uint32_t sx0 = xpos[x];
+            const uint32_t sx1 = MIN(sx0 + 1, src_width - 1);
+            const uint32_t wx = xweight[x];
+
+            out[x].r = bilinear(r0[sx0].r, r0[sx1].r, r1[sx0].r, r1[sx1].r, wx, wy);
+            out[x].g = bilinear(r0[sx0].g, r0[sx1].g, r1[sx0].g, r1[sx1].g, wx, wy);
+            out[x].b = bilinear(r0[sx0].b, r0[sx1].b, r1[sx0].b, r1[sx1].b, wx, wy);
+            out[x].pad = 0;
+        }
+    }
+    return true;
+}
+
 #ifdef DUMP_BITMAP
 #define RAM_PATH "/tmp/tmpfs"
 
@@ -88,6 +88,30 @@ static inline int bitmap_fmt_has_graduality(uint8_t fmt)
 BitmapGradualType bitmap_get_graduality_level     (SpiceBitmap *bitmap);
 int               bitmap_has_extra_stride         (SpiceBitmap *bitmap);
 
+/* Buffers of bitmap_scale_to_rgb32, kept from a frame to the next so they
+ * are only allocated again when the dimensions change.
+ * Must be zeroed before the first use and released with bitmap_scaler_clear */
+typedef struct BitmapScaler {
+    uint32_t src_width, src_height;
+    uint32_t dest_width, dest_height;
+    const uint8_t **lines;
+    uint32_t *xpos;
+    uint16_t *xweight;
+    uint32_t *ypos;
+    uint16_t *yweight;
+    rgb32_pixel_t *rows[2];
+} BitmapScaler;
+
+void bitmap_scaler_clear(BitmapScaler *scaler);
+
+/* Scales the @src area of @bitmap with a bilinear filter into a 32 bits
+ * RGB buffer. Lines are read and written in memory order.
+ * Returns false if the bitmap format is not supported */
+bool bitmap_scale_to_rgb32(BitmapScaler *scaler, const SpiceBitmap *bitmap,
+                           const SpiceRect *src, int top_down,
+                           uint8_t *dest, uint32_t dest_stride,
+                           uint32_t dest_width, uint32_t dest_height);
+
 void dump_bitmap(SpiceBitmap *bitmap);
 
 int spice_bitmap_from_surface_type(uint32_t surface_format);
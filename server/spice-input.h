@@ -30,7 +30,7 @@ SPICE_BEGIN_DECLS
 
 #define SPICE_INTERFACE_KEYBOARD "keyboard"
 #define SPICE_INTERFACE_KEYBOARD_MAJOR 1
-#define SPICE_INTERFACE_KEYBOARD_MINOR 1
+#define SPICE_INTERFACE_KEYBOARD_MINOR 2
 typedef struct SpiceKbdInterface SpiceKbdInterface;
 typedef struct SpiceKbdInstance SpiceKbdInstance;
 typedef struct SpiceKbdState SpiceKbdState;
@@ -40,6 +40,8 @@ struct SpiceKbdInterface {
 
     void (*push_scan_freg)(SpiceKbdInstance *sin, uint8_t frag);
     uint8_t (*get_leds)(SpiceKbdInstance *sin);
+    /* minor version 2: push several fragments at once, optional */
+    void (*push_scan_frags)(SpiceKbdInstance *sin, const uint8_t *frags, uint32_t num_frags);
 };
 
 struct SpiceKbdInstance {
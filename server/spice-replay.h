@@ -37,6 +37,13 @@ void            spice_replay_free_cmd(SpiceReplay *replay, QXLCommandExt *cmd);
 void            spice_replay_free(SpiceReplay *replay);
 SpiceReplay *   spice_replay_new(FILE *file, int nsurfaces);
 
+/* number of commands in the recording, -1 if the recording is not indexed
+ * as the ones in the old text format */
+int             spice_replay_get_num_cmds(SpiceReplay *replay);
+/* makes cmd the next command returned by spice_replay_next_cmd, returns 0 on
+ * success or -1 if the recording is not indexed or cmd is out of range */
+int             spice_replay_seek(SpiceReplay *replay, int cmd);
+
 SPICE_END_DECLS
 
 #endif /* SPICE_REPLAY_H_ */
@@ -173,6 +173,72 @@ void spice_server_vm_stop(SpiceServer *s);
 
 int spice_server_get_num_clients(SpiceServer *s) SPICE_GNUC_DEPRECATED;
 
+typedef struct SpiceClientChannelStats {
+    uint32_t size;              /* sizeof(SpiceClientChannelStats) of the caller */
+    int type;                   /* SPICE_CHANNEL_* */
+    int id;
+    uint32_t pipe_size;         /* number of messages waiting to be sent */
+    uint64_t sent_messages;
+    uint64_t sent_bytes;
+} SpiceClientChannelStats;
+
+/* number of images sent by SpiceImageType, the new image types are
+ * appended, so this structure stays the last field of SpiceClientStats */
+typedef struct SpiceClientImageStats {
+    uint64_t bitmap;
+    uint64_t quic;
+    uint64_t lz_plt;
+    uint64_t lz_rgb;
+    uint64_t glz_rgb;
+    uint64_t from_cache;
+    uint64_t surface;
+    uint64_t jpeg;
+    uint64_t from_cache_lossless;
+    uint64_t zlib_glz_rgb;
+    uint64_t jpeg_alpha;
+    uint64_t lz4;
+} SpiceClientImageStats;
+
+typedef struct SpiceClientStats {
+    /* set by the caller, see spice_server_get_client_stats */
+    uint32_t size;              /* sizeof(SpiceClientStats) */
+    uint32_t channel_size;      /* sizeof(SpiceClientChannelStats) */
+    uint32_t connection_id;
+    uint64_t bit_rate;          /* estimated bandwidth in bits per second, 0 if unknown */
+    uint64_t roundtrip_ns;      /* estimated roundtrip in nanoseconds, 0 if unknown */
+    uint64_t queued_memory;     /* bytes queued to be sent to the client */
+    uint32_t num_streams;       /* video streams that sent frames in the last second */
+    uint32_t stream_fps;        /* frames sent per second, all the streams together */
+    uint32_t num_channels;
+    SpiceClientChannelStats *channels;
+    SpiceClientImageStats images;
+} SpiceClientStats;
+
+/**
+ * Fills @stats with a snapshot of the statistics of the connected clients.
+ * Counters start when the client connects and are never reset.
+ *
+ * Fields can be appended to the structures in later versions, so before
+ * the call the size field of every element of @stats must be set to
+ * sizeof(SpiceClientStats) and its channel_size field to
+ * sizeof(SpiceClientChannelStats); only the fields within these sizes are
+ * written. The channels arrays are allocated and must be released with
+ * spice_server_free_client_stats.
+ *
+ * @s: the Spice server to query
+ * @stats: array of @max_clients elements
+ * @max_clients: number of elements of @stats
+ * @return the number of connected clients, if more than @max_clients
+ *         only the first @max_clients are filled; -1 on error
+ */
+int spice_server_get_client_stats(SpiceServer *s, SpiceClientStats *stats, int max_clients);
+
+/**
+ * Releases the memory allocated by spice_server_get_client_stats for the
+ * first @num_clients elements of @stats.
+ */
+void spice_server_free_client_stats(SpiceServer *s, SpiceClientStats *stats, int num_clients);
+
 SPICE_END_DECLS
 
 #endif /* SPICE_SERVER_H_ */
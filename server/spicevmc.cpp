@@ -22,6 +22,7 @@
 
 #include <cassert>
 #include <cstring>
+#include <pthread.h>
 
 #ifdef USE_LZ4
 #include <lz4.h>
@@ -32,6 +33,7 @@
 #include "char-device.h"
 #include "red-channel.h"
 #include "red-channel-client.h"
+#include "red-client.h"
 #include "reds.h"
 #include "migration-protocol.h"
 
@@ -43,6 +45,10 @@
 // avoid DoS
 #define QUEUED_DATA_LIMIT (1024*1024)
 
+// number of data items kept for reuse, enough for a channel at its
+// queued data limit
+#define ITEM_POOL_SIZE (QUEUED_DATA_LIMIT / BUF_SIZE + 2)
+
 enum {
     RED_PIPE_ITEM_TYPE_SPICEVMC_DATA = RED_PIPE_ITEM_TYPE_CHANNEL_BASE,
     RED_PIPE_ITEM_TYPE_SPICEVMC_MIGRATE_DATA,
@@ -53,14 +59,54 @@ enum {
 struct RedVmcChannel;
 class VmcChannelClient;
 
-struct RedVmcPipeItem: public RedPipeItemNum<RED_PIPE_ITEM_TYPE_SPICEVMC_DATA> {
-    SpiceDataCompressionType type;
+struct RedVmcPipeItem final: public RedPipeItemNum<RED_PIPE_ITEM_TYPE_SPICEVMC_DATA> {
+    /* data items are big and allocated at the rate the device is read,
+     * recycle their memory instead of going through the allocator */
+    void *operator new(size_t size);
+    void operator delete(void *p);
+    size_t get_size() const override
+    {
+        return buf_used;
+    }
+
+    SpiceDataCompressionType type = SPICE_DATA_COMPRESSION_TYPE_NONE;
     uint32_t uncompressed_data_size = 0;
     /* writes which don't fit this will get split, this is not a problem */
     uint8_t buf[BUF_SIZE];
     uint32_t buf_used = 0;
 };
 
+static pthread_mutex_t item_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static void *item_pool[ITEM_POOL_SIZE];
+static unsigned item_pool_count;
+
+void *RedVmcPipeItem::operator new(size_t size)
+{
+    void *p = nullptr;
+
+    spice_assert(size == sizeof(RedVmcPipeItem));
+    pthread_mutex_lock(&item_pool_lock);
+    if (item_pool_count > 0) {
+        p = item_pool[--item_pool_count];
+    }
+    pthread_mutex_unlock(&item_pool_lock);
+    return p ? p : g_malloc(size);
+}
+
+void RedVmcPipeItem::operator delete(void *p)
+{
+    if (!p) {
+        return;
+    }
+    pthread_mutex_lock(&item_pool_lock);
+    if (item_pool_count < ITEM_POOL_SIZE) {
+        item_pool[item_pool_count++] = p;
+        p = nullptr;
+    }
+    pthread_mutex_unlock(&item_pool_lock);
+    g_free(p);
+}
+
 struct RedCharDeviceSpiceVmc: public RedCharDevice
 {
     RedCharDeviceSpiceVmc(SpiceCharDeviceInstance *sin, RedsState *reds, RedVmcChannel *channel);
@@ -91,6 +137,8 @@ struct RedVmcChannel: public RedChannel
     RedCharDeviceWriteBuffer *recv_from_client_buf;
     uint8_t port_opened;
     uint32_t queued_data;
+    /* device reads stopped till the client receives the data queued */
+    bool read_paused;
     RedStatCounter in_data;
     RedStatCounter in_compressed;
     RedStatCounter in_decompressed;
@@ -230,23 +278,41 @@ RedCharDeviceSpiceVmc::read_one_msg_from_device()
     red::shared_ptr<RedVmcPipeItem> msg_item;
     int n;
 
-    if (!channel->rcc || channel->queued_data >= QUEUED_DATA_LIMIT) {
+    if (!channel->rcc) {
+        return RedPipeItemPtr();
+    }
+    /* when the client memory is over budget continue only once our own
+     * data is sent, the client can be stuck on other channels */
+    if (channel->queued_data >= QUEUED_DATA_LIMIT ||
+        (channel->queued_data > 0 && channel->rcc->get_client()->is_over_memory_budget())) {
+        channel->read_paused = true;
         return RedPipeItemPtr();
     }
+    channel->read_paused = false;
 
     if (!channel->pipe_item) {
         msg_item = red::make_shared<RedVmcPipeItem>();
-        msg_item->type = SPICE_DATA_COMPRESSION_TYPE_NONE;
     } else {
         spice_assert(channel->pipe_item->buf_used == 0);
         msg_item = std::move(channel->pipe_item);
     }
 
-    n = read(msg_item->buf, sizeof(msg_item->buf));
-    if (n > 0) {
+    /* devices like USB redirection produce a lot of small writes, send
+     * together all the data already available instead of a message for
+     * each read */
+    while (msg_item->buf_used < sizeof(msg_item->buf)) {
+        n = read(msg_item->buf + msg_item->buf_used,
+                 sizeof(msg_item->buf) - msg_item->buf_used);
+        if (n <= 0) {
+            break;
+        }
         spice_debug("read from dev %d", n);
+        msg_item->buf_used += n;
+    }
+
+    n = msg_item->buf_used;
+    if (n > 0) {
         msg_item->uncompressed_data_size = n;
-        msg_item->buf_used = n;
 
         if (!try_compress_lz4(channel.get(), msg_item)) {
             stat_inc_counter(channel->out_data, n);
@@ -499,10 +565,11 @@ static void spicevmc_red_channel_send_data(VmcChannelClient *rcc,
     item->add_to_marshaller(m, i->buf, i->buf_used);
 
     // account for sent data and wake up device if was blocked
-    uint32_t old_queued_data = channel->queued_data;
     channel->queued_data -= i->buf_used;
-    if (channel->chardev &&
-        old_queued_data >= QUEUED_DATA_LIMIT && channel->queued_data < QUEUED_DATA_LIMIT) {
+    if (channel->chardev && channel->read_paused &&
+        (channel->queued_data == 0 ||
+         (channel->queued_data < QUEUED_DATA_LIMIT &&
+          !rcc->get_client()->is_over_memory_budget()))) {
         channel->chardev->wakeup();
     }
 }
@@ -597,6 +664,7 @@ void RedVmcChannel::on_connect(RedClient *client, RedStream *stream, int migrati
         return;
     }
     vmc_channel->queued_data = 0;
+    vmc_channel->read_paused = false;
     rcc->ack_zero_messages_window();
 
     if (strcmp(sin->subtype, "port") == 0) {
@@ -20,6 +20,7 @@
 #ifndef _WIN32
 #include <stdio.h>
 #include <stdlib.h>
+#include <inttypes.h>
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
@@ -235,4 +236,62 @@ void stat_file_remove_counter(RedStatFile *stat_file, uint64_t *counter)
 {
     stat_file_remove(stat_file, SPICE_CONTAINEROF(counter, SpiceStatNode, value));
 }
+
+StatNodeRef
+stat_file_add_histogram(RedStatFile *stat_file, StatNodeRef parent, const char *name, int visible,
+                        StatHistogramValues *values)
+{
+    StatNodeRef ref = stat_file_add_node(stat_file, parent, name, visible);
+    char bucket_name[32];
+    unsigned i;
+
+    memset(values, 0, sizeof(*values));
+    if (ref == INVALID_STAT_REF) {
+        return INVALID_STAT_REF;
+    }
+    values->count = stat_file_add_counter(stat_file, ref, "count", visible);
+    values->sum = stat_file_add_counter(stat_file, ref, "sum", visible);
+    for (i = 0; i < STAT_HISTOGRAM_NUM_BUCKETS; i++) {
+        uint64_t limit = stat_histogram_bucket_limit(i);
+        if (limit) {
+            snprintf(bucket_name, sizeof(bucket_name), "lt_%010" PRIu64, limit);
+        } else {
+            g_strlcpy(bucket_name, "lt_inf", sizeof(bucket_name));
+        }
+        values->buckets[i] = stat_file_add_counter(stat_file, ref, bucket_name, visible);
+        if (!values->buckets[i]) {
+            break;
+        }
+    }
+    /* do not leave a partial histogram if we are out of nodes */
+    if (!values->count || !values->sum || i < STAT_HISTOGRAM_NUM_BUCKETS) {
+        stat_file_remove_histogram(stat_file, ref, values);
+        return INVALID_STAT_REF;
+    }
+    return ref;
+}
+
+void stat_file_remove_histogram(RedStatFile *stat_file, StatNodeRef ref,
+                                StatHistogramValues *values)
+{
+    unsigned i;
+
+    if (ref == INVALID_STAT_REF) {
+        return;
+    }
+    /* remove the children first, stat_file_remove would leave them orphans */
+    if (values->count) {
+        stat_file_remove_counter(stat_file, values->count);
+    }
+    if (values->sum) {
+        stat_file_remove_counter(stat_file, values->sum);
+    }
+    for (i = 0; i < STAT_HISTOGRAM_NUM_BUCKETS; i++) {
+        if (values->buckets[i]) {
+            stat_file_remove_counter(stat_file, values->buckets[i]);
+        }
+    }
+    stat_file_remove_node(stat_file, ref);
+    memset(values, 0, sizeof(*values));
+}
 #endif
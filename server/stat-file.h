@@ -29,6 +29,50 @@ typedef uint32_t StatNodeRef;
 
 typedef struct RedStatFile RedStatFile;
 
+/*
+ * Histograms are stored as a node with a "count" and a "sum" counter and a
+ * counter for each bucket. Buckets are log-linear: bucket 0 holds the values
+ * below 1024, then each power of 2 is split in 2 buckets, the last bucket
+ * holds all values from 2^30.
+ * Bucket counters are named after their upper limit ("lt_0000001024") so
+ * readers can compute percentiles without knowing the bucket layout.
+ */
+#define STAT_HISTOGRAM_NUM_BUCKETS 42
+#define STAT_HISTOGRAM_MIN_SHIFT 10
+
+typedef struct StatHistogramValues {
+    uint64_t *count;
+    uint64_t *sum;
+    uint64_t *buckets[STAT_HISTOGRAM_NUM_BUCKETS];
+} StatHistogramValues;
+
+static inline unsigned stat_histogram_bucket(uint64_t value)
+{
+    unsigned msb, bucket;
+
+    if (value < (1u << STAT_HISTOGRAM_MIN_SHIFT)) {
+        return 0;
+    }
+    msb = 63 - __builtin_clzll(value);
+    bucket = 1 + (msb - STAT_HISTOGRAM_MIN_SHIFT) * 2 + ((value >> (msb - 1)) & 1);
+    return bucket < STAT_HISTOGRAM_NUM_BUCKETS ? bucket : STAT_HISTOGRAM_NUM_BUCKETS - 1;
+}
+
+/* Returns the first value not included in the bucket, 0 for the last bucket */
+static inline uint64_t stat_histogram_bucket_limit(unsigned bucket)
+{
+    unsigned msb;
+
+    if (bucket == 0) {
+        return 1u << STAT_HISTOGRAM_MIN_SHIFT;
+    }
+    if (bucket >= STAT_HISTOGRAM_NUM_BUCKETS - 1) {
+        return 0;
+    }
+    msb = STAT_HISTOGRAM_MIN_SHIFT + (bucket - 1) / 2;
+    return (uint64_t) (3 + ((bucket - 1) & 1)) << (msb - 1);
+}
+
 RedStatFile *stat_file_new(unsigned int max_nodes);
 void stat_file_free(RedStatFile *stat_file);
 void stat_file_unlink(RedStatFile *stat_file);
@@ -39,6 +83,11 @@ uint64_t *stat_file_add_counter(RedStatFile *stat_file, StatNodeRef parent,
                                 const char *name, int visible);
 void stat_file_remove_node(RedStatFile *stat_file, StatNodeRef ref);
 void stat_file_remove_counter(RedStatFile *stat_file, uint64_t *counter);
+StatNodeRef stat_file_add_histogram(RedStatFile *stat_file, StatNodeRef parent,
+                                    const char *name, int visible,
+                                    StatHistogramValues *values);
+void stat_file_remove_histogram(RedStatFile *stat_file, StatNodeRef ref,
+                                StatHistogramValues *values);
 
 SPICE_END_DECLS
 
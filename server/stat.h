@@ -40,6 +40,14 @@ typedef struct {
     uint8_t dummy_empty_field[0]; /* C/C++ compatibility */
 } RedStatNode;
 
+typedef struct {
+#ifdef RED_STATISTICS
+    uint32_t ref;
+    StatHistogramValues values;
+#endif
+    uint8_t dummy_empty_field[0]; /* C/C++ compatibility */
+} RedStatHistogram;
+
 #ifdef RED_STATISTICS
 void stat_init_node(RedStatNode *node, SpiceServer *reds,
                     const RedStatNode *parent, const char *name, int visible);
@@ -47,6 +55,9 @@ void stat_remove_node(SpiceServer *reds, RedStatNode *node);
 void stat_init_counter(RedStatCounter *counter, SpiceServer *reds,
                        const RedStatNode *parent, const char *name, int visible);
 void stat_remove_counter(SpiceServer *reds, RedStatCounter *counter);
+void stat_init_histogram(RedStatHistogram *histogram, SpiceServer *reds,
+                         const RedStatNode *parent, const char *name, int visible);
+void stat_remove_histogram(SpiceServer *reds, RedStatHistogram *histogram);
 
 #else
 
@@ -71,6 +82,17 @@ static inline void
 stat_remove_counter(SpiceServer *reds, RedStatCounter *counter)
 {
 }
+
+static inline void
+stat_init_histogram(RedStatHistogram *histogram, SpiceServer *reds,
+                    const RedStatNode *parent, const char *name, int visible)
+{
+}
+
+static inline void
+stat_remove_histogram(SpiceServer *reds, RedStatHistogram *histogram)
+{
+}
 #endif /* RED_STATISTICS */
 
 static inline void
@@ -83,6 +105,17 @@ stat_inc_counter(RedStatCounter counter, uint64_t value)
 #endif
 }
 
+/* For counters reporting a current value instead of a total */
+static inline void
+stat_set_counter(RedStatCounter counter, uint64_t value)
+{
+#ifdef RED_STATISTICS
+    if (counter.counter) {
+        *(counter.counter) = value;
+    }
+#endif
+}
+
 typedef uint64_t stat_time_t;
 
 static inline stat_time_t stat_now(clockid_t clock_id)
@@ -93,6 +126,42 @@ static inline stat_time_t stat_now(clockid_t clock_id)
     return ts.tv_nsec + (uint64_t) ts.tv_sec * (1000 * 1000 * 1000);
 }
 
+/* Histograms can be updated from any thread, values are usually durations
+ * in nanoseconds computed with stat_histogram_time() */
+static inline void
+stat_histogram_add(G_GNUC_UNUSED RedStatHistogram *histogram, G_GNUC_UNUSED uint64_t value)
+{
+#ifdef RED_STATISTICS
+    if (histogram->values.count) {
+        __atomic_fetch_add(histogram->values.buckets[stat_histogram_bucket(value)], 1,
+                           __ATOMIC_RELAXED);
+        __atomic_fetch_add(histogram->values.sum, value, __ATOMIC_RELAXED);
+        __atomic_fetch_add(histogram->values.count, 1, __ATOMIC_RELAXED);
+    }
+#endif
+}
+
+/* Current time for histograms, does not call the clock without statistics */
+static inline stat_time_t stat_histogram_time(void)
+{
+#ifdef RED_STATISTICS
+    return stat_now(CLOCK_MONOTONIC);
+#else
+    return 0;
+#endif
+}
+
+static inline void
+stat_histogram_add_since(G_GNUC_UNUSED RedStatHistogram *histogram,
+                         G_GNUC_UNUSED stat_time_t start)
+{
+#ifdef RED_STATISTICS
+    if (histogram->values.count) {
+        stat_histogram_add(histogram, stat_histogram_time() - start);
+    }
+#endif
+}
+
 typedef struct {
 #if defined(RED_WORKER_STAT) || defined(COMPRESS_STAT)
     stat_time_t time;
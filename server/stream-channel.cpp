@@ -22,7 +22,9 @@
 #include <spice/stream-device.h>
 
 #include "red-channel-client.h"
+#include "red-client.h"
 #include "stream-channel.h"
+#include "stream-send-rate.h"
 #include "reds.h"
 #include "common-graphics-channel.h"
 #include "display-limits.h"
@@ -40,7 +42,13 @@ public:
     /* current video stream id, <0 if not initialized or
      * we are not sending a stream */
     int stream_id = -1;
+
+    /* frames waiting in the pipe of this client */
+    uint32_t queued_frames = 0;
+    /* rate at which frames can be sent to this client */
+    StreamSendRate send_rate;
 private:
+    void update_send_rate(const StreamDataItem *item);
     StreamChannel* get_channel()
     {
         return static_cast<StreamChannel*>(CommonGraphicsChannelClient::get_channel());
@@ -73,14 +81,24 @@ struct StreamCreateItem: public RedPipeItemNum<RED_PIPE_ITEM_TYPE_STREAM_CREATE>
 
 struct StreamDataItem: public RedPipeItemNum<RED_PIPE_ITEM_TYPE_STREAM_DATA> {
     ~StreamDataItem() override;
+    size_t get_size() const override
+    {
+        return data.data_size;
+    }
 
     StreamChannel *channel;
+    /* time the frame was queued, used to pace the device; unlike
+     * RedPipeItem::queue_time this is set without statistics support */
+    uint64_t send_queue_time;
     // NOTE: this must be the last field in the structure
     SpiceMsgDisplayStreamData data;
 };
 
 #define PRIMARY_SURFACE_ID 0
 
+/* upper limit of the frame rate requested from the device */
+#define STREAM_CHANNEL_MAX_FPS 60
+
 RECORDER(stream_channel_data, 32, "Stream channel data packet");
 
 StreamChannelClient::~StreamChannelClient()
@@ -232,6 +250,7 @@ void StreamChannelClient::send_item(RedPipeItem *pipe_item)
     }
     case RED_PIPE_ITEM_TYPE_STREAM_DATA: {
         auto item = static_cast<StreamDataItem*>(pipe_item);
+        update_send_rate(item);
         init_send_data(SPICE_MSG_DISPLAY_STREAM_DATA);
         spice_marshall_msg_display_stream_data(m, &item->data);
         pipe_item->add_to_marshaller(m, item->data.data, item->data.data_size);
@@ -256,6 +275,19 @@ void StreamChannelClient::send_item(RedPipeItem *pipe_item)
     begin_send_message();
 }
 
+void StreamChannelClient::update_send_rate(const StreamDataItem *item)
+{
+    send_rate.frame_sending(spice_get_monotonic_time_ns(), item->send_queue_time,
+                            item->data.data_size);
+    if (queued_frames) {
+        queued_frames--;
+    }
+
+    StreamChannel *channel = get_channel();
+    channel->update_client_stat();
+    channel->update_queue_stat(0, 0);
+}
+
 bool StreamChannelClient::handle_message(uint16_t type, uint32_t size, void *msg)
 {
     switch (type) {
@@ -422,6 +454,9 @@ StreamChannel::change_format(const StreamMsgFormat *fmt)
 
     // allocate a new stream id
     stream_id = (stream_id + 1) % NUM_STREAMS;
+    // frame sizes depend on the codec and the resolution
+    avg_frame_size = 0;
+    reset_client_stat();
 
     // send create stream
     auto item = red::make_shared<StreamCreateItem>();
@@ -452,11 +487,24 @@ StreamChannel::update_queue_stat(int32_t num_diff, int32_t size_diff)
 
 StreamDataItem::~StreamDataItem()
 {
-    channel->update_queue_stat(-1, -data.data_size);
+    // channel is set only once the item is queued
+    if (channel) {
+        channel->update_queue_stat(-1, -data.data_size);
+    }
+}
+
+RedPipeItemPtr
+StreamChannel::new_data_item(size_t size, uint8_t **data)
+{
+    auto item = new (size) StreamDataItem();
+    item->channel = nullptr;
+    item->data.data_size = size;
+    *data = item->data.data;
+    return RedPipeItemPtr(item);
 }
 
 void
-StreamChannel::send_data(const void *data, size_t size, uint32_t mm_time)
+StreamChannel::send_data(RedPipeItemPtr pipe_item, uint32_t mm_time)
 {
     if (stream_id < 0) {
         // this condition can happen if the guest didn't handle
@@ -465,15 +513,82 @@ StreamChannel::send_data(const void *data, size_t size, uint32_t mm_time)
         return;
     }
 
-    auto item = new (size) StreamDataItem();
+    auto item = static_cast<StreamDataItem*>(pipe_item.get());
     item->data.base.id = stream_id;
     item->data.base.multi_media_time = mm_time;
-    item->data.data_size = size;
     item->channel = this;
-    update_queue_stat(1, size);
-    // TODO try to optimize avoiding the copy
-    memcpy(item->data.data, data, size);
-    pipes_add(red::shared_ptr<StreamDataItem>(item));
+    item->send_queue_time = spice_get_monotonic_time_ns();
+    avg_frame_size = avg_frame_size ?
+        (avg_frame_size * 7 + item->data.data_size) / 8 : item->data.data_size;
+
+    RedChannelClient *rcc;
+    FOREACH_CLIENT(this, rcc) {
+        static_cast<StreamChannelClient*>(rcc)->queued_frames++;
+    }
+    update_client_stat();
+    update_queue_stat(1, item->data.data_size);
+    pipes_add(std::move(pipe_item));
+}
+
+bool
+StreamChannel::is_over_memory_budget()
+{
+    RedChannelClient *rcc;
+
+    FOREACH_CLIENT(this, rcc) {
+        if (rcc->get_client()->is_over_memory_budget()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Aggregates the per client statistics: the device has to produce frames
+ * at a rate the slowest client can receive, otherwise they pile up in its
+ * pipe and increase the latency. The target frame rate leaves a quarter
+ * of the measured bandwidth for the other messages and the jitter.
+ */
+void
+StreamChannel::update_client_stat()
+{
+    RedChannelClient *rcc;
+    uint32_t max_client_items = 0;
+    uint64_t min_bit_rate = 0;
+
+    FOREACH_CLIENT(this, rcc) {
+        auto scc = static_cast<StreamChannelClient*>(rcc);
+
+        max_client_items = MAX(max_client_items, scc->queued_frames);
+        uint64_t bit_rate = scc->send_rate.get_bit_rate();
+        if (bit_rate && (!min_bit_rate || bit_rate < min_bit_rate)) {
+            min_bit_rate = bit_rate;
+        }
+    }
+
+    queue_stat.max_client_items = max_client_items;
+    queue_stat.target_bit_rate = min_bit_rate;
+    queue_stat.target_fps = 0;
+    if (min_bit_rate && avg_frame_size) {
+        uint64_t fps = min_bit_rate * 3 / 4 / 8 / avg_frame_size;
+        queue_stat.target_fps = CLAMP(fps, 1, STREAM_CHANNEL_MAX_FPS);
+    }
+}
+
+/*
+ * A new stream can have a very different bit rate, the device
+ * is not paced until the clients are measured again.
+ */
+void
+StreamChannel::reset_client_stat()
+{
+    RedChannelClient *rcc;
+
+    FOREACH_CLIENT(this, rcc) {
+        static_cast<StreamChannelClient*>(rcc)->send_rate.reset();
+    }
+    update_client_stat();
+    update_queue_stat(0, 0);
 }
 
 void
@@ -510,6 +625,7 @@ StreamChannel::reset()
     stream_id = -1;
     width = 0;
     height = 0;
+    reset_client_stat();
 
     if (!is_connected()) {
         return;
@@ -45,6 +45,11 @@ typedef void (*stream_channel_start_proc)(void *opaque, struct StreamMsgStartSto
 struct StreamQueueStat {
     uint32_t num_items;
     uint32_t size;
+    /* frames waiting in the pipe of the most late client */
+    uint32_t max_client_items;
+    /* rates the slowest client can receive, 0 if not measured yet */
+    uint64_t target_bit_rate;
+    uint32_t target_fps;
 };
 
 typedef void (*stream_channel_queue_stat_proc)(void *opaque, const StreamQueueStat *stats,
@@ -64,7 +69,22 @@ struct StreamChannel final: public RedChannel
     void reset();
 
     void change_format(const struct StreamMsgFormat *fmt);
-    void send_data(const void *data, size_t size, uint32_t mm_time);
+
+    /**
+     * Allocates the item for a frame of @size bytes, @data is set to
+     * the frame buffer. The frame can be read directly in the buffer
+     * then queued with send_data(); the item is shared by the pipes of
+     * all the clients so the frame is never copied.
+     * send_data() always takes the ownership of the item, even if the
+     * frame is dropped.
+     */
+    RedPipeItemPtr new_data_item(size_t size, uint8_t **data);
+    void send_data(RedPipeItemPtr item, uint32_t mm_time);
+    /**
+     * Returns true if a client of the channel has more queued data than
+     * its memory budget allows, the device should stop producing frames.
+     */
+    bool is_over_memory_budget();
 
     void register_start_cb(stream_channel_start_proc cb, void *opaque);
     void register_queue_stat_cb(stream_channel_queue_stat_proc cb, void *opaque);
@@ -74,6 +94,8 @@ private:
                     int migration, RedChannelCapabilities *caps) override;
 
     inline void update_queue_stat(int32_t num_diff, int32_t size_diff);
+    void update_client_stat();
+    void reset_client_stat();
     void request_new_stream(StreamMsgStartStop *start);
 
     /* current video stream id, <0 if not initialized or
@@ -83,6 +105,8 @@ private:
     unsigned width = 0, height = 0;
 
     StreamQueueStat queue_stat;
+    /* average size of the frames, used to compute the target frame rate */
+    uint32_t avg_frame_size = 0;
 
     /* callback to notify when a stream should be started or stopped */
     stream_channel_start_proc start_cb;
@@ -0,0 +1,45 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+#include <config.h>
+
+#include "stream-send-rate.h"
+#include "utils.h"
+
+/* the estimate expires if no frame had to wait for this time */
+#define STREAM_SEND_RATE_EXPIRE_NS (2 * NSEC_PER_SEC)
+
+void StreamSendRate::frame_sending(uint64_t now, uint64_t queue_time, uint32_t size)
+{
+    if (last_frame_size && queue_time <= last_frame_start && now > last_frame_start) {
+        uint64_t sample = uint64_t{last_frame_size} * 8 * NSEC_PER_SEC / (now - last_frame_start);
+        bit_rate = bit_rate ? (bit_rate * 3 + sample) / 4 : sample;
+        bit_rate_time = now;
+    } else if (bit_rate && now - bit_rate_time >= STREAM_SEND_RATE_EXPIRE_NS) {
+        bit_rate = 0;
+    }
+    last_frame_start = now;
+    last_frame_size = size;
+}
+
+void StreamSendRate::reset()
+{
+    bit_rate = 0;
+    bit_rate_time = 0;
+    last_frame_start = 0;
+    last_frame_size = 0;
+}
@@ -0,0 +1,63 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef STREAM_SEND_RATE_H_
+#define STREAM_SEND_RATE_H_
+
+#include <cstdint>
+
+#include "push-visibility.h"
+
+/**
+ * Estimate of the rate at which the frames of a stream can be sent to a
+ * client.
+ *
+ * Messages are sent one at a time, so if a frame was already queued when
+ * the previous frame started to be sent, sending the previous frame took
+ * the whole time since then. Otherwise the link was idle and the time says
+ * nothing about the client bandwidth.
+ * Once the device is paced to the estimate frames stop waiting, so the
+ * estimate would never grow again: it expires if no frame had to wait for
+ * a while and the link is probed again at full rate.
+ */
+class StreamSendRate
+{
+public:
+    /* a frame of @size bytes queued at @queue_time starts to be sent at @now */
+    void frame_sending(uint64_t now, uint64_t queue_time, uint32_t size);
+    /* forgets the estimate, for instance when the stream changes */
+    void reset();
+
+    /* bits per second, 0 if not known */
+    uint64_t get_bit_rate() const
+    {
+        return bit_rate;
+    }
+
+private:
+    uint64_t bit_rate = 0;
+    /* time of the last sample of bit_rate */
+    uint64_t bit_rate_time = 0;
+    /* last frame sent */
+    uint64_t last_frame_start = 0;
+    uint32_t last_frame_size = 0;
+};
+
+#include "pop-visibility.h"
+
+#endif /* STREAM_SEND_RATE_H_ */
@@ -0,0 +1,630 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * Benchmark the image encoders in isolation.
+ *
+ * Every image of the corpus is compressed with every encoder supporting its
+ * format and the speed and compression ratio are reported for each encoder
+ * and format. The corpus is made of the BMP files given on the command line
+ * (or found in the given directories), like the ones written by dump_bitmap()
+ * when the server is built with DUMP_BITMAP. Without files a synthetic corpus
+ * covering all the bitmap formats is generated.
+ */
+#include <config.h>
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <glib.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_CYCLES 1
+#endif
+
+#include "image-encoders.h"
+#include "spice-bitmap-utils.h"
+#include "utils.h"
+
+#define SYNTHETIC_WIDTH 512
+#define SYNTHETIC_HEIGHT 384
+#define GLZ_WINDOW_SIZE (1024 * 1024 * 4)
+#define JPEG_QUALITY 85
+
+enum {
+    CODEC_QUIC,
+    CODEC_LZ,
+    CODEC_GLZ,
+    CODEC_JPEG,
+#ifdef USE_LZ4
+    CODEC_LZ4,
+#endif
+    NUM_CODECS
+};
+
+static const char *const codec_names[NUM_CODECS] = {
+    "quic",
+    "lz",
+    "glz",
+    "jpeg",
+#ifdef USE_LZ4
+    "lz4",
+#endif
+};
+
+#define NUM_FORMATS (SPICE_BITMAP_FMT_8BIT_A + 1)
+
+static const char *const format_names[NUM_FORMATS] = {
+    "invalid",
+    "1bit-le",
+    "1bit-be",
+    "4bit-le",
+    "4bit-be",
+    "8bit",
+    "16bit",
+    "24bit",
+    "32bit",
+    "rgba",
+    "8bit-a",
+};
+
+typedef struct {
+    char *name;
+    SpiceBitmap bitmap;
+    SpiceChunks *chunks;
+    uint8_t *data;
+} CorpusImage;
+
+typedef struct {
+    uint32_t images;
+    uint64_t pixels;
+    uint64_t orig_size;
+    uint64_t comp_size;
+    uint64_t time_ns;
+    uint64_t cycles;
+} CodecResult;
+
+static gint iterations = 5;
+static gboolean csv = FALSE;
+static CodecResult results[NUM_CODECS][NUM_FORMATS];
+
+static inline uint64_t read_cycles(void)
+{
+#ifdef HAVE_CYCLES
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+static uint32_t bitmap_line_size(uint8_t format, uint32_t width)
+{
+    switch (format) {
+    case SPICE_BITMAP_FMT_1BIT_LE:
+    case SPICE_BITMAP_FMT_1BIT_BE:
+        return SPICE_ALIGN(width, 8) / 8;
+    case SPICE_BITMAP_FMT_4BIT_LE:
+    case SPICE_BITMAP_FMT_4BIT_BE:
+        return SPICE_ALIGN(width, 2) / 2;
+    case SPICE_BITMAP_FMT_8BIT:
+    case SPICE_BITMAP_FMT_8BIT_A:
+        return width;
+    default:
+        return width * bitmap_fmt_get_bytes_per_pixel(format);
+    }
+}
+
+static SpicePalette *palette_new(uint16_t num_ents)
+{
+    auto palette = (SpicePalette *) g_malloc0(sizeof(SpicePalette) + num_ents * sizeof(uint32_t));
+    static uint64_t unique = 0;
+
+    palette->unique = ++unique;
+    palette->num_ents = num_ents;
+    return palette;
+}
+
+/* takes ownership of data and palette */
+static CorpusImage *corpus_image_new(const char *name, uint8_t format,
+                                     uint32_t width, uint32_t height, bool top_down,
+                                     uint8_t *data, SpicePalette *palette)
+{
+    auto image = g_new0(CorpusImage, 1);
+    uint32_t stride = bitmap_line_size(format, width);
+
+    image->name = g_strdup(name);
+    image->data = data;
+    image->chunks = spice_chunks_new(1);
+    image->chunks->data_size = stride * height;
+    image->chunks->chunk[0].data = data;
+    image->chunks->chunk[0].len = stride * height;
+
+    image->bitmap.format = format;
+    image->bitmap.flags = top_down ? SPICE_BITMAP_FLAGS_TOP_DOWN : 0;
+    image->bitmap.x = width;
+    image->bitmap.y = height;
+    image->bitmap.stride = stride;
+    image->bitmap.palette = palette;
+    image->bitmap.palette_id = palette ? palette->unique : 0;
+    image->bitmap.data = image->chunks;
+    return image;
+}
+
+static void corpus_image_free(gpointer data)
+{
+    auto image = (CorpusImage *) data;
+
+    spice_chunks_destroy(image->chunks);
+    g_free(image->bitmap.palette);
+    g_free(image->data);
+    g_free(image->name);
+    g_free(image);
+}
+
+static uint32_t get_le(const uint8_t *p, int size)
+{
+    uint32_t val = 0;
+
+    for (int i = size - 1; i >= 0; i--) {
+        val = (val << 8) | p[i];
+    }
+    return val;
+}
+
+/* Loads an uncompressed BMP file as written by dump_bitmap().
+ * The lines are repacked without the padding of the BMP format so the
+ * image can be compressed with all the encoders. */
+static CorpusImage *load_bmp(const char *filename)
+{
+    gchar *contents = NULL;
+    gsize size;
+    CorpusImage *image = NULL;
+
+    if (!g_file_get_contents(filename, &contents, &size, NULL)) {
+        g_warning("cannot read %s", filename);
+        return NULL;
+    }
+
+    const auto file = (const uint8_t *) contents;
+    if (size < 54 || file[0] != 'B' || file[1] != 'M' || get_le(file + 30, 4) != 0) {
+        g_warning("%s is not an uncompressed BMP file", filename);
+        g_free(contents);
+        return NULL;
+    }
+
+    const uint32_t data_offset = get_le(file + 10, 4);
+    const bool alpha = get_le(file + 6, 2) != 0;
+    const uint32_t width = get_le(file + 18, 4);
+    const int32_t height = (int32_t) get_le(file + 22, 4);
+    const uint32_t bpp = get_le(file + 28, 2);
+    uint32_t num_ents = get_le(file + 46, 4);
+    const uint32_t lines = ABS(height);
+    uint8_t format;
+
+    switch (bpp) {
+    case 1:
+        format = SPICE_BITMAP_FMT_1BIT_BE;
+        break;
+    case 4:
+        format = SPICE_BITMAP_FMT_4BIT_BE;
+        break;
+    case 8:
+        format = SPICE_BITMAP_FMT_8BIT;
+        break;
+    case 16:
+        format = SPICE_BITMAP_FMT_16BIT;
+        break;
+    case 24:
+        format = SPICE_BITMAP_FMT_24BIT;
+        break;
+    case 32:
+        format = alpha ? SPICE_BITMAP_FMT_RGBA : SPICE_BITMAP_FMT_32BIT;
+        break;
+    default:
+        g_warning("%s: unsupported depth %u", filename, bpp);
+        g_free(contents);
+        return NULL;
+    }
+
+    const uint32_t row_size = ((width * bpp + 31) / 32) * 4;
+    const uint32_t line_size = bitmap_line_size(format, width);
+    SpicePalette *palette = NULL;
+    if (bpp <= 8 && num_ents == 0) {
+        num_ents = 1u << bpp;
+    }
+    if (width == 0 || lines == 0 || width > 16384 || lines > 16384 ||
+        (bpp <= 8 && num_ents > (1u << bpp)) ||
+        data_offset < 54 + (bpp <= 8 ? num_ents * 4 : 0) ||
+        data_offset > size || size - data_offset < (uint64_t) row_size * lines) {
+        g_warning("%s: invalid BMP file", filename);
+        g_free(contents);
+        return NULL;
+    }
+
+    if (bpp <= 8) {
+        palette = palette_new(num_ents);
+        for (uint32_t i = 0; i < num_ents; i++) {
+            palette->ents[i] = get_le(file + 54 + i * 4, 4);
+        }
+    }
+
+    auto data = (uint8_t *) g_malloc(line_size * lines);
+    for (uint32_t y = 0; y < lines; y++) {
+        memcpy(data + y * line_size, file + data_offset + y * row_size, line_size);
+    }
+    image = corpus_image_new(filename, format, width, lines, height < 0, data, palette);
+    g_free(contents);
+    return image;
+}
+
+static void load_path(GPtrArray *corpus, const char *path)
+{
+    if (!g_file_test(path, G_FILE_TEST_IS_DIR)) {
+        CorpusImage *image = load_bmp(path);
+        if (image) {
+            g_ptr_array_add(corpus, image);
+        }
+        return;
+    }
+
+    GDir *dir = g_dir_open(path, 0, NULL);
+    const gchar *name;
+    if (!dir) {
+        g_warning("cannot open directory %s", path);
+        return;
+    }
+    while ((name = g_dir_read_name(dir)) != NULL) {
+        if (g_str_has_suffix(name, ".bmp")) {
+            gchar *filename = g_build_filename(path, name, NULL);
+            load_path(corpus, filename);
+            g_free(filename);
+        }
+    }
+    g_dir_close(dir);
+}
+
+/* Draws something looking like a desktop: a gradient background, some flat
+ * windows and text like noise */
+static void synthetic_pixel(uint32_t x, uint32_t y, uint8_t rgba[4], GRand *rand)
+{
+    const uint32_t w = SYNTHETIC_WIDTH, h = SYNTHETIC_HEIGHT;
+
+    rgba[0] = 40 + x * 100 / w;
+    rgba[1] = 60 + y * 120 / h;
+    rgba[2] = 160 + (x + y) * 60 / (w + h);
+    rgba[3] = 255 - x * 255 / w;
+
+    if (x >= w / 8 && x < w * 5 / 8 && y >= h / 8 && y < h * 3 / 4) {
+        // a window with a title bar and some text
+        if (y < h / 8 + 20) {
+            rgba[0] = 50; rgba[1] = 80; rgba[2] = 140;
+        } else if ((y / 12) % 2 == 0 && g_rand_int_range(rand, 0, 3) == 0) {
+            rgba[0] = rgba[1] = rgba[2] = 20;
+        } else {
+            rgba[0] = rgba[1] = rgba[2] = 240;
+        }
+        rgba[3] = 255;
+    } else if (x >= w * 11 / 16 && y >= h / 2) {
+        // a photo like area
+        rgba[0] = (x * 7 + y * 3 + g_rand_int_range(rand, 0, 32)) & 0xff;
+        rgba[1] = (x * 3 + y * 5 + g_rand_int_range(rand, 0, 32)) & 0xff;
+        rgba[2] = (x * 2 + y * 9 + g_rand_int_range(rand, 0, 32)) & 0xff;
+    }
+}
+
+static void add_synthetic_corpus(GPtrArray *corpus)
+{
+    const uint32_t w = SYNTHETIC_WIDTH, h = SYNTHETIC_HEIGHT;
+    auto rgba = (uint8_t *) g_malloc(w * h * 4);
+    GRand *rand = g_rand_new_with_seed(42);
+
+    for (uint32_t y = 0; y < h; y++) {
+        for (uint32_t x = 0; x < w; x++) {
+            synthetic_pixel(x, y, rgba + (y * w + x) * 4, rand);
+        }
+    }
+    g_rand_free(rand);
+
+    for (uint8_t format = SPICE_BITMAP_FMT_1BIT_LE; format < NUM_FORMATS; format++) {
+        const uint32_t line_size = bitmap_line_size(format, w);
+        auto data = (uint8_t *) g_malloc0(line_size * h);
+        SpicePalette *palette = NULL;
+
+        if (format == SPICE_BITMAP_FMT_8BIT) {
+            palette = palette_new(256);
+            for (uint32_t i = 0; i < 256; i++) {
+                // 3-3-2 palette
+                palette->ents[i] = ((i >> 5) * 255 / 7) << 16 | (((i >> 2) & 7) * 255 / 7) << 8 |
+                                   (i & 3) * 255 / 3;
+            }
+        } else if (bitmap_fmt_is_plt(format)) {
+            const uint32_t num_ents = format <= SPICE_BITMAP_FMT_1BIT_BE ? 2 : 16;
+            palette = palette_new(num_ents);
+            for (uint32_t i = 0; i < num_ents; i++) {
+                const uint32_t gray = i * 255 / (num_ents - 1);
+                palette->ents[i] = gray << 16 | gray << 8 | gray;
+            }
+        }
+
+        for (uint32_t y = 0; y < h; y++) {
+            uint8_t *line = data + y * line_size;
+            for (uint32_t x = 0; x < w; x++) {
+                const uint8_t *p = rgba + (y * w + x) * 4;
+                const uint32_t gray = (p[0] * 77 + p[1] * 150 + p[2] * 29) >> 8;
+
+                switch (format) {
+                case SPICE_BITMAP_FMT_1BIT_LE:
+                    line[x / 8] |= (gray >= 128) << (x % 8);
+                    break;
+                case SPICE_BITMAP_FMT_1BIT_BE:
+                    line[x / 8] |= (gray >= 128) << (7 - x % 8);
+                    break;
+                case SPICE_BITMAP_FMT_4BIT_LE:
+                    line[x / 2] |= (gray >> 4) << (x % 2 ? 4 : 0);
+                    break;
+                case SPICE_BITMAP_FMT_4BIT_BE:
+                    line[x / 2] |= (gray >> 4) << (x % 2 ? 0 : 4);
+                    break;
+                case SPICE_BITMAP_FMT_8BIT:
+                    line[x] = (p[0] >> 5) << 5 | (p[1] >> 5) << 2 | p[2] >> 6;
+                    break;
+                case SPICE_BITMAP_FMT_16BIT: {
+                    const uint16_t pixel = (p[0] >> 3) << 10 | (p[1] >> 3) << 5 | p[2] >> 3;
+                    line[x * 2] = pixel & 0xff;
+                    line[x * 2 + 1] = pixel >> 8;
+                    break;
+                }
+                case SPICE_BITMAP_FMT_24BIT:
+                    line[x * 3] = p[2];
+                    line[x * 3 + 1] = p[1];
+                    line[x * 3 + 2] = p[0];
+                    break;
+                case SPICE_BITMAP_FMT_32BIT:
+                case SPICE_BITMAP_FMT_RGBA:
+                    line[x * 4] = p[2];
+                    line[x * 4 + 1] = p[1];
+                    line[x * 4 + 2] = p[0];
+                    line[x * 4 + 3] = format == SPICE_BITMAP_FMT_RGBA ? p[3] : 0;
+                    break;
+                case SPICE_BITMAP_FMT_8BIT_A:
+                    line[x] = p[3];
+                    break;
+                }
+            }
+        }
+
+        gchar *name = g_strdup_printf("synthetic-%s", format_names[format]);
+        g_ptr_array_add(corpus, corpus_image_new(name, format, w, h, true, data, palette));
+        g_free(name);
+    }
+    g_free(rgba);
+}
+
+static bool codec_supports(int codec, const SpiceBitmap *bitmap)
+{
+    switch (codec) {
+    case CODEC_QUIC:
+    case CODEC_JPEG:
+        return bitmap->format == SPICE_BITMAP_FMT_16BIT ||
+               bitmap->format == SPICE_BITMAP_FMT_24BIT ||
+               bitmap->format == SPICE_BITMAP_FMT_32BIT ||
+               bitmap->format == SPICE_BITMAP_FMT_RGBA;
+    case CODEC_LZ:
+        return bitmap_fmt_is_rgb(bitmap->format) || bitmap->palette;
+    case CODEC_GLZ:
+        // the server only uses GLZ for these formats, see get_compression_for_bitmap()
+        return bitmap_fmt_has_graduality(bitmap->format);
+#ifdef USE_LZ4
+    case CODEC_LZ4:
+        return bitmap_fmt_is_rgb(bitmap->format);
+#endif
+    }
+    return false;
+}
+
+static bool compress(ImageEncoders *enc, int codec, SpiceBitmap *bitmap,
+                     compress_send_data_t *comp_data)
+{
+    SpiceImage dest;
+
+    memset(&dest, 0, sizeof(dest));
+    switch (codec) {
+    case CODEC_QUIC:
+        return image_encoders_compress_quic(enc, &dest, bitmap, comp_data);
+    case CODEC_LZ:
+        return image_encoders_compress_lz(enc, &dest, bitmap, comp_data);
+    case CODEC_GLZ: {
+        // like a Drawable going away after being sent, the image stays in
+        // the dictionary until it gets out of the window
+        GlzImageRetention retention;
+        glz_retention_init(&retention);
+        auto red_drawable = red::make_shared<RedDrawable>();
+        bool ret = image_encoders_compress_glz(enc, &dest, bitmap, red_drawable.get(),
+                                               &retention, comp_data, FALSE);
+        glz_retention_detach_drawables(&retention);
+        image_encoders_free_glz_drawables_to_free(enc);
+        return ret;
+    }
+    case CODEC_JPEG:
+        return image_encoders_compress_jpeg(enc, &dest, bitmap, comp_data);
+#ifdef USE_LZ4
+    case CODEC_LZ4:
+        return image_encoders_compress_lz4(enc, &dest, bitmap, comp_data);
+#endif
+    }
+    return false;
+}
+
+static void benchmark_image(ImageEncoders *enc, CorpusImage *image, bool first_pass)
+{
+    SpiceBitmap *bitmap = &image->bitmap;
+
+    for (int codec = 0; codec < NUM_CODECS; codec++) {
+        CodecResult *result = &results[codec][bitmap->format];
+        compress_send_data_t comp_data;
+
+        if (!codec_supports(codec, bitmap)) {
+            continue;
+        }
+
+        memset(&comp_data, 0, sizeof(comp_data));
+        const uint64_t start = spice_get_monotonic_time_ns();
+        const uint64_t start_cycles = read_cycles();
+        const bool ok = compress(enc, codec, bitmap, &comp_data);
+        const uint64_t cycles = read_cycles() - start_cycles;
+        const uint64_t time_ns = spice_get_monotonic_time_ns() - start;
+        if (!ok) {
+            // some encoders give up on images not worth compressing
+            if (first_pass) {
+                g_debug("%s: %s failed", image->name, codec_names[codec]);
+            }
+            continue;
+        }
+
+        RedCompressBuf *buf = comp_data.comp_buf;
+        while (buf) {
+            RedCompressBuf *next = buf->send_next;
+            compress_buf_free(buf);
+            buf = next;
+        }
+
+        result->images += first_pass;
+        result->pixels += (uint64_t) bitmap->x * bitmap->y;
+        result->orig_size += (uint64_t) bitmap->stride * bitmap->y;
+        result->comp_size += comp_data.comp_buf_size;
+        result->time_ns += time_ns;
+        result->cycles += cycles;
+    }
+}
+
+static void print_result(const char *codec, const char *format, const CodecResult *result)
+{
+    const double secs = result->time_ns / 1e9;
+    const double mb_per_sec = secs > 0 ? result->orig_size / secs / (1000 * 1000) : 0;
+    const double ratio = result->comp_size ? (double) result->orig_size / result->comp_size : 0;
+    const double ns_per_pixel = (double) result->time_ns / result->pixels;
+    const double cycles_per_pixel = (double) result->cycles / result->pixels;
+
+    if (csv) {
+        printf("%s,%s,%u,%" G_GUINT64_FORMAT ",%" G_GUINT64_FORMAT ",%" G_GUINT64_FORMAT
+               ",%.3f,%.4f,%.3f,%.3f\n",
+               codec, format, result->images, result->pixels, result->orig_size,
+               result->comp_size, mb_per_sec, ratio, ns_per_pixel, cycles_per_pixel);
+    } else {
+        printf("%-6s %-8s %6u %10.1f %8.2f %10.2f %10.2f\n",
+               codec, format, result->images, mb_per_sec, ratio, ns_per_pixel, cycles_per_pixel);
+    }
+}
+
+static void print_results(void)
+{
+    if (csv) {
+        printf("codec,format,images,pixels,orig_bytes,comp_bytes,mb_per_s,ratio,"
+               "ns_per_pixel,cycles_per_pixel\n");
+    } else {
+        printf("%-6s %-8s %6s %10s %8s %10s %10s\n",
+               "codec", "format", "images", "MB/s", "ratio", "ns/pixel", "cycles/px");
+    }
+
+    for (int codec = 0; codec < NUM_CODECS; codec++) {
+        CodecResult total;
+
+        memset(&total, 0, sizeof(total));
+        for (int format = 0; format < NUM_FORMATS; format++) {
+            const CodecResult *result = &results[codec][format];
+            if (result->images == 0) {
+                continue;
+            }
+            print_result(codec_names[codec], format_names[format], result);
+            total.images += result->images;
+            total.pixels += result->pixels;
+            total.orig_size += result->orig_size;
+            total.comp_size += result->comp_size;
+            total.time_ns += result->time_ns;
+            total.cycles += result->cycles;
+        }
+        if (total.images != 0) {
+            print_result(codec_names[codec], "all", &total);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    GError *error = NULL;
+    gchar **paths = NULL;
+    GOptionEntry entries[] = {
+        { "iterations", 'n', 0, G_OPTION_ARG_INT, &iterations, "Number of times the corpus is compressed (default 5)", "N" },
+        { "csv", 0, 0, G_OPTION_ARG_NONE, &csv, "Print the results as CSV", NULL },
+        { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &paths, "BMP files or directories", "FILE" },
+        { NULL }
+    };
+
+    GOptionContext *context = g_option_context_new("- benchmark the image encoders");
+    g_option_context_add_main_entries(context, entries, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &error)) {
+        g_printerr("Option parsing failed: %s\n", error->message);
+        exit(1);
+    }
+    g_option_context_free(context);
+    if (iterations <= 0) {
+        g_printerr("invalid number of iterations\n");
+        exit(1);
+    }
+
+    GPtrArray *corpus = g_ptr_array_new_with_free_func(corpus_image_free);
+    if (paths) {
+        for (gchar **path = paths; *path; path++) {
+            load_path(corpus, *path);
+        }
+        g_strfreev(paths);
+    } else {
+        add_synthetic_corpus(corpus);
+    }
+    if (corpus->len == 0) {
+        g_printerr("no image to compress\n");
+        exit(1);
+    }
+
+    ImageEncoderSharedData shared_data;
+    ImageEncoders enc;
+    memset(&shared_data, 0, sizeof(shared_data));
+    memset(&enc, 0, sizeof(enc));
+    image_encoder_shared_init(&shared_data);
+    image_encoders_init(&enc, &shared_data);
+    enc.jpeg_quality = JPEG_QUALITY;
+    if (!image_encoders_get_glz_dictionary(&enc, NULL, 0, GLZ_WINDOW_SIZE) ||
+        !image_encoders_glz_create(&enc, 0)) {
+        g_printerr("cannot create the GLZ encoder\n");
+        exit(1);
+    }
+
+    /* the corpus is compressed as a whole in each pass so GLZ can find
+     * matches between images like it does for a display */
+    for (gint pass = 0; pass < iterations; pass++) {
+        image_encoders_free_glz_drawables(&enc);
+        for (guint i = 0; i < corpus->len; i++) {
+            benchmark_image(&enc, (CorpusImage *) g_ptr_array_index(corpus, i), pass == 0);
+        }
+    }
+    print_results();
+
+    image_encoders_free(&enc);
+    g_ptr_array_free(corpus, TRUE);
+
+    return 0;
+}
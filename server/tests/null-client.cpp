@@ -0,0 +1,290 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <config.h>
+#include <errno.h>
+#include <string.h>
+#include <glib.h>
+
+#include <spice/protocol.h>
+
+#include "null-client.h"
+#include "reds.h"
+#include "red-client.h"
+#include "main-channel.h"
+#include "net-utils.h"
+
+// same values used by spice-gtk
+#define PIXMAP_CACHE_SIZE (1024 * 1024 * 20)
+#define GLZ_WINDOW_SIZE (1024 * 1024 * 4)
+
+#define MINI_HEADER_SIZE 6
+
+struct NullClientChannel {
+    NullClient *client;
+    int type;
+    int socket;
+    SpiceWatch *watch;
+
+    // parsing state of the current message
+    uint8_t header[MINI_HEADER_SIZE];
+    unsigned header_pos;
+    uint16_t msg_type;
+    uint32_t msg_size;
+    uint32_t msg_pos;
+    // start of the body, enough for the messages we reply to
+    uint8_t body[12];
+
+    uint32_t ack_window;
+    uint32_t ack_count;
+
+    NullClientMsgStats stats[NULL_CLIENT_MAX_MSG_TYPE + 1];
+};
+
+struct NullClient {
+    SpiceCoreInterface *core;
+    RedClient *red_client;
+    red::shared_ptr<MainChannel> main_channel;
+    NullClientChannel channels[3];
+    unsigned num_channels;
+};
+
+static void null_client_send(NullClientChannel *channel, uint16_t type,
+                             const void *data, uint32_t size)
+{
+    uint8_t buf[MINI_HEADER_SIZE + 16];
+
+    spice_assert(size <= sizeof(buf) - MINI_HEADER_SIZE);
+    buf[0] = type & 0xff;
+    buf[1] = type >> 8;
+    for (int i = 0; i < 4; i++) {
+        buf[2 + i] = (size >> (8 * i)) & 0xff;
+    }
+    if (size) {
+        memcpy(buf + MINI_HEADER_SIZE, data, size);
+    }
+
+    if (socket_write(channel->socket, buf, MINI_HEADER_SIZE + size) != MINI_HEADER_SIZE + size) {
+        g_warning("null client: failed to send message %u to channel %d",
+                  type, channel->type);
+    }
+}
+
+static void null_client_send_display_init(NullClientChannel *channel)
+{
+    uint8_t init[14];
+    uint64_t pixmap_cache_size = GUINT64_TO_LE(PIXMAP_CACHE_SIZE);
+    uint32_t glz_window_size = GUINT32_TO_LE(GLZ_WINDOW_SIZE);
+
+    // SpiceMsgcDisplayInit is packed: u8 id, i64 size, u8 id, i32 size
+    init[0] = 1;
+    memcpy(init + 1, &pixmap_cache_size, 8);
+    init[9] = 1;
+    memcpy(init + 10, &glz_window_size, 4);
+    null_client_send(channel, SPICE_MSGC_DISPLAY_INIT, init, sizeof(init));
+}
+
+static void null_client_handle_message(NullClientChannel *channel)
+{
+    NullClientMsgStats *stats = &channel->stats[MIN(channel->msg_type, NULL_CLIENT_MAX_MSG_TYPE)];
+
+    stats->count++;
+    stats->bytes += MINI_HEADER_SIZE + channel->msg_size;
+
+    switch (channel->msg_type) {
+    case SPICE_MSG_SET_ACK: {
+        uint32_t generation, window;
+
+        memcpy(&generation, channel->body, 4);
+        memcpy(&window, channel->body + 4, 4);
+        channel->ack_window = GUINT32_FROM_LE(window);
+        channel->ack_count = 0;
+        null_client_send(channel, SPICE_MSGC_ACK_SYNC, &generation, sizeof(generation));
+        return;
+    }
+    case SPICE_MSG_PING:
+        // id and timestamp are echoed back
+        null_client_send(channel, SPICE_MSGC_PONG, channel->body, 12);
+        break;
+    }
+
+    if (channel->ack_window && ++channel->ack_count >= channel->ack_window) {
+        channel->ack_count = 0;
+        null_client_send(channel, SPICE_MSGC_ACK, NULL, 0);
+    }
+}
+
+static void null_client_parse(NullClientChannel *channel, const uint8_t *data, size_t len)
+{
+    while (len > 0) {
+        if (channel->header_pos < MINI_HEADER_SIZE) {
+            size_t n = MIN(len, MINI_HEADER_SIZE - channel->header_pos);
+            memcpy(channel->header + channel->header_pos, data, n);
+            channel->header_pos += n;
+            data += n;
+            len -= n;
+            if (channel->header_pos < MINI_HEADER_SIZE) {
+                break;
+            }
+            channel->msg_type = channel->header[0] | (channel->header[1] << 8);
+            channel->msg_size = channel->header[2] | (channel->header[3] << 8) |
+                                (channel->header[4] << 16) | ((uint32_t) channel->header[5] << 24);
+            channel->msg_pos = 0;
+            memset(channel->body, 0, sizeof(channel->body));
+        }
+
+        size_t n = MIN(len, channel->msg_size - channel->msg_pos);
+        if (channel->msg_pos < sizeof(channel->body)) {
+            memcpy(channel->body + channel->msg_pos, data,
+                   MIN(n, sizeof(channel->body) - channel->msg_pos));
+        }
+        channel->msg_pos += n;
+        data += n;
+        len -= n;
+
+        if (channel->msg_pos == channel->msg_size) {
+            null_client_handle_message(channel);
+            channel->header_pos = 0;
+        }
+    }
+}
+
+static void null_client_read(int fd, int event, void *opaque)
+{
+    NullClientChannel *channel = (NullClientChannel *) opaque;
+    uint8_t buf[64 * 1024];
+
+    for (;;) {
+        ssize_t ret = socket_read(fd, buf, sizeof(buf));
+        if (ret > 0) {
+            null_client_parse(channel, buf, ret);
+            continue;
+        }
+        if (ret == 0) {
+            // channel disconnected by the server
+            channel->client->core->watch_remove(channel->watch);
+            channel->watch = NULL;
+        } else if (errno != EAGAIN && errno != EINTR) {
+            g_warning("null client: error reading from channel %d: %s",
+                      channel->type, strerror(errno));
+        }
+        break;
+    }
+}
+
+static RedStream *null_client_channel_init(NullClient *client, RedsState *reds, int type)
+{
+    NullClientChannel *channel = &client->channels[client->num_channels++];
+    int sv[2];
+
+    if (socketpair(AF_LOCAL, SOCK_STREAM, 0, sv) != 0) {
+        spice_error("socketpair failed %s", strerror(errno));
+    }
+    red_socket_set_non_blocking(sv[0], true);
+    red_socket_set_non_blocking(sv[1], true);
+
+    channel->client = client;
+    channel->type = type;
+    channel->socket = sv[1];
+    channel->watch = client->core->watch_add(sv[1], SPICE_WATCH_EVENT_READ,
+                                             null_client_read, channel);
+
+    // the display channel waits for this message before sending anything
+    if (type == SPICE_CHANNEL_DISPLAY) {
+        null_client_send_display_init(channel);
+    }
+
+    return red_stream_new(reds, sv[0]);
+}
+
+NullClient *null_client_new(SpiceCoreInterface *core, SpiceServer *server)
+{
+    static const int channel_types[] = { SPICE_CHANNEL_DISPLAY, SPICE_CHANNEL_CURSOR };
+    NullClient *client = new NullClient();
+    RedChannelCapabilities caps;
+    uint32_t common_caps = 1 << SPICE_COMMON_CAP_MINI_HEADER;
+
+    memset(&caps, 0, sizeof(caps));
+    caps.num_common_caps = 1;
+    caps.common_caps = (uint32_t*) spice_memdup(&common_caps, sizeof(common_caps));
+
+    client->core = core;
+    client->red_client = red_client_new(server, FALSE);
+    client->main_channel = main_channel_new(server);
+    main_channel_link(client->main_channel.get(), client->red_client,
+                      null_client_channel_init(client, server, SPICE_CHANNEL_MAIN),
+                      0, FALSE, &caps);
+
+    for (auto type : channel_types) {
+        RedChannel *channel = reds_find_channel(server, type, 0);
+        if (channel) {
+            channel->connect(client->red_client, null_client_channel_init(client, server, type),
+                             FALSE, &caps);
+        }
+    }
+    red_channel_capabilities_reset(&caps);
+
+    return client;
+}
+
+void null_client_destroy(NullClient *client)
+{
+    if (!client) {
+        return;
+    }
+
+    client->red_client->destroy();
+    for (unsigned i = 0; i < client->num_channels; i++) {
+        NullClientChannel *channel = &client->channels[i];
+        if (channel->watch) {
+            client->core->watch_remove(channel->watch);
+        }
+        socket_close(channel->socket);
+    }
+    delete client;
+}
+
+NullClientMsgStats null_client_get_msg_stats(NullClient *client, int channel_type,
+                                             uint16_t msg_type)
+{
+    NullClientMsgStats stats = { 0, 0 };
+
+    for (unsigned i = 0; i < client->num_channels; i++) {
+        if (client->channels[i].type == channel_type) {
+            stats = client->channels[i].stats[MIN(msg_type, NULL_CLIENT_MAX_MSG_TYPE)];
+        }
+    }
+    return stats;
+}
+
+uint64_t null_client_get_total_bytes(NullClient *client)
+{
+    uint64_t total = 0;
+
+    for (unsigned i = 0; i < client->num_channels; i++) {
+        for (const auto &stats : client->channels[i].stats) {
+            total += stats.bytes;
+        }
+    }
+    return total;
+}
+
+bool null_client_get_server_stats(NullClient *client, SpiceClientStats *stats)
+{
+    return client->red_client->get_stats(stats);
+}
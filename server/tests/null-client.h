@@ -0,0 +1,60 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * In process client which connects to the main, display and cursor
+ * channels of a server and discards everything it receives.
+ *
+ * Messages are still fully marshalled and compressed by the server so this
+ * can be used to measure the server side of the display pipeline without
+ * a real client. The client only answers the messages needed to keep the
+ * channels flowing (acks and pings).
+ */
+#ifndef __NULL_CLIENT_H__
+#define __NULL_CLIENT_H__
+
+#include <stdbool.h>
+#include <spice.h>
+
+SPICE_BEGIN_DECLS
+
+/* messages with a type above this are accounted together */
+#define NULL_CLIENT_MAX_MSG_TYPE 512
+
+typedef struct NullClient NullClient;
+
+typedef struct NullClientMsgStats {
+    uint64_t count;
+    uint64_t bytes;
+} NullClientMsgStats;
+
+NullClient *null_client_new(SpiceCoreInterface *core, SpiceServer *server);
+void null_client_destroy(NullClient *client);
+
+/* statistics of the messages received for a SPICE_CHANNEL_* channel,
+ * the size includes the message header */
+NullClientMsgStats null_client_get_msg_stats(NullClient *client, int channel_type,
+                                             uint16_t msg_type);
+uint64_t null_client_get_total_bytes(NullClient *client);
+
+/* statistics kept by the server for this client, see spice_server_get_client_stats,
+ * the result must be released with spice_server_free_client_stats */
+bool null_client_get_server_stats(NullClient *client, SpiceClientStats *stats);
+
+SPICE_END_DECLS
+
+#endif // __NULL_CLIENT_H__
@@ -30,6 +30,7 @@
 #include <pthread.h>
 #ifndef _WIN32
 #include <sys/wait.h>
+#include <sys/resource.h>
 #endif
 #include <fcntl.h>
 #include <glib.h>
@@ -38,6 +39,7 @@
 #include <spice/macros.h>
 #include "test-display-base.h"
 #include "test-glib-compat.h"
+#include "null-client.h"
 #include <common/log.h>
 
 static SpiceCoreInterface *core;
@@ -54,6 +56,16 @@ static GMainLoop *loop = NULL;
 static GAsyncQueue *display_queue = NULL;
 static GAsyncQueue *cursor_queue = NULL;
 static long total_size;
+static gint total_cmds = -1;
+static gint start_cmd = 0;
+
+/* benchmark mode, commands are sent to an in process client */
+static gboolean benchmark = FALSE;
+static NullClient *null_client = NULL;
+static gint64 benchmark_start;
+static pthread_mutex_t latency_mutex = PTHREAD_MUTEX_INITIALIZER;
+static GHashTable *cmd_times = NULL;
+static GArray *latencies = NULL;
 
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 static GSource *fill_source = NULL;
@@ -179,6 +191,14 @@ static int get_command_from(QXLInstance *qin, QXLCommandExt *ext, GAsyncQueue *q
 
     *ext = *cmd;
 
+    if (benchmark) {
+        gint64 now = g_get_monotonic_time() - benchmark_start;
+
+        pthread_mutex_lock(&latency_mutex);
+        g_hash_table_insert(cmd_times, cmd, GSIZE_TO_POINTER(now));
+        pthread_mutex_unlock(&latency_mutex);
+    }
+
     return TRUE;
 }
 
@@ -221,7 +241,20 @@ static void end_replay(void)
 
 static void release_resource(QXLInstance *qin, struct QXLReleaseInfoExt release_info)
 {
-    spice_replay_free_cmd(replay, (QXLCommandExt *)(uintptr_t)release_info.info->id);
+    QXLCommandExt *cmd = (QXLCommandExt *)(uintptr_t)release_info.info->id;
+
+    if (benchmark) {
+        gpointer start;
+
+        pthread_mutex_lock(&latency_mutex);
+        if (latencies && g_hash_table_lookup_extended(cmd_times, cmd, NULL, &start)) {
+            gint64 latency = g_get_monotonic_time() - benchmark_start - GPOINTER_TO_SIZE(start);
+            g_array_append_val(latencies, latency);
+            g_hash_table_remove(cmd_times, cmd);
+        }
+        pthread_mutex_unlock(&latency_mutex);
+    }
+    spice_replay_free_cmd(replay, cmd);
 }
 
 static int get_cursor_command(QXLInstance *qin, struct QXLCommandExt *ext)
@@ -291,13 +324,113 @@ static gboolean start_client(gchar *cmd, GError **error)
 static gboolean progress_timer(gpointer user_data)
 {
     FILE *fd = (FILE*) user_data;
-    /* it seems somehow thread safe, move to worker thread? */
-    double pos = (double)ftell(fd);
+    double pos;
 
+    if (total_cmds > 0) {
+        g_debug("%.2f%%", (double)(start_cmd + ncommands) / total_cmds * 100);
+        return TRUE;
+    }
+    /* it seems somehow thread safe, move to worker thread? */
+    pos = (double)ftell(fd);
     g_debug("%.2f%%", pos/total_size * 100);
     return TRUE;
 }
 
+static gint compare_latency(gconstpointer a, gconstpointer b)
+{
+    gint64 la = *(const gint64 *) a, lb = *(const gint64 *) b;
+
+    return la < lb ? -1 : la > lb;
+}
+
+static const char *message_name(int channel, int type)
+{
+    switch (channel) {
+    case SPICE_CHANNEL_DISPLAY:
+        switch (type) {
+        case SPICE_MSG_DISPLAY_MARK: return "mark";
+        case SPICE_MSG_DISPLAY_COPY_BITS: return "copy_bits";
+        case SPICE_MSG_DISPLAY_INVAL_LIST: return "inval_list";
+        case SPICE_MSG_DISPLAY_INVAL_ALL_PIXMAPS: return "inval_all_pixmaps";
+        case SPICE_MSG_DISPLAY_INVAL_PALETTE: return "inval_palette";
+        case SPICE_MSG_DISPLAY_INVAL_ALL_PALETTES: return "inval_all_palettes";
+        case SPICE_MSG_DISPLAY_STREAM_CREATE: return "stream_create";
+        case SPICE_MSG_DISPLAY_STREAM_DATA: return "stream_data";
+        case SPICE_MSG_DISPLAY_STREAM_CLIP: return "stream_clip";
+        case SPICE_MSG_DISPLAY_STREAM_DESTROY: return "stream_destroy";
+        case SPICE_MSG_DISPLAY_STREAM_DESTROY_ALL: return "stream_destroy_all";
+        case SPICE_MSG_DISPLAY_DRAW_FILL: return "draw_fill";
+        case SPICE_MSG_DISPLAY_DRAW_OPAQUE: return "draw_opaque";
+        case SPICE_MSG_DISPLAY_DRAW_COPY: return "draw_copy";
+        case SPICE_MSG_DISPLAY_DRAW_BLEND: return "draw_blend";
+        case SPICE_MSG_DISPLAY_DRAW_BLACKNESS: return "draw_blackness";
+        case SPICE_MSG_DISPLAY_DRAW_WHITENESS: return "draw_whiteness";
+        case SPICE_MSG_DISPLAY_DRAW_INVERS: return "draw_invers";
+        case SPICE_MSG_DISPLAY_DRAW_ROP3: return "draw_rop3";
+        case SPICE_MSG_DISPLAY_DRAW_STROKE: return "draw_stroke";
+        case SPICE_MSG_DISPLAY_DRAW_TEXT: return "draw_text";
+        case SPICE_MSG_DISPLAY_DRAW_TRANSPARENT: return "draw_transparent";
+        case SPICE_MSG_DISPLAY_DRAW_ALPHA_BLEND: return "draw_alpha_blend";
+        case SPICE_MSG_DISPLAY_SURFACE_CREATE: return "surface_create";
+        case SPICE_MSG_DISPLAY_SURFACE_DESTROY: return "surface_destroy";
+        case SPICE_MSG_DISPLAY_STREAM_DATA_SIZED: return "stream_data_sized";
+        case SPICE_MSG_DISPLAY_MONITORS_CONFIG: return "monitors_config";
+        case SPICE_MSG_DISPLAY_DRAW_COMPOSITE: return "draw_composite";
+        }
+        return "display";
+    case SPICE_CHANNEL_CURSOR:
+        return "cursor";
+    }
+    return "other";
+}
+
+static void print_benchmark_results(gint64 elapsed)
+{
+    static const int channels[] = { SPICE_CHANNEL_DISPLAY, SPICE_CHANNEL_CURSOR };
+    double secs = elapsed / (double) G_USEC_PER_SEC;
+    unsigned i;
+    int type;
+
+    g_print("Replayed %u commands in %.3f s, %.1f commands/s\n",
+            ncommands, secs, secs > 0 ? ncommands / secs : 0.0);
+
+    pthread_mutex_lock(&latency_mutex);
+    if (latencies->len > 0) {
+        g_array_sort(latencies, compare_latency);
+        g_print("Command latency: p50 %.3f ms, p99 %.3f ms, max %.3f ms (%u commands released)\n",
+                g_array_index(latencies, gint64, latencies->len / 2) / 1000.0,
+                g_array_index(latencies, gint64, latencies->len * 99 / 100) / 1000.0,
+                g_array_index(latencies, gint64, latencies->len - 1) / 1000.0,
+                latencies->len);
+    }
+    g_array_free(latencies, TRUE);
+    latencies = NULL;
+    pthread_mutex_unlock(&latency_mutex);
+
+    g_print("Sent %.3f MB to the client\n",
+            null_client_get_total_bytes(null_client) / (1024.0 * 1024.0));
+    for (i = 0; i < G_N_ELEMENTS(channels); i++) {
+        for (type = 0; type <= NULL_CLIENT_MAX_MSG_TYPE; type++) {
+            NullClientMsgStats stats = null_client_get_msg_stats(null_client, channels[i], type);
+            if (stats.count == 0) {
+                continue;
+            }
+            g_print("  %-20s %4d: %10" G_GUINT64_FORMAT " messages %12" G_GUINT64_FORMAT " bytes\n",
+                    message_name(channels[i], type), type, stats.count, stats.bytes);
+        }
+    }
+
+#ifndef _WIN32
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        g_print("CPU time: user %.3f s, system %.3f s\n",
+                usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6,
+                usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6);
+        g_print("Peak memory: %ld KB\n", usage.ru_maxrss);
+    }
+#endif
+}
+
 static void free_queue(GAsyncQueue *queue)
 {
     for (;;) {
@@ -336,6 +469,8 @@ int main(int argc, char **argv)
         { "slow", 's', 0, G_OPTION_ARG_INT, &slow, "Slow down replay. Delays USEC microseconds before each command", "USEC" },
         { "skip", 0, 0, G_OPTION_ARG_INT, &skip, "Skip 'slow' for the first n commands", NULL },
         { "count", 0, 0, G_OPTION_ARG_NONE, &print_count, "Print the number of commands processed", NULL },
+        { "start", 0, 0, G_OPTION_ARG_INT, &start_cmd, "Start the replay at the given command", "N" },
+        { "benchmark", 'b', 0, G_OPTION_ARG_NONE, &benchmark, "Replay as fast as possible to an in process client and print statistics", NULL },
         { "tls-port", 0, 0, G_OPTION_ARG_INT, &tls_port, "Secure server port", "PORT" },
         { "cacert-file", 0, 0, G_OPTION_ARG_FILENAME, &cacert_file, "TLS CA certificate", "FILE" },
         { "cert-file", 0, 0, G_OPTION_ARG_FILENAME, &cert_file, "TLS server certificate", "FILE" },
@@ -411,13 +546,18 @@ int main(int argc, char **argv)
     fseek(fd, 0L, SEEK_END);
     total_size = ftell(fd);
     fseek(fd, 0L, SEEK_SET);
-    if (total_size > 0)
+    if (total_size > 0 && !benchmark)
         g_timeout_add_seconds(1, progress_timer, fd);
     replay = spice_replay_new(fd, MAX_SURFACE_NUM);
     if (replay == NULL) {
         g_printerr("Error initializing replay\n");
         exit(1);
     }
+    total_cmds = spice_replay_get_num_cmds(replay);
+    if (start_cmd > 0 && spice_replay_seek(replay, start_cmd) < 0) {
+        g_printerr("Cannot start the replay at command %d\n", start_cmd);
+        exit(1);
+    }
 
     display_queue = g_async_queue_new();
     cursor_queue = g_async_queue_new();
@@ -448,16 +588,26 @@ int main(int argc, char **argv)
     g_free(key_file);
     cacert_file = cert_file = key_file = NULL;
 
-    spice_server_set_port(server, port);
     spice_server_set_noauth(server);
-
-    g_print("listening on port %d (insecure)\n", port);
+    if (!benchmark) {
+        spice_server_set_port(server, port);
+        g_print("listening on port %d (insecure)\n", port);
+    }
     spice_server_init(server, core);
 
     display_sin.base.sif = &display_sif.base;
     spice_server_add_interface(server, &display_sin.base);
 
-    if (client) {
+    if (benchmark) {
+        cmd_times = g_hash_table_new(NULL, NULL);
+        latencies = g_array_new(FALSE, FALSE, sizeof(gint64));
+        null_client = null_client_new(core, server);
+        benchmark_start = g_get_monotonic_time();
+        slow = 0;
+        wait = FALSE;
+        g_free(client);
+        client = NULL;
+    } else if (client) {
         start_client(client, &error);
         wait = TRUE;
         g_free(client);
@@ -474,11 +624,19 @@ int main(int argc, char **argv)
 
     if (print_count)
         g_print("Counted %d commands\n", ncommands);
+    if (benchmark) {
+        print_benchmark_results(g_get_monotonic_time() - benchmark_start);
+        null_client_destroy(null_client);
+        null_client = NULL;
+    }
 
     spice_server_destroy(server);
     free_queue(display_queue);
     free_queue(cursor_queue);
     end_replay();
+    if (cmd_times) {
+        g_hash_table_destroy(cmd_times);
+    }
 
     g_main_loop_unref(loop);
     basic_event_loop_destroy();
@@ -0,0 +1,144 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * Test the bilinear scaler used to downscale video streams.
+ */
+#include <config.h>
+
+#include <string.h>
+
+#include "test-glib-compat.h"
+#include "spice-bitmap-utils.h"
+
+#define WIDTH 12
+#define HEIGHT 9
+
+static uint8_t pixels[WIDTH * HEIGHT * 4];
+
+/* Fills a 32 bits bitmap split in two chunks with a horizontal gradient in
+ * red and a vertical gradient in green */
+static SpiceChunks *create_bitmap(SpiceBitmap *bitmap)
+{
+    SpiceChunks *chunks = spice_chunks_new(2);
+    int x, y;
+
+    for (y = 0; y < HEIGHT; y++) {
+        for (x = 0; x < WIDTH; x++) {
+            rgb32_pixel_t *pixel = (rgb32_pixel_t *) pixels + y * WIDTH + x;
+            pixel->r = x * 20;
+            pixel->g = y * 25;
+            pixel->b = 100;
+            pixel->pad = 0;
+        }
+    }
+    chunks->data_size = sizeof(pixels);
+    chunks->chunk[0].data = pixels;
+    chunks->chunk[0].len = 4 * WIDTH * 4;
+    chunks->chunk[1].data = pixels + chunks->chunk[0].len;
+    chunks->chunk[1].len = sizeof(pixels) - chunks->chunk[0].len;
+
+    memset(bitmap, 0, sizeof(*bitmap));
+    bitmap->format = SPICE_BITMAP_FMT_32BIT;
+    bitmap->x = WIDTH;
+    bitmap->y = HEIGHT;
+    bitmap->stride = WIDTH * 4;
+    bitmap->data = chunks;
+    return chunks;
+}
+
+static void test_scale_down(void)
+{
+    SpiceBitmap bitmap;
+    SpiceChunks *chunks = create_bitmap(&bitmap);
+    const SpiceRect src = { .left = 2, .top = 1, .right = 11, .bottom = 7 };
+    /* source lines 1.25, 2.75, 4.25 and 5.75 */
+    const uint8_t green[4] = { 31, 69, 106, 144 };
+    BitmapScaler scaler = { 0 };
+    rgb32_pixel_t out[4][6];
+    rgb32_pixel_t out_same[HEIGHT][WIDTH];
+    const SpiceRect all = { .left = 0, .top = 0, .right = WIDTH, .bottom = HEIGHT };
+    int x, y, n;
+
+    /* the buffers of the scaler are reused or reallocated on the next frames */
+    for (n = 0; n < 2; n++) {
+        memset(out, 0, sizeof(out));
+        g_assert_true(bitmap_scale_to_rgb32(&scaler, &bitmap, &src, TRUE, (uint8_t *) out,
+                                            sizeof(out[0]), 6, 4));
+        for (y = 0; y < 4; y++) {
+            for (x = 0; x < 6; x++) {
+                /* a linear gradient stays linear, sampled at the pixel centers */
+                g_assert_cmpint(out[y][x].r, ==, 45 + x * 30);
+                g_assert_cmpint(out[y][x].g, ==, green[y]);
+                g_assert_cmpint(out[y][x].b, ==, 100);
+            }
+        }
+        g_assert_true(bitmap_scale_to_rgb32(&scaler, &bitmap, &all, TRUE, (uint8_t *) out_same,
+                                            sizeof(out_same[0]), WIDTH, HEIGHT));
+        g_assert_cmpmem(out_same, sizeof(out_same), pixels, sizeof(pixels));
+    }
+
+    bitmap_scaler_clear(&scaler);
+    spice_chunks_destroy(chunks);
+}
+
+static void test_scale_same_size(void)
+{
+    SpiceBitmap bitmap;
+    SpiceChunks *chunks = create_bitmap(&bitmap);
+    const SpiceRect src = { .left = 0, .top = 0, .right = WIDTH, .bottom = HEIGHT };
+    BitmapScaler scaler = { 0 };
+    rgb32_pixel_t out[HEIGHT][WIDTH];
+
+    g_assert_true(bitmap_scale_to_rgb32(&scaler, &bitmap, &src, TRUE, (uint8_t *) out,
+                                        sizeof(out[0]), WIDTH, HEIGHT));
+    g_assert_cmpmem(out, sizeof(out), pixels, sizeof(pixels));
+
+    bitmap_scaler_clear(&scaler);
+    spice_chunks_destroy(chunks);
+}
+
+static void test_scale_invalid(void)
+{
+    SpiceBitmap bitmap;
+    SpiceChunks *chunks = create_bitmap(&bitmap);
+    const SpiceRect outside = { .left = 0, .top = 0, .right = WIDTH + 1, .bottom = HEIGHT };
+    const SpiceRect src = { .left = 0, .top = 0, .right = WIDTH, .bottom = HEIGHT };
+    BitmapScaler scaler = { 0 };
+    rgb32_pixel_t out[HEIGHT][WIDTH];
+
+    g_assert_false(bitmap_scale_to_rgb32(&scaler, &bitmap, &outside, TRUE, (uint8_t *) out,
+                                         sizeof(out[0]), 4, 4));
+
+    bitmap.format = SPICE_BITMAP_FMT_8BIT_A;
+    g_assert_false(bitmap_scale_to_rgb32(&scaler, &bitmap, &src, TRUE, (uint8_t *) out,
+                                         sizeof(out[0]), 4, 4));
+
+    bitmap_scaler_clear(&scaler);
+    spice_chunks_destroy(chunks);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/server/bitmap-scale/down", test_scale_down);
+    g_test_add_func("/server/bitmap-scale/same-size", test_scale_same_size);
+    g_test_add_func("/server/bitmap-scale/invalid", test_scale_invalid);
+
+    return g_test_run();
+}
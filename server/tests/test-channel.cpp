@@ -19,6 +19,7 @@
  * This test allocate a channel and do some test sending some messages
  */
 #include <config.h>
+#include <cstddef>
 #include <unistd.h>
 #include <spice.h>
 
@@ -196,6 +197,35 @@ static RedStream *create_dummy_stream(SpiceServer *server, int *p_socket)
     return stream;
 }
 
+// the messages sent before and after the ACK are accounted
+static void check_client_stats(RedClient *client)
+{
+    SpiceClientStats stats;
+
+    stats.size = sizeof(stats);
+    stats.channel_size = sizeof(SpiceClientChannelStats);
+    g_assert_true(client->get_stats(&stats));
+    g_assert_cmpuint(stats.num_channels, ==, 2);
+    g_assert_cmpuint(stats.queued_memory, ==, 0);
+
+    SpiceClientChannelStats *channel_stats = nullptr;
+    for (uint32_t i = 0; i < stats.num_channels; i++) {
+        if (stats.channels[i].type == SPICE_CHANNEL_PORT) {
+            channel_stats = &stats.channels[i];
+        }
+    }
+    g_assert_nonnull(channel_stats);
+    g_assert_cmpint(channel_stats->id, ==, 0);
+    g_assert_cmpuint(channel_stats->sent_messages, >, 20);
+    g_assert_cmpuint(channel_stats->sent_bytes, >=, channel_stats->sent_messages * 6);
+    g_assert_cmpuint(channel_stats->size, ==, sizeof(SpiceClientChannelStats));
+    g_free(stats.channels);
+
+    // structures smaller than the first version are refused
+    stats.size = offsetof(SpiceClientStats, channels);
+    g_assert_false(client->get_stats(&stats));
+}
+
 static void channel_loop()
 {
     SpiceCoreInterface *core;
@@ -258,6 +288,8 @@ static void channel_loop()
     // start all test
     basic_event_loop_mainloop();
 
+    check_client_stats(client);
+
     // cleanup
     client->destroy();
     main_channel.reset();
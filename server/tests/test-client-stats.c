@@ -0,0 +1,96 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * Check the image statistics reported for a client receiving
+ * LZ compressed images.
+ */
+#include <config.h>
+
+#include <string.h>
+
+#include "test-glib-compat.h"
+#include "test-display-base.h"
+#include "null-client.h"
+
+#define CHECK_MS 100
+#define MAX_CHECKS 100
+
+static SpiceCoreInterface *core;
+static SpiceServer *server;
+static SpiceTimer *check_timer;
+static NullClient *client;
+static SpiceClientStats stats;
+static int num_checks;
+
+static const CommandType simple_commands[] = {
+    SIMPLE_DRAW,
+    SIMPLE_UPDATE,
+};
+
+static void check_stats(SPICE_GNUC_UNUSED void *opaque)
+{
+    spice_server_free_client_stats(server, &stats, 1);
+    memset(&stats, 0, sizeof(stats));
+    stats.size = sizeof(stats);
+    stats.channel_size = sizeof(SpiceClientChannelStats);
+    g_assert_true(null_client_get_server_stats(client, &stats));
+
+    if (stats.images.lz_rgb > 0 || ++num_checks >= MAX_CHECKS) {
+        basic_event_loop_quit();
+        return;
+    }
+    core->timer_start(check_timer, CHECK_MS);
+}
+
+static void test_client_stats_images(void)
+{
+    Test *test;
+
+    core = basic_event_loop_init();
+    test = test_new(core);
+    server = test->server;
+    spice_server_set_image_compression(server, SPICE_IMAGE_COMPRESSION_LZ);
+    test_add_display_interface(test);
+    test_set_simple_command_list(test, simple_commands, G_N_ELEMENTS(simple_commands));
+    client = null_client_new(core, server);
+
+    check_timer = core->timer_add(check_stats, NULL);
+    core->timer_start(check_timer, CHECK_MS);
+    basic_event_loop_mainloop();
+
+    // the images are compressed as requested and accounted by type
+    g_assert_cmpuint(stats.images.lz_rgb, >, 0);
+    g_assert_cmpuint(stats.images.quic, ==, 0);
+    g_assert_cmpuint(stats.images.glz_rgb, ==, 0);
+    g_assert_cmpuint(stats.num_channels, >=, 3);
+    spice_server_free_client_stats(server, &stats, 1);
+
+    core->timer_remove(check_timer);
+    null_client_destroy(client);
+    test_destroy(test);
+    basic_event_loop_destroy();
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/server/client-stats-images", test_client_stats_images);
+
+    return g_test_run();
+}
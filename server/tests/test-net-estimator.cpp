@@ -0,0 +1,163 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+ * Test the estimate of the link to a client
+ */
+#include <config.h>
+
+#include "test-glib-compat.h"
+#include "net-estimator.h"
+#include "utils.h"
+
+#define MBPS (UINT64_C(1000) * 1000)
+
+/* simulates one second of traffic at @bit_rate */
+static uint64_t send_period(NetEstimator &estimator, uint64_t now,
+                            uint64_t bit_rate, bool saturated)
+{
+    for (int i = 0; i < 100; i++) {
+        estimator.data_sent(bit_rate / 8 / 100, now + i * NSEC_PER_SEC / 100);
+    }
+    if (saturated) {
+        estimator.send_blocked(0);
+    }
+    now += NSEC_PER_SEC;
+    estimator.update(now);
+    return now;
+}
+
+static void test_unknown(void)
+{
+    NetEstimator estimator;
+    uint64_t now = NSEC_PER_SEC;
+
+    estimator.update(now);
+    /* not saturated, nothing is known about the link */
+    now = send_period(estimator, now, 2 * MBPS, false);
+    g_assert_cmpuint(estimator.get_bit_rate(), ==, 0);
+    g_assert_cmpuint(estimator.get_roundtrip_ns(), ==, 0);
+}
+
+static void test_saturated(void)
+{
+    NetEstimator estimator;
+    uint64_t now = NSEC_PER_SEC;
+
+    estimator.update(now);
+    now = send_period(estimator, now, 100 * MBPS, true);
+    g_assert_cmpuint(estimator.get_bit_rate(), ==, 100 * MBPS);
+
+    /* the client moves to a slower network */
+    for (int i = 0; i < 20; i++) {
+        now = send_period(estimator, now, 4 * MBPS, true);
+    }
+    g_assert_cmpuint(estimator.get_bit_rate(), <, 5 * MBPS);
+
+    /* not saturated: only raises the estimate */
+    now = send_period(estimator, now, 1 * MBPS, false);
+    g_assert_cmpuint(estimator.get_bit_rate(), >, 3 * MBPS);
+    for (int i = 0; i < 20; i++) {
+        now = send_period(estimator, now, 50 * MBPS, false);
+    }
+    g_assert_cmpuint(estimator.get_bit_rate(), >, 45 * MBPS);
+}
+
+static void test_delivery_rate(void)
+{
+    NetEstimator estimator;
+    uint64_t now = NSEC_PER_SEC;
+
+    estimator.set_initial(10 * MBPS, 20 * NSEC_PER_MILLISEC);
+    estimator.update(now);
+
+    /* the rate measured by the kernel is preferred to the data sent */
+    estimator.data_sent(MBPS / 8, now);
+    estimator.send_blocked(30 * MBPS);
+    estimator.send_blocked(50 * MBPS);
+    now += NSEC_PER_SEC;
+    estimator.update(now);
+    g_assert_cmpuint(estimator.get_bit_rate(), ==, (10 * MBPS * 3 + 50 * MBPS) / 4);
+}
+
+/* without delivery rate the link is measured while it is busy */
+static void test_busy(void)
+{
+    NetEstimator estimator;
+    uint64_t now = NSEC_PER_SEC;
+
+    estimator.update(now);
+
+    /* 1 MB sent in 100 ms then the link is idle */
+    estimator.data_sent(500 * 1000, now + 200 * NSEC_PER_MILLISEC);
+    estimator.send_blocked(0);
+    estimator.send_unblocked(now + 250 * NSEC_PER_MILLISEC);
+    estimator.data_sent(500 * 1000, now + 250 * NSEC_PER_MILLISEC);
+    estimator.send_blocked(0);
+    estimator.send_unblocked(now + 300 * NSEC_PER_MILLISEC);
+    estimator.data_sent(1000, now + 300 * NSEC_PER_MILLISEC);
+    now += NSEC_PER_SEC;
+    estimator.update(now);
+    g_assert_cmpuint(estimator.get_bit_rate(), ==, 80 * MBPS);
+
+    /* still full at the end of the period, busy since the first send */
+    estimator.data_sent(1000 * 1000, now + 500 * NSEC_PER_MILLISEC);
+    estimator.send_blocked(0);
+    now += NSEC_PER_SEC;
+    estimator.update(now);
+    g_assert_cmpuint(estimator.get_bit_rate(), ==, (80 * MBPS * 3 + 16 * MBPS) / 4);
+}
+
+static void test_roundtrip(void)
+{
+    NetEstimator estimator;
+    uint64_t now = NSEC_PER_SEC;
+
+    estimator.set_initial(10 * MBPS, 20 * NSEC_PER_MILLISEC);
+    estimator.update(now);
+
+    /* the smallest sample of the period is used */
+    estimator.add_roundtrip(80 * NSEC_PER_MILLISEC);
+    estimator.add_roundtrip(4 * NSEC_PER_MILLISEC);
+    estimator.add_roundtrip(0);
+    now += NSEC_PER_SEC;
+    estimator.update(now);
+    g_assert_cmpuint(estimator.get_roundtrip_ns(), ==, 16 * NSEC_PER_MILLISEC);
+
+    /* periods too short are merged with the next one */
+    estimator.add_roundtrip(16 * NSEC_PER_MILLISEC);
+    now += NSEC_PER_MILLISEC;
+    estimator.update(now);
+    g_assert_cmpuint(estimator.get_roundtrip_ns(), ==, 16 * NSEC_PER_MILLISEC);
+    now += NSEC_PER_SEC;
+    estimator.update(now);
+    g_assert_cmpuint(estimator.get_roundtrip_ns(), ==, 16 * NSEC_PER_MILLISEC);
+    g_assert_cmpuint(estimator.get_bit_rate(), ==, 10 * MBPS);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, nullptr);
+
+    g_test_add_func("/server/net-estimator/unknown", test_unknown);
+    g_test_add_func("/server/net-estimator/saturated", test_saturated);
+    g_test_add_func("/server/net-estimator/delivery-rate", test_delivery_rate);
+    g_test_add_func("/server/net-estimator/busy", test_busy);
+    g_test_add_func("/server/net-estimator/roundtrip", test_roundtrip);
+
+    return g_test_run();
+}
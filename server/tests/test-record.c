@@ -92,14 +92,28 @@ test_record(bool compress)
     int version;
     g_assert_nonnull(fgets(line, sizeof(line), f));
     g_assert_cmpint(sscanf(line, "SPICE_REPLAY %d", &version), ==, 1);
+    g_assert_cmpint(version, ==, RECORD_FORMAT_VERSION);
 
-    int w, t;
-    g_assert_nonnull(fgets(line, sizeof(line), f));
-    g_assert_cmpint(sscanf(line, "event %*d %d %d", &w, &t), ==, 2);
-    g_assert_cmpint(w, ==, 1);
-    g_assert_cmpint(t, ==, 123);
+    RecordBlockHeader header;
+    g_assert_cmpint(fread(&header, sizeof(header), 1, f), ==, 1);
+    g_assert_cmpuint(GUINT32_FROM_LE(header.magic), ==, RECORD_BLOCK_MAGIC);
+    g_assert_cmpuint(GUINT32_FROM_LE(header.what), ==, 1);
+    g_assert_cmpuint(GUINT32_FROM_LE(header.type), ==, 123);
+    g_assert_cmpuint(GUINT32_FROM_LE(header.size), ==, 0);
+
+    // the index follows the blocks
+    RecordIndexEntry entry;
+    RecordIndexFooter footer;
+    g_assert_cmpint(fread(&entry, sizeof(entry), 1, f), ==, 1);
+    g_assert_cmpuint(GUINT64_FROM_LE(entry.offset), ==, strlen(line));
+    g_assert_cmpuint(GUINT32_FROM_LE(entry.what), ==, 1);
+    g_assert_cmpuint(GUINT32_FROM_LE(entry.type), ==, 123);
+    g_assert_cmpint(fread(&footer, sizeof(footer), 1, f), ==, 1);
+    g_assert_cmpuint(GUINT64_FROM_LE(footer.index_offset), ==, strlen(line) + sizeof(header));
+    g_assert_cmpuint(GUINT32_FROM_LE(footer.num_entries), ==, 1);
+    g_assert_cmpuint(GUINT32_FROM_LE(footer.magic), ==, RECORD_INDEX_MAGIC);
 
-    g_assert_null(fgets(line, sizeof(line), f));
+    g_assert_cmpint(fgetc(f), ==, EOF);
 
     if (!compress) {
         fclose(f);
@@ -111,6 +125,226 @@ test_record(bool compress)
     unlink(fn);
 }
 
+static bool
+record_update(RedRecord *rec, RedMemSlotInfo *mem_info, uint32_t update_id)
+{
+    QXLUpdateCmd update;
+    QXLCommandExt ext_cmd;
+
+    memset(&update, 0, sizeof(update));
+    update.area.right = 64;
+    update.area.bottom = 32;
+    update.update_id = update_id;
+
+    memset(&ext_cmd, 0, sizeof(ext_cmd));
+    ext_cmd.cmd.type = QXL_CMD_UPDATE;
+    ext_cmd.cmd.data = (uintptr_t) &update;
+    return red_record_qxl_command(rec, mem_info, ext_cmd);
+}
+
+static bool
+record_surface_create(RedRecord *rec, RedMemSlotInfo *mem_info)
+{
+    QXLSurfaceCmd surface;
+    QXLCommandExt ext_cmd;
+
+    memset(&surface, 0, sizeof(surface));
+    surface.type = QXL_SURFACE_CMD_CREATE;
+    surface.u.surface_create.format = SPICE_SURFACE_FMT_32_xRGB;
+    surface.u.surface_create.width = 64;
+    surface.u.surface_create.height = 32;
+    surface.u.surface_create.stride = 64 * 4;
+
+    memset(&ext_cmd, 0, sizeof(ext_cmd));
+    ext_cmd.cmd.type = QXL_CMD_SURFACE;
+    ext_cmd.cmd.data = (uintptr_t) &surface;
+    return red_record_qxl_command(rec, mem_info, ext_cmd);
+}
+
+static uint32_t
+replay_update_id(SpiceReplay *replay)
+{
+    QXLCommandExt *cmd = spice_replay_next_cmd(replay, NULL);
+    uint32_t update_id;
+
+    g_assert_nonnull(cmd);
+    g_assert_cmpint(cmd->cmd.type, ==, QXL_CMD_UPDATE);
+    update_id = ((QXLUpdateCmd *) (uintptr_t) cmd->cmd.data)->update_id;
+    spice_replay_free_cmd(replay, cmd);
+    return update_id;
+}
+
+static void
+test_replay_seek(void)
+{
+    const char *fn = OUTPUT_FILENAME;
+    RedMemSlotInfo mem_info;
+    RedRecord *rec;
+    SpiceReplay *replay;
+    uint32_t i;
+
+    g_unsetenv("SPICE_WORKER_RECORD_FILTER");
+    memslot_info_init(&mem_info, 1, 1, 1, 1, 0);
+    memslot_info_add_slot(&mem_info, 0, 0, 0, 0, UINTPTR_MAX, 0);
+
+    rec = red_record_new(fn);
+    for (i = 0; i < 3; i++) {
+        record_update(rec, &mem_info, 100 + i);
+    }
+    red_record_unref(rec);
+    memslot_info_destroy(&mem_info);
+
+    replay = spice_replay_new(fopen(fn, "rb"), 16);
+    g_assert_nonnull(replay);
+    g_assert_cmpint(spice_replay_get_num_cmds(replay), ==, 3);
+
+    g_assert_cmpint(spice_replay_seek(replay, 2), ==, 0);
+    g_assert_cmpuint(replay_update_id(replay), ==, 102);
+    g_assert_null(spice_replay_next_cmd(replay, NULL));
+
+    g_assert_cmpint(spice_replay_seek(replay, 0), ==, 0);
+    for (i = 0; i < 3; i++) {
+        g_assert_cmpuint(replay_update_id(replay), ==, 100 + i);
+    }
+    g_assert_cmpint(spice_replay_seek(replay, 3), ==, -1);
+
+    spice_replay_free(replay);
+    unlink(fn);
+}
+
+#ifndef _WIN32
+#define DROP_TEST_UPDATES 50000
+
+static unsigned dropped_replayed;
+
+static void
+count_dropped(SPICE_GNUC_UNUSED const gchar *log_domain,
+              SPICE_GNUC_UNUSED GLogLevelFlags log_level,
+              const gchar *message, SPICE_GNUC_UNUSED gpointer user_data)
+{
+    int counter, dropped;
+
+    if (sscanf(message, "%d: %d commands were dropped while recording",
+               &counter, &dropped) == 2) {
+        dropped_replayed += dropped;
+    }
+}
+
+// the filter writes the file after red_record_unref returned, wait for the
+// index which is written last
+static void
+wait_record_index(const char *fn)
+{
+    int n;
+
+    for (n = 0; n < 100; ++n) {
+        FILE *f = fopen(fn, "rb");
+        if (f) {
+            RecordIndexFooter footer;
+            long size;
+            bool complete = false;
+
+            fseek(f, 0, SEEK_END);
+            size = ftell(f);
+            if (size >= (long) sizeof(footer) &&
+                fseek(f, size - sizeof(footer), SEEK_SET) == 0 &&
+                fread(&footer, sizeof(footer), 1, f) == 1 &&
+                GUINT32_FROM_LE(footer.magic) == RECORD_INDEX_MAGIC) {
+                complete = GUINT64_FROM_LE(footer.index_offset) +
+                    GUINT32_FROM_LE(footer.num_entries) * sizeof(RecordIndexEntry) +
+                    sizeof(footer) == (unsigned long) size;
+            }
+            fclose(f);
+            if (complete) {
+                return;
+            }
+        }
+        usleep(100000);
+    }
+    g_assert_not_reached();
+}
+
+static void
+test_record_drop(void)
+{
+    const char *fn = OUTPUT_FILENAME;
+    RedMemSlotInfo mem_info;
+    RedRecord *rec;
+    SpiceReplay *replay;
+    QXLCommandExt *cmd;
+    unsigned recorded = 0, dropped_indexed = 0;
+    uint32_t i;
+
+    // the filter does not read for a while so the queue fills up
+    g_setenv("SPICE_WORKER_RECORD_FILTER", "sh -c 'sleep 1; exec cat'", 1);
+    g_setenv("SPICE_WORKER_RECORD_QUEUE_SIZE", "1", 1);
+    g_setenv("SPICE_WORKER_RECORD_POLICY", "drop", 1);
+    memslot_info_init(&mem_info, 1, 1, 1, 1, 0);
+    memslot_info_add_slot(&mem_info, 0, 0, 0, 0, UINTPTR_MAX, 0);
+
+    unlink(fn);
+    rec = red_record_new(fn);
+    g_assert_nonnull(rec);
+    for (i = 0; i < DROP_TEST_UPDATES; i++) {
+        if (record_update(rec, &mem_info, i)) {
+            recorded++;
+        }
+    }
+    // surface commands are kept even if the queue is full
+    g_assert_true(record_surface_create(rec, &mem_info));
+    red_record_unref(rec);
+    memslot_info_destroy(&mem_info);
+    g_unsetenv("SPICE_WORKER_RECORD_FILTER");
+    g_unsetenv("SPICE_WORKER_RECORD_QUEUE_SIZE");
+    g_unsetenv("SPICE_WORKER_RECORD_POLICY");
+
+    g_assert_cmpuint(recorded, >, 0);
+    g_assert_cmpuint(recorded, <, DROP_TEST_UPDATES);
+    wait_record_index(fn);
+
+    // the dropped commands are recorded in the index
+    FILE *f = fopen(fn, "rb");
+    RecordIndexFooter footer;
+    RecordIndexEntry entry;
+    g_assert_nonnull(f);
+    g_assert_cmpint(fseek(f, -(long) sizeof(footer), SEEK_END), ==, 0);
+    g_assert_cmpint(fread(&footer, sizeof(footer), 1, f), ==, 1);
+    g_assert_cmpint(fseek(f, GUINT64_FROM_LE(footer.index_offset), SEEK_SET), ==, 0);
+    for (i = 0; i < GUINT32_FROM_LE(footer.num_entries); i++) {
+        g_assert_cmpint(fread(&entry, sizeof(entry), 1, f), ==, 1);
+        if (GUINT32_FROM_LE(entry.what) == 2) {
+            g_assert_cmpuint(GUINT32_FROM_LE(entry.type), >, 0);
+            dropped_indexed += GUINT32_FROM_LE(entry.type);
+        }
+    }
+    fclose(f);
+    g_assert_cmpuint(recorded + dropped_indexed, ==, DROP_TEST_UPDATES);
+
+    // the replay reports the dropped commands and gets the kept ones
+    replay = spice_replay_new(fopen(fn, "rb"), 16);
+    g_assert_nonnull(replay);
+    g_assert_cmpint(spice_replay_get_num_cmds(replay), ==, recorded + 1);
+
+    dropped_replayed = 0;
+    guint handler = g_log_set_handler(G_LOG_DOMAIN, G_LOG_LEVEL_WARNING, count_dropped, NULL);
+    for (i = 0; i < recorded; i++) {
+        replay_update_id(replay);
+    }
+    cmd = spice_replay_next_cmd(replay, NULL);
+    g_assert_nonnull(cmd);
+    g_assert_cmpint(cmd->cmd.type, ==, QXL_CMD_SURFACE);
+    g_assert_cmpint(((QXLSurfaceCmd *) (uintptr_t) cmd->cmd.data)->type, ==,
+                    QXL_SURFACE_CMD_CREATE);
+    spice_replay_free_cmd(replay, cmd);
+    g_assert_null(spice_replay_next_cmd(replay, NULL));
+    g_log_remove_handler(G_LOG_DOMAIN, handler);
+    g_assert_cmpuint(dropped_replayed, ==, dropped_indexed);
+
+    spice_replay_free(replay);
+    unlink(fn);
+}
+#endif
+
 int
 main(void)
 {
@@ -118,6 +352,10 @@ main(void)
     // TODO implement on Windows
 #ifndef _WIN32
     test_record(true);
+#endif
+    test_replay_seek();
+#ifndef _WIN32
+    test_record_drop();
 #endif
     return 0;
 }
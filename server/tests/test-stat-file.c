@@ -106,6 +106,65 @@ static void stat_file_start(void)
     stat_file_free(stat_file);
 }
 
+static void stat_file_histogram_buckets(void)
+{
+    unsigned i;
+
+    g_assert_cmpuint(stat_histogram_bucket(0),==,0);
+    g_assert_cmpuint(stat_histogram_bucket(1023),==,0);
+    g_assert_cmpuint(stat_histogram_bucket(UINT64_MAX),==,STAT_HISTOGRAM_NUM_BUCKETS - 1);
+
+    /* each bucket starts where the previous one ends */
+    for (i = 0; i < STAT_HISTOGRAM_NUM_BUCKETS - 1; ++i) {
+        uint64_t limit = stat_histogram_bucket_limit(i);
+        g_assert_cmpuint(limit,>,0);
+        g_assert_cmpuint(stat_histogram_bucket(limit - 1),==,i);
+        g_assert_cmpuint(stat_histogram_bucket(limit),==,i + 1);
+    }
+    g_assert_cmpuint(stat_histogram_bucket_limit(STAT_HISTOGRAM_NUM_BUCKETS - 1),==,0);
+}
+
+static void stat_file_histogram(void)
+{
+    RedStatFile *stat_file;
+    StatNodeRef ref, ref2;
+    StatHistogramValues values, values2;
+    const unsigned histogram_nodes = STAT_HISTOGRAM_NUM_BUCKETS + 3;
+    unsigned i;
+
+    stat_file = stat_file_new(histogram_nodes + 1);
+    g_assert_nonnull(stat_file);
+
+    ref = stat_file_add_histogram(stat_file, INVALID_STAT_REF, "histogram", TRUE, &values);
+    g_assert_cmpuint(ref,!=,INVALID_STAT_REF);
+    g_assert_nonnull(values.count);
+    g_assert_nonnull(values.sum);
+    for (i = 0; i < STAT_HISTOGRAM_NUM_BUCKETS; ++i) {
+        g_assert_nonnull(values.buckets[i]);
+    }
+
+    /* adding again gives the same counters */
+    ref2 = stat_file_add_histogram(stat_file, INVALID_STAT_REF, "histogram", TRUE, &values2);
+    g_assert_cmpuint(ref2,==,ref);
+    g_assert(memcmp(&values, &values2, sizeof(values)) == 0);
+
+    /* not enough space, nothing should be left */
+    ref2 = stat_file_add_histogram(stat_file, INVALID_STAT_REF, "other", TRUE, &values2);
+    g_assert_cmpuint(ref2,==,INVALID_STAT_REF);
+    g_assert_null(values2.count);
+    ref2 = stat_file_add_node(stat_file, INVALID_STAT_REF, "node", TRUE);
+    g_assert_cmpuint(ref2,!=,INVALID_STAT_REF);
+    stat_file_remove_node(stat_file, ref2);
+
+    /* removing frees all the nodes */
+    stat_file_remove_histogram(stat_file, ref, &values);
+    g_assert_null(values.count);
+    ref = stat_file_add_histogram(stat_file, INVALID_STAT_REF, "other", TRUE, &values);
+    g_assert_cmpuint(ref,!=,INVALID_STAT_REF);
+
+    stat_file_unlink(stat_file);
+    stat_file_free(stat_file);
+}
 
 int main(int argc, char *argv[])
 {
@@ -113,6 +172,8 @@ int main(int argc, char *argv[])
 
     g_test_add_func("/server/stat-file", stat_file);
     g_test_add_func("/server/stat-file-start", stat_file_start);
+    g_test_add_func("/server/stat-file-histogram-buckets", stat_file_histogram_buckets);
+    g_test_add_func("/server/stat-file-histogram", stat_file_histogram);
 
     return g_test_run();
 }
@@ -24,6 +24,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <string>
 
 #include <unistd.h>
 
@@ -105,6 +106,10 @@ check_vmc_error_message()
 
 static int num_send_data_calls = 0;
 static size_t send_data_bytes = 0;
+static int num_new_data_item_calls = 0;
+static std::string last_frame;
+// emulate a channel without stream, which drops the frames
+static bool drop_frames = false;
 
 StreamChannel::StreamChannel(RedsState *reds, uint32_t id):
     RedChannel(reds, SPICE_CHANNEL_DISPLAY, id, RedChannel::HandleAcks)
@@ -117,11 +122,32 @@ StreamChannel::change_format(const StreamMsgFormat *fmt)
 {
 }
 
+struct TestDataItem: public RedPipeItem {
+    TestDataItem(size_t size): RedPipeItem(0), size(size) {}
+    size_t size;
+    uint8_t data[];
+};
+
+RedPipeItemPtr
+StreamChannel::new_data_item(size_t size, uint8_t **data)
+{
+    auto item = new (size) TestDataItem(size);
+    ++num_new_data_item_calls;
+    *data = item->data;
+    return RedPipeItemPtr(item);
+}
+
 void
-StreamChannel::send_data(const void *data, size_t size, uint32_t mm_time)
+StreamChannel::send_data(RedPipeItemPtr item, uint32_t mm_time)
 {
+    auto data_item = static_cast<TestDataItem*>(item.get());
+
+    last_frame.assign(reinterpret_cast<const char *>(data_item->data), data_item->size);
+    if (drop_frames) {
+        return;
+    }
     ++num_send_data_calls;
-    send_data_bytes += size;
+    send_data_bytes += data_item->size;
 }
 
 void
@@ -167,6 +193,9 @@ static void test_stream_device_setup(TestFixture *fixture, gconstpointer user_da
 
     num_send_data_calls = 0;
     send_data_bytes = 0;
+    num_new_data_item_calls = 0;
+    last_frame.clear();
+    drop_frames = false;
 }
 
 static void test_stream_device_teardown(TestFixture *fixture, gconstpointer user_data)
@@ -382,6 +411,35 @@ static void test_stream_device_data_message(TestFixture *fixture, gconstpointer
     g_assert_cmpint(send_data_bytes, ==, 1017);
 }
 
+// frames sent while the channel has no stream (before the format or after
+// a stop) are dropped, each following frame must get its own buffer
+static void test_stream_device_data_dropped(TestFixture *fixture, gconstpointer user_data)
+{
+    uint8_t *p = vmc->message;
+
+    drop_frames = true;
+    p = add_stream_hdr(p, STREAM_TYPE_DATA, 5);
+    memcpy(p, "hello", 5);
+    p += 5;
+    p = add_stream_hdr(p, STREAM_TYPE_DATA, 7);
+    memcpy(p, "goodbye", 7);
+    p += 7;
+    vmc_emu_add_read_till(vmc, p);
+
+    test_kick();
+
+    // we should read all data
+    g_assert(vmc->message_sizes_curr - vmc->message_sizes == 1);
+
+    // we should have no data from the device
+    discard_server_capabilities();
+    g_assert_cmpint(vmc->write_pos, ==, 0);
+
+    g_assert_cmpint(num_new_data_item_calls, ==, 2);
+    g_assert_cmpint(num_send_data_calls, ==, 0);
+    g_assert_cmpstr(last_frame.c_str(), ==, "goodbye");
+}
+
 static void test_display_info(TestFixture *fixture, gconstpointer user_data)
 {
     // initialize a QXL interface. This must be done before receiving the display info message from
@@ -475,6 +533,8 @@ int main(int argc, char *argv[])
              test_stream_device_huge_data, nullptr);
     test_add("/server/stream-device-data-message",
              test_stream_device_data_message, nullptr);
+    test_add("/server/stream-device-data-dropped",
+             test_stream_device_data_dropped, nullptr);
     test_add("/server/display-info", test_display_info, nullptr);
 
     return g_test_run();
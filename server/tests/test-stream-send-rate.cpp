@@ -0,0 +1,119 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+ * Test the estimate of the rate frames can be sent to a stream client
+ */
+#include <config.h>
+
+#include "test-glib-compat.h"
+#include "stream-send-rate.h"
+#include "utils.h"
+
+#define MBPS (UINT64_C(1000) * 1000)
+#define FRAME_SIZE 100000
+
+/* sends @num_frames frames at @bit_rate, every frame is queued
+ * when the previous one starts to be sent */
+static uint64_t send_queued_frames(StreamSendRate &send_rate, uint64_t now,
+                                   uint64_t bit_rate, int num_frames)
+{
+    const uint64_t send_time = FRAME_SIZE * 8 * NSEC_PER_SEC / bit_rate;
+
+    for (int i = 0; i < num_frames; i++) {
+        send_rate.frame_sending(now, now - send_time, FRAME_SIZE);
+        now += send_time;
+    }
+    return now;
+}
+
+/* sends @num_frames frames, one every @interval, the link is idle
+ * between the frames */
+static uint64_t send_paced_frames(StreamSendRate &send_rate, uint64_t now,
+                                  uint64_t interval, int num_frames)
+{
+    for (int i = 0; i < num_frames; i++) {
+        send_rate.frame_sending(now, now, FRAME_SIZE);
+        now += interval;
+    }
+    return now;
+}
+
+static void test_measure(void)
+{
+    StreamSendRate send_rate;
+    uint64_t now = NSEC_PER_SEC;
+
+    /* a single frame or frames on an idle link tell nothing */
+    now = send_paced_frames(send_rate, now, NSEC_PER_SEC / 10, 10);
+    g_assert_cmpuint(send_rate.get_bit_rate(), ==, 0);
+
+    now = send_queued_frames(send_rate, now, 8 * MBPS, 10);
+    g_assert_cmpuint(send_rate.get_bit_rate(), ==, 8 * MBPS);
+
+    /* the client moves to a slower network */
+    now = send_queued_frames(send_rate, now, 2 * MBPS, 20);
+    g_assert_cmpuint(send_rate.get_bit_rate(), <, 3 * MBPS);
+}
+
+static void test_recover(void)
+{
+    StreamSendRate send_rate;
+    uint64_t now = NSEC_PER_SEC;
+
+    now = send_queued_frames(send_rate, now, 2 * MBPS, 10);
+    g_assert_cmpuint(send_rate.get_bit_rate(), ==, 2 * MBPS);
+
+    /* the device is paced to the estimate while the bandwidth
+     * recovered, frames do not wait anymore */
+    now = send_paced_frames(send_rate, now, NSEC_PER_SEC / 2, 2);
+    g_assert_cmpuint(send_rate.get_bit_rate(), ==, 2 * MBPS);
+    now = send_paced_frames(send_rate, now, NSEC_PER_SEC / 2, 4);
+    g_assert_cmpuint(send_rate.get_bit_rate(), ==, 0);
+
+    /* without pacing frames wait again and the link is measured */
+    now = send_queued_frames(send_rate, now, 20 * MBPS, 2);
+    g_assert_cmpuint(send_rate.get_bit_rate(), ==, 20 * MBPS);
+}
+
+static void test_reset(void)
+{
+    StreamSendRate send_rate;
+    uint64_t now = NSEC_PER_SEC;
+
+    now = send_queued_frames(send_rate, now, 2 * MBPS, 10);
+    g_assert_cmpuint(send_rate.get_bit_rate(), ==, 2 * MBPS);
+
+    /* the stream changes, the frames of the old one are not accounted */
+    send_rate.reset();
+    g_assert_cmpuint(send_rate.get_bit_rate(), ==, 0);
+    now = send_queued_frames(send_rate, now, 8 * MBPS, 1);
+    g_assert_cmpuint(send_rate.get_bit_rate(), ==, 0);
+    now = send_queued_frames(send_rate, now, 8 * MBPS, 1);
+    g_assert_cmpuint(send_rate.get_bit_rate(), ==, 8 * MBPS);
+}
+
+int main(int argc, char *argv[])
+{
+    g_test_init(&argc, &argv, nullptr);
+
+    g_test_add_func("/server/stream-send-rate/measure", test_measure);
+    g_test_add_func("/server/stream-send-rate/recover", test_recover);
+    g_test_add_func("/server/stream-send-rate/reset", test_reset);
+
+    return g_test_run();
+}
@@ -0,0 +1,142 @@
+/* -*- Mode: C; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+/*
+   Copyright (C) 2026 Red Hat, Inc.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, see <http://www.gnu.org/licenses/>.
+*/
+/**
+ * Test the trace rings and their dump
+ */
+#include <config.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+
+#include "test-glib-compat.h"
+#include "red-trace.h"
+
+static char *trace_filename;
+
+static unsigned count_occurrences(const char *str, const char *pattern)
+{
+    unsigned count = 0;
+
+    while ((str = strstr(str, pattern)) != nullptr) {
+        count++;
+        str += strlen(pattern);
+    }
+    return count;
+}
+
+static char *dump_trace(void)
+{
+    char *contents = nullptr;
+
+    g_assert_true(red_trace_dump(trace_filename));
+    g_assert_true(g_file_get_contents(trace_filename, &contents, nullptr, nullptr));
+    return contents;
+}
+
+static gpointer item_thread(gpointer)
+{
+    red_trace_event(RED_TRACE_SEND_ITEM, 0x1234, 1);
+    red_trace_event(RED_TRACE_MSG_SENT, 0x1234, 2);
+    return nullptr;
+}
+
+/* events of an item are linked even if they come from different threads */
+static void test_item(void)
+{
+    red_trace_event(RED_TRACE_PROCESS_CMD, 0x1234, 0);
+    red_trace_event(RED_TRACE_CURRENT_ADD, 0x1234, 1);
+    red_trace_event(RED_TRACE_PIPES_ADD, 0x1234, 1);
+    g_thread_join(g_thread_new("item", item_thread, nullptr));
+
+    char *contents = dump_trace();
+    g_assert_true(g_str_has_prefix(contents, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":["));
+    g_assert_true(g_str_has_suffix(contents, "]}\n"));
+    g_assert_cmpuint(count_occurrences(contents, "\"id\":\"0x1234\""), ==, 7);
+    g_assert_cmpuint(count_occurrences(contents, "\"ph\":\"b\""), ==, 1);
+    g_assert_cmpuint(count_occurrences(contents, "\"ph\":\"e\""), ==, 1);
+    g_assert_cmpuint(count_occurrences(contents, "\"ph\":\"n\""), ==, 5);
+    g_assert_nonnull(strstr(contents, "\"name\":\"process_cmd\""));
+    g_assert_nonnull(strstr(contents, "\"name\":\"msg_sent\""));
+    /* 2 threads recorded events */
+    g_assert_nonnull(strstr(contents, "\"tid\":1"));
+    g_assert_nonnull(strstr(contents, "\"tid\":2"));
+    g_free(contents);
+}
+
+static gpointer wrap_thread(gpointer)
+{
+    for (unsigned i = 0; i < RED_TRACE_RING_SIZE * 2 + 10; i++) {
+        red_trace_event(RED_TRACE_MSG_SENT, 0, i);
+    }
+    return nullptr;
+}
+
+/* only the last events are kept when the ring is full, the oldest one
+ * is dropped as a writer could be overwriting it while dumping */
+static void test_wrap(void)
+{
+    g_thread_join(g_thread_new("wrap", wrap_thread, nullptr));
+
+    char *contents = dump_trace();
+    g_assert_cmpuint(count_occurrences(contents, "\"ph\":\"i\""), ==, RED_TRACE_RING_SIZE - 1);
+    g_assert_null(strstr(contents, "\"args\":{\"arg\":9}"));
+    char *arg = g_strdup_printf("\"args\":{\"arg\":%u}", RED_TRACE_RING_SIZE + 10);
+    g_assert_null(strstr(contents, arg));
+    g_free(arg);
+    arg = g_strdup_printf("\"args\":{\"arg\":%u}", RED_TRACE_RING_SIZE + 11);
+    g_assert_nonnull(strstr(contents, arg));
+    g_free(arg);
+    arg = g_strdup_printf("\"args\":{\"arg\":%u}", RED_TRACE_RING_SIZE * 2 + 9);
+    g_assert_nonnull(strstr(contents, arg));
+    g_free(arg);
+    g_free(contents);
+}
+
+/* ids are never reused, unlike the addresses of the items */
+static void test_new_id(void)
+{
+    uint64_t id = red_trace_new_id();
+
+    g_assert_cmpuint(id, !=, 0);
+    for (int i = 0; i < 10; i++) {
+        uint64_t next_id = red_trace_new_id();
+        g_assert_cmpuint(next_id, >, id);
+        id = next_id;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int fd = g_file_open_tmp("spice-trace-XXXXXX.json", &trace_filename, nullptr);
+    g_assert_cmpint(fd, >=, 0);
+    close(fd);
+
+    g_setenv("SPICE_TRACE_FILENAME", trace_filename, TRUE);
+    g_assert_true(red_trace_init());
+
+    g_test_init(&argc, &argv, nullptr);
+
+    g_test_add_func("/server/trace/item", test_item);
+    g_test_add_func("/server/trace/wrap", test_wrap);
+    g_test_add_func("/server/trace/new-id", test_new_id);
+
+    int ret = g_test_run();
+
+    g_unlink(trace_filename);
+    g_free(trace_filename);
+    return ret;
+}
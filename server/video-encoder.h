@@ -22,6 +22,7 @@
 #define VIDEO_ENCODER_H_
 
 #include <inttypes.h>
+#include <stdbool.h>
 #include <glib.h>
 #include <common/draw.h>
 
@@ -37,6 +38,12 @@ struct VideoBuffer {
     /* The size of the compressed frame in bytes. */
     uint32_t size;
 
+    /* The dimensions of the compressed frame if the encoder scaled it down,
+     * zero if the frame has the size of the source area.
+     */
+    uint32_t width;
+    uint32_t height;
+
     /* Releases the video buffer resources and deallocates it.
      *
      * @buffer:   The video buffer.
@@ -132,6 +139,26 @@ struct VideoEncoder {
      */
     uint64_t (*get_bit_rate)(VideoEncoder *encoder);
 
+    /* Limits the bit rate the rate control is allowed to use. This lets the
+     * server share the client bandwidth between several streams.
+     *
+     * @encoder:      The video encoder.
+     * @max_bit_rate: The maximum bit rate in bits per second or zero to
+     *                remove the limit.
+     */
+    void (*set_max_bit_rate)(VideoEncoder *encoder, uint64_t max_bit_rate);
+
+    /* Allows the video encoder to reduce the frame dimensions when the bit
+     * rate is too low to keep a reasonable frame rate at the lowest quality.
+     * The encoded size is then reported in the VideoBuffer width and height
+     * fields, so this must only be enabled if the client can scale the
+     * frames back. This method is NULL if the encoder does not support it.
+     *
+     * @encoder:    The video encoder.
+     * @enable:     Whether the frames can be scaled down.
+     */
+    void (*enable_downscale)(VideoEncoder *encoder, bool enable);
+
     /* Collects video statistics.
      *
      * @encoder:    The video encoder.
@@ -16,6 +16,8 @@
 */
 #include <config.h>
 
+#include <algorithm>
+
 #include "video-stream.h"
 #include "display-channel-private.h"
 #include "main-channel-client.h"
@@ -174,8 +176,175 @@ VideoStreamClipItem::VideoStreamClipItem(VideoStreamAgent *agent):
     region_ret_rects(&agent->clip, rects->rects, n_rects);
 }
 
-static int is_stream_start(Drawable *drawable)
+static const char *const video_stream_content_names[VIDEO_STREAM_CONTENT_LAST] = {
+    "copy",
+    "scaled_copy",
+    "blend",
+};
+
+void video_stream_activity_init_stat(DisplayChannel *display, RedsState *reds,
+                                     const RedStatNode *stat)
+{
+    DisplayChannelPrivate *priv = display->priv.get();
+
+    stat_init_node(&priv->stream_activity_stat, reds, stat, "stream_detection", TRUE);
+    stat = &priv->stream_activity_stat;
+    stat_init_counter(&priv->stream_activity_promote_counter, reds, stat, "promote", TRUE);
+    stat_init_counter(&priv->stream_activity_demote_counter, reds, stat, "demote", TRUE);
+    stat_init_counter(&priv->stream_activity_start_counter, reds, stat, "start", TRUE);
+    for (int i = 0; i < VIDEO_STREAM_CONTENT_LAST; i++) {
+        stat_init_counter(&priv->stream_activity_content_counters[i], reds, stat,
+                          video_stream_content_names[i], TRUE);
+    }
+}
+
+/* Returns the content class of a drawable or VIDEO_STREAM_CONTENT_LAST if the
+ * drawable is not a possible video frame */
+static VideoStreamContent drawable_get_content(DisplayChannel *display, Drawable *drawable)
 {
+    RedDrawable *red_drawable = drawable->red_drawable.get();
+    const SpiceRect *bbox = &red_drawable->bbox;
+
+    if (!is_primary_surface(display, drawable->surface) ||
+        rect_get_area(bbox) < RED_STREAM_MIN_SIZE) {
+        return VIDEO_STREAM_CONTENT_LAST;
+    }
+
+    switch (red_drawable->type) {
+    case QXL_DRAW_COPY: {
+        const SpiceRect *src = &red_drawable->u.copy.src_area;
+
+        if (src->right - src->left != bbox->right - bbox->left ||
+            src->bottom - src->top != bbox->bottom - bbox->top) {
+            return VIDEO_STREAM_CONTENT_SCALED_COPY;
+        }
+        return VIDEO_STREAM_CONTENT_COPY;
+    }
+    case QXL_DRAW_ALPHA_BLEND:
+    case QXL_DRAW_COMPOSITE:
+        return VIDEO_STREAM_CONTENT_BLEND;
+    default:
+        return VIDEO_STREAM_CONTENT_LAST;
+    }
+}
+
+/* Checks whether an update of @area belongs to the activity region @activity.
+ * The two areas must overlap for at least half of the bigger one, this way
+ * small overlays (subtitles, player controls) get their own region */
+static bool region_activity_matches(const RegionActivity *activity, const SpiceRect *area)
+{
+    SpiceRect sect;
+
+    if (!rect_intersects(&activity->area, area)) {
+        return false;
+    }
+    sect = activity->area;
+    rect_sect(&sect, area);
+    return 2 * rect_get_area(&sect) >= MAX(rect_get_area(&activity->area), rect_get_area(area));
+}
+
+static void region_activity_demote(DisplayChannel *display, RegionActivity *activity)
+{
+    if (activity->hot) {
+        spice_debug("activity region (%d, %d) (%d, %d) demoted, fps %u",
+                    activity->area.left, activity->area.top,
+                    activity->area.right, activity->area.bottom, activity->fps);
+        stat_inc_counter(display->priv->stream_activity_demote_counter, 1);
+        activity->hot = false;
+    }
+}
+
+/*
+ * Records an update of the primary surface. Video players do not always
+ * draw frames as a sequence of identical QXL_DRAW_COPY, frames can be scaled
+ * or blended with some overlay. The update frequency of the area is used as
+ * an hint that the area contains video, see is_stream_start().
+ */
+void video_stream_activity_update(DisplayChannel *display, Drawable *drawable)
+{
+    DisplayChannelPrivate *priv = display->priv.get();
+    RegionActivity *activity = nullptr;
+    RegionActivity *oldest = nullptr;
+    const SpiceRect *bbox = &drawable->red_drawable->bbox;
+    red_time_t now = drawable->creation_time;
+
+    if (priv->stream_video == SPICE_STREAM_VIDEO_OFF) {
+        return;
+    }
+
+    VideoStreamContent content = drawable_get_content(display, drawable);
+    if (content == VIDEO_STREAM_CONTENT_LAST) {
+        return;
+    }
+    stat_inc_counter(priv->stream_activity_content_counters[content], 1);
+
+    for (auto &&region : priv->activity_regions) {
+        if (region.last_time && now - region.last_time > RED_STREAM_ACTIVITY_TIMEOUT) {
+            region_activity_demote(display, &region);
+            region.last_time = 0;
+        }
+        if (!oldest || region.last_time < oldest->last_time) {
+            oldest = &region;
+        }
+        if (!activity && region.last_time && region_activity_matches(&region, bbox)) {
+            activity = &region;
+        }
+    }
+
+    if (!activity) {
+        activity = oldest;
+        region_activity_demote(display, activity);
+        activity->area = *bbox;
+        activity->window_start = now;
+        activity->window_updates = 0;
+        activity->fps = 0;
+        activity->content_mask = 0;
+    } else if (content != VIDEO_STREAM_CONTENT_BLEND) {
+        /* overlays are blended over the video, keep the area of the frames */
+        activity->area = *bbox;
+    }
+    activity->last_time = now;
+    activity->window_updates++;
+    activity->content_mask |= 1u << content;
+
+    red_time_t elapsed = now - activity->window_start;
+    if (elapsed < RED_STREAM_ACTIVITY_WINDOW) {
+        return;
+    }
+    activity->fps = (uint64_t{activity->window_updates} * NSEC_PER_SEC + elapsed / 2) / elapsed;
+    activity->window_start = now;
+    activity->window_updates = 0;
+
+    if (!activity->hot && activity->fps >= RED_STREAM_ACTIVITY_PROMOTE_FPS) {
+        spice_debug("activity region (%d, %d) (%d, %d) promoted, fps %u content 0x%x",
+                    activity->area.left, activity->area.top,
+                    activity->area.right, activity->area.bottom,
+                    activity->fps, activity->content_mask);
+        stat_inc_counter(priv->stream_activity_promote_counter, 1);
+        activity->hot = true;
+    } else if (activity->fps < RED_STREAM_ACTIVITY_DEMOTE_FPS) {
+        region_activity_demote(display, activity);
+    }
+}
+
+static bool is_hot_area(DisplayChannel *display, const SpiceRect *area)
+{
+    for (const auto &region : display->priv->activity_regions) {
+        if (region.hot && region.last_time && region_activity_matches(&region, area)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int is_stream_start(DisplayChannel *display, Drawable *drawable)
+{
+    /* an area detected as frequently updated needs less evidence */
+    if (drawable->frames_count >= RED_STREAM_ACTIVITY_FRAMES_START_CONDITION &&
+        is_hot_area(display, &drawable->red_drawable->bbox)) {
+        stat_inc_counter(display->priv->stream_activity_start_counter, 1);
+        return TRUE;
+    }
     return ((drawable->frames_count >= RED_STREAM_FRAMES_START_CONDITION) &&
             (drawable->gradual_frames_count >=
              (RED_STREAM_GRADUAL_FRAMES_START_CONDITION * drawable->frames_count)));
@@ -442,7 +611,7 @@ static bool video_stream_add_frame(DisplayChannel *display,
         frame_drawable->last_gradual_frame = last_gradual_frame;
     }
 
-    if (is_stream_start(frame_drawable)) {
+    if (is_stream_start(display, frame_drawable)) {
         display_channel_create_stream(display, frame_drawable);
         return TRUE;
     }
@@ -592,7 +761,9 @@ static void dcc_update_streams_max_latency(DisplayChannelClient *dcc,
     dcc_set_max_stream_latency(dcc, new_max_latency);
 }
 
-static uint64_t get_initial_bit_rate(DisplayChannelClient *dcc, VideoStream *stream)
+/* Returns the bit rate available to the client for its streams and
+ * other messages */
+static uint64_t get_client_bit_rate(DisplayChannelClient *dcc)
 {
     char *env_bit_rate_str;
     uint64_t bit_rate = 0;
@@ -632,6 +803,13 @@ static uint64_t get_initial_bit_rate(DisplayChannelClient *dcc, VideoStream *str
         }
     }
 
+    return bit_rate;
+}
+
+static uint64_t get_initial_bit_rate(DisplayChannelClient *dcc, VideoStream *stream)
+{
+    uint64_t bit_rate = get_client_bit_rate(dcc);
+
     spice_debug("base-bit-rate %.2f (Mbps)", bit_rate / 1024.0 / 1024.0);
     /* dividing the available bandwidth among the active streams, and saving
      * (1-RED_STREAM_CHANNEL_CAPACITY) of it for other messages */
@@ -639,6 +817,79 @@ static uint64_t get_initial_bit_rate(DisplayChannelClient *dcc, VideoStream *str
             stream->width * stream->height) / DCC_TO_DC(dcc)->priv->streams_size_total;
 }
 
+/* The share of the bandwidth a stream should get: bigger and more fluid
+ * videos need a higher bit rate to keep the same quality */
+static uint64_t video_stream_agent_get_weight(VideoStreamAgent *agent)
+{
+    VideoStream *stream = agent->stream;
+    SpiceRect extents;
+    uint64_t area;
+
+    region_extents(&agent->vis_region, &extents);
+    area = rect_get_area(&extents);
+    if (!area) {
+        area = stream->width * stream->height;
+    }
+    return area * CLAMP(stream->input_fps, 1, MAX_FPS);
+}
+
+/*
+ * Shares the client stream bandwidth between its active streams according to
+ * their weight and pushes the result to the video encoders as a bit rate
+ * limit. The encoders rate control still adjusts the bit rate within that
+ * limit. If the bandwidth cannot provide RED_STREAM_MIN_BIT_RATE to all the
+ * streams the lower weight ones are throttled to that minimum.
+ */
+void dcc_video_streams_schedule(DisplayChannelClient *dcc)
+{
+    std::array<VideoStreamAgent *, NUM_STREAMS> agents;
+    int num_agents = 0;
+    int i;
+
+    for (i = 0; i < NUM_STREAMS; i++) {
+        VideoStreamAgent *agent = dcc_get_video_stream_agent(dcc, i);
+
+        if (agent->video_encoder && agent->video_encoder->set_max_bit_rate) {
+            agents[num_agents++] = agent;
+        }
+    }
+
+    if (num_agents == 0) {
+        return;
+    }
+    if (num_agents == 1) {
+        /* nothing to share, leave the encoder rate control alone */
+        agents[0]->video_encoder->set_max_bit_rate(agents[0]->video_encoder, 0);
+        return;
+    }
+
+    std::sort(agents.begin(), agents.begin() + num_agents,
+              [](VideoStreamAgent *a, VideoStreamAgent *b) {
+                  return video_stream_agent_get_weight(a) > video_stream_agent_get_weight(b);
+              });
+
+    uint64_t budget = RED_STREAM_CHANNEL_CAPACITY * get_client_bit_rate(dcc);
+    int num_scheduled = MIN(static_cast<uint64_t>(num_agents), MAX(1, budget / RED_STREAM_MIN_BIT_RATE));
+    uint64_t total_weight = 0;
+
+    for (i = 0; i < num_scheduled; i++) {
+        total_weight += video_stream_agent_get_weight(agents[i]);
+    }
+    for (i = 0; i < num_agents; i++) {
+        VideoStreamAgent *agent = agents[i];
+        uint64_t max_bit_rate = RED_STREAM_MIN_BIT_RATE;
+
+        if (i < num_scheduled) {
+            max_bit_rate = MAX(max_bit_rate,
+                               budget * video_stream_agent_get_weight(agent) / total_weight);
+        } else {
+            spice_debug("stream %d: throttled, not enough bandwidth",
+                        display_channel_get_video_stream_id(DCC_TO_DC(dcc), agent->stream));
+        }
+        agent->video_encoder->set_max_bit_rate(agent->video_encoder, max_bit_rate);
+    }
+}
+
 static uint32_t get_roundtrip_ms(void *opaque)
 {
     auto agent = static_cast<VideoStreamAgent *>(opaque);
@@ -755,7 +1006,14 @@ void dcc_create_stream(DisplayChannelClient *dcc, VideoStream *stream)
 
     uint64_t initial_bit_rate = get_initial_bit_rate(dcc, stream);
     agent->video_encoder = dcc_create_video_encoder(dcc, initial_bit_rate, &video_cbs);
+    /* scaled frames are sent as sized frames, the client scales them back */
+    if (agent->video_encoder && agent->video_encoder->enable_downscale &&
+        dcc->test_remote_cap(SPICE_DISPLAY_CAP_SIZED_STREAM) &&
+        getenv("SPICE_STREAM_DOWNSCALE")) {
+        agent->video_encoder->enable_downscale(agent->video_encoder, true);
+    }
     dcc->pipe_add(video_stream_create_item_new(agent));
+    dcc_video_streams_schedule(dcc);
 
     if (dcc->test_remote_cap(SPICE_DISPLAY_CAP_STREAM_REPORT)) {
         auto report_pipe_item = red::make_shared<RedStreamActivateReportItem>();
@@ -781,6 +1039,7 @@ void video_stream_agent_stop(VideoStreamAgent *agent)
     if (agent->video_encoder) {
         agent->video_encoder->destroy(agent->video_encoder);
         agent->video_encoder = nullptr;
+        dcc_video_streams_schedule(dcc);
     }
 }
 
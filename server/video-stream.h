@@ -43,7 +43,15 @@
 #define RED_STREAM_CLIENT_REPORT_TIMEOUT MSEC_PER_SEC
 #define RED_STREAM_DEFAULT_HIGH_START_BIT_RATE (10 * 1024 * 1024) // 10Mbps
 #define RED_STREAM_DEFAULT_LOW_START_BIT_RATE (2.5 * 1024 * 1024) // 2.5Mbps
+#define RED_STREAM_MIN_BIT_RATE (256 * 1024) // 256Kbps
 #define MAX_FPS 30
+/* region activity detection, see video_stream_activity_update() */
+#define RED_STREAM_ACTIVITY_WINDOW (NSEC_PER_SEC / 2)
+#define RED_STREAM_ACTIVITY_TIMEOUT NSEC_PER_SEC
+#define RED_STREAM_ACTIVITY_PROMOTE_FPS 12
+#define RED_STREAM_ACTIVITY_DEMOTE_FPS 4
+#define RED_STREAM_ACTIVITY_FRAMES_START_CONDITION 5
+#define NUM_ACTIVITY_REGIONS 8
 
 struct VideoStream;
 
@@ -107,6 +115,29 @@ struct ItemTrace {
     SpiceRect dest_area;
 };
 
+/* Kind of drawable updating a region, used to classify the region content */
+enum VideoStreamContent {
+    VIDEO_STREAM_CONTENT_COPY,
+    VIDEO_STREAM_CONTENT_SCALED_COPY,
+    VIDEO_STREAM_CONTENT_BLEND,
+
+    VIDEO_STREAM_CONTENT_LAST
+};
+
+/* Tracks how often an area of the primary surface is updated, whatever the
+ * geometry and the type of the drawables updating it. A region is marked
+ * as "hot" when its update rate goes above RED_STREAM_ACTIVITY_PROMOTE_FPS
+ * and stays so until the rate drops below RED_STREAM_ACTIVITY_DEMOTE_FPS. */
+struct RegionActivity {
+    SpiceRect area;
+    red_time_t last_time;
+    red_time_t window_start;
+    uint32_t window_updates;
+    uint32_t fps;
+    uint32_t content_mask; /* bit mask of VideoStreamContent */
+    bool hot;
+};
+
 struct VideoStream {
     uint8_t refs;
     Drawable *current;
@@ -131,6 +162,9 @@ void video_stream_maintenance(DisplayChannel *display, Drawable *candidate,
 void video_stream_timeout(DisplayChannel *display);
 void video_stream_detach_and_stop(DisplayChannel *display);
 void video_stream_trace_add_drawable(DisplayChannel *display, Drawable *item);
+void video_stream_activity_update(DisplayChannel *display, Drawable *drawable);
+void video_stream_activity_init_stat(DisplayChannel *display, RedsState *reds,
+                                     const RedStatNode *stat);
 void video_stream_detach_behind(DisplayChannel *display, QRegion *region,
                                 Drawable *drawable);
 GArray *video_stream_parse_preferred_codecs(SpiceMsgcDisplayPreferredVideoCodecType *msg);
@@ -71,6 +71,11 @@
 #define MAX_CONTROL_DATA 125
 #define CONTROL_HDR_LEN 2
 
+/* maximum data merged in a single frame while coalescing writes */
+#define COALESCE_BUF_SIZE (16 * 1024)
+/* larger messages are not copied, they are sent in their own frame */
+#define COALESCE_MAX_MSG_SIZE 1024
+
 typedef struct {
     uint8_t raw_pos;
     union {
@@ -106,6 +111,14 @@ struct RedsWebSocket {
     WebSocketControl pong;
     WebSocketControl pending_pong;
 
+    /* data written while coalescing, sent as a single frame when flushed.
+     * Once the frame header is computed (coalesce_framed) the data can only
+     * be sent, not appended to */
+    uint8_t *coalesce_buf;
+    uint32_t coalesce_len, coalesce_pos;
+    bool coalesce;
+    bool coalesce_framed;
+
     void *raw_stream;
     websocket_read_cb_t raw_read;
     websocket_write_cb_t raw_write;
@@ -114,6 +127,7 @@ struct RedsWebSocket {
 
 static int websocket_ack_close(RedsWebSocket *ws);
 static int send_pending_data(RedsWebSocket *ws);
+static int send_coalesced_data(RedsWebSocket *ws);
 
 static inline int get_control_raw_len(const WebSocketControl *control)
 {
@@ -316,14 +330,35 @@ static bool websocket_get_frame_header(websocket_frame_t *frame)
     return true;
 }
 
+/* Unmasks data in place. Most of the data is unmasked a 64 bit word at a
+ * time using the mask rotated according to the position in the frame */
 static void relay_data(uint8_t* buf, size_t size, websocket_frame_t *frame)
 {
-    if (frame->masked) {
-        size_t i;
-        for (i = 0; i < size; i++) {
-            *buf++ ^= frame->mask[(frame->relayed + i) % 4];
+    unsigned pos = frame->relayed % 4;
+    uint8_t mask_bytes[sizeof(uint64_t)];
+    uint64_t mask, data;
+    unsigned i;
+
+    if (!frame->masked) {
+        return;
+    }
+
+    if (size >= sizeof(uint64_t)) {
+        for (i = 0; i < sizeof(mask_bytes); i++) {
+            mask_bytes[i] = frame->mask[(pos + i) % 4];
+        }
+        memcpy(&mask, mask_bytes, sizeof(mask));
+        /* each word is a multiple of 4 bytes so the position in the mask
+         * does not change */
+        for (; size >= sizeof(data); size -= sizeof(data), buf += sizeof(data)) {
+            memcpy(&data, buf, sizeof(data));
+            data ^= mask;
+            memcpy(buf, &data, sizeof(data));
         }
     }
+    for (; size > 0; size--) {
+        *buf++ ^= frame->mask[pos++ % 4];
+    }
 }
 
 int websocket_read(RedsWebSocket *ws, uint8_t *buf, size_t len, unsigned *flags)
@@ -550,6 +585,14 @@ static int send_pending_data(RedsWebSocket *ws)
         return 1;
     }
 
+    /* finish sending a coalesced frame */
+    if (ws->coalesce_framed) {
+        rc = send_coalesced_data(ws);
+        if (rc <= 0) {
+            return rc;
+        }
+    }
+
     /* write pending data frame header not send completely */
     if (ws->write_header_pos < ws->write_header_len) {
         rc = send_data_header_left(ws);
@@ -588,11 +631,61 @@ static int send_pending_data(RedsWebSocket *ws)
     return 1;
 }
 
+/* Send the coalesced data as a single frame, returns 1 once all the data
+ * is sent */
+static int send_coalesced_data(RedsWebSocket *ws)
+{
+    struct iovec iov[2];
+    int iovcnt;
+    int rc;
+
+    if (!ws->coalesce_framed) {
+        if (ws->coalesce_len == 0) {
+            return 1;
+        }
+        ws->write_header_pos = 0;
+        ws->write_header_len = fill_header(ws->write_header, ws->coalesce_len,
+                                           WEBSOCKET_BINARY_FINAL);
+        ws->coalesce_pos = 0;
+        ws->coalesce_framed = true;
+    }
+
+    while (ws->write_header_pos < ws->write_header_len ||
+           ws->coalesce_pos < ws->coalesce_len) {
+        iovcnt = 0;
+        if (ws->write_header_pos < ws->write_header_len) {
+            iov[iovcnt].iov_base = ws->write_header + ws->write_header_pos;
+            iov[iovcnt].iov_len = ws->write_header_len - ws->write_header_pos;
+            iovcnt++;
+        }
+        iov[iovcnt].iov_base = ws->coalesce_buf + ws->coalesce_pos;
+        iov[iovcnt].iov_len = ws->coalesce_len - ws->coalesce_pos;
+        iovcnt++;
+
+        rc = ws->raw_writev(ws->raw_stream, iov, iovcnt);
+        if (rc <= 0) {
+            return rc;
+        }
+        if (ws->write_header_pos < ws->write_header_len) {
+            int header_sent = MIN(rc, ws->write_header_len - ws->write_header_pos);
+            ws->write_header_pos += header_sent;
+            rc -= header_sent;
+        }
+        ws->coalesce_pos += rc;
+    }
+
+    ws->coalesce_framed = false;
+    ws->coalesce_len = 0;
+    ws->coalesce_pos = 0;
+    return 1;
+}
+
 /* Write a WebSocket frame with the enclosed data out. */
 int websocket_writev(RedsWebSocket *ws, const struct iovec *iov, int iovcnt, unsigned flags)
 {
     uint64_t len;
     int rc;
+    struct iovec iov_buf[16];
     struct iovec *iov_out;
     int iov_out_cnt;
     int i;
@@ -618,20 +711,46 @@ int websocket_writev(RedsWebSocket *ws, const struct iovec *iov, int iovcnt, uns
         return rc;
     }
 
-    iov_out_cnt = iovcnt + 1;
-    iov_out = g_malloc(iov_out_cnt * sizeof(*iov_out));
-
     for (i = 0, len = 0; i < iovcnt; i++) {
         len += iov[i].iov_len;
-        iov_out[i + 1] = iov[i];
     }
 
+    /* merge small messages with the previous ones, the frame will be sent
+     * by websocket_flush or when the buffer is full */
+    if (ws->coalesce && (flags & FIN_FLAG) && !ws->send_unfinished &&
+        len <= COALESCE_MAX_MSG_SIZE) {
+        if (ws->coalesce_len + len > COALESCE_BUF_SIZE) {
+            rc = send_coalesced_data(ws);
+            if (rc <= 0) {
+                return rc;
+            }
+        }
+        for (i = 0; i < iovcnt; i++) {
+            memcpy(ws->coalesce_buf + ws->coalesce_len, iov[i].iov_base, iov[i].iov_len);
+            ws->coalesce_len += iov[i].iov_len;
+        }
+        return len;
+    }
+
+    /* keep data ordered, send the coalesced data first */
+    rc = send_coalesced_data(ws);
+    if (rc <= 0) {
+        return rc;
+    }
+
+    iov_out_cnt = iovcnt + 1;
+    iov_out = (size_t) iov_out_cnt <= G_N_ELEMENTS(iov_buf) ?
+        iov_buf : g_new(struct iovec, iov_out_cnt);
+    memcpy(iov_out + 1, iov, iovcnt * sizeof(*iov));
+
     ws->write_header_pos = 0;
     ws->write_header_len = fill_header(ws->write_header, len, flags);
     iov_out[0].iov_len = ws->write_header_len;
     iov_out[0].iov_base = ws->write_header;
     rc = ws->raw_writev(ws->raw_stream, iov_out, iov_out_cnt);
-    g_free(iov_out);
+    if (iov_out != iov_buf) {
+        g_free(iov_out);
+    }
     if (rc <= 0) {
         ws->write_header_len = 0;
         return rc;
@@ -668,6 +787,11 @@ int websocket_write(RedsWebSocket *ws, const void *buf, size_t len, unsigned fla
         return rc;
     }
     if (ws->write_remainder == 0) {
+        /* keep data ordered, send the coalesced data first */
+        rc = send_coalesced_data(ws);
+        if (rc <= 0) {
+            return rc;
+        }
         rc = send_data_header(ws, len, flags);
         if (rc <= 0) {
             return rc;
@@ -795,5 +919,37 @@ RedsWebSocket *websocket_new(const void *buf, size_t len, void *stream, websocke
 
 void websocket_free(RedsWebSocket *ws)
 {
+    g_free(ws->coalesce_buf);
     g_free(ws);
 }
+
+void websocket_set_coalesce(RedsWebSocket *ws, bool coalesce)
+{
+    /* coalesced data is sent with a single vectored write */
+    if (!ws->raw_writev) {
+        return;
+    }
+    if (coalesce && !ws->coalesce_buf) {
+        ws->coalesce_buf = g_malloc(COALESCE_BUF_SIZE);
+    }
+    ws->coalesce = coalesce;
+}
+
+int websocket_flush(RedsWebSocket *ws)
+{
+    int rc;
+
+    if (ws->closed) {
+        errno = EPIPE;
+        return -1;
+    }
+    rc = send_pending_data(ws);
+    if (rc <= 0) {
+        return rc;
+    }
+    /* a frame written by the caller is still in progress */
+    if (ws->write_remainder) {
+        return 1;
+    }
+    return send_coalesced_data(ws);
+}
@@ -19,6 +19,7 @@
 #define WEBSOCKET_H_
 
 #include <stdint.h>
+#include <stdbool.h>
 #include <spice/macros.h>
 
 #include "sys-socket.h"
@@ -52,6 +53,18 @@ int websocket_read(RedsWebSocket *ws, uint8_t *buf, size_t len, unsigned *flags)
 int websocket_write(RedsWebSocket *ws, const void *buf, size_t len, unsigned flags);
 int websocket_writev(RedsWebSocket *ws, const struct iovec *iov, int iovcnt, unsigned flags);
 
+/**
+ * Merge the data of following small vectored writes in a single frame,
+ * larger ones are sent in their own frame.
+ * Data is sent calling websocket_flush or when the frame is full.
+ */
+void websocket_set_coalesce(RedsWebSocket *ws, bool coalesce);
+/**
+ * Send coalesced data.
+ * Returns 1 if all data was sent, otherwise like websocket_write.
+ */
+int websocket_flush(RedsWebSocket *ws);
+
 SPICE_END_DECLS
 
 #endif